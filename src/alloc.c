@@ -12,6 +12,9 @@ int alloc_debug=0;
 int alloc_errors=0;
 uint64_t alloc_count=0;
 uint64_t free_count=0;
+// Some code allocates from more than one thread, so keep the counts exact.
+#define count_alloc()	__sync_fetch_and_add(&alloc_count, 1)
+#define count_free()	__sync_fetch_and_add(&free_count, 1)
 void alloc_counters_reset(void)
 {
 	alloc_count=0;
@@ -35,7 +38,7 @@ char *strdup_w(const char *s, const char *func)
 #ifdef UTEST
 	else
 	{
-		alloc_count++;
+		count_alloc();
 		if(alloc_debug) printf("%p alloced s\n", ret);
 	}
 #endif
@@ -57,7 +60,7 @@ void *realloc_w(void *ptr, size_t size, const char *func)
 	if(!(ret=realloc(ptr, size))) log_oom_w(__func__, func);
 #ifdef UTEST
 	else if(!already_alloced)
-		alloc_count++;
+		count_alloc();
 	if(alloc_debug) printf("%p alloced r\n", ret);
 #endif
 	return ret;
@@ -73,7 +76,7 @@ void *malloc_w(size_t size, const char *func)
 #ifdef UTEST
 	else
 	{
-		alloc_count++;
+		count_alloc();
 		if(alloc_debug) printf("%p alloced m\n", ret);
 	}
 #endif
@@ -90,7 +93,7 @@ void *calloc_w(size_t nmem, size_t size, const char *func)
 #ifdef UTEST
 	else
 	{
-		alloc_count++;
+		count_alloc();
 		if(alloc_debug) printf("%p alloced c\n", ret);
 	}
 #endif
@@ -106,7 +109,7 @@ void free_v(void **ptr)
 	free(*ptr);
 	*ptr=NULL;
 #ifdef UTEST
-	free_count++;
+	count_free();
 #endif
 }
 
@@ -14,6 +14,7 @@
 #include <ws2tcpip.h>
 #else
 #include <netinet/ip.h>
+#include <sys/uio.h>
 #endif
 
 #ifdef HAVE_NCURSES_H
@@ -26,6 +27,10 @@
 
 static size_t bufmaxsize=(ASYNC_BUF_LEN*2)+32;
 
+// Payloads at least this big are sent straight from the caller's buffer by
+// asfd->write(), rather than being copied into the write buffer first.
+#define WRITE_REF_MIN	4096
+
 static void truncate_readbuf(struct asfd *asfd)
 {
 	asfd->readbuf[0]='\0';
@@ -270,9 +275,30 @@ static int check_ratelimit(struct asfd *asfd)
 static int asfd_do_write(struct asfd *asfd)
 {
 	ssize_t w;
+#ifndef HAVE_WIN32
+	int iovcnt=0;
+	struct iovec iov[2];
+#endif
 	if(asfd->ratelimit && check_ratelimit(asfd)) return 0;
 
-	w=write(asfd->fd, asfd->writebuf, asfd->writebuflen);
+#ifdef HAVE_WIN32
+	if(asfd->writebuflen)
+		w=write(asfd->fd, asfd->writebuf, asfd->writebuflen);
+	else
+		w=write(asfd->fd, asfd->writeref, asfd->writereflen);
+#else
+	if(asfd->writebuflen)
+	{
+		iov[iovcnt].iov_base=asfd->writebuf;
+		iov[iovcnt++].iov_len=asfd->writebuflen;
+	}
+	if(asfd->writereflen)
+	{
+		iov[iovcnt].iov_base=(void *)asfd->writeref;
+		iov[iovcnt++].iov_len=asfd->writereflen;
+	}
+	w=writev(asfd->fd, iov, iovcnt);
+#endif
 	if(w<0)
 	{
 		if(errno==EAGAIN || errno==EINTR)
@@ -296,6 +322,15 @@ printf("wrote %d: %s\n", w, buf);
 }
 */
 
+	if((size_t)w>asfd->writebuflen)
+	{
+		// Into the payload that is being sent from where it is.
+		w-=asfd->writebuflen;
+		asfd->writebuflen=0;
+		asfd->writeref+=w;
+		asfd->writereflen-=w;
+		return 0;
+	}
 	memmove(asfd->writebuf, asfd->writebuf+w, asfd->writebuflen-w);
 	asfd->writebuflen-=w;
 	return 0;
@@ -305,12 +340,22 @@ static int asfd_do_write_ssl(struct asfd *asfd)
 {
 	int e;
 	ssize_t w;
+	const char *buf=asfd->writebuf;
+	size_t len=asfd->writebuflen;
 
 	asfd->write_blocked_on_read=0;
 
+	// There is no writev() for SSL, so a payload being sent by reference
+	// goes in its own records, after the write buffer has gone.
+	if(!len)
+	{
+		buf=asfd->writeref;
+		len=asfd->writereflen;
+	}
+
 	if(asfd->ratelimit && check_ratelimit(asfd)) return 0;
 	ERR_clear_error();
-	w=SSL_write(asfd->ssl, asfd->writebuf, asfd->writebuflen);
+	w=SSL_write(asfd->ssl, buf, len);
 
 	switch((e=SSL_get_error(asfd->ssl, w)))
 	{
@@ -323,10 +368,16 @@ printf("wrote %d: %s\n", w, buf);
 }
 */
 			if(asfd->ratelimit) asfd->rlbytes+=w;
+			asfd->sent+=w;
+			if(buf!=asfd->writebuf)
+			{
+				asfd->writeref+=w;
+				asfd->writereflen-=w;
+				break;
+			}
 			memmove(asfd->writebuf,
 				asfd->writebuf+w, asfd->writebuflen-w);
 			asfd->writebuflen-=w;
-			asfd->sent+=w;
 			break;
 		case SSL_ERROR_WANT_WRITE:
 			break;
@@ -362,6 +413,10 @@ static int append_to_write_buffer(struct asfd *asfd,
 static enum append_ret asfd_append_all_to_write_buffer(struct asfd *asfd,
 	struct iobuf *wbuf)
 {
+	// Wait for a payload that is being sent by reference to go first.
+	if(asfd->writereflen)
+		return APPEND_BLOCKED;
+
 	switch(asfd->streamtype)
 	{
 		case ASFD_STREAM_STANDARD:
@@ -432,9 +487,62 @@ int asfd_read_expect(struct asfd *asfd, enum cmd cmd, const char *expect)
 	return ret;
 }
 
+static int can_write_by_reference(struct asfd *asfd, struct iobuf *wbuf)
+{
+	return asfd->streamtype==ASFD_STREAM_STANDARD
+	  && wbuf->len>=WRITE_REF_MIN;
+}
+
+// Put the header into the write buffer, then send the payload from where it
+// is, together with whatever is in the write buffer. The caller's buffer is
+// only referenced until this returns, so it does not return until the whole
+// payload has gone.
+static int write_by_reference(struct asfd *asfd, struct iobuf *wbuf,
+	int flush(struct asfd *))
+{
+	int ret=-1;
+	size_t sblen=0;
+	char sbuf[10]="";
+
+	snprintf(sbuf, sizeof(sbuf), "%c%04X",
+		wbuf->cmd, (unsigned int)wbuf->len);
+	sblen=strlen(sbuf);
+	while(asfd->writebuflen+sblen >= bufmaxsize-1)
+		if(flush(asfd)) return -1;
+	append_to_write_buffer(asfd, sbuf, sblen);
+
+	asfd->writeref=wbuf->buf;
+	asfd->writereflen=wbuf->len;
+	while(asfd->writereflen)
+		if(flush(asfd)) goto end;
+	wbuf->len=0;
+	ret=0;
+end:
+	asfd->writeref=NULL;
+	asfd->writereflen=0;
+	return ret;
+}
+
+static int write_flush(struct asfd *asfd)
+{
+	return asfd->as->write(asfd->as);
+}
+
+// Want to make sure that we are listening for reads too - this will let us
+// exit promptly if the client was killed.
+static int read_and_write(struct asfd *asfd)
+{
+	if(asfd->as->read_write(asfd->as)) return -1;
+	if(!asfd->rbuf->buf) return 0;
+	iobuf_log_unexpected(asfd->rbuf, __func__);
+	return -1;
+}
+
 static int asfd_write(struct asfd *asfd, struct iobuf *wbuf)
 {
 	if(asfd->as->doing_estimate) return 0;
+	if(can_write_by_reference(asfd, wbuf))
+		return write_by_reference(asfd, wbuf, write_flush);
 	while(wbuf->len)
 	{
 		if(asfd->append_all_to_write_buffer(asfd, wbuf)==APPEND_ERROR)
@@ -717,16 +825,6 @@ struct asfd *setup_asfd_ncurses_stdin(struct async *as)
 		/*ssl=*/NULL, ASFD_STREAM_NCURSES_STDIN);
 }
 
-// Want to make sure that we are listening for reads too - this will let us
-// exit promptly if the client was killed.
-static int read_and_write(struct asfd *asfd)
-{
-	if(asfd->as->read_write(asfd->as)) return -1;
-	if(!asfd->rbuf->buf) return 0;
-	iobuf_log_unexpected(asfd->rbuf, __func__);
-	return -1;
-}
-
 int asfd_flush_asio(struct asfd *asfd)
 {
 	while(asfd && asfd->writebuflen>0)
@@ -736,6 +834,8 @@ int asfd_flush_asio(struct asfd *asfd)
 
 int asfd_write_wrapper(struct asfd *asfd, struct iobuf *wbuf)
 {
+	if(can_write_by_reference(asfd, wbuf))
+		return write_by_reference(asfd, wbuf, read_and_write);
 	while(1)
 	{
 		switch(asfd->append_all_to_write_buffer(asfd, wbuf))
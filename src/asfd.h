@@ -68,6 +68,9 @@ struct asfd
 	char *writebuf;
 	size_t writebuflen;
 	int write_blocked_on_read;
+	// A payload being sent from the caller's buffer, after writebuf.
+	const char *writeref;
+	size_t writereflen;
 
 	struct asfd *next;
 
@@ -82,6 +85,10 @@ struct asfd
 	uint8_t listening_for_new_clients;
 	uint8_t new_client;
 
+	// For the epoll backend of struct async.
+	uint32_t epoll_events;
+	uint32_t epoll_revents;
+
 	// For the main server process.
 	pid_t pid;
 	enum asfd_fdtype fdtype;
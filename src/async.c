@@ -2,13 +2,22 @@
 #include "alloc.h"
 #include "asfd.h"
 #include "async.h"
+#include "fsops.h"
 #include "handy.h"
 #include "iobuf.h"
 #include "log.h"
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 void async_free(struct async **as)
 {
 	if(!as || !*as) return;
+	// Do not deregister anything here. A forked child frees the async
+	// that it inherited, and the epoll set is shared with the parent.
+	close_fd(&(*as)->epfd);
+	free_v((void **)&(*as)->events);
 	free_v((void **)as);
 }
 
@@ -28,6 +37,115 @@ static int asfd_problem(struct asfd *asfd)
 	return -1;
 }
 
+// Work out whether we want to read from and/or write to the asfd this time
+// round. Returns 1 if there is something to do, 0 if not, or -1 on error.
+static int asfd_prepare(struct asfd *asfd, int doread)
+{
+	if(asfd->attempt_reads)
+		asfd->doread=doread;
+	else
+		asfd->doread=0;
+
+	asfd->dowrite=0;
+
+	if(doread)
+	{
+		if(asfd->parse_readbuf(asfd))
+			return asfd_problem(asfd);
+		if(asfd->rbuf->buf || asfd->read_blocked_on_write)
+			asfd->doread=0;
+	}
+
+	if((asfd->writebuflen || asfd->writereflen)
+	  && !asfd->write_blocked_on_read)
+		asfd->dowrite++; // The write buffer is not yet empty.
+
+	return asfd->doread || asfd->dowrite;
+}
+
+// Act on what the backend told us about the asfd.
+static int asfd_dispatch(struct asfd *asfd,
+	int canread, int canwrite, int exception)
+{
+	struct async *as=asfd->as;
+
+	if(exception)
+	{
+		switch(asfd->fdtype)
+		{
+			case ASFD_FD_SERVER_LISTEN_MAIN:
+			case ASFD_FD_SERVER_LISTEN_STATUS:
+				as->last_time=as->now;
+				return -1;
+			default:
+#ifdef _AIX
+				/* On AIX, for some weird reason,
+				 * writing the stats file makes the
+				 * socket show up in fse, despite
+				 * everything being fine. We ignore
+				 * it.
+				 */
+				if(strncmp(asfd->desc, "stats file",
+					sizeof("stats file")))
+				{
+					logp("%s: had an exception\n",
+						asfd->desc);
+					return asfd_problem(asfd);
+				}
+#else
+				logp("%s: had an exception\n",
+					asfd->desc);
+				return asfd_problem(asfd);
+#endif /* _AIX */
+		}
+	}
+
+	canread=asfd->doread && canread;
+	canwrite=asfd->dowrite && canwrite;
+
+	if(canread) // Able to read.
+	{
+		asfd->network_timeout=asfd->max_network_timeout;
+		switch(asfd->fdtype)
+		{
+			case ASFD_FD_SERVER_LISTEN_MAIN:
+			case ASFD_FD_SERVER_LISTEN_STATUS:
+				// Indicate to the caller that we have
+				// a new incoming client.
+				asfd->new_client++;
+				break;
+			default:
+				if(asfd->do_read(asfd)
+				  || asfd->parse_readbuf(asfd))
+					return asfd_problem(asfd);
+				break;
+		}
+	}
+
+	if(canwrite) // Able to write.
+	{
+		asfd->network_timeout=asfd->max_network_timeout;
+		if(asfd->do_write(asfd))
+			return asfd_problem(asfd);
+	}
+
+	if(!canread && !canwrite)
+	{
+		// Be careful to avoid 'read quick' mode.
+		if((as->setsec || as->setusec)
+		  && asfd->max_network_timeout>0
+		  && as->now-as->last_time>0
+		  && asfd->network_timeout--<=0)
+		{
+			logp("%s: no activity for %d seconds.\n",
+				asfd->desc, asfd->max_network_timeout);
+			return asfd_problem(asfd);
+		}
+	}
+
+	return 0;
+}
+
 static int async_io(struct async *as, int doread)
 {
 	int mfd=-1;
@@ -53,26 +171,13 @@ static int async_io(struct async *as, int doread)
 
 	for(asfd=as->asfd; asfd; asfd=asfd->next)
 	{
-		if(asfd->attempt_reads)
-			asfd->doread=doread;
-		else
-			asfd->doread=0;
-
-		asfd->dowrite=0;
-
-		if(doread)
+		switch(asfd_prepare(asfd, doread))
 		{
-			if(asfd->parse_readbuf(asfd))
-				return asfd_problem(asfd);
-			if(asfd->rbuf->buf || asfd->read_blocked_on_write)
-				asfd->doread=0;
+			case 0: continue;
+			case 1: break;
+			default: return -1;
 		}
 
-		if(asfd->writebuflen && !asfd->write_blocked_on_read)
-			asfd->dowrite++; // The write buffer is not yet empty.
-
-		if(!asfd->doread && !asfd->dowrite) continue;
-
 		add_fd_to_sets(asfd->fd, asfd->doread?&fsr:NULL,
 			asfd->dowrite?&fsw:NULL, &fse, &mfd);
 
@@ -102,77 +207,126 @@ static int async_io(struct async *as, int doread)
 
 	for(asfd=as->asfd; asfd; asfd=asfd->next)
 	{
-		if(FD_ISSET(asfd->fd, &fse))
-		{
-			switch(asfd->fdtype)
-			{
-				case ASFD_FD_SERVER_LISTEN_MAIN:
-				case ASFD_FD_SERVER_LISTEN_STATUS:
-					as->last_time=as->now;
-					return -1;
-				default:
-#ifdef _AIX
-					/* On AIX, for some weird reason,
-					 * writing the stats file makes the
-					 * socket show up in fse, despite
-					 * everything being fine. We ignore
-					 * it.
-					 */
-					if(strncmp(asfd->desc, "stats file",
-						sizeof("stats file")))
-					{
-						logp("%s: had an exception\n",
-							asfd->desc);
-						return asfd_problem(asfd);
-					}
-#else
-					logp("%s: had an exception\n",
-						asfd->desc);
-					return asfd_problem(asfd);
-#endif /* _AIX */
-			}
-		}
+		if(asfd_dispatch(asfd,
+			FD_ISSET(asfd->fd, &fsr),
+			FD_ISSET(asfd->fd, &fsw),
+			FD_ISSET(asfd->fd, &fse)))
+				return -1;
+	}
 
-		if(asfd->doread && FD_ISSET(asfd->fd, &fsr)) // Able to read.
-		{
-			asfd->network_timeout=asfd->max_network_timeout;
-			switch(asfd->fdtype)
-			{
-				case ASFD_FD_SERVER_LISTEN_MAIN:
-				case ASFD_FD_SERVER_LISTEN_STATUS:
-					// Indicate to the caller that we have
-					// a new incoming client.
-					asfd->new_client++;
-					break;
-				default:
-					if(asfd->do_read(asfd)
-					  || asfd->parse_readbuf(asfd))
-						return asfd_problem(asfd);
-					break;
-			}
-		}
+end:
+	as->last_time=as->now;
+	return 0;
+}
 
-		if(asfd->dowrite && FD_ISSET(asfd->fd, &fsw)) // Able to write.
-		{
-			asfd->network_timeout=asfd->max_network_timeout;
-			if(asfd->do_write(asfd))
-				return asfd_problem(asfd);
-		}
+#ifdef HAVE_SYS_EPOLL_H
+// Bring the events registered for the asfd into line with what we want this
+// time round. Nothing is kept registered while there is nothing to wait for,
+// so that a hangup on an idle fd does not keep waking us up.
+static int asfd_epoll_sync(struct async *as, struct asfd *asfd,
+	uint32_t events)
+{
+	int op;
+	struct epoll_event ev;
+
+	if(events==asfd->epoll_events) return 0;
+	if(!events) op=EPOLL_CTL_DEL;
+	else if(!asfd->epoll_events) op=EPOLL_CTL_ADD;
+	else op=EPOLL_CTL_MOD;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events=events;
+	ev.data.ptr=asfd;
+	if(epoll_ctl(as->epfd, op, asfd->fd, &ev))
+	{
+		logp("%s: epoll_ctl error in %s: %s\n",
+			asfd->desc, __func__, strerror(errno));
+		return asfd_problem(asfd);
+	}
+	asfd->epoll_events=events;
+	return 0;
+}
 
-		if((!asfd->doread || !FD_ISSET(asfd->fd, &fsr))
-		  && (!asfd->dowrite || !FD_ISSET(asfd->fd, &fsw)))
+static int async_events_grow_maybe(struct async *as, int needed)
+{
+	if(needed<=as->events_alloc) return 0;
+	if(!(as->events=(struct epoll_event *)realloc_w(as->events,
+		needed*sizeof(struct epoll_event), __func__)))
+			return -1;
+	as->events_alloc=needed;
+	return 0;
+}
+
+// The same as async_io(), but only the fds with something to do are
+// registered with the kernel, and the registrations are only touched when
+// what we want from an fd changes.
+static int async_io_epoll(struct async *as, int doread)
+{
+	int e;
+	int ready;
+	int timeout;
+	int dosomething=0;
+	uint32_t revents;
+	struct asfd *asfd;
+
+	as->now=time(NULL);
+	if(!as->last_time) as->last_time=as->now;
+
+	if(as->doing_estimate) goto end;
+
+	for(asfd=as->asfd; asfd; asfd=asfd->next)
+	{
+		uint32_t events=0;
+		asfd->epoll_revents=0;
+		switch(asfd_prepare(asfd, doread))
 		{
-			// Be careful to avoid 'read quick' mode.
-			if((as->setsec || as->setusec)
-			  && asfd->max_network_timeout>0
-			  && as->now-as->last_time>0
-			  && asfd->network_timeout--<=0)
-			{
-				logp("%s: no activity for %d seconds.\n",
-					asfd->desc, asfd->max_network_timeout);
-				return asfd_problem(asfd);
-			}
+			case 0: break;
+			case 1:
+				events=EPOLLPRI;
+				if(asfd->doread) events|=EPOLLIN;
+				if(asfd->dowrite) events|=EPOLLOUT;
+				dosomething++;
+				break;
+			default: return -1;
 		}
+		if(asfd_epoll_sync(as, asfd, events))
+			return -1;
+	}
+	if(!dosomething) goto end;
+
+	if(async_events_grow_maybe(as, dosomething))
+		return -1;
+
+	timeout=as->setsec*1000+(as->setusec+999)/1000;
+
+	errno=0;
+	ready=epoll_wait(as->epfd, as->events, dosomething, timeout);
+	if(errno==EAGAIN || errno==EINTR) goto end;
+
+	if(ready<0)
+	{
+		logp("epoll_wait error in %s: %s\n", __func__,
+			strerror(errno));
+		as->last_time=as->now;
+		return -1;
+	}
+
+	for(e=0; e<ready; e++)
+	{
+		asfd=(struct asfd *)as->events[e].data.ptr;
+		asfd->epoll_revents=as->events[e].events;
+	}
+
+	for(asfd=as->asfd; asfd; asfd=asfd->next)
+	{
+		// Like select(), let errors and hangups show up as readable
+		// and writable, so that do_read() and do_write() find them.
+		revents=asfd->epoll_revents;
+		if(asfd_dispatch(asfd,
+			revents & (EPOLLIN|EPOLLERR|EPOLLHUP),
+			revents & (EPOLLOUT|EPOLLERR|EPOLLHUP),
+			revents & EPOLLPRI))
+				return -1;
 	}
 
 end:
@@ -180,6 +334,17 @@ end:
 	return 0;
 }
 
+static int async_epoll_read_write(struct async *as)
+{
+	return async_io_epoll(as, 1 /* Read too. */);
+}
+
+static int async_epoll_write(struct async *as)
+{
+	return async_io_epoll(as, 0 /* No read. */);
+}
+#endif
+
 static int async_read_write(struct async *as)
 {
 	return async_io(as, 1 /* Read too. */);
@@ -233,6 +398,20 @@ static void async_asfd_remove(struct async *as, struct asfd *asfd)
 	}
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+static void async_epoll_asfd_remove(struct async *as, struct asfd *asfd)
+{
+	if(!asfd) return;
+	if(asfd->epoll_events)
+	{
+		// Errors are not interesting, the fd might have been closed.
+		epoll_ctl(as->epfd, EPOLL_CTL_DEL, asfd->fd, NULL);
+		asfd->epoll_events=0;
+	}
+	async_asfd_remove(as, asfd);
+}
+#endif
+
 void async_asfd_free_all(struct async **as)
 {
 	struct asfd *a=NULL;
@@ -264,11 +443,43 @@ static int async_init(struct async *as, int estimate)
 	return 0;
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+static int async_epoll_init(struct async *as, int estimate)
+{
+	async_init(as, estimate);
+
+	if((as->epfd=epoll_create1(EPOLL_CLOEXEC))<0)
+	{
+		logp("epoll_create1 error in %s: %s\n", __func__,
+			strerror(errno));
+		return -1;
+	}
+
+	as->read_write=async_epoll_read_write;
+	as->write=async_epoll_write;
+	as->asfd_remove=async_epoll_asfd_remove;
+
+	return 0;
+}
+#endif
+
 struct async *async_alloc(void)
 {
 	struct async *as;
 	if(!(as=(struct async *)calloc_w(1, sizeof(struct async), __func__)))
 		return NULL;
+	as->epfd=-1;
 	as->init=async_init;
 	return as;
 }
+
+struct async *async_alloc_epoll(void)
+{
+	struct async *as;
+	if(!(as=async_alloc()))
+		return NULL;
+#ifdef HAVE_SYS_EPOLL_H
+	as->init=async_epoll_init;
+#endif
+	return as;
+}
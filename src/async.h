@@ -4,6 +4,8 @@
 #define ASYNC_BUF_LEN	16000
 #define ZCHUNK		ASYNC_BUF_LEN
 
+struct epoll_event;
+
 struct async
 {
 	struct asfd *asfd;
@@ -28,9 +30,17 @@ struct async
 	void (*asfd_add)(struct async *, struct asfd *);
 	void (*asfd_remove)(struct async *, struct asfd *);
 	void (*settimers)(struct async *, int, int); // For debug purposes.
+
+	// For the epoll backend.
+	int epfd;
+	struct epoll_event *events;
+	int events_alloc;
 };
 
 extern struct async *async_alloc(void);
+// Uses epoll instead of select(), where it is available, so there is no
+// limit on the number of fds. Regular files cannot be added to it.
+extern struct async *async_alloc_epoll(void);
 extern void async_free(struct async **as);
 extern void async_asfd_free_all(struct async **as);
 
@@ -234,6 +234,20 @@ int extra_comms_client(struct async *as, struct conf **confs,
 			goto end;
 	}
 
+	if(server_supports(feat, ":restore_compression:"))
+	{
+		char msg[64]="";
+		snprintf(msg, sizeof(msg), "restore_compression=%d",
+			get_int(confs[OPT_RESTORE_COMPRESSION]));
+		if(asfd->write_str(asfd, CMD_GEN, msg))
+			goto end;
+	}
+	else
+	{
+		// Older servers always compress at level 9.
+		set_int(confs[OPT_RESTORE_COMPRESSION], 9);
+	}
+
 #ifndef RS_DEFAULT_STRONG_LEN
 	if(server_supports(feat, ":rshash=blake2:"))
 	{
@@ -19,10 +19,10 @@ static int do_restore_file_or_get_meta(struct asfd *asfd, struct BFILE *bfd,
 	struct sbuf *sb, const char *fname,
 	char **metadata, size_t *metalen,
 	struct cntr *cntr, const char *rpath,
-	const char *encryption_password)
+	const char *encryption_password, int restore_compression)
 {
 	int ret=-1;
-	int enccompressed=0;
+	int compressed=0;
 	uint64_t rcvdbytes=0;
 	uint64_t sentbytes=0;
 	const char *encpassword=NULL;
@@ -34,17 +34,21 @@ static int do_restore_file_or_get_meta(struct asfd *asfd, struct BFILE *bfd,
 		if(sb->encryption==ENCRYPTION_KEY_DERIVED)
 			key_deriv=1;
 	}
-	enccompressed=dpth_protocol1_is_compressed(sb->compression,
+	compressed=dpth_protocol1_is_compressed(sb->compression,
 		sb->protocol1->datapth.buf);
+	// The server compresses files that were stored uncompressed as it
+	// sends them, unless we asked for them as they are.
+	if(!encpassword && restore_compression)
+		compressed=1;
 /*
 	printf("%s \n", fname);
-	if(encpassword && !enccompressed)
+	if(encpassword && !compressed)
 		printf("encrypted and not compressed\n");
-	else if(!encpassword && enccompressed)
+	else if(!encpassword && compressed)
 		printf("not encrypted and compressed\n");
-	else if(!encpassword && !enccompressed)
+	else if(!encpassword && !compressed)
 		printf("not encrypted and not compressed\n");
-	else if(encpassword && enccompressed)
+	else if(encpassword && compressed)
 		printf("encrypted and compressed\n");
 */
 
@@ -56,7 +60,7 @@ static int do_restore_file_or_get_meta(struct asfd *asfd, struct BFILE *bfd,
 #endif
 			NULL,
 			&rcvdbytes, &sentbytes, encpassword,
-			enccompressed, cntr, metadata,
+			compressed, cntr, metadata,
 			key_deriv, sb->protocol1->salt);
 		*metalen=sentbytes;
 		// skip setting cntr, as we do not actually
@@ -70,7 +74,7 @@ static int do_restore_file_or_get_meta(struct asfd *asfd, struct BFILE *bfd,
 #endif
 			bfd,
 			&rcvdbytes, &sentbytes,
-			encpassword, enccompressed,
+			encpassword, compressed,
 			cntr, NULL, key_deriv, sb->protocol1->salt);
 #ifndef HAVE_WIN32
 		if(bfd && bfd->close(bfd, asfd))
@@ -98,7 +102,8 @@ static int do_restore_file_or_get_meta(struct asfd *asfd, struct BFILE *bfd,
 static int restore_file_or_get_meta(struct asfd *asfd, struct BFILE *bfd,
 	struct sbuf *sb, const char *fname, enum action act,
 	char **metadata, size_t *metalen, int vss_restore,
-	struct cntr *cntr, const char *encyption_password)
+	struct cntr *cntr, const char *encyption_password,
+	int restore_compression)
 {
 	int ret=0;
 	char *rpath=NULL;
@@ -137,7 +142,8 @@ static int restore_file_or_get_meta(struct asfd *asfd, struct BFILE *bfd,
 #endif
 
 	if(!(ret=do_restore_file_or_get_meta(asfd, bfd, sb, fname,
-		metadata, metalen, cntr, rpath, encyption_password)))
+		metadata, metalen, cntr, rpath, encyption_password,
+		restore_compression)))
 			cntr_add(cntr, sb->path.cmd, 1);
 end:
 	free_w(&rpath);
@@ -148,7 +154,8 @@ end:
 static int restore_metadata(struct asfd *asfd,
 	struct BFILE *bfd, struct sbuf *sb,
 	const char *fname, enum action act,
-	int vss_restore, struct cntr *cntr, const char *encryption_password)
+	int vss_restore, struct cntr *cntr, const char *encryption_password,
+	int restore_compression)
 {
 	int ret=-1;
 	size_t metalen=0;
@@ -173,7 +180,8 @@ static int restore_metadata(struct asfd *asfd,
 
 	// Read in the metadata...
 	if(restore_file_or_get_meta(asfd, bfd, sb, fname, act,
-		&metadata, &metalen, vss_restore, cntr, encryption_password))
+		&metadata, &metalen, vss_restore, cntr, encryption_password,
+		restore_compression))
 			goto end;
 	if(metadata)
 	{
@@ -205,7 +213,7 @@ end:
 int restore_switch_protocol1(struct asfd *asfd, struct sbuf *sb,
 	const char *fullpath, enum action act,
 	struct BFILE *bfd, int vss_restore, struct cntr *cntr,
-	const char *encryption_password)
+	const char *encryption_password, int restore_compression)
 {
 	switch(sb->path.cmd)
 	{
@@ -227,14 +235,15 @@ int restore_switch_protocol1(struct asfd *asfd, struct sbuf *sb,
 			return restore_file_or_get_meta(asfd, bfd, sb,
 				fullpath, act,
 				NULL, NULL, vss_restore, cntr,
-				encryption_password);
+				encryption_password, restore_compression);
 		case CMD_METADATA:
 		case CMD_VSS:
 		case CMD_ENC_METADATA:
 		case CMD_ENC_VSS:
 			return restore_metadata(asfd, bfd, sb,
 				fullpath, act,
-				vss_restore, cntr, encryption_password);
+				vss_restore, cntr, encryption_password,
+				restore_compression);
 		default:
 			// Other cases (dir/links/etc) are handled in the
 			// calling function.
@@ -11,6 +11,7 @@
 #include "../../protocol2/blist.h"
 #include "../../protocol2/rabin/rabin.h"
 #include "../../slist.h"
+#include "chunk_pool.h"
 #include "rabin_read.h"
 #include "backup_phase2.h"
 
@@ -132,6 +133,19 @@ end:
 	return ret;
 }
 
+static int interrupt_file(struct asfd *asfd, struct slist *slist,
+	struct sbuf *sb)
+{
+	char buf[32];
+	base64_from_uint64(sb->protocol2->index, buf);
+	if(asfd->write_str(asfd, CMD_INTERRUPT, buf))
+		return -1;
+	if(slist_del_sbuf(slist, sb))
+		return -1;
+	sbuf_free(&sb);
+	return 0;
+}
+
 static int add_to_blks_list(struct asfd *asfd, struct conf **confs,
 	struct slist *slist)
 {
@@ -141,7 +155,6 @@ static int add_to_blks_list(struct asfd *asfd, struct conf **confs,
 
 	if(sb->protocol2->bfd.mode==BF_CLOSED)
 	{
-		char buf[32];
 		struct cntr *cntr=NULL;
 		if(confs) cntr=get_cntr(confs);
 		switch(rabin_open_file(sb, asfd, cntr, confs))
@@ -149,13 +162,7 @@ static int add_to_blks_list(struct asfd *asfd, struct conf **confs,
 			case 1: // All OK.
 				break;
 			case 0: // Could not open file. Tell the server.
-				base64_from_uint64(sb->protocol2->index, buf);
-				if(asfd->write_str(asfd, CMD_INTERRUPT, buf))
-					return -1;
-				if(slist_del_sbuf(slist, sb))
-					return -1;
-				sbuf_free(&sb);
-				return 0;
+				return interrupt_file(asfd, slist, sb);
 			default:
 				return -1;
 		}
@@ -182,6 +189,97 @@ static int add_to_blks_list(struct asfd *asfd, struct conf **confs,
 	return 0;
 }
 
+// Like add_to_blks_list(), but with the files split into blocks by the
+// chunk pool threads.
+static int add_to_blks_list_pool(struct asfd *asfd, struct conf **confs,
+	struct slist *slist, struct chunk_pool *pool, int max_jobs)
+{
+	int threaded=0;
+	struct sbuf *sb;
+	struct sbuf *last;
+	struct cntr *cntr=NULL;
+	if(confs) cntr=get_cntr(confs);
+
+	// Keep the threads supplied with files. Opening them is done here,
+	// because it may involve sending warnings to the server.
+	while(chunk_pool_jobs(pool)<max_jobs)
+	{
+		last=chunk_pool_last(pool);
+		if(!(sb=last?last->next:slist->last_requested))
+			break;
+		// Metadata is read into a single buffer, so it is opened and
+		// dealt with once it gets to the head of the queue.
+		if(sbuf_is_metadata(sb))
+		{
+			if(chunk_pool_add(pool, sb, 0))
+				return -1;
+			continue;
+		}
+		switch(rabin_open_file(sb, asfd, cntr, confs))
+		{
+			case 1: // All OK.
+				if(chunk_pool_add(pool, sb, 1))
+					return -1;
+				break;
+			case 0: // Could not open file. The server is told
+				// when it gets to the head of the queue.
+				if(chunk_pool_add(pool, sb, 0))
+					return -1;
+				break;
+			default:
+				return -1;
+		}
+	}
+
+	if(!(sb=chunk_pool_head(pool, &threaded)))
+		return 0;
+
+	if(!threaded)
+	{
+		if(sbuf_is_metadata(sb))
+		{
+			if(add_to_blks_list(asfd, confs, slist))
+				return -1;
+			if(slist->last_requested!=sb)
+				chunk_pool_drop(pool);
+			return 0;
+		}
+		chunk_pool_drop(pool);
+		return interrupt_file(asfd, slist, sb);
+	}
+
+	switch(chunk_pool_take(pool, slist->blist))
+	{
+		case 0: // All OK.
+			break;
+		case 1: // File ended.
+			if(rabin_close_file(sb, asfd))
+			{
+				logp("Failed to close file %s\n",
+					sb->path.buf);
+				return -1;
+			}
+			slist->last_requested=sb->next;
+			break;
+		default:
+			return -1;
+	}
+	return 0;
+}
+
+static int get_chunker_threads(struct conf **confs)
+{
+	int threads;
+	if(!confs || (threads=get_int(confs[OPT_CHUNKER_THREADS]))<=0)
+		return 0;
+#ifndef HAVE_PTHREAD
+	logp("Ignoring chunker_threads, because built without pthreads\n");
+	return 0;
+#else
+	return threads;
+#endif
+}
+
 static void free_stuff(struct slist *slist)
 {
 	struct blk *blk;
@@ -242,7 +340,7 @@ static void get_wbuf_from_data(struct conf **confs,
 
 static int iobuf_from_blk_data(struct iobuf *wbuf, struct blk *blk)
 {
-	if(blk_md5_update(blk)) return -1;
+	// The md5sum was filled in when the block was generated.
 	blk_to_iobuf_sig(blk, wbuf);
 	return 0;
 }
@@ -290,8 +388,10 @@ int backup_phase2_client_protocol2(struct asfd *asfd,
 	struct conf **confs, int resume)
 {
 	int ret=-1;
+	int threads=0;
 	uint8_t end_flags=0;
 	struct slist *slist=NULL;
+	struct chunk_pool *pool=NULL;
 	struct iobuf *rbuf=NULL;
 	struct iobuf *wbuf=NULL;
 	struct cntr *cntr=NULL;
@@ -311,6 +411,15 @@ int backup_phase2_client_protocol2(struct asfd *asfd,
 	  || !(wbuf=iobuf_alloc())
 	  || blks_generate_init())
 		goto end;
+	if(confs && blks_generate_set_engine(get_string(confs[OPT_CHUNKER])))
+		goto end;
+	if((threads=get_chunker_threads(confs)))
+	{
+		logp("Using %d chunker threads\n", threads);
+		if(!(pool=chunk_pool_alloc(threads,
+			get_string(confs[OPT_CHUNKER]))))
+				goto end;
+	}
 	rbuf=asfd->rbuf;
 
 	if(!resume)
@@ -346,7 +455,21 @@ int backup_phase2_client_protocol2(struct asfd *asfd,
 				==APPEND_ERROR)
 					goto end;
 		}
-		if(asfd->as->read_write(asfd->as))
+		if(pool && chunk_pool_jobs(pool) && !wbuf->len
+		  && (!slist->blist->head
+		   || slist->blist->tail->index
+			- slist->blist->head->index<BLKS_MAX_IN_MEM))
+		{
+			// There are threads working on blocks, so do not sit
+			// waiting for the network. chunk_pool_take() waits a
+			// little instead, if there is nothing ready.
+			if(asfd->as->read_quick(asfd->as))
+			{
+				logp("error in %s\n", __func__);
+				goto end;
+			}
+		}
+		else if(asfd->as->read_write(asfd->as))
 		{
 			logp("error in %s\n", __func__);
 			goto end;
@@ -362,7 +485,13 @@ int backup_phase2_client_protocol2(struct asfd *asfd,
 			- slist->blist->head->index<BLKS_MAX_IN_MEM)
 		)
 		{
-			if(add_to_blks_list(asfd, confs, slist))
+			if(pool)
+			{
+				if(add_to_blks_list_pool(asfd, confs, slist,
+					pool, threads*2))
+						goto end;
+			}
+			else if(add_to_blks_list(asfd, confs, slist))
 				goto end;
 		}
 
@@ -390,6 +519,8 @@ int backup_phase2_client_protocol2(struct asfd *asfd,
 
 	ret=0;
 end:
+	// The threads may still be looking at entries in slist.
+	chunk_pool_free(&pool);
 	slist_free(&slist);
 	blks_generate_free();
 	if(wbuf)
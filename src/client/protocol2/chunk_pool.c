@@ -0,0 +1,414 @@
+#include "../../burp.h"
+#include "../../alloc.h"
+#include "../../iobuf.h"
+#include "../../log.h"
+#include "../../sbuf.h"
+#include "../../protocol2/blk.h"
+#include "../../protocol2/blist.h"
+#include "../../protocol2/rabin/rabin.h"
+#include "chunk_pool.h"
+
+// Splits files into blocks and checksums them on separate threads, one file
+// per thread, while the main process gets on with talking to the server.
+// The main process does everything else - opening files, logging, closing
+// them, and numbering the blocks - so that the rest of the client does not
+// need to know about threads. Blocks are handed back in the same order
+// that the files were added.
+
+#ifdef HAVE_PTHREAD
+
+#include <pthread.h>
+
+// How many blocks a thread may get ahead of the main process on one file
+// before it waits for them to be taken.
+#define CHUNK_JOB_MAX_BLKS	256
+// How long the main process waits for a block to become ready before it
+// goes back to servicing the network, in milliseconds.
+#define CHUNK_POOL_WAIT_MS	10
+
+enum chunk_job_state
+{
+	CHUNK_JOB_QUEUED=0,
+	CHUNK_JOB_RUNNING,
+	CHUNK_JOB_DONE,
+	CHUNK_JOB_SERIAL // Left for the main process to deal with.
+};
+
+struct chunk_job
+{
+	struct sbuf *sb;
+	enum chunk_job_state state;
+	int error;
+	int count;
+	int taken;
+	struct blk *head;
+	struct blk *tail;
+	struct chunk_job *next;
+};
+
+struct chunk_worker
+{
+	pthread_t thread;
+	int started;
+	struct blks_gen *gen;
+	struct chunk_pool *pool;
+};
+
+struct chunk_pool
+{
+	pthread_mutex_t lock;
+	pthread_cond_t work; // Threads wait on this.
+	pthread_cond_t ready; // The main process waits on this.
+	int stop;
+	int jobs;
+	struct chunk_job *head;
+	struct chunk_job *tail;
+	int threads;
+	struct chunk_worker *workers;
+};
+
+static void blks_free(struct blk *blk)
+{
+	struct blk *next;
+	for(; blk; blk=next)
+	{
+		next=blk->next;
+		blk_free(&blk);
+	}
+}
+
+static void chunk_job_free(struct chunk_job **job)
+{
+	if(!job || !*job) return;
+	blks_free((*job)->head);
+	free_v((void **)job);
+}
+
+// Jobs are started in order, so the file at the head of the queue always
+// has a thread on it, or is next in line for one.
+static struct chunk_job *job_to_run(struct chunk_pool *pool)
+{
+	struct chunk_job *job;
+	for(job=pool->head; job; job=job->next)
+		if(job->state==CHUNK_JOB_QUEUED)
+			return job;
+	return NULL;
+}
+
+static void run_job(struct chunk_worker *worker, struct chunk_job *job)
+{
+	int r;
+	int just_opened=1;
+	struct blk *blk;
+	struct chunk_pool *pool=worker->pool;
+
+	job->state=CHUNK_JOB_RUNNING;
+	while(1)
+	{
+		pthread_mutex_unlock(&pool->lock);
+		r=blks_gen_next(worker->gen, job->sb, just_opened, &blk);
+		just_opened=0;
+		if(blk && blk_md5_update(blk))
+			r=-1;
+		if(r<0)
+			blk_free(&blk);
+		pthread_mutex_lock(&pool->lock);
+
+		if(blk)
+		{
+			if(job->tail)
+				job->tail->next=blk;
+			else
+				job->head=blk;
+			job->tail=blk;
+			job->count++;
+		}
+		if(r)
+		{
+			if(r<0)
+				job->error=1;
+			job->state=CHUNK_JOB_DONE;
+		}
+		pthread_cond_signal(&pool->ready);
+		if(job->state==CHUNK_JOB_DONE)
+			return;
+
+		while(!pool->stop && job->count>=CHUNK_JOB_MAX_BLKS)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if(pool->stop)
+			return;
+	}
+}
+
+static void *chunk_worker_run(void *arg)
+{
+	struct chunk_job *job;
+	struct chunk_worker *worker=(struct chunk_worker *)arg;
+	struct chunk_pool *pool=worker->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	while(!pool->stop)
+	{
+		if((job=job_to_run(pool)))
+			run_job(worker, job);
+		else
+			pthread_cond_wait(&pool->work, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct chunk_pool *chunk_pool_alloc(int threads, const char *engine)
+{
+	int t;
+	int r;
+	struct chunk_pool *pool;
+
+	if(!(pool=(struct chunk_pool *)
+		calloc_w(1, sizeof(struct chunk_pool), __func__)))
+			return NULL;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->ready, NULL);
+
+	if(!(pool->workers=(struct chunk_worker *)
+		calloc_w(threads, sizeof(struct chunk_worker), __func__)))
+			goto error;
+	pool->threads=threads;
+	for(t=0; t<threads; t++)
+	{
+		struct chunk_worker *worker=&pool->workers[t];
+		worker->pool=pool;
+		if(!(worker->gen=blks_gen_alloc())
+		  || blks_gen_set_engine(worker->gen, engine))
+			goto error;
+		if((r=pthread_create(&worker->thread, NULL,
+			chunk_worker_run, worker)))
+		{
+			logp("Could not start chunker thread: %s\n",
+				strerror(r));
+			goto error;
+		}
+		worker->started=1;
+	}
+	return pool;
+error:
+	chunk_pool_free(&pool);
+	return NULL;
+}
+
+void chunk_pool_free(struct chunk_pool **pool)
+{
+	int t;
+	struct chunk_job *job;
+	struct chunk_job *next;
+	struct chunk_pool *p;
+
+	if(!pool || !*pool) return;
+	p=*pool;
+
+	pthread_mutex_lock(&p->lock);
+	p->stop=1;
+	pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->lock);
+
+	if(p->workers)
+	{
+		for(t=0; t<p->threads; t++)
+		{
+			if(p->workers[t].started)
+				pthread_join(p->workers[t].thread, NULL);
+			blks_gen_free(&p->workers[t].gen);
+		}
+		free_v((void **)&p->workers);
+	}
+
+	for(job=p->head; job; job=next)
+	{
+		next=job->next;
+		chunk_job_free(&job);
+	}
+
+	pthread_cond_destroy(&p->ready);
+	pthread_cond_destroy(&p->work);
+	pthread_mutex_destroy(&p->lock);
+	free_v((void **)pool);
+}
+
+// Queue up a file that has already been opened. If 'threaded' is not set,
+// the entry just holds its place in the queue, and the caller deals with it
+// when it gets to the head.
+int chunk_pool_add(struct chunk_pool *pool, struct sbuf *sb, int threaded)
+{
+	struct chunk_job *job;
+
+	if(!(job=(struct chunk_job *)
+		calloc_w(1, sizeof(struct chunk_job), __func__)))
+			return -1;
+	job->sb=sb;
+	job->state=threaded?CHUNK_JOB_QUEUED:CHUNK_JOB_SERIAL;
+
+	pthread_mutex_lock(&pool->lock);
+	if(pool->tail)
+		pool->tail->next=job;
+	else
+		pool->head=job;
+	pool->tail=job;
+	pool->jobs++;
+	if(threaded)
+		pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+// The queue is only changed by the main process, so these do not need to
+// take the lock.
+int chunk_pool_jobs(struct chunk_pool *pool)
+{
+	return pool->jobs;
+}
+
+struct sbuf *chunk_pool_head(struct chunk_pool *pool, int *threaded)
+{
+	if(!pool->head)
+		return NULL;
+	if(threaded)
+		*threaded=pool->head->state!=CHUNK_JOB_SERIAL;
+	return pool->head->sb;
+}
+
+struct sbuf *chunk_pool_last(struct chunk_pool *pool)
+{
+	return pool->tail?pool->tail->sb:NULL;
+}
+
+static void remove_head(struct chunk_pool *pool)
+{
+	struct chunk_job *job;
+
+	pthread_mutex_lock(&pool->lock);
+	job=pool->head;
+	pool->head=job->next;
+	if(!pool->head)
+		pool->tail=NULL;
+	pool->jobs--;
+	pthread_mutex_unlock(&pool->lock);
+
+	chunk_job_free(&job);
+}
+
+void chunk_pool_drop(struct chunk_pool *pool)
+{
+	if(pool->head)
+		remove_head(pool);
+}
+
+static void get_deadline(struct timespec *ts)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_nsec+=CHUNK_POOL_WAIT_MS*1000000L;
+	if(ts->tv_nsec>=1000000000L)
+	{
+		ts->tv_sec++;
+		ts->tv_nsec-=1000000000L;
+	}
+}
+
+// Moves any blocks that are ready for the file at the head of the queue on
+// to the end of blist. Waits briefly if there are none yet.
+// Returns 1 when the file is finished and has been removed from the queue,
+// 0 when there is more to come, -1 for error.
+int chunk_pool_take(struct chunk_pool *pool, struct blist *blist)
+{
+	int error;
+	enum chunk_job_state state;
+	struct blk *blk;
+	struct blk *next;
+	struct timespec ts;
+	struct chunk_job *job=pool->head;
+	struct sbuf *sb=job->sb;
+
+	pthread_mutex_lock(&pool->lock);
+	if(!job->head && job->state!=CHUNK_JOB_DONE)
+	{
+		get_deadline(&ts);
+		pthread_cond_timedwait(&pool->ready, &pool->lock, &ts);
+	}
+	blk=job->head;
+	job->head=job->tail=NULL;
+	job->count=0;
+	state=job->state;
+	error=job->error;
+	if(blk)
+		pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	// Numbering the blocks and setting the markers is done here, because
+	// the rest of the client expects the blist to be in file order.
+	for(; blk; blk=next)
+	{
+		next=blk->next;
+		blk->next=NULL;
+		if(!job->taken++)
+			sb->protocol2->bstart=blk;
+		if(!sb->protocol2->bsighead)
+			sb->protocol2->bsighead=blk;
+		blist_add_blk(blist, blk);
+	}
+
+	if(state!=CHUNK_JOB_DONE)
+		return 0;
+	if(error)
+	{
+		logp("Error splitting %s into blocks\n",
+			iobuf_to_printable(&sb->path));
+		return -1;
+	}
+	if(blist->tail)
+		sb->protocol2->bend=blist->tail;
+	remove_head(pool);
+	return 1;
+}
+
+#else
+
+struct chunk_pool *chunk_pool_alloc(int threads, const char *engine)
+{
+	logp("%s() called, but built without pthreads\n", __func__);
+	return NULL;
+}
+
+void chunk_pool_free(struct chunk_pool **pool)
+{
+}
+
+int chunk_pool_add(struct chunk_pool *pool, struct sbuf *sb, int threaded)
+{
+	return -1;
+}
+
+int chunk_pool_jobs(struct chunk_pool *pool)
+{
+	return 0;
+}
+
+struct sbuf *chunk_pool_head(struct chunk_pool *pool, int *threaded)
+{
+	return NULL;
+}
+
+struct sbuf *chunk_pool_last(struct chunk_pool *pool)
+{
+	return NULL;
+}
+
+void chunk_pool_drop(struct chunk_pool *pool)
+{
+}
+
+int chunk_pool_take(struct chunk_pool *pool, struct blist *blist)
+{
+	return -1;
+}
+
+#endif
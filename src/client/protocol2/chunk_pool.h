@@ -0,0 +1,18 @@
+#ifndef _CHUNK_POOL_H
+#define _CHUNK_POOL_H
+
+struct blist;
+struct chunk_pool;
+struct sbuf;
+
+extern struct chunk_pool *chunk_pool_alloc(int threads, const char *engine);
+extern void chunk_pool_free(struct chunk_pool **pool);
+extern int chunk_pool_add(struct chunk_pool *pool,
+	struct sbuf *sb, int threaded);
+extern int chunk_pool_jobs(struct chunk_pool *pool);
+extern struct sbuf *chunk_pool_head(struct chunk_pool *pool, int *threaded);
+extern struct sbuf *chunk_pool_last(struct chunk_pool *pool);
+extern void chunk_pool_drop(struct chunk_pool *pool);
+extern int chunk_pool_take(struct chunk_pool *pool, struct blist *blist);
+
+#endif
@@ -429,6 +429,13 @@ void cntr_add_deleted(struct cntr *c, char ch)
 	incr_deleted(c, CMD_GRAND_TOTAL);
 }
 
+void cntr_add_deleted_val(struct cntr *c, char ch, uint64_t val)
+{
+	incr_deleted_val(c, ch, val);
+	incr_deleted_val(c, CMD_TOTAL, val);
+	incr_deleted_val(c, CMD_GRAND_TOTAL, val);
+}
+
 void cntr_add_bytes(struct cntr *c, uint64_t bytes)
 {
 	incr_count_val(c, CMD_BYTES, bytes);
@@ -113,6 +113,8 @@ extern void cntr_add_same_val(struct cntr *c,
 	char ch, uint64_t val);
 extern void cntr_add_changed_val(struct cntr *c,
 	char ch, uint64_t val);
+extern void cntr_add_deleted_val(struct cntr *c,
+	char ch, uint64_t val);
 
 #ifndef HAVE_WIN32
 extern size_t cntr_to_str(struct cntr *cntr, const char *path);
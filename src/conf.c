@@ -692,6 +692,20 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	case OPT_DEDUP_GROUP:
 	  return sc_str(c[o], 0,
 		CONF_FLAG_CC_OVERRIDE, "dedup_group");
+	case OPT_DEDUP_THREADS:
+	  return sc_int(c[o], 0, 0, "dedup_threads");
+	case OPT_DELETE_THREADS:
+	  return sc_int(c[o], 0, 0, "delete_threads");
+	case OPT_DELETE_MAX_PER_SECOND:
+	  return sc_int(c[o], 0, 0, "delete_max_per_second");
+	case OPT_DELTA_THREADS:
+	  return sc_int(c[o], 0, 0, "delta_threads");
+	case OPT_DIFF_THREADS:
+	  return sc_int(c[o], 0, 0, "diff_threads");
+	case OPT_COMPRESS_THREADS:
+	  return sc_int(c[o], 0, 0, "compress_threads");
+	case OPT_SYNC_INTERVAL:
+	  return sc_int(c[o], 0, CONF_FLAG_CC_OVERRIDE, "sync_interval");
 	case OPT_CLIENT_CAN_DELETE:
 	  return sc_int(c[o], 1,
 		CONF_FLAG_CC_OVERRIDE, "client_can_delete");
@@ -722,6 +736,8 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	case OPT_MESSAGE:
 	  return sc_int(c[o], 0,
 		CONF_FLAG_CC_OVERRIDE, "");
+	case OPT_RESTORE_COMPRESSION:
+	  return sc_int(c[o], 9, 0, "restore_compression");
 	case OPT_INCEXCDIR:
 	  // This is a combination of OPT_INCLUDE and OPT_EXCLUDE, so
 	  // no field name set for now.
@@ -798,6 +814,10 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	  return sc_int(c[o], 0, CONF_FLAG_INCEXC, "atime");
 	case OPT_SCAN_PROBLEM_RAISES_ERROR:
 	  return sc_int(c[o], 0, CONF_FLAG_INCEXC, "scan_problem_raises_error");
+	case OPT_CHUNKER:
+	  return sc_str(c[o], 0, 0, "chunker");
+	case OPT_CHUNKER_THREADS:
+	  return sc_int(c[o], 0, 0, "chunker_threads");
 	case OPT_OVERWRITE:
 	  return sc_int(c[o], 0,
 		CONF_FLAG_INCEXC|CONF_FLAG_INCEXC_RESTORE, "overwrite");
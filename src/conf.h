@@ -98,6 +98,11 @@ enum conf_opt
 	OPT_PROTOCOL,
 	OPT_RSHASH,
 	OPT_MESSAGE,
+	// The deflate level that the server uses on files that it has to
+	// compress as it sends them during a restore, or 0 to send them
+	// uncompressed. Set on the client, and passed to the server in
+	// extra_comms.
+	OPT_RESTORE_COMPRESSION,
 	OPT_CNAME_LOWERCASE, // force lowercase cname, client or server option
 	OPT_CNAME_FQDN, // use fqdn cname, client or server option
 
@@ -178,6 +183,8 @@ enum conf_opt
 	OPT_XATTR,
 	OPT_ATIME,
 	OPT_SCAN_PROBLEM_RAISES_ERROR,
+	OPT_CHUNKER, // protocol2 block boundary engine
+	OPT_CHUNKER_THREADS,
 	// These are to do with restore.
 	OPT_OVERWRITE,
 	OPT_STRIP,
@@ -260,6 +267,13 @@ enum conf_opt
 	OPT_RESTORE_CLIENTS,
 
 	OPT_DEDUP_GROUP,
+	OPT_DEDUP_THREADS,
+	OPT_DELETE_THREADS,
+	OPT_DELETE_MAX_PER_SECOND,
+	OPT_DELTA_THREADS,
+	OPT_DIFF_THREADS,
+	OPT_COMPRESS_THREADS,
+	OPT_SYNC_INTERVAL,
 
 	OPT_CLIENT_CAN_DELETE,
 	OPT_CLIENT_CAN_DIFF,
@@ -11,6 +11,7 @@
 #include "strlist.h"
 #include "times.h"
 #include "client/glob_windows.h"
+#include "protocol2/rabin/rconf.h"
 #include "conffile.h"
 
 // This will strip off everything after the last quote. So, configs like this
@@ -254,6 +255,12 @@ static int load_conf_field_and_value(struct conf **c,
 		if(compression<0) return -1;
 		set_int(c[OPT_SSL_COMPRESSION], compression);
 	}
+	else if(!strcmp(f, "restore_compression"))
+	{
+		int compression=get_compression(v);
+		if(compression<0) return -1;
+		set_int(c[OPT_RESTORE_COMPRESSION], compression);
+	}
 	else if(!strcmp(f, "ratelimit"))
 	{
 		float f=0;
@@ -715,6 +722,12 @@ static int client_conf_checks(struct conf **c, const char *path, int *r)
 				return -1;
 		}
 	}
+	if(get_string(c[OPT_CHUNKER]))
+	{
+		struct rconf rconf;
+		if(rconf_set_engine(&rconf, get_string(c[OPT_CHUNKER])))
+			conf_problem(path, "chunker must be 'rabin' or 'gear'", r);
+	}
 	if(autoupgrade_os
 	  && strstr(autoupgrade_os, ".."))
 		conf_problem(path,
@@ -1421,6 +1434,8 @@ int conf_switch_to_orig_client(struct conf **globalcs,
 	}
 	set_int(sconfs[OPT_SEND_CLIENT_CNTR],
 		get_int(cconfs[OPT_SEND_CLIENT_CNTR]));
+	set_int(sconfs[OPT_RESTORE_COMPRESSION],
+		get_int(cconfs[OPT_RESTORE_COMPRESSION]));
 
 	if(!restore_client_allowed(cconfs, sconfs))
 		goto end;
@@ -325,6 +325,19 @@ int unlink_w(const char *path, const char *func)
 	return 0;
 }
 
+// Gets anything at path out of the way of a new file. Opening it for
+// writing instead would truncate it, and with it any hard links to it.
+int unlink_for_write(const char *path, const char *func)
+{
+	if(unlink(path) && errno!=ENOENT)
+	{
+		logp("unlink(%s) called from %s(): %s\n",
+			path, func, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
 static void init_max(const char *path,
 	uint32_t *max, int what, uint32_t default_max)
 {
@@ -21,6 +21,7 @@ extern int recursive_delete_dirs_only(const char *path);
 extern int recursive_delete_dirs_only_no_warnings(const char *path);
 
 extern int unlink_w(const char *path, const char *func);
+extern int unlink_for_write(const char *path, const char *func);
 
 extern int init_fs_max(const char *path);
 
@@ -7,6 +7,7 @@
 #include "prepend.h"
 #ifndef HAVE_WIN32
 #include "server/compress.h"
+#include "server/pgzip.h"
 #include "server/protocol1/zlibio.h"
 #endif
 
@@ -81,10 +82,30 @@ static void not_open(const char *func)
 	logp("File pointer not open in %s\n", func);
 }
 
+#ifndef HAVE_WIN32
+// Writing a new gzip file can be done on a pool of threads, unless zlib is
+// being asked for anything more than a compression level.
+// Returns 1 if it can, with the level filled in.
+static int pgzip_mode(const char *mode, int *level)
+{
+	if(!pgzip_get_threads() || *mode++!='w')
+		return 0;
+	if(*mode=='b')
+		mode++;
+	*level=Z_DEFAULT_COMPRESSION;
+	if(isdigit(*mode))
+		*level=*mode++-'0';
+	return !*mode;
+}
+#endif
+
 static struct fzp *fzp_do_open(const char *path, const char *mode,
 	enum fzp_type type)
 {
 	struct fzp *fzp=NULL;
+#ifndef HAVE_WIN32
+	int level;
+#endif
 
 	if(!(fzp=fzp_alloc())) goto error;
 	fzp->type=type;
@@ -95,6 +116,15 @@ static struct fzp *fzp_do_open(const char *path, const char *mode,
 				goto error;
 			return fzp;
 		case FZP_COMPRESSED:
+#ifndef HAVE_WIN32
+			if(pgzip_mode(mode, &level))
+			{
+				fzp->type=FZP_PGZIP;
+				if(!(fzp->pz=pgzip_open(path, level)))
+					goto error;
+				return fzp;
+			}
+#endif
 			if(!(fzp->zp=open_zp(path, mode)))
 				goto error;
 			return fzp;
@@ -129,6 +159,11 @@ int fzp_close(struct fzp **fzp)
 		case FZP_COMPRESSED:
 			ret=close_zp(&((*fzp)->zp));
 			break;
+#ifndef HAVE_WIN32
+		case FZP_PGZIP:
+			ret=pgzip_close(&((*fzp)->pz));
+			break;
+#endif
 		default:
 			unknown_type((*fzp)->type, __func__);
 			break;
@@ -162,6 +197,10 @@ size_t fzp_write(struct fzp *fzp, const void *ptr, size_t nmemb)
 			return fwrite(ptr, 1, nmemb, fzp->fp);
 		case FZP_COMPRESSED:
 			return gzwrite(fzp->zp, ptr, (unsigned)nmemb);
+#ifndef HAVE_WIN32
+		case FZP_PGZIP:
+			return pgzip_write(fzp->pz, ptr, nmemb);
+#endif
 		default:
 			unknown_type(fzp->type, __func__);
 			goto error;
@@ -189,6 +228,41 @@ error:
 	return -1;
 }
 
+int fzp_getc(struct fzp *fzp)
+{
+	if(fzp) switch(fzp->type)
+	{
+		case FZP_FILE:
+			return fgetc(fzp->fp);
+		case FZP_COMPRESSED:
+			return gzgetc(fzp->zp);
+		default:
+			unknown_type(fzp->type, __func__);
+			goto error;
+	}
+	not_open(__func__);
+error:
+	return EOF;
+}
+
+// Only one character can be pushed back between reads.
+int fzp_ungetc(struct fzp *fzp, int c)
+{
+	if(fzp) switch(fzp->type)
+	{
+		case FZP_FILE:
+			return ungetc(c, fzp->fp);
+		case FZP_COMPRESSED:
+			return gzungetc(c, fzp->zp);
+		default:
+			unknown_type(fzp->type, __func__);
+			goto error;
+	}
+	not_open(__func__);
+error:
+	return EOF;
+}
+
 int fzp_flush(struct fzp *fzp)
 {
 	if(fzp) switch(fzp->type)
@@ -197,6 +271,10 @@ int fzp_flush(struct fzp *fzp)
 			return fflush(fzp->fp);
 		case FZP_COMPRESSED:
 			return gzflush(fzp->zp, Z_FINISH);
+#ifndef HAVE_WIN32
+		case FZP_PGZIP:
+			return pgzip_flush(fzp->pz);
+#endif
 		default:
 			unknown_type(fzp->type, __func__);
 			goto error;
@@ -234,6 +312,10 @@ off_t fzp_tell(struct fzp *fzp)
 			return ftello(fzp->fp);
 		case FZP_COMPRESSED:
 			return gztell(fzp->zp);
+#ifndef HAVE_WIN32
+		case FZP_PGZIP:
+			return pgzip_tell(fzp->pz);
+#endif
 		default:
 			unknown_type(fzp->type, __func__);
 			goto error;
@@ -342,6 +424,13 @@ int fzp_printf(struct fzp *fzp, const char *format, ...)
 		case FZP_COMPRESSED:
 			ret=gzprintf(fzp->zp, "%s", fzp->buf);
 			break;
+#ifndef HAVE_WIN32
+		case FZP_PGZIP:
+			n=(int)strlen(fzp->buf);
+			if(pgzip_write(fzp->pz, fzp->buf, n)==(size_t)n)
+				ret=n;
+			break;
+#endif
 		default:
 			unknown_type(fzp->type, __func__);
 			break;
@@ -484,10 +573,10 @@ static void pass_msg(size_t nmemb, size_t got, int pass)
 
 int fzp_read_ensure(struct fzp *fzp, void *ptr, size_t nmemb, const char *func)
 {
-	static int f;
-	static int r;
-	static size_t got;
-	static int pass;
+	int f;
+	int r;
+	size_t got;
+	int pass;
 	for(r=0, got=0, pass=0; got!=nmemb; pass++)
 	{
 		r=fzp_read(fzp, ((char *)ptr)+got, nmemb-got);
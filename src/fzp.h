@@ -6,9 +6,13 @@
 enum fzp_type
 {
 	FZP_FILE=0,
-	FZP_COMPRESSED
+	FZP_COMPRESSED,
+	// Compressed on a pool of threads. Only for writing.
+	FZP_PGZIP
 };
 
+struct pgzip;
+
 struct fzp
 {
 	enum fzp_type type;
@@ -16,6 +20,7 @@ struct fzp
 	{
 		FILE *fp;
 		gzFile zp;
+		struct pgzip *pz;
 	};
 	char *buf;
 	size_t s;
@@ -28,6 +33,8 @@ extern int fzp_close(struct fzp **fzp);
 extern int fzp_read(struct fzp *fzp, void *ptr, size_t nmemb);
 extern size_t fzp_write(struct fzp *fzp, const void *ptr, size_t nmemb);
 extern int fzp_eof(struct fzp *fzp);
+extern int fzp_getc(struct fzp *fzp);
+extern int fzp_ungetc(struct fzp *fzp, int c);
 extern int fzp_flush(struct fzp *fzp);
 
 extern int fzp_seek(struct fzp *fzp, off_t offset, int whence);
@@ -9,6 +9,19 @@
 #include "strlist.h"
 #include "times.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+// Worker threads leave their messages for the main thread to log where they
+// can, but errors deep in the helpers that they call still get logged from
+// the thread. These take turns, so that the log buffers are not shared.
+static pthread_mutex_t log_lock=PTHREAD_MUTEX_INITIALIZER;
+#define LOG_LOCK	pthread_mutex_lock(&log_lock)
+#define LOG_UNLOCK	pthread_mutex_unlock(&log_lock)
+#else
+#define LOG_LOCK
+#define LOG_UNLOCK
+#endif
+
 const char *prog="unknown";
 const char *prog_long="unknown";
 
@@ -38,6 +51,7 @@ void logp(const char *fmt, ...)
 	va_start(ap, fmt);
 	vsnprintf(buf, sizeof(buf), fmt, ap);
 	pid=(int)getpid();
+	LOG_LOCK;
 	if(logfzp)
 		fzp_printf(logfzp, "%s: %s[%d] %s",
 			gettimenow(), prog, pid, buf);
@@ -68,6 +82,7 @@ void logp(const char *fmt, ...)
 					gettimenow(), prog, pid, buf);
 		}
 	}
+	LOG_UNLOCK;
 	va_end(ap);
 #endif
 }
@@ -110,6 +125,7 @@ void logc(const char *fmt, ...)
 	va_list ap;
 	va_start(ap, fmt);
 	vsnprintf(buf, sizeof(buf), fmt, ap);
+	LOG_LOCK;
 	if(logfzp)
 		fzp_printf(logfzp, "%s", buf); // for the server side
 	else
@@ -118,6 +134,7 @@ void logc(const char *fmt, ...)
 		  && do_stdout)
 			fprintf(stdout, "%s", buf);
 	}
+	LOG_UNLOCK;
 	va_end(ap);
 }
 
@@ -48,15 +48,14 @@ static int do_write(struct asfd *asfd,
 static int do_inflate(struct asfd *asfd,
 	z_stream *zstrm, struct BFILE *bfd,
 	uint8_t *out, uint8_t *buftouse, size_t lentouse,
-	char **metadata, const char *encpassword, int enccompressed,
-	uint64_t *sent)
+	char **metadata, int compressed, uint64_t *sent)
 {
 	int zret=Z_OK;
 	unsigned have=0;
 
-	// Do not want to inflate encrypted data that was not compressed.
+	// Do not want to inflate data that was not compressed.
 	// Just write it straight out.
-	if(encpassword && !enccompressed)
+	if(!compressed)
 		return do_write(asfd, bfd, buftouse, lentouse, metadata, sent);
 
 	zstrm->avail_in=lentouse;
@@ -173,7 +172,7 @@ int transfer_gzfile_inl(struct asfd *asfd,
 #endif
 	struct BFILE *bfd,
 	uint64_t *rcvd, uint64_t *sent,
-	const char *encpassword, int enccompressed,
+	const char *encpassword, int compressed,
 	struct cntr *cntr, char **metadata,
 	int key_deriv, uint64_t salt)
 {
@@ -298,9 +297,7 @@ int transfer_gzfile_inl(struct asfd *asfd,
 
 					if(do_inflate(asfd, &zstrm, bfd, out,
 						buftouse, lentouse, metadata,
-						encpassword,
-						enccompressed,
-						sent))
+						compressed, sent))
 					{
 						ret=-1; quit++;
 						break;
@@ -320,8 +317,7 @@ int transfer_gzfile_inl(struct asfd *asfd,
 					if(doutlen && do_inflate(asfd,
 					  &zstrm, bfd,
 					  out, doutbuf, (size_t)doutlen,
-					  metadata, encpassword,
-					  enccompressed, sent))
+					  metadata, compressed, sent))
 					{
 						ret=-1; quit++;
 						break;
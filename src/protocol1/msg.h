@@ -10,7 +10,7 @@ extern int transfer_gzfile_inl(struct asfd *asfd,
 #endif
 	struct BFILE *bfd,
 	uint64_t *rcvd, uint64_t *sent,
-	const char *encpassword, int enccompressed,
+	const char *encpassword, int compressed,
 	struct cntr *cntr, char **metadata,
 	int key_deriv, uint64_t salt);
 
@@ -0,0 +1,137 @@
+#include "../../burp.h"
+#include "gear.h"
+
+// The table has to be identical on every client, and is only ever read, so
+// that any number of threads can chunk with it at once. It was generated
+// from the fixed seed 0x6275727067656172 with splitmix64, rather than with
+// the system random functions.
+const uint64_t gear_table[256]={
+	0x20217CCB1E620BDCULL, 0x4D47C74F0297310FULL,
+	0x50C5CCDD6C0D25F6ULL, 0xB322F3940791E348ULL,
+	0x95363610A01FB196ULL, 0xBC31B032F12EED75ULL,
+	0xC20E91010E65E09BULL, 0xA3D80ED2D3DFBB40ULL,
+	0xC1F5757442C13CC9ULL, 0xA694240F71AE42F1ULL,
+	0x79F101235F4FD717ULL, 0xF68FCF613E9CFC0DULL,
+	0x37CE965ED757F23FULL, 0x932A7B05A1DF1100ULL,
+	0xE2B94255C4E07F31ULL, 0x0FE55766AD81EF8EULL,
+	0x1CF86E4CBD99D1DAULL, 0xA53BBD4A75623F0DULL,
+	0x3D847A774083DCDBULL, 0xACEDDF5E6CD28132ULL,
+	0xDF0CD9CAED017E51ULL, 0x389233551653C94BULL,
+	0xF3667CEE53507689ULL, 0xF67994A537C6DB72ULL,
+	0xA46C1D96BCCC1938ULL, 0x555FACC3E1733DE3ULL,
+	0x7C864D50DBE385FEULL, 0x12DF026146846AFEULL,
+	0x9EC4AE3C692C5CEBULL, 0xC4FC59B520EF30B4ULL,
+	0x83E9277F4D6927FCULL, 0x96928C646D53A9ABULL,
+	0x875548A0400FC9A7ULL, 0xFBD1ECCDA2DAF239ULL,
+	0xB8BFB9A4F18DF4E2ULL, 0xDD215F65E79F2507ULL,
+	0x8024EB7648F48FD1ULL, 0x28360456438F2103ULL,
+	0x0266ACE2A81D0C68ULL, 0xDC4DECF53599525EULL,
+	0x4C25BAF6E5038476ULL, 0x33768478AC0738C1ULL,
+	0x02D65370A491D8B1ULL, 0xACB4A6BFFA456654ULL,
+	0x4B82D8A350AF48C4ULL, 0x97D4B280F92C3C53ULL,
+	0x079FBEB9742584F1ULL, 0x3C3E744110F3C8DDULL,
+	0x559DEACC4D91B849ULL, 0x0445AD5C7C76A388ULL,
+	0xCAF0E83C78B6BAE2ULL, 0xB3F8F244FFEA474FULL,
+	0x0AC4B2F615EB7F60ULL, 0x06019348DB698005ULL,
+	0x9032E8E5B9948A91ULL, 0xFCFF661B2C3B8D7CULL,
+	0x2A392249DC636704ULL, 0xA6EE3D8EB09C0363ULL,
+	0xEFD4A411EDA2B4B1ULL, 0xD2D8D7DD39C6AFA8ULL,
+	0xA4F79D8680F25767ULL, 0x0048BD975372C920ULL,
+	0xEC307D3D882084EFULL, 0xFD14ACBD77C83187ULL,
+	0xFE37765E8C84171DULL, 0xB224A1A7656F7485ULL,
+	0x7127EE4203B15282ULL, 0x98468995F601B3B7ULL,
+	0xE0B8577C20750AD9ULL, 0xE1FCC340A67FE0A0ULL,
+	0x61FEAE948B84933AULL, 0x89D8481C282D2CC1ULL,
+	0x891D971C5404CC67ULL, 0x34E1FE6F1D8AED6BULL,
+	0x2B97C304DFE9C0ACULL, 0xA1C8BA8225E8D517ULL,
+	0x9C019CF4782F27F8ULL, 0xA6219049468AFB51ULL,
+	0x38A225A11BA4CDFCULL, 0x051CA98A76DF3709ULL,
+	0x37243F52DA4BEBAEULL, 0x66A919F078876D7EULL,
+	0x803D0435587492B5ULL, 0xBB5A246AD06D5AA1ULL,
+	0x728C6989441CAAD4ULL, 0x4A2F92AF26768728ULL,
+	0x84A05DB43801D928ULL, 0x15BEED625D8346D9ULL,
+	0x89BF546BBC24A0E4ULL, 0x016B5EC0BB67BB8AULL,
+	0xAFF94EDD5A32B36FULL, 0xCA5E381B9228D610ULL,
+	0x201F720D1F72B64CULL, 0x3A13B753F24812A5ULL,
+	0x90E60856DF203775ULL, 0x0A241738E3F0B100ULL,
+	0xD4BB786A7447952AULL, 0xDDAF444261239FA5ULL,
+	0x2016EDB896BE9B74ULL, 0xDB6E4C02345936BFULL,
+	0x2D55C847D8AE7B49ULL, 0x6E95968FB7C76785ULL,
+	0x02DBE35BA216ED8CULL, 0xDB56E7DA32909793ULL,
+	0x73B70F81F6466958ULL, 0xEFE1E4E4ACDEE969ULL,
+	0x896C4DA3FEC9D5A7ULL, 0xA07A7713F9B00208ULL,
+	0xF95AEFEA94D76C6AULL, 0x42D1C8ED8F306929ULL,
+	0xC2E8CE4F2EBDF79FULL, 0x7D015DDB02918F6DULL,
+	0x22D854E48287774EULL, 0xCAF390A4DB7FAFB6ULL,
+	0xAB1A98D2F734AA01ULL, 0x105A7F643AEA5834ULL,
+	0xCF9CC591A4927E55ULL, 0xBEF54091C6584E7DULL,
+	0x9BBD52BE0D9D3718ULL, 0x6EEE795A07452E5DULL,
+	0x19CC1142B1EEC216ULL, 0x8B13B736D01FB0C4ULL,
+	0x6ED111008A44E50CULL, 0xBA5D8100826A9855ULL,
+	0xC7675B7E94F8677EULL, 0x868817D9F5878431ULL,
+	0x3CC5CF216DFFBC76ULL, 0x5A21C62D97C05A50ULL,
+	0x3ED2F4B21F670CBEULL, 0xC27F5D24C11F6409ULL,
+	0xE59939AC4E55D35EULL, 0xBF059A08E29EC8D4ULL,
+	0x0F8544602ABFBF64ULL, 0x188CEB1BECF8068BULL,
+	0x04DB4C2A87B3B734ULL, 0xD01A3417FB6462AEULL,
+	0x2C2CE86EB5AB6449ULL, 0xA94251D11847C664ULL,
+	0x05EE87F371212297ULL, 0x23D645411AD6DCDFULL,
+	0x2659B350F85742FBULL, 0xBCDB7F598B94BA4CULL,
+	0xA6DC458BD3CACBA3ULL, 0x3A0AD0539645EBFBULL,
+	0x5536545962E82EB0ULL, 0x19B4F9F41C7B3D7DULL,
+	0x6F22DCECD2604340ULL, 0x11E3B1803A7AFA34ULL,
+	0x7E62EE11A2714963ULL, 0xA10D8D30EA0F2E04ULL,
+	0x0BBED87A63EE39E7ULL, 0x425B99DFECD7BB5EULL,
+	0x48F0413C17B2268FULL, 0x1C9E9AF35120C879ULL,
+	0x311F0AF09BD92111ULL, 0xF302672C91EC2B1AULL,
+	0x7BA7DDC690299906ULL, 0x704944A44C9E6204ULL,
+	0xAA571BCD1ACBB6B9ULL, 0xAB2587549AE740AFULL,
+	0xF1A1208D74C04F77ULL, 0x78E756A4A78EEC6FULL,
+	0xD9CFF624EDCC6878ULL, 0xB28CEF9F779D8BC8ULL,
+	0xB3064B895BB688EEULL, 0x414A843CEB890A8FULL,
+	0xF4F21E8EB8ABCA0AULL, 0x07339DAC5B7A9865ULL,
+	0xF76BEF540124568FULL, 0x8EF76ADBD4ECF57FULL,
+	0x4CE769D23ADDBC48ULL, 0x6180A4D83468208FULL,
+	0xC10834074CDBE603ULL, 0xACFD55087C44833FULL,
+	0x4027F110C267A947ULL, 0x8840FC51BB9654E3ULL,
+	0x7D607C7B5DABB647ULL, 0x3E45C3A14D4665DEULL,
+	0x83BAF16C70836821ULL, 0x2C23E37753B47B4FULL,
+	0x5CBD403C8FB69EEEULL, 0xDE9ABB4EB7A7E3B2ULL,
+	0xA0A54B2731346F18ULL, 0xE6454B136C5EACEAULL,
+	0x0BAD1B60C3F3F809ULL, 0x8D12179D78EB49F3ULL,
+	0xCDDF1BC0B1AF74CBULL, 0x497C3E00F52B40ECULL,
+	0x4BFB226E574DD85BULL, 0xC19D0E0E9E133BE4ULL,
+	0x65CF48D0FEEA3348ULL, 0xDFBA5692F9108415ULL,
+	0x4C3C404A1BE7424DULL, 0xAEF6D343E2DCE894ULL,
+	0x64301CE34AD141B8ULL, 0x593979C5A1E0555CULL,
+	0x024F8F229CD6F956ULL, 0x6873EEE420C526EDULL,
+	0xE5750169EDB772EDULL, 0xCE18AE429DC1084FULL,
+	0x2A2B36D72BA6E94FULL, 0xDBA732479CFCD5FCULL,
+	0xA6EF546500C09100ULL, 0x22EFF205082FD1E2ULL,
+	0x13D84A88148E9B1BULL, 0xDA8C2065D01D4AE8ULL,
+	0x01D7D6FF25442E8EULL, 0xB2868ACE31E562ACULL,
+	0x188C99174F9E01FAULL, 0xB5B283FB3CB73A20ULL,
+	0xBC0E7FB1D1924939ULL, 0xB8981D83E708099EULL,
+	0xCECF99A2D18B3582ULL, 0x1A9F57FE3ABD972AULL,
+	0x515641C42696C5ACULL, 0x1C4B8C49D12649F3ULL,
+	0xCAFDBEC9DC56A1BDULL, 0x0CD825BDBE831D4BULL,
+	0x8A6D6CD35251E133ULL, 0x98870439CCD9D277ULL,
+	0xD4734CA6DD8D94B1ULL, 0x4D246AF8C3B929CFULL,
+	0xEEAC8983110DC116ULL, 0x4E00B954579D04C0ULL,
+	0x8BD50A76CE9EA73DULL, 0xCF582699A5101B27ULL,
+	0x23C88B1A7E611BF0ULL, 0xF10FCC699CBADB03ULL,
+	0x826F92D6EE1E9F32ULL, 0xE72A107D740327C9ULL,
+	0xFA3F68B89BD40B87ULL, 0x47877DFE11397EF6ULL,
+	0x08E165A6DEFC65B2ULL, 0xDC9DDA0FC3FB3855ULL,
+	0xF8F69F9F49EA0CA3ULL, 0xB530A535D16D7C63ULL,
+	0xB3016703F66FE7D7ULL, 0xEEF9126C98138986ULL,
+	0x1948525193AB894BULL, 0x818AE4F9A66DEF5FULL,
+	0xF423D050509BD290ULL, 0x94100278457C1A73ULL,
+	0x9756792DAA31C8A6ULL, 0x62152D05D4C903A6ULL,
+	0xEA3BD2533C0D6901ULL, 0xC223988201E9F4E3ULL,
+	0x7934AD622FF94BC7ULL, 0xD94D3088479B8BA3ULL,
+	0x9D4BD7634657C183ULL, 0x7E653FE042720EEEULL,
+	0x953A7A205A126A7DULL, 0x37129F24B55BBA53ULL,
+	0xA8ADE3E9FBFE65CAULL, 0x36C9869582640974ULL,
+	0xA4C2C05185B8AB9DULL, 0x92E1E9E9011705E8ULL,
+};
@@ -0,0 +1,8 @@
+#ifndef __RABIN_GEAR_H
+#define __RABIN_GEAR_H
+
+#include "../../burp.h"
+
+extern const uint64_t gear_table[256];
+
+#endif
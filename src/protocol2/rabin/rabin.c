@@ -1,5 +1,6 @@
 #include "../../burp.h"
 #include "rabin.h"
+#include "gear.h"
 #include "rconf.h"
 #include "win.h"
 #include "../../alloc.h"
@@ -8,126 +9,282 @@
 #include "../../sbuf.h"
 #include "../../client/protocol2/rabin_read.h"
 
-static struct blk *blk=NULL;
-static char *gcp=NULL;
-static char *gbuf=NULL;
-static char *gbuf_end=NULL;
-static struct rconf rconf;
-static struct win *win=NULL; // Rabin sliding window.
-static int first=0;
+// Read this many blocks worth of file at a time, so that there is not a
+// read() for every block.
+#define GBUF_BLKS	8
 
-int blks_generate_init(void)
+// Looks for a block boundary between *cp and end. Returns 1 with *cp just
+// past the boundary if one was found, otherwise returns 0 with *cp at end.
+// 'length' is how much of the block has been seen before *cp.
+typedef int (*scan_func_t)(struct blks_gen *gen,
+	char **cp, char *end, uint32_t length);
+
+// Everything needed to split one file at a time into blocks. There is no
+// shared state in here, so separate threads can each have their own.
+struct blks_gen
 {
-	rconf_init(&rconf);
-	if(!(win=win_alloc(&rconf))
-	  || !(gbuf=(char *)malloc_w(rconf.blk_max, __func__)))
-		return -1;
-	gbuf_end=gbuf;
-	gcp=gbuf;
-	return 0;
+	struct blk *blk;
+	char *gcp;
+	char *gbuf;
+	char *gbuf_end;
+	size_t gbuf_len;
+	struct rconf rconf;
+	struct win *win; // Rabin sliding window.
+	scan_func_t scan;
+};
+
+// The one used by the blks_generate() interface.
+static struct blks_gen *gen=NULL;
+
+static int scan_rabin(struct blks_gen *g,
+	char **cp, char *end, uint32_t length);
+static int scan_gear(struct blks_gen *g,
+	char **cp, char *end, uint32_t length);
+
+static scan_func_t engine_to_scan(enum rconf_engine engine)
+{
+	switch(engine)
+	{
+		case RCONF_ENGINE_GEAR: return scan_gear;
+		case RCONF_ENGINE_RABIN:
+		default: return scan_rabin;
+	}
 }
 
-void blks_generate_free(void)
+struct blks_gen *blks_gen_alloc(void)
 {
-	free_w(&gbuf);
-	blk_free(&blk);
-	win_free(&win);
+	struct blks_gen *g;
+	if(!(g=(struct blks_gen *)calloc_w(1, sizeof(struct blks_gen),
+		__func__)))
+			return NULL;
+	rconf_init(&g->rconf);
+	g->scan=engine_to_scan(g->rconf.engine);
+	g->gbuf_len=g->rconf.blk_max*GBUF_BLKS;
+	if(!(g->win=win_alloc(&g->rconf))
+	  || !(g->gbuf=(char *)malloc_w(g->gbuf_len, __func__)))
+	{
+		blks_gen_free(&g);
+		return NULL;
+	}
+	g->gbuf_end=g->gbuf;
+	g->gcp=g->gbuf;
+	return g;
 }
 
-// This is where the magic happens.
-// Return 1 for got a block, 0 for no block got.
-static int blk_read(void)
+void blks_gen_free(struct blks_gen **g)
+{
+	if(!g || !*g) return;
+	free_w(&(*g)->gbuf);
+	blk_free(&(*g)->blk);
+	win_free(&(*g)->win);
+	free_v((void **)g);
+}
+
+int blks_gen_set_engine(struct blks_gen *g, const char *engine)
+{
+	if(rconf_set_engine(&g->rconf, engine))
+		return -1;
+	g->scan=engine_to_scan(g->rconf.engine);
+	return 0;
+}
+
+static int scan_rabin(struct blks_gen *g,
+	char **cp, char *end, uint32_t length)
 {
+	char *p=*cp;
 	unsigned char c;
+	struct win *win=g->win;
+	struct rconf *rconf=&g->rconf;
+	uint64_t checksum=win->checksum;
+
+	// The checksum only covers the last win_size bytes, and the window is
+	// reset at the start of each block, so nothing before
+	// blk_min-win_size can affect where the block ends.
+	if(length+rconf->win_size<rconf->blk_min)
+	{
+		size_t skip=rconf->blk_min-rconf->win_size-length;
+		if((size_t)(end-p)<=skip)
+		{
+			*cp=end;
+			return 0;
+		}
+		p+=skip;
+		length+=skip;
+	}
 
-	for(; gcp<gbuf_end; gcp++)
+	for(; p<end; p++)
 	{
-		c=(unsigned char)*gcp;
+		c=(unsigned char)*p;
 
-		blk->fingerprint = (blk->fingerprint * rconf.prime) + c;
-		win->checksum    = (win->checksum    * rconf.prime) + c
-				   - (win->data[win->pos] * rconf.multiplier);
+		checksum = (checksum * rconf->prime) + c
+			   - (win->data[win->pos] * rconf->multiplier);
 		win->data[win->pos] = c;
 
 		win->pos++;
-		if(blk->data)
-			blk->data[blk->length] = c;
-		blk->length++;
-
-		if(win->pos == rconf.win_size)
+		if(win->pos == rconf->win_size)
 			win->pos=0;
 
-		if( blk->length >= rconf.blk_min
-		 && (blk->length == rconf.blk_max
-		  || (win->checksum % rconf.blk_avg) == rconf.prime))
+		length++;
+		if( length >= rconf->blk_min
+		 && (length == rconf->blk_max
+		  || (checksum % rconf->blk_avg) == rconf->prime))
 		{
-			gcp++;
+			win->checksum=checksum;
+			*cp=p+1;
 			return 1;
 		}
 	}
+	win->checksum=checksum;
+	*cp=end;
 	return 0;
 }
 
-static void win_reset(void)
-{
-	win->checksum=0;
-	win->pos=0;
-	memset(win->data, 0, rconf.win_size);
-}
-
-static int blk_read_to_list(struct sbuf *sb, struct blist *blist)
+static int scan_gear(struct blks_gen *g,
+	char **cp, char *end, uint32_t length)
 {
-	if(!blk_read()) return 0;
+	char *p=*cp;
+	struct rconf *rconf=&g->rconf;
+	uint64_t hash=g->win->checksum;
 
-	win_reset();
+	// Each byte is shifted out of the top of the hash after 64 more
+	// bytes, so everything before blk_min-64 can be skipped.
+	if(length+64<rconf->blk_min)
+	{
+		size_t skip=rconf->blk_min-64-length;
+		if((size_t)(end-p)<=skip)
+		{
+			*cp=end;
+			return 0;
+		}
+		p+=skip;
+		length+=skip;
+	}
 
-	// Got something.
-	if(first)
+	// Up to blk_min, there is no need to test for a boundary.
+	if(length+1<rconf->blk_min)
 	{
-		sb->protocol2->bstart=blk;
-		first=0;
+		char *stop=end;
+		if((size_t)(end-p)>rconf->blk_min-1-length)
+			stop=p+(rconf->blk_min-1-length);
+		length+=stop-p;
+		for(; p<stop; p++)
+			hash=(hash<<1)+gear_table[(unsigned char)*p];
 	}
-	if(!sb->protocol2->bsighead)
+
+	for(; p<end; p++)
 	{
-		sb->protocol2->bsighead=blk;
+		hash=(hash<<1)+gear_table[(unsigned char)*p];
+		length++;
+		if(length >= rconf->blk_min
+		 && (length == rconf->blk_max
+		  || !(hash & rconf->gear_mask)))
+		{
+			g->win->checksum=hash;
+			*cp=p+1;
+			return 1;
+		}
 	}
-	blist_add_blk(blist, blk);
-	blk=NULL;
-	return 1;
+	g->win->checksum=hash;
+	*cp=end;
+	return 0;
 }
 
-// The client uses this.
-// Return 0 for OK. 1 for OK, and file ended, -1 for error.
-int blks_generate(struct sbuf *sb, struct blist *blist, int just_opened)
+static uint64_t fingerprint_update(struct rconf *rconf, uint64_t fingerprint,
+	const char *data, size_t len)
+{
+	const unsigned char *p=(const unsigned char *)data;
+	const unsigned char *end=p+len;
+	uint64_t p1=rconf->prime;
+	uint64_t p2=p1*p1;
+	uint64_t p3=p2*p1;
+	uint64_t p4=p3*p1;
+
+	// Four bytes at a time, so that the multiplies do not all have to
+	// wait for each other.
+	for(; p+4<=end; p+=4)
+		fingerprint = fingerprint * p4
+			+ p[0] * p3 + p[1] * p2 + p[2] * p1 + p[3];
+	for(; p<end; p++)
+		fingerprint=(fingerprint * p1) + *p;
+	return fingerprint;
+}
+
+// This is where the magic happens.
+// Return 1 for got a block, 0 for no block got.
+static int blk_read(struct blks_gen *g)
+{
+	int got;
+	char *start=g->gcp;
+	char *end=g->gbuf_end;
+	struct blk *blk=g->blk;
+	size_t len;
+
+	// Never let a block grow past blk_max.
+	if((size_t)(end-g->gcp) > g->rconf.blk_max-blk->length)
+		end=g->gcp+(g->rconf.blk_max-blk->length);
+
+	got=g->scan(g, &g->gcp, end, blk->length);
+
+	// Now that it is known where the block ends, copy and fingerprint the
+	// bytes that belong to it in one go.
+	len=g->gcp-start;
+	if(blk->data)
+		memcpy(blk->data+blk->length, start, len);
+	blk->fingerprint=fingerprint_update(&g->rconf,
+		blk->fingerprint, start, len);
+	blk->length+=len;
+
+	return got;
+}
+
+static void win_reset(struct blks_gen *g)
+{
+	g->win->checksum=0;
+	g->win->pos=0;
+	memset(g->win->data, 0, g->rconf.win_size);
+}
+
+static struct blk *blk_take(struct blks_gen *g)
 {
-	static ssize_t bytes;
-	first=just_opened;
+	struct blk *blk=g->blk;
+	g->blk=NULL;
+	win_reset(g);
+	return blk;
+}
 
-	if(!blk && !(blk=blk_alloc_with_data(rconf.blk_max)))
+// Returns 0 with the next block of the file in *blk_out. Returns 1 when
+// the file has ended, with any block left over in *blk_out. Returns -1 for
+// error.
+int blks_gen_next(struct blks_gen *g, struct sbuf *sb, int just_opened,
+	struct blk **blk_out)
+{
+	ssize_t bytes;
+
+	*blk_out=NULL;
+	if(!g->blk && !(g->blk=blk_alloc_with_data(g->rconf.blk_max)))
 		return -1;
 
-	if(first)
-		win_reset();
+	if(just_opened)
+		win_reset(g);
 
-	if(gcp<gbuf_end)
-	{
-		// Could have got a fill before buf ran out -
-		// need to resume from the same place in that case.
-		if(blk_read_to_list(sb, blist))
-			return 0; // Got a block.
-		// Did not get a block. Carry on and read more.
-	}
-	while((bytes=rabin_read(sb, gbuf, rconf.blk_max)))
+	// Could have got a fill before buf ran out - need to resume from
+	// the same place in that case.
+	while(g->gcp<g->gbuf_end
+	  || (bytes=rabin_read(sb, g->gbuf, g->gbuf_len))>0)
 	{
-		gcp=gbuf;
-		gbuf_end=gbuf+bytes;
-		sb->protocol2->bytes_read+=bytes;
-		if(blk_read_to_list(sb, blist))
-			return 0; // Got a block
-		// Did not get a block. Maybe should try again?
-		// If there are async timeouts, look at this!
-		return 0;
+		if(g->gcp>=g->gbuf_end)
+		{
+			g->gcp=g->gbuf;
+			g->gbuf_end=g->gbuf+bytes;
+			sb->protocol2->bytes_read+=bytes;
+		}
+		if(blk_read(g))
+		{
+			*blk_out=blk_take(g);
+			return 0;
+		}
 	}
+	if(bytes<0) return -1;
 
 	// Getting here means there is no more to read from the file.
 	// Make sure to deal with anything left over.
@@ -136,59 +293,92 @@ int blks_generate(struct sbuf *sb, struct blist *blist, int just_opened)
 	{
 		// Empty file, set up an empty block so that the server
 		// can skip over it.
-		free_w(&blk->data);
+		free_w(&g->blk->data);
+		*blk_out=blk_take(g);
+	}
+	else if(g->blk->length)
+		*blk_out=blk_take(g);
+	return 1;
+}
+
+int blks_generate_init(void)
+{
+	if(!(gen=blks_gen_alloc()))
+		return -1;
+	return 0;
+}
+
+int blks_generate_set_engine(const char *engine)
+{
+	return blks_gen_set_engine(gen, engine);
+}
+
+void blks_generate_free(void)
+{
+	blks_gen_free(&gen);
+}
+
+static void add_to_list(struct sbuf *sb, struct blist *blist,
+	struct blk *blk, int *first)
+{
+	if(*first)
+	{
 		sb->protocol2->bstart=blk;
+		*first=0;
+	}
+	if(!sb->protocol2->bsighead)
+	{
 		sb->protocol2->bsighead=blk;
-		blist_add_blk(blist, blk);
-		blk=NULL;
 	}
-	else if(blk)
+	blist_add_blk(blist, blk);
+}
+
+// The client uses this.
+// Return 0 for OK. 1 for OK, and file ended, -1 for error.
+int blks_generate(struct sbuf *sb, struct blist *blist, int just_opened)
+{
+	int ret;
+	struct blk *blk=NULL;
+
+	if((ret=blks_gen_next(gen, sb, just_opened, &blk))<0)
+		return -1;
+	if(blk)
 	{
-		if(blk->length)
+		if(blk_md5_update(blk))
 		{
-			if(first)
-			{
-				sb->protocol2->bstart=blk;
-				first=0;
-			}
-			if(!sb->protocol2->bsighead)
-			{
-				sb->protocol2->bsighead=blk;
-			}
-			blist_add_blk(blist, blk);
+			blk_free(&blk);
+			return -1;
 		}
-		else blk_free(&blk);
-		blk=NULL;
+		add_to_list(sb, blist, blk, &just_opened);
 	}
-	if(blist->tail) sb->protocol2->bend=blist->tail;
-	return 1;
+	if(ret==1 && blist->tail)
+		sb->protocol2->bend=blist->tail;
+	return ret;
 }
 
+// The server does not know which engine the client used, so the block is
+// accepted if the fingerprint matches and any engine would have ended the
+// block exactly at the end of the data.
 int blk_verify_fingerprint(uint64_t fingerprint, char *data, size_t length)
 {
-	win_reset();
-
-	memcpy(gbuf, data, length);
-	gbuf_end=gbuf+length;
-	gcp=gbuf;
-	blk_free(&blk);
-	if(!blk && !(blk=blk_alloc())) return -1;
-	blk->length=0;
-	blk->fingerprint=0;
-
-	// FIX THIS: blk_read should return 1 when it has a block.
-	// But, if the block is too small (because the end of the file
-	// happened), it returns 0, and blks_generate treats it as having found
-	// a final block.
-	// So, here the return of blk_read is ignored and we look at the
-	// position of gcp instead.
-	blk_read();
-//printf("%d %d\n", blk->length, length);
-//printf("%016"PRIX64" %016"PRIX64" ",
-//	blk->fingerprint, fingerprint);
-//printf("%s\n", blk->fingerprint==fingerprint?"yes":"no");
-	if(gcp==gbuf_end
-	  && blk->fingerprint==fingerprint)
-		return 1;
+	char *cp;
+	char *end=data+length;
+	enum rconf_engine engines[]={RCONF_ENGINE_RABIN, RCONF_ENGINE_GEAR};
+	size_t e;
+
+	if(length>gen->rconf.blk_max
+	  || fingerprint_update(&gen->rconf, 0, data, length)!=fingerprint)
+		return 0;
+
+	for(e=0; e<sizeof(engines)/sizeof(engines[0]); e++)
+	{
+		win_reset(gen);
+		cp=data;
+		// Ending on a boundary exactly at the end is fine, as is
+		// reaching the end without finding one, because the end of
+		// the file also ends a block.
+		engine_to_scan(engines[e])(gen, &cp, end, 0);
+		if(cp==end) return 1;
+	}
 	return 0;
 }
@@ -3,10 +3,19 @@
 
 struct asfd;
 struct blist;
+struct blk;
+struct blks_gen;
 struct conf;
 struct sbuf;
 
+extern struct blks_gen *blks_gen_alloc(void);
+extern void blks_gen_free(struct blks_gen **g);
+extern int blks_gen_set_engine(struct blks_gen *g, const char *engine);
+extern int blks_gen_next(struct blks_gen *g, struct sbuf *sb,
+	int just_opened, struct blk **blk_out);
+
 extern int blks_generate_init(void);
+extern int blks_generate_set_engine(const char *engine);
 extern void blks_generate_free(void);
 extern int blks_generate(struct sbuf *sb, struct blist *blist,
 	int just_opened);
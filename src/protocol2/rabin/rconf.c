@@ -12,9 +12,23 @@ static uint64_t get_multiplier(uint32_t win, uint64_t prime)
 	return multiplier;
 }
 
+// Use the top bits of the gear hash, because they are the ones that depend
+// on the most input bytes. The number of bits sets the average distance
+// between boundaries once the minimum block size has been passed.
+static uint64_t get_gear_mask(uint32_t blk_avg)
+{
+	int bits=0;
+
+	while((1U<<(bits+1)) <= blk_avg) bits++;
+
+	return ((1ULL<<bits)-1)<<(64-bits);
+}
+
 // Hey you. Probably best not fuck with these.
 void rconf_init(struct rconf *rconf)
 {
+	rconf->engine=RCONF_ENGINE_RABIN;
+
 	rconf->prime=3;		// Not configurable.
 
 	rconf->win_min=17;	// Not configurable.
@@ -26,4 +40,30 @@ void rconf_init(struct rconf *rconf)
 	rconf->blk_max=RABIN_MAX; // Maximum block size.
 
 	rconf->multiplier=get_multiplier(rconf->win_size, rconf->prime);
+
+	rconf->gear_mask=get_gear_mask(rconf->blk_avg);
+}
+
+int rconf_set_engine(struct rconf *rconf, const char *engine)
+{
+	if(!engine || !strcmp(engine, "rabin"))
+		rconf->engine=RCONF_ENGINE_RABIN;
+	else if(!strcmp(engine, "gear"))
+		rconf->engine=RCONF_ENGINE_GEAR;
+	else
+	{
+		logp("Unknown chunker setting: %s\n", engine);
+		return -1;
+	}
+	return 0;
+}
+
+const char *rconf_engine_to_str(enum rconf_engine engine)
+{
+	switch(engine)
+	{
+		case RCONF_ENGINE_RABIN: return "rabin";
+		case RCONF_ENGINE_GEAR: return "gear";
+		default: return "unknown";
+	}
 }
@@ -7,8 +7,19 @@
 
 #include "../../burp.h"
 
+// How block boundaries are found. The fingerprint that goes in the
+// signatures is the same whichever engine is used, so the server does not
+// need to know which one the client picked.
+enum rconf_engine
+{
+	RCONF_ENGINE_RABIN=0,	// Rolling checksum over a sliding window.
+	RCONF_ENGINE_GEAR	// Table driven, FastCDC style.
+};
+
 struct rconf
 {
+	enum rconf_engine engine;
+
 	uint64_t prime;
 
 	uint32_t win_min;
@@ -20,9 +31,13 @@ struct rconf
 	uint32_t blk_max;
 
 	uint64_t multiplier;
+
+	uint64_t gear_mask;
 };
 
 extern void rconf_init(struct rconf *rconf);
 extern int rconf_check(struct rconf *rconf);
+extern int rconf_set_engine(struct rconf *rconf, const char *engine);
+extern const char *rconf_engine_to_str(enum rconf_engine engine);
 
 #endif
@@ -36,3 +36,43 @@ void regex_free(regex_t **regex)
         regfree(*regex);
 	free_v((void **)regex);
 }
+
+// Returns the text that anything matching the regular expression has to
+// start with, or NULL if that is not known.
+char *regex_literal_prefix(const char *str)
+{
+#ifdef HAVE_WIN32
+	// Windows matches without case, so there is no such text.
+	(void)str;
+	return NULL;
+#else
+	size_t len=0;
+	const char *cp;
+	char *prefix=NULL;
+
+	if(!str || *str!='^' || strchr(str, '|')
+	  || !(prefix=strdup_w(str+1, __func__)))
+		return NULL;
+	for(cp=str+1; *cp; cp++)
+	{
+		if(*cp=='\\')
+		{
+			// Escaped punctuation stands for itself.
+			if(!cp[1] || isalnum((unsigned char)cp[1]))
+				break;
+			cp++;
+		}
+		else if(strchr(".[]()*+?{}^$", *cp))
+			break;
+		// Characters that might be repeated zero times are not
+		// certain to be there.
+		if(cp[1]=='*' || cp[1]=='?' || cp[1]=='{')
+			break;
+		prefix[len++]=*cp;
+	}
+	prefix[len]='\0';
+	if(!len)
+		free_w(&prefix);
+	return prefix;
+#endif
+}
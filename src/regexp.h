@@ -10,5 +10,6 @@
 extern regex_t *regex_compile(const char *str);
 extern int regex_check(regex_t *regex, const char *buf);
 extern void regex_free(regex_t **regex);
+extern char *regex_literal_prefix(const char *str);
 
 #endif
@@ -35,10 +35,20 @@ struct sbuf *sbuf_alloc(enum protocol protocol)
 
 void sbuf_free_content(struct sbuf *sb)
 {
-	iobuf_free_content(&sb->path);
-	iobuf_free_content(&sb->attr);
-	iobuf_free_content(&sb->link);
-	iobuf_free_content(&sb->endfile);
+	if(sb->flags & SBUF_VIEW)
+	{
+		iobuf_init(&sb->path);
+		iobuf_init(&sb->attr);
+		iobuf_init(&sb->link);
+		iobuf_init(&sb->endfile);
+	}
+	else
+	{
+		iobuf_free_content(&sb->path);
+		iobuf_free_content(&sb->attr);
+		iobuf_free_content(&sb->link);
+		iobuf_free_content(&sb->endfile);
+	}
 	memset(&(sb->statp), 0, sizeof(sb->statp));
 	sb->compression=-1;
 	sb->winattr=0;
@@ -310,8 +320,8 @@ static enum parse_ret parse_cmd(struct sbuf *sb, struct asfd *asfd,
 static int sbuf_fill(struct sbuf *sb, struct asfd *asfd, struct fzp *fzp,
 	struct blk *blk, struct cntr *cntr)
 {
-	static struct iobuf *rbuf;
-	static struct iobuf localrbuf;
+	struct iobuf *rbuf;
+	struct iobuf localrbuf;
 	int ret=-1;
 
 	if(asfd) rbuf=asfd->rbuf;
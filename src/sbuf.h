@@ -31,6 +31,10 @@
 #define SBUF_RECV_DELTA			0x1000
 #define SBUF_CLIENT_RESTORE_HACK	0x2000
 
+// The iobufs point into memory owned by whatever filled the sbuf in, and
+// must not be freed.
+#define SBUF_VIEW			0x4000
+
 #define ENCRYPTION_UNSET	-1 // Also legacy
 #define ENCRYPTION_NONE		0
 #define ENCRYPTION_KEY_DERIVED	1
@@ -16,6 +16,9 @@
 #include "backup_phase3.h"
 #include "compress.h"
 #include "delete.h"
+#include "deleter.h"
+#include "durable.h"
+#include "pgzip.h"
 #include "sdirs.h"
 #include "protocol1/backup_phase2.h"
 #include "protocol1/backup_phase4.h"
@@ -167,6 +170,8 @@ static int do_backup_server(struct async *as, struct sdirs *sdirs,
 	logp("in do_backup_server\n");
 
 	log_rshash(cconfs);
+	durable_set_interval(get_int(cconfs[OPT_SYNC_INTERVAL]));
+	pgzip_set_threads(get_int(cconfs[OPT_COMPRESS_THREADS]));
 
 	if(resume)
 	{
@@ -224,6 +229,8 @@ static int do_backup_server(struct async *as, struct sdirs *sdirs,
 			logp("error in backup phase 2\n");
 			goto error;
 		}
+		if(durable_commit(1))
+			goto error;
 
 		asfd->write_str(asfd, CMD_GEN, "okbackupend");
 	}
@@ -241,6 +248,8 @@ static int do_backup_server(struct async *as, struct sdirs *sdirs,
 		logp("error in backup phase 3\n");
 		goto error;
 	}
+	if(durable_commit(1))
+		goto error;
 
 	if(do_rename(sdirs->working, sdirs->finishing))
 		goto error;
@@ -250,6 +259,8 @@ static int do_backup_server(struct async *as, struct sdirs *sdirs,
 		logp("error in backup phase 4\n");
 		goto error;
 	}
+	if(durable_commit(1))
+		goto error;
 
 	cntr_print(cntr, ACTION_BACKUP, asfd);
 	cntr_stats_to_file(cntr, sdirs->rworking, ACTION_BACKUP);
@@ -277,7 +288,7 @@ static int do_backup_server(struct async *as, struct sdirs *sdirs,
 error:
 	ret=-1;
 end:
-
+	durable_release();
 	log_fzp_set(NULL, cconfs);
 	return ret;
 }
@@ -287,6 +298,7 @@ int run_backup(struct async *as, struct sdirs *sdirs, struct conf **cconfs,
 {
 	int ret;
 	char okstr[32]="";
+	struct deleter *deleter=NULL;
 	struct asfd *asfd=as->asfd;
 	struct iobuf *rbuf=asfd->rbuf;
 	const char *cname=get_string(cconfs[OPT_CNAME]);
@@ -342,10 +354,17 @@ int run_backup(struct async *as, struct sdirs *sdirs, struct conf **cconfs,
 	if((ret=do_backup_server(as, sdirs, cconfs, incexc, resume)))
 		goto end;
 
+	if(!(deleter=deleter_alloc_from_conf(cconfs)))
+	{
+		ret=-1;
+		goto end;
+	}
 	if((ret=delete_backups(sdirs, cname,
 		get_strlist(cconfs[OPT_KEEP]),
-		get_string(cconfs[OPT_MANUAL_DELETE]))))
+		get_string(cconfs[OPT_MANUAL_DELETE]),
+		deleter)))
 			goto end;
 end:
+	deleter_free(&deleter);
 	return ret;
 }
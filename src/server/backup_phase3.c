@@ -46,6 +46,8 @@ int backup_phase3_server_all(struct sdirs *sdirs, struct conf **confs)
 	  || !(newmanio=manio_open_phase3(manifesttmp,
 		comp_level(get_int(confs[OPT_COMPRESSION])),
 		protocol, rmanifest_relative))
+	  || (protocol==PROTO_2
+		&& manio_reuse_chunks_from(newmanio, sdirs->cmanifest))
 	  || !(chmanio=manio_open_phase2(sdirs->changed, "rb", protocol))
 	  || !(unmanio=manio_open_phase2(sdirs->unchanged, "rb", protocol))
 	  || !(usb=sbuf_alloc(protocol))
@@ -0,0 +1,663 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../cmd.h"
+#include "../fsops.h"
+#include "../fzp.h"
+#include "../log.h"
+#include "../prepend.h"
+#include "../sbuf.h"
+#include "browse_tree.h"
+#include "durable.h"
+#include "manio.h"
+
+#include <sys/mman.h>
+
+// After the header come:
+//   the nodes, in manifest order, with the root first;
+//   the children of each node, as node numbers in uint32_t, with the
+//     children of a node next to each other;
+//   the names and link targets, each one nul terminated, and each one only
+//     stored once. The empty string is at the start.
+// Numbers are in the byte order of the machine that wrote it, and a tree
+// from another machine is ignored.
+
+#define BROWSE_TREE_FILE	"browse"
+#define BROWSE_TREE_MAGIC	"burpbrt1"
+#define BROWSE_TREE_MAGIC_LEN	8
+#define BROWSE_TREE_BYTE_ORDER	0x01020304
+
+struct browse_tree_header
+{
+	char magic[BROWSE_TREE_MAGIC_LEN];
+	uint32_t byte_order;
+	uint32_t reserved;
+	uint64_t nodes;
+	uint64_t kids;
+	uint64_t strings_len;
+};
+
+// Just the stat fields that the monitor gives out.
+struct browse_node
+{
+	uint64_t name;
+	uint64_t link;
+	uint32_t children;
+	uint32_t count;
+	uint32_t mode;
+	uint32_t nlink;
+	uint32_t uid;
+	uint32_t gid;
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t rdev;
+	int64_t size;
+	int64_t blksize;
+	int64_t blocks;
+	int64_t atime;
+	int64_t ctime;
+	int64_t mtime;
+};
+
+struct browse_tree
+{
+	char *map;
+	size_t size;
+	struct browse_tree_header header;
+	struct browse_node *nodes;
+	uint32_t *kids;
+	char *strings;
+};
+
+struct builder
+{
+	struct browse_tree_header header;
+	struct browse_node *nodes;
+	size_t nodes_alloc;
+	uint32_t *parents;
+	size_t parents_alloc;
+	char *strings;
+	size_t strings_alloc;
+	// Offsets of the strings, plus one, so that zero is an empty slot.
+	uint64_t *slots;
+	size_t slots_len;
+	size_t slots_used;
+	// The nodes on the way down to the last one added.
+	uint32_t *stack;
+	size_t stack_alloc;
+	size_t depth;
+	int rooted;
+};
+
+static int grow(void **buf, size_t *alloc, size_t want, size_t size)
+{
+	size_t len;
+	void *newbuf;
+	if(want<=*alloc)
+		return 0;
+	len=*alloc?*alloc:1024;
+	while(len<want) len*=2;
+	if(!(newbuf=realloc_w(*buf, len*size, __func__)))
+		return -1;
+	*buf=newbuf;
+	*alloc=len;
+	return 0;
+}
+
+static uint64_t hash_name(const char *name, size_t len)
+{
+	size_t i;
+	uint64_t hash=0xcbf29ce484222325ULL;
+	for(i=0; i<len; i++)
+	{
+		hash^=(uint8_t)name[i];
+		hash*=0x100000001b3ULL;
+	}
+	return hash;
+}
+
+// Returns the slot that the name is in, or the empty one that it would go
+// in.
+static size_t find_slot(struct builder *b, const char *name, size_t len)
+{
+	uint64_t o;
+	size_t mask=b->slots_len-1;
+	size_t i=hash_name(name, len)&mask;
+	while((o=b->slots[i]))
+	{
+		o--;
+		if(!strncmp(b->strings+o, name, len)
+		  && !b->strings[o+len])
+			break;
+		i=(i+1)&mask;
+	}
+	return i;
+}
+
+static int rehash(struct builder *b)
+{
+	size_t i;
+	size_t old_len=b->slots_len;
+	uint64_t o;
+	uint64_t *old=b->slots;
+	b->slots_len=old_len?old_len*2:1024;
+	if(!(b->slots=(uint64_t *)calloc_w(b->slots_len,
+		sizeof(uint64_t), __func__)))
+	{
+		b->slots=old;
+		b->slots_len=old_len;
+		return -1;
+	}
+	for(i=0; i<old_len; i++)
+	{
+		if(!(o=old[i]))
+			continue;
+		b->slots[find_slot(b, b->strings+o-1,
+			strlen(b->strings+o-1))]=o;
+	}
+	free_v((void **)&old);
+	return 0;
+}
+
+static int intern(struct builder *b, const char *name, size_t len,
+	uint64_t *offset)
+{
+	size_t i;
+	if(!len)
+	{
+		*offset=0;
+		return 0;
+	}
+	if((b->slots_used+1)*2>b->slots_len
+	  && rehash(b))
+		return -1;
+	i=find_slot(b, name, len);
+	if(b->slots[i])
+	{
+		*offset=b->slots[i]-1;
+		return 0;
+	}
+	if(grow((void **)&b->strings, &b->strings_alloc,
+		b->header.strings_len+len+1, 1))
+			return -1;
+	*offset=b->header.strings_len;
+	memcpy(b->strings+*offset, name, len);
+	b->strings[*offset+len]='\0';
+	b->header.strings_len+=len+1;
+	b->slots[i]=*offset+1;
+	b->slots_used++;
+	return 0;
+}
+
+static void node_set_stat(struct browse_node *node, struct stat *statp)
+{
+	node->mode=(uint32_t)statp->st_mode;
+	node->nlink=(uint32_t)statp->st_nlink;
+	node->uid=(uint32_t)statp->st_uid;
+	node->gid=(uint32_t)statp->st_gid;
+	node->dev=(uint64_t)statp->st_dev;
+	node->ino=(uint64_t)statp->st_ino;
+	node->rdev=(uint64_t)statp->st_rdev;
+	node->size=(int64_t)statp->st_size;
+	node->blksize=(int64_t)statp->st_blksize;
+	node->blocks=(int64_t)statp->st_blocks;
+	node->atime=(int64_t)statp->st_atime;
+	node->ctime=(int64_t)statp->st_ctime;
+	node->mtime=(int64_t)statp->st_mtime;
+}
+
+static int add_node(struct builder *b, uint32_t parent,
+	const char *name, size_t len, const char *link,
+	struct stat *statp, uint32_t *id)
+{
+	struct browse_node *node;
+	if(b->header.nodes>=UINT32_MAX)
+	{
+		logp("Too many entries for a browse tree\n");
+		return -1;
+	}
+	if(grow((void **)&b->nodes, &b->nodes_alloc,
+		b->header.nodes+1, sizeof(struct browse_node))
+	  || grow((void **)&b->parents, &b->parents_alloc,
+		b->header.nodes+1, sizeof(uint32_t)))
+			return -1;
+	*id=(uint32_t)b->header.nodes;
+	node=&b->nodes[*id];
+	memset(node, 0, sizeof(struct browse_node));
+	if(intern(b, name, len, &node->name)
+	  || intern(b, link, link?strlen(link):0, &node->link))
+		return -1;
+	if(statp)
+		node_set_stat(node, statp);
+	b->parents[*id]=parent;
+	if(*id)
+		b->nodes[parent].count++;
+	b->header.nodes++;
+	return 0;
+}
+
+static int namecmp(const char *a, const char *b, size_t blen)
+{
+	size_t i;
+	for(i=0; i<blen; i++)
+	{
+		if(!a[i])
+			return -1;
+		if(a[i]==b[i])
+			continue;
+		// Signed, to match the order of the manifest.
+		return (int8_t)a[i]<(int8_t)b[i]?-1:1;
+	}
+	return a[blen]?1:0;
+}
+
+static int add_path(struct builder *b, struct sbuf *sb)
+{
+	size_t len;
+	size_t level=0;
+	uint32_t id;
+	const char *tok;
+	const char *end=sb->path.buf+sb->path.len;
+	struct stat fake;
+	struct browse_node *last;
+
+	// Some messing around so that we can list '/'.
+	if(!b->rooted && *sb->path.buf=='/')
+	{
+		if(intern(b, "/", 1, &b->nodes[0].name))
+			return -1;
+		node_set_stat(&b->nodes[0], &sb->statp);
+		b->rooted=1;
+	}
+
+	for(tok=sb->path.buf; tok<end; tok+=len)
+	{
+		if(*tok=='/')
+		{
+			len=1;
+			continue;
+		}
+		for(len=0; tok+len<end && tok[len]!='/'; len++) { }
+
+		if(b->depth>level+1)
+		{
+			// The manifest is sorted, so anything already in the
+			// tree is on the way down to the last one added.
+			last=&b->nodes[b->stack[level+1]];
+			if(!namecmp(b->strings+last->name, tok, len))
+			{
+				level++;
+				continue;
+			}
+		}
+
+		if(tok+len==end)
+		{
+			if(add_node(b, b->stack[level], tok, len,
+				sb->link.buf, &sb->statp, &id))
+					return -1;
+		}
+		else
+		{
+			// There is an entry in a directory where the
+			// directory itself was not backed up.
+			// Make a fake entry for the directory, using the same
+			// stat data, but with the directory flag.
+			memcpy(&fake, &sb->statp, sizeof(fake));
+			fake.st_mode=(fake.st_mode&~S_IFMT)|S_IFDIR;
+			if(add_node(b, b->stack[level], tok, len,
+				NULL, &fake, &id))
+					return -1;
+		}
+		if(grow((void **)&b->stack, &b->stack_alloc,
+			level+2, sizeof(uint32_t)))
+				return -1;
+		b->stack[++level]=id;
+		b->depth=level+1;
+	}
+	return 0;
+}
+
+static void builder_free_content(struct builder *b)
+{
+	free_v((void **)&b->nodes);
+	free_v((void **)&b->parents);
+	free_w(&b->strings);
+	free_v((void **)&b->slots);
+	free_v((void **)&b->stack);
+}
+
+void browse_tree_free(struct browse_tree **tree)
+{
+	if(!tree || !*tree) return;
+	if((*tree)->map)
+		munmap((*tree)->map, (*tree)->size);
+	else
+	{
+		free_v((void **)&(*tree)->nodes);
+		free_v((void **)&(*tree)->kids);
+		free_w(&(*tree)->strings);
+	}
+	free_v((void **)tree);
+}
+
+// Put the children of each node next to each other, and hand over the
+// nodes and strings to the tree.
+static struct browse_tree *builder_to_tree(struct builder *b)
+{
+	uint64_t i;
+	uint32_t parent;
+	uint32_t start=0;
+	struct browse_node *node;
+	struct browse_tree *tree;
+
+	if(!(tree=(struct browse_tree *)
+		calloc_w(1, sizeof(struct browse_tree), __func__)))
+			return NULL;
+	b->header.kids=b->header.nodes-1;
+	if(b->header.kids
+	  && !(tree->kids=(uint32_t *)malloc_w(
+		b->header.kids*sizeof(uint32_t), __func__)))
+	{
+		browse_tree_free(&tree);
+		return NULL;
+	}
+	for(i=0; i<b->header.nodes; i++)
+	{
+		node=&b->nodes[i];
+		node->children=start;
+		start+=node->count;
+		node->count=0;
+	}
+	// The nodes are in manifest order, so this keeps the children of
+	// each node in manifest order too.
+	for(i=1; i<b->header.nodes; i++)
+	{
+		parent=b->parents[i];
+		node=&b->nodes[parent];
+		tree->kids[node->children+node->count++]=(uint32_t)i;
+	}
+
+	tree->header=b->header;
+	tree->nodes=b->nodes;
+	tree->strings=b->strings;
+	b->nodes=NULL;
+	b->strings=NULL;
+	return tree;
+}
+
+struct browse_tree *browse_tree_build(struct manio *manio)
+{
+	int ars;
+	uint32_t id;
+	struct sbuf *sb=NULL;
+	struct builder b;
+	struct browse_tree *tree=NULL;
+
+	memset(&b, 0, sizeof(b));
+	memcpy(b.header.magic, BROWSE_TREE_MAGIC, BROWSE_TREE_MAGIC_LEN);
+	b.header.byte_order=BROWSE_TREE_BYTE_ORDER;
+
+	if(!(sb=sbuf_alloc(manio->protocol))
+	  || grow((void **)&b.strings, &b.strings_alloc, 1, 1)
+	  || grow((void **)&b.stack, &b.stack_alloc, 1, sizeof(uint32_t)))
+		goto end;
+	b.strings[0]='\0';
+	b.header.strings_len=1;
+	if(add_node(&b, 0, "", 0, NULL, NULL, &id))
+		goto end;
+	b.stack[0]=id;
+	b.depth=1;
+
+	while(1)
+	{
+		sbuf_free_content(sb);
+		if((ars=manio_read(manio, sb)))
+		{
+			if(ars<0) goto end;
+			// ars==1 means it ended ok.
+			break;
+		}
+
+		if(manio->protocol==PROTO_2 && sb->endfile.buf)
+			continue;
+
+		if(sb->path.cmd!=CMD_DIRECTORY
+		  && sb->path.cmd!=CMD_FILE
+		  && sb->path.cmd!=CMD_ENC_FILE
+		  && sb->path.cmd!=CMD_EFS_FILE
+		  && sb->path.cmd!=CMD_SPECIAL
+		  && !cmd_is_link(sb->path.cmd))
+			continue;
+
+		if(add_path(&b, sb))
+			goto end;
+	}
+
+	tree=builder_to_tree(&b);
+end:
+	builder_free_content(&b);
+	sbuf_free(&sb);
+	return tree;
+}
+
+static int write_all(struct fzp *fzp, const void *buf, size_t len)
+{
+	if(len && fzp_write(fzp, buf, len)!=len)
+		return -1;
+	return 0;
+}
+
+static int write_tree(const char *path, struct browse_tree *tree)
+{
+	struct fzp *fzp=NULL;
+	if(!(fzp=fzp_open(path, "wb"))
+	  || write_all(fzp, &tree->header, sizeof(tree->header))
+	  || write_all(fzp, tree->nodes,
+		tree->header.nodes*sizeof(struct browse_node))
+	  || write_all(fzp, tree->kids,
+		tree->header.kids*sizeof(uint32_t))
+	  || write_all(fzp, tree->strings, tree->header.strings_len))
+		goto error;
+	return fzp_close(&fzp);
+error:
+	logp("Could not write %s\n", path);
+	fzp_close(&fzp);
+	return -1;
+}
+
+int browse_tree_write(const char *dir, enum protocol protocol)
+{
+	int ret=-1;
+	char *path=NULL;
+	char *tmp=NULL;
+	char *manifest=NULL;
+	struct manio *manio=NULL;
+	struct browse_tree *tree=NULL;
+
+	logp("Writing browse tree\n");
+
+	if(!(manifest=prepend_s(dir,
+		protocol==PROTO_1?"manifest.gz":"manifest"))
+	  || !(path=prepend_s(dir, BROWSE_TREE_FILE))
+	  || !(tmp=prepend(path, ".tmp"))
+	  || !(manio=manio_open(manifest, "rb", protocol)))
+		goto end;
+	manio->views=1;
+	if(!(tree=browse_tree_build(manio))
+	  || write_tree(tmp, tree)
+	  || do_rename(tmp, path)
+	  || durable_add_path(path))
+		goto end;
+	ret=0;
+end:
+	if(ret)
+	{
+		logp("Could not write browse tree in %s\n", dir);
+		if(tmp) unlink(tmp);
+	}
+	browse_tree_free(&tree);
+	manio_close(&manio);
+	free_w(&manifest);
+	free_w(&tmp);
+	free_w(&path);
+	return ret;
+}
+
+static int check_header(struct browse_tree *tree)
+{
+	size_t need;
+	const struct browse_tree_header *h=&tree->header;
+
+	if(memcmp(h->magic, BROWSE_TREE_MAGIC, BROWSE_TREE_MAGIC_LEN)
+	  || h->byte_order!=BROWSE_TREE_BYTE_ORDER)
+		return -1;
+	// Check each count before adding them up, so that nothing can
+	// overflow.
+	if(!h->nodes
+	  || h->nodes>UINT32_MAX
+	  || h->kids!=h->nodes-1
+	  || !h->strings_len
+	  || h->strings_len>tree->size)
+		return -1;
+	need=sizeof(struct browse_tree_header)
+		+h->nodes*sizeof(struct browse_node)
+		+h->kids*sizeof(uint32_t)
+		+h->strings_len;
+	if(need!=tree->size)
+		return -1;
+
+	tree->nodes=(struct browse_node *)(tree->map
+		+sizeof(struct browse_tree_header));
+	tree->kids=(uint32_t *)(tree->nodes+h->nodes);
+	tree->strings=(char *)(tree->kids+h->kids);
+
+	if(tree->strings[0]
+	  || tree->strings[h->strings_len-1])
+		return -1;
+	return 0;
+}
+
+struct browse_tree *browse_tree_open(const char *dir)
+{
+	int fd=-1;
+	char *path=NULL;
+	struct stat statp;
+	struct browse_tree *tree=NULL;
+
+	if(!(path=prepend_s(dir, BROWSE_TREE_FILE)))
+		goto error;
+	if((fd=open(path, O_RDONLY))<0)
+	{
+		if(errno!=ENOENT)
+			logp("Could not open %s: %s\n", path, strerror(errno));
+		goto error;
+	}
+	if(fstat(fd, &statp)
+	  || (size_t)statp.st_size<sizeof(struct browse_tree_header))
+		goto ignored;
+	if(!(tree=(struct browse_tree *)
+		calloc_w(1, sizeof(struct browse_tree), __func__)))
+			goto error;
+	tree->size=(size_t)statp.st_size;
+	tree->map=(char *)mmap(NULL, tree->size, PROT_READ, MAP_SHARED, fd, 0);
+	if(tree->map==MAP_FAILED)
+	{
+		tree->map=NULL;
+		logp("Could not mmap %s: %s\n", path, strerror(errno));
+		goto error;
+	}
+	close(fd);
+	fd=-1;
+	memcpy(&tree->header, tree->map, sizeof(tree->header));
+	if(check_header(tree))
+		goto ignored;
+	free_w(&path);
+	return tree;
+ignored:
+	logp("Ignoring unusable %s\n", path);
+error:
+	if(fd>=0) close(fd);
+	browse_tree_free(&tree);
+	free_w(&path);
+	return NULL;
+}
+
+static struct browse_node *get_node(struct browse_tree *tree, uint32_t node)
+{
+	struct browse_node *n;
+	if(node>=tree->header.nodes)
+		goto corrupt;
+	n=&tree->nodes[node];
+	if(n->name>=tree->header.strings_len
+	  || n->link>=tree->header.strings_len
+	  || (uint64_t)n->children+n->count>tree->header.kids)
+		goto corrupt;
+	return n;
+corrupt:
+	logp("Corrupt browse tree node %u\n", node);
+	return NULL;
+}
+
+int browse_tree_entry(struct browse_tree *tree, uint32_t node,
+	const char **name, const char **link, struct stat *statp)
+{
+	struct browse_node *n;
+	if(!(n=get_node(tree, node)))
+		return -1;
+	*name=tree->strings+n->name;
+	*link=tree->strings+n->link;
+	memset(statp, 0, sizeof(struct stat));
+	statp->st_mode=(mode_t)n->mode;
+	statp->st_nlink=(nlink_t)n->nlink;
+	statp->st_uid=(uid_t)n->uid;
+	statp->st_gid=(gid_t)n->gid;
+	statp->st_dev=(dev_t)n->dev;
+	statp->st_ino=(ino_t)n->ino;
+	statp->st_rdev=(dev_t)n->rdev;
+	statp->st_size=(off_t)n->size;
+	statp->st_blksize=(blksize_t)n->blksize;
+	statp->st_blocks=(blkcnt_t)n->blocks;
+	statp->st_atime=(time_t)n->atime;
+	statp->st_ctime=(time_t)n->ctime;
+	statp->st_mtime=(time_t)n->mtime;
+	return 0;
+}
+
+uint32_t browse_tree_children(struct browse_tree *tree, uint32_t node,
+	const uint32_t **kids)
+{
+	struct browse_node *n;
+	if(!(n=get_node(tree, node)))
+		return 0;
+	*kids=tree->kids+n->children;
+	return n->count;
+}
+
+int browse_tree_find(struct browse_tree *tree, uint32_t node,
+	const char *name, size_t len, uint32_t *found)
+{
+	int cmp;
+	uint32_t mid;
+	uint32_t low=0;
+	uint32_t high;
+	const uint32_t *kids=NULL;
+	struct browse_node *n;
+
+	high=browse_tree_children(tree, node, &kids);
+	while(low<high)
+	{
+		mid=low+(high-low)/2;
+		if(!(n=get_node(tree, kids[mid])))
+			return -1;
+		if(!(cmp=namecmp(tree->strings+n->name, name, len)))
+		{
+			*found=kids[mid];
+			return 1;
+		}
+		if(cmp<0)
+			low=mid+1;
+		else
+			high=mid;
+	}
+	return 0;
+}
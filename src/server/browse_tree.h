@@ -0,0 +1,39 @@
+#ifndef _BROWSE_TREE_H
+#define _BROWSE_TREE_H
+
+#include "manio.h"
+
+// The directory tree of a backup, as the status monitor browses it. It is
+// written into the backup directory at the end of phase4, in a form that
+// can be mapped straight into memory.
+
+struct browse_tree;
+
+// Build the tree from the manifest in a backup directory, and write it
+// next to the manifest.
+extern int browse_tree_write(const char *dir, enum protocol protocol);
+
+// Returns NULL if the backup directory has no usable tree.
+extern struct browse_tree *browse_tree_open(const char *dir);
+
+// Build the tree in memory from a manifest opened for reading.
+extern struct browse_tree *browse_tree_build(struct manio *manio);
+
+extern void browse_tree_free(struct browse_tree **tree);
+
+// The root is node 0. Its name is "/" when the paths start with a slash,
+// and empty otherwise.
+extern int browse_tree_entry(struct browse_tree *tree, uint32_t node,
+	const char **name, const char **link, struct stat *statp);
+
+// Points *kids at the children of a node, in manifest order.
+// Returns how many there are.
+extern uint32_t browse_tree_children(struct browse_tree *tree, uint32_t node,
+	const uint32_t **kids);
+
+// Returns 1 and sets *found if the node has a child with the name, 0 if it
+// does not, or -1 if the tree is corrupt.
+extern int browse_tree_find(struct browse_tree *tree, uint32_t node,
+	const char *name, size_t len, uint32_t *found);
+
+#endif
@@ -11,6 +11,7 @@
 #include "../strlist.h"
 #include "bu_get.h"
 #include "child.h"
+#include "deleter.h"
 #include "sdirs.h"
 #include "protocol2/backup_phase4.h"
 #include "delete.h"
@@ -37,10 +38,10 @@ end:
 }
 
 static int recursive_delete_w(struct sdirs *sdirs, struct bu *bu,
-	const char *manual_delete)
+	const char *manual_delete, struct deleter *deleter)
 {
 	if(manual_delete) return 0;
-	if(recursive_delete(sdirs->deleteme))
+	if(deleter_recursive_delete(deleter, sdirs->deleteme))
 	{
 		logp("Error when trying to delete %s\n", bu->path);
 		return -1;
@@ -50,7 +51,7 @@ static int recursive_delete_w(struct sdirs *sdirs, struct bu *bu,
 
 // The failure conditions here are dealt with by the rubble cleaning code.
 static int delete_backup(struct sdirs *sdirs, const char *cname, struct bu *bu,
-	const char *manual_delete)
+	const char *manual_delete, struct deleter *deleter)
 {
 	logp("deleting %s backup %" PRId64 "\n", cname, bu->bno);
 
@@ -75,7 +76,7 @@ static int delete_backup(struct sdirs *sdirs, const char *cname, struct bu *bu,
 				sdirs->current, strerror(errno));
 			return -1;
 		}
-		return recursive_delete_w(sdirs, bu, manual_delete);
+		return recursive_delete_w(sdirs, bu, manual_delete, deleter);
 	}
 	if(!bu->next && bu->prev)
 	{
@@ -97,21 +98,22 @@ static int delete_backup(struct sdirs *sdirs, const char *cname, struct bu *bu,
 			return -1;
 		// If interrupted here, moving the symlink could have failed
 		// after current was deleted but before currenttmp was renamed.
-		if(recursive_delete_w(sdirs, bu, manual_delete))
+		if(recursive_delete_w(sdirs, bu, manual_delete, deleter))
 			return -1;
 		return 0;
 	}
 
 	// It is not the current backup.
 	if(do_rename_w(bu->path, sdirs->deleteme, cname, bu)
-	  || recursive_delete_w(sdirs, bu, manual_delete))
+	  || recursive_delete_w(sdirs, bu, manual_delete, deleter))
 		return -1;
 	return 0;
 }
 
 static int range_loop(struct sdirs *sdirs, const char *cname,
 	struct strlist *keep, unsigned long rmin, struct bu *bu_list,
-	struct bu *last, const char *manual_delete, int *deleted)
+	struct bu *last, const char *manual_delete, struct deleter *deleter,
+	int *deleted)
 {
 	struct bu *bu=NULL;
 	unsigned long r=0;
@@ -144,7 +146,7 @@ static int range_loop(struct sdirs *sdirs, const char *cname,
 			  && (bu->flags & BU_DELETABLE))
 			{
 				if(delete_backup(sdirs, cname, bu,
-					manual_delete)) return -1;
+					manual_delete, deleter)) return -1;
 				(*deleted)++;
 				if(--count<=1) break;
 			}
@@ -155,7 +157,8 @@ static int range_loop(struct sdirs *sdirs, const char *cname,
 }
 
 static int do_delete_backups(struct sdirs *sdirs, const char *cname,
-	struct strlist *keep, struct bu *bu_list, const char *manual_delete)
+	struct strlist *keep, struct bu *bu_list, const char *manual_delete,
+	struct deleter *deleter)
 {
 	int ret=-1;
 	int deleted=0;
@@ -175,7 +178,8 @@ static int do_delete_backups(struct sdirs *sdirs, const char *cname,
 		rmin=m * k->flag;
 
 		if(k->next && range_loop(sdirs, cname,
-			k, rmin, bu_list, last, manual_delete, &deleted))
+			k, rmin, bu_list, last, manual_delete, deleter,
+			&deleted))
 				goto end;
 		m=rmin;
         }
@@ -185,7 +189,7 @@ static int do_delete_backups(struct sdirs *sdirs, const char *cname,
 
 	for(; bu; bu=bu->prev)
 	{
-		if(delete_backup(sdirs, cname, bu, manual_delete))
+		if(delete_backup(sdirs, cname, bu, manual_delete, deleter))
 			goto end;
 		deleted++;
 	}
@@ -196,7 +200,8 @@ end:
 }
 
 int delete_backups(struct sdirs *sdirs,
-	const char *cname, struct strlist *keep, const char *manual_delete)
+	const char *cname, struct strlist *keep, const char *manual_delete,
+	struct deleter *deleter)
 {
 	int ret=-1;
 	struct bu *bu_list=NULL;
@@ -206,7 +211,7 @@ int delete_backups(struct sdirs *sdirs,
 	{
 		if(bu_get_list(sdirs, &bu_list)) goto end;
 		switch(do_delete_backups(sdirs, cname, keep, bu_list,
-			manual_delete))
+			manual_delete, deleter))
 		{
 			case 0: ret=0; goto end;
 			case -1: ret=-1; goto end;
@@ -221,7 +226,8 @@ end:
 
 int do_delete_server(struct asfd *asfd,
 	struct sdirs *sdirs, struct cntr *cntr,
-	const char *cname, const char *backup, const char *manual_delete)
+	const char *cname, const char *backup, const char *manual_delete,
+	struct deleter *deleter)
 {
 	int ret=-1;
 	int found=0;
@@ -253,7 +259,7 @@ int do_delete_server(struct asfd *asfd,
 						goto end;
 				if(asfd->write_str(asfd, CMD_GEN, "ok")
 				  || delete_backup(sdirs, cname, bu,
-					manual_delete))
+					manual_delete, deleter))
 						goto end;
 			}
 			else
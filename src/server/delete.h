@@ -1,13 +1,16 @@
 #ifndef _DELETE_SERVER_H
 #define _DELETE_SERVER_H
 
+struct deleter;
 struct sdirs;
 
 extern int delete_backups(struct sdirs *sdirs, const char *cname,
-	struct strlist *keep, const char *manual_delete);
+	struct strlist *keep, const char *manual_delete,
+	struct deleter *deleter);
 
 extern int do_delete_server(struct asfd *asfd,
 	struct sdirs *sdirs, struct cntr *cntr,
-	const char *cname, const char *backup, const char *manual_delete);
+	const char *cname, const char *backup, const char *manual_delete,
+	struct deleter *deleter);
 
 #endif
@@ -0,0 +1,661 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../cmd.h"
+#include "../cntr.h"
+#include "../conf.h"
+#include "../cstat.h"
+#include "../fsops.h"
+#include "../log.h"
+#include "../strlist.h"
+#include "child.h"
+#include "deleter.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+// Deletes files and directory trees, working relative to open directory
+// fds so that the kernel does not have to look up the whole path each time.
+// A tree is split into jobs a directory at a time, and a directory is only
+// handed to another thread when there is one going spare, otherwise the
+// thread that found it deletes it. Each directory stays open until all the
+// jobs under it have finished, and then it is removed from its parent.
+// The worker threads do not log or touch the counters. They keep count of
+// what they have deleted, and the calling thread reports that while it
+// waits for them.
+
+struct del_dir
+{
+	struct del_dir *parent;
+	// Relative to the parent, or the full path if there is no parent.
+	char *name;
+	int fd;
+	// One for the walk through its own entries, plus one for each of the
+	// directories under it that are still being deleted.
+	int pending;
+};
+
+struct del_job
+{
+	// Either a directory to delete.
+	struct del_dir *dir;
+	// Or some files to unlink, all in the directory that is the first
+	// prefix bytes of each path.
+	struct strlist *paths;
+	int count;
+	size_t prefix;
+
+	struct del_job *next;
+};
+
+struct deleter
+{
+	int threads;
+	int max_per_second;
+	struct cntr *cntr;
+
+	// Set up for each call.
+	const char *path;
+	int rootfd;
+	struct del_job *head;
+	struct del_job *tail;
+	int queued;
+	int running;
+	int stop;
+	uint64_t next_slot;
+	uint64_t files;
+	uint64_t dirs;
+	uint64_t reported_files;
+	uint64_t reported_dirs;
+	int errors;
+	char error[256];
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+};
+
+static void lock(struct deleter *d)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&d->lock);
+#endif
+}
+
+static void unlock(struct deleter *d)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&d->lock);
+#endif
+}
+
+static void wake(struct deleter *d)
+{
+#ifdef HAVE_PTHREAD
+	pthread_cond_broadcast(&d->cond);
+#endif
+}
+
+static void deleter_init(struct deleter *d,
+	int threads, int max_per_second, struct cntr *cntr)
+{
+	memset(d, 0, sizeof(struct deleter));
+#ifdef HAVE_PTHREAD
+	d->threads=threads>0?threads:0;
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_cond_init(&d->cond, NULL);
+#endif
+	d->max_per_second=max_per_second>0?max_per_second:0;
+	d->cntr=cntr;
+	d->rootfd=-1;
+}
+
+static void deleter_free_content(struct deleter *d)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&d->lock);
+	pthread_cond_destroy(&d->cond);
+#endif
+}
+
+struct deleter *deleter_alloc(int threads, int max_per_second,
+	struct cntr *cntr)
+{
+	struct deleter *d;
+#ifndef HAVE_PTHREAD
+	if(threads>0)
+		logp("Ignoring delete_threads, because built without pthreads\n");
+#endif
+	if(!(d=(struct deleter *)calloc_w(1, sizeof(struct deleter), __func__)))
+		return NULL;
+	deleter_init(d, threads, max_per_second, cntr);
+	return d;
+}
+
+struct deleter *deleter_alloc_from_conf(struct conf **confs)
+{
+	return deleter_alloc(get_int(confs[OPT_DELETE_THREADS]),
+		get_int(confs[OPT_DELETE_MAX_PER_SECOND]),
+		get_cntr(confs));
+}
+
+void deleter_free(struct deleter **deleter)
+{
+	if(!deleter || !*deleter) return;
+	deleter_free_content(*deleter);
+	free_v((void **)deleter);
+}
+
+static void set_error(struct deleter *d, const char *what, const char *name,
+	int err)
+{
+	lock(d);
+	if(!d->errors++)
+		snprintf(d->error, sizeof(d->error), "%.16s %.180s: %.48s",
+			what, name, strerror(err));
+	unlock(d);
+}
+
+static uint64_t now_usec(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec*1000000+tv.tv_usec;
+}
+
+// Each removal takes the next slot, and waits for it to come round.
+static void throttle(struct deleter *d)
+{
+	uint64_t now;
+	uint64_t slot;
+	if(!d->max_per_second)
+		return;
+	now=now_usec();
+	lock(d);
+	slot=d->next_slot>now?d->next_slot:now;
+	d->next_slot=slot+1000000/d->max_per_second;
+	unlock(d);
+	if(slot>now)
+		usleep(slot-now);
+}
+
+static void report(struct deleter *d)
+{
+	uint64_t files;
+	uint64_t dirs;
+	if(!d->cntr)
+		return;
+	files=__sync_fetch_and_add(&d->files, 0);
+	dirs=__sync_fetch_and_add(&d->dirs, 0);
+	cntr_add_deleted_val(d->cntr, CMD_FILE, files-d->reported_files);
+	cntr_add_deleted_val(d->cntr, CMD_DIRECTORY, dirs-d->reported_dirs);
+	d->reported_files=files;
+	d->reported_dirs=dirs;
+	write_status(CNTR_STATUS_DELETING, d->path, d->cntr);
+}
+
+static void unlink_one(struct deleter *d, int dirfd, const char *name)
+{
+	throttle(d);
+	if(unlinkat(dirfd, name, 0))
+	{
+		if(errno!=ENOENT)
+			set_error(d, "unlink", name, errno);
+		return;
+	}
+	__sync_fetch_and_add(&d->files, 1);
+}
+
+static void job_add(struct deleter *d, struct del_job *job)
+{
+	lock(d);
+	if(d->tail)
+		d->tail->next=job;
+	else
+		d->head=job;
+	d->tail=job;
+	d->queued++;
+	unlock(d);
+	wake(d);
+}
+
+// Call with the lock held.
+static struct del_job *job_take(struct deleter *d)
+{
+	struct del_job *job;
+	if(!(job=d->head))
+		return NULL;
+	if(!(d->head=job->next))
+		d->tail=NULL;
+	d->queued--;
+	return job;
+}
+
+static int worth_splitting(struct deleter *d)
+{
+	int ret;
+	if(!d->threads)
+		return 0;
+	lock(d);
+	ret=d->queued<d->threads;
+	unlock(d);
+	return ret;
+}
+
+static struct del_dir *dir_alloc(struct deleter *d,
+	struct del_dir *parent, const char *name)
+{
+	struct del_dir *dir;
+	if(!(dir=(struct del_dir *)calloc_w(1, sizeof(struct del_dir), __func__))
+	  || !(dir->name=strdup_w(name, __func__)))
+	{
+		free_v((void **)&dir);
+		set_error(d, "alloc", name, ENOMEM);
+		return NULL;
+	}
+	dir->parent=parent;
+	dir->fd=-1;
+	dir->pending=1;
+	if(parent)
+	{
+		lock(d);
+		parent->pending++;
+		unlock(d);
+	}
+	return dir;
+}
+
+// Drops a hold on the directory. When the last one goes, the directory
+// is removed from its parent, and the hold on the parent is dropped too.
+static void dir_release(struct deleter *d, struct del_dir *dir)
+{
+	while(dir)
+	{
+		int finished;
+		struct del_dir *parent=dir->parent;
+		lock(d);
+		finished=!--dir->pending;
+		unlock(d);
+		if(!finished)
+			return;
+		if(dir->fd>=0)
+			close(dir->fd);
+		if(parent)
+		{
+			throttle(d);
+			if(unlinkat(parent->fd, dir->name, AT_REMOVEDIR))
+				set_error(d, "rmdir", dir->name, errno);
+			else
+				__sync_fetch_and_add(&d->dirs, 1);
+		}
+		free_w(&dir->name);
+		free_v((void **)&dir);
+		dir=parent;
+	}
+}
+
+static int entry_is_dir(int dirfd, struct dirent *entry)
+{
+	struct stat statp;
+#ifdef _DIRENT_HAVE_D_TYPE
+	if(entry->d_type!=DT_UNKNOWN)
+		return entry->d_type==DT_DIR;
+#endif
+	if(fstatat(dirfd, entry->d_name, &statp, AT_SYMLINK_NOFOLLOW))
+		return -1;
+	return S_ISDIR(statp.st_mode);
+}
+
+static void walk_dir(struct deleter *d, struct del_dir *dir);
+
+static void delete_subdir(struct deleter *d, struct del_dir *parent,
+	const char *name)
+{
+	struct del_dir *dir;
+	struct del_job *job;
+	if(!(dir=dir_alloc(d, parent, name)))
+		return;
+	if(worth_splitting(d)
+	  && (job=(struct del_job *)
+		calloc_w(1, sizeof(struct del_job), __func__)))
+	{
+		job->dir=dir;
+		job_add(d, job);
+		return;
+	}
+	walk_dir(d, dir);
+}
+
+static void walk_dir(struct deleter *d, struct del_dir *dir)
+{
+	int fd;
+	DIR *dirp=NULL;
+	struct dirent *entry;
+
+	if(dir->fd<0
+	  && (dir->fd=openat(dir->parent->fd, dir->name,
+		O_RDONLY|O_DIRECTORY|O_NOFOLLOW))<0)
+	{
+		set_error(d, "open", dir->name, errno);
+		goto end;
+	}
+	// The directory fd itself is kept for the *at() calls.
+	if((fd=dup(dir->fd))<0)
+	{
+		set_error(d, "dup", dir->name, errno);
+		goto end;
+	}
+	if(!(dirp=fdopendir(fd)))
+	{
+		set_error(d, "fdopendir", dir->name, errno);
+		close(fd);
+		goto end;
+	}
+	while(1)
+	{
+		errno=0;
+		if(!(entry=readdir(dirp)))
+		{
+			if(errno)
+				set_error(d, "readdir", dir->name, errno);
+			break;
+		}
+		if(!filter_dot(entry))
+			continue;
+		switch(entry_is_dir(dir->fd, entry))
+		{
+			case 0:
+				unlink_one(d, dir->fd, entry->d_name);
+				break;
+			case 1:
+				delete_subdir(d, dir, entry->d_name);
+				break;
+			default:
+				if(errno!=ENOENT)
+					set_error(d, "stat",
+						entry->d_name, errno);
+				break;
+		}
+	}
+end:
+	if(dirp)
+		closedir(dirp);
+	if(!d->threads)
+		report(d);
+	dir_release(d, dir);
+}
+
+static void unlink_files(struct deleter *d, struct del_job *job)
+{
+	int i;
+	int fd=d->rootfd;
+	char *dirname=NULL;
+	struct strlist *s=job->paths;
+
+	if(job->prefix)
+	{
+		if(!(dirname=strdup_w(s->path, __func__)))
+		{
+			set_error(d, "alloc", s->path, ENOMEM);
+			return;
+		}
+		dirname[job->prefix]='\0';
+		if((fd=openat(d->rootfd, dirname,
+			O_RDONLY|O_DIRECTORY|O_NOFOLLOW))<0)
+		{
+			// Nothing in there to delete.
+			if(errno!=ENOENT)
+				set_error(d, "open", dirname, errno);
+			free_w(&dirname);
+			return;
+		}
+	}
+	for(i=0; i<job->count; i++, s=s->next)
+		unlink_one(d, fd,
+			s->path+(job->prefix?job->prefix+1:0));
+	if(fd!=d->rootfd)
+		close(fd);
+	free_w(&dirname);
+}
+
+static void do_job(struct deleter *d, struct del_job *job)
+{
+	if(job->dir)
+		walk_dir(d, job->dir);
+	else
+		unlink_files(d, job);
+	free_v((void **)&job);
+}
+
+#ifdef HAVE_PTHREAD
+static void *worker(void *arg)
+{
+	struct del_job *job;
+	struct deleter *d=(struct deleter *)arg;
+
+	lock(d);
+	while(1)
+	{
+		while(!d->head && !d->stop)
+			pthread_cond_wait(&d->cond, &d->lock);
+		if(!(job=job_take(d)))
+			break;
+		d->running++;
+		unlock(d);
+		do_job(d, job);
+		lock(d);
+		if(!--d->running && !d->head)
+			pthread_cond_broadcast(&d->cond);
+	}
+	unlock(d);
+	return NULL;
+}
+
+// Returns the number of threads that finished.
+static int run_threads(struct deleter *d)
+{
+	int t;
+	int started=0;
+	pthread_t *threads;
+	struct timespec ts;
+
+	if(!(threads=(pthread_t *)
+		calloc_w(d->threads, sizeof(pthread_t), __func__)))
+			return 0;
+	for(t=0; t<d->threads; t++)
+	{
+		if(pthread_create(&threads[t], NULL, worker, d))
+			break;
+		started++;
+	}
+
+	lock(d);
+	// Jobs are only ever added by other jobs, so once there are none
+	// queued or running, everything is done.
+	while(started && (d->head || d->running))
+	{
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec++;
+		pthread_cond_timedwait(&d->cond, &d->lock, &ts);
+		unlock(d);
+		report(d);
+		lock(d);
+	}
+	d->stop=1;
+	unlock(d);
+	wake(d);
+
+	for(t=0; t<started; t++)
+		pthread_join(threads[t], NULL);
+	free_v((void **)&threads);
+	return started;
+}
+#endif
+
+static int run(struct deleter *d)
+{
+	struct del_job *job;
+
+	d->stop=0;
+	d->errors=0;
+#ifdef HAVE_PTHREAD
+	if(d->threads && run_threads(d))
+		goto end;
+	// Could not start any threads, so do it all here.
+#endif
+	while(1)
+	{
+		lock(d);
+		job=job_take(d);
+		unlock(d);
+		if(!job)
+			break;
+		do_job(d, job);
+	}
+#ifdef HAVE_PTHREAD
+end:
+#endif
+	report(d);
+	if(d->errors)
+	{
+		logp("%d error%s deleting in %s, the first was %s\n",
+			d->errors, d->errors==1?"":"s", d->path, d->error);
+		return -1;
+	}
+	return 0;
+}
+
+static int open_root(struct deleter *d, const char *path)
+{
+	d->path=path;
+	if((d->rootfd=open(path, O_RDONLY|O_DIRECTORY|O_NOFOLLOW))<0)
+	{
+		logp("Could not open %s in %s: %s\n",
+			path, __func__, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int do_recursive_delete(struct deleter *d, const char *path)
+{
+	int ret=-1;
+	struct stat statp;
+	struct del_dir *root=NULL;
+	struct del_job *job=NULL;
+
+	if(lstat(path, &statp))
+		return 0;
+	if(!S_ISDIR(statp.st_mode))
+	{
+		if(unlink(path))
+		{
+			logp("unlink %s: %s\n", path, strerror(errno));
+			return -1;
+		}
+		return 0;
+	}
+
+	if(open_root(d, path)
+	  || !(root=dir_alloc(d, NULL, path))
+	  || !(job=(struct del_job *)
+		calloc_w(1, sizeof(struct del_job), __func__)))
+			goto end;
+	// The root fd belongs to the root directory from here on.
+	root->fd=d->rootfd;
+	d->rootfd=-1;
+	job->dir=root;
+	root=NULL;
+	job_add(d, job);
+	if(run(d))
+		goto end;
+	if(rmdir(path))
+	{
+		logp("rmdir %s: %s\n", path, strerror(errno));
+		goto end;
+	}
+	ret=0;
+end:
+	if(root)
+	{
+		free_w(&root->name);
+		free_v((void **)&root);
+	}
+	if(d->rootfd>=0)
+		close(d->rootfd);
+	d->rootfd=-1;
+	return ret;
+}
+
+int deleter_recursive_delete(struct deleter *deleter, const char *path)
+{
+	int ret;
+	struct deleter serial;
+	if(deleter)
+		return do_recursive_delete(deleter, path);
+	deleter_init(&serial, 0, 0, NULL);
+	ret=do_recursive_delete(&serial, path);
+	deleter_free_content(&serial);
+	return ret;
+}
+
+static size_t get_prefix(const char *path)
+{
+	const char *cp;
+	if(!(cp=strchr(path, '/')))
+		return 0;
+	return cp-path;
+}
+
+static int do_unlink_files(struct deleter *d,
+	const char *dir, struct strlist *paths)
+{
+	int ret=-1;
+	struct strlist *s;
+	struct del_job *job=NULL;
+
+	if(!paths)
+		return 0;
+	if(open_root(d, dir))
+		return -1;
+	for(s=paths; s; s=s->next)
+	{
+		size_t prefix=get_prefix(s->path);
+		if(job
+		  && job->prefix==prefix
+		  && !strncmp(job->paths->path, s->path, prefix))
+		{
+			job->count++;
+			continue;
+		}
+		if(!(job=(struct del_job *)
+			calloc_w(1, sizeof(struct del_job), __func__)))
+				goto end;
+		job->paths=s;
+		job->count=1;
+		job->prefix=prefix;
+		job_add(d, job);
+	}
+	ret=run(d);
+end:
+	// Anything still queued after an error.
+	while((job=job_take(d)))
+		free_v((void **)&job);
+	close(d->rootfd);
+	d->rootfd=-1;
+	return ret;
+}
+
+int deleter_unlink_files(struct deleter *deleter,
+	const char *dir, struct strlist *paths)
+{
+	int ret;
+	struct deleter serial;
+	if(deleter)
+		return do_unlink_files(deleter, dir, paths);
+	deleter_init(&serial, 0, 0, NULL);
+	ret=do_unlink_files(&serial, dir, paths);
+	deleter_free_content(&serial);
+	return ret;
+}
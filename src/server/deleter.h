@@ -0,0 +1,29 @@
+#ifndef _DELETER_H
+#define _DELETER_H
+
+struct cntr;
+struct conf;
+struct strlist;
+
+struct deleter;
+
+extern struct deleter *deleter_alloc(int threads, int max_per_second,
+	struct cntr *cntr);
+// Uses delete_threads, delete_max_per_second and the counters from confs.
+extern struct deleter *deleter_alloc_from_conf(struct conf **confs);
+extern void deleter_free(struct deleter **deleter);
+
+// These return 0 for OK, -1 for error. A NULL deleter does everything in
+// the calling thread, with no limit on how fast.
+
+// Deletes path and everything under it. It is not an error if path does
+// not exist.
+extern int deleter_recursive_delete(struct deleter *deleter,
+	const char *path);
+// Unlinks each of the paths, which are relative to dir. Paths that do not
+// exist are ignored. Paths that are next to each other in the list and
+// share their first directory are unlinked by the same thread.
+extern int deleter_unlink_files(struct deleter *deleter,
+	const char *dir, struct strlist *paths);
+
+#endif
@@ -7,29 +7,156 @@
 #include "../cmd.h"
 #include "../cntr.h"
 #include "../cstat.h"
+#include "../fzp.h"
+#include "../iobuf.h"
 #include "../log.h"
+#include "../pathcmp.h"
 #include "../prepend.h"
 #include "../sbuf.h"
 #include "bu_get.h"
 #include "child.h"
 #include "manio.h"
+#include "manio_index.h"
 #include "diff.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+// Backups are compared in units of work, each one a range of paths. For
+// protocol2 backups with manifest indexes, the ranges are split at the
+// starts of the chunk files in either manifest. Where a chunk file covers
+// exactly the same range in both manifests, and the files are the same,
+// the range is skipped without reading it. Other ranges can be compared on
+// separate threads, and the main process sends the results in path order.
+// Without indexes, everything is one unit.
+
+// How many chunks can be compared in one unit.
+#define DIFF_UNIT_CHUNKS	4
+// How many units the threads can get ahead of the ones being sent.
+#define DIFF_UNITS_AHEAD	4
+
+struct diff_unit
+{
+	// Paths from lo up to, but not including, hi. NULL for no limit.
+	char *lo;
+	char *hi;
+	// Chunk files that cover exactly this range in each manifest.
+	char *chunk1;
+	char *chunk2;
+
+	int done;
+	int error;
+	// The messages to send, when not sending straight away.
+	struct iobuf *msgs;
+	size_t count;
+	size_t alloc;
+};
+
+struct diff
+{
+	char *manifest1;
+	char *manifest2;
+	enum protocol protocol;
+	struct manio_index *index1;
+	struct manio_index *index2;
+	struct diff_unit *units;
+	size_t count;
+	size_t alloc;
+	size_t skipped;
+
+	int threads;
+	size_t next;
+	size_t sent;
+	int stop;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+};
+
 static char *get_manifest_path(const char *fullpath, enum protocol protocol)
 {
 	return prepend_s(fullpath, protocol==PROTO_1?"manifest.gz":"manifest");
 }
 
-static int send_diff(struct asfd *asfd, const char *symbol, struct sbuf *sb)
+static void diff_unit_free_msgs(struct diff_unit *unit)
+{
+	size_t i;
+	for(i=0; i<unit->count; i++)
+		iobuf_free_content(&unit->msgs[i]);
+	free_v((void **)&unit->msgs);
+	unit->count=0;
+	unit->alloc=0;
+}
+
+static void diff_free_content(struct diff *d)
+{
+	size_t i;
+	for(i=0; i<d->count; i++)
+	{
+		free_w(&d->units[i].lo);
+		free_w(&d->units[i].hi);
+		free_w(&d->units[i].chunk1);
+		free_w(&d->units[i].chunk2);
+		diff_unit_free_msgs(&d->units[i]);
+	}
+	free_v((void **)&d->units);
+	manio_index_free(&d->index1);
+	manio_index_free(&d->index2);
+	free_w(&d->manifest1);
+	free_w(&d->manifest2);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&d->lock);
+	pthread_cond_destroy(&d->cond);
+#endif
+}
+
+// Sends straight to the client if there is an asfd, otherwise keeps the
+// message in the unit.
+static int out(struct asfd *asfd, struct diff_unit *unit,
+	enum cmd cmd, const char *buf, size_t len)
+{
+	struct iobuf *msg;
+	struct iobuf *tmp;
+	if(asfd)
+	{
+		struct iobuf wbuf;
+		iobuf_set(&wbuf, cmd, (char *)buf, len);
+		return asfd->write(asfd, &wbuf);
+	}
+	if(unit->count>=unit->alloc)
+	{
+		size_t alloc=unit->alloc?unit->alloc*2:64;
+		if(!(tmp=(struct iobuf *)realloc_w(unit->msgs,
+			alloc*sizeof(struct iobuf), __func__)))
+				return -1;
+		unit->msgs=tmp;
+		unit->alloc=alloc;
+	}
+	msg=&unit->msgs[unit->count];
+	iobuf_init(msg);
+	if(!(msg->buf=(char *)malloc_w(len+1, __func__)))
+		return -1;
+	memcpy(msg->buf, buf, len);
+	msg->buf[len]='\0';
+	msg->cmd=cmd;
+	msg->len=len;
+	unit->count++;
+	return 0;
+}
+
+static int send_diff(struct asfd *asfd, struct diff_unit *unit,
+	const char *symbol, struct sbuf *sb)
 {
 	int ret=-1;
 	char *dpath=NULL;
 	if(!(dpath=prepend_s(symbol, sb->path.buf))
-	  || asfd->write(asfd, &sb->attr)
-	  || asfd->write_str(asfd, sb->path.cmd, dpath))
+	  || out(asfd, unit, sb->attr.cmd, sb->attr.buf, sb->attr.len)
+	  || out(asfd, unit, sb->path.cmd, dpath, strlen(dpath)))
 		goto end;
 	if(sbuf_is_link(sb)
-	  && asfd->write(asfd, &sb->link))
+	  && out(asfd, unit, sb->link.cmd, sb->link.buf, sb->link.len))
 		goto end;
 	ret=0;
 end:
@@ -37,99 +164,171 @@ end:
 	return ret;
 }
 
-static int send_deletion(struct asfd *asfd, struct sbuf *sb)
+static int send_deletion(struct asfd *asfd, struct diff_unit *unit,
+	struct sbuf *sb)
 {
-	return send_diff(asfd, "- ", sb);
+	return send_diff(asfd, unit, "- ", sb);
 }
 
-static int send_addition(struct asfd *asfd, struct sbuf *sb)
+static int send_addition(struct asfd *asfd, struct diff_unit *unit,
+	struct sbuf *sb)
 {
-	return send_diff(asfd, "+ ", sb);
+	return send_diff(asfd, unit, "+ ", sb);
 }
 
-static int diff_manifests(struct asfd *asfd, const char *fullpath1,
-	const char *fullpath2, enum protocol protocol)
+// Returns 1 if the files have the same contents, 0 if not, or -1 on error.
+static int same_file(const char *path1, const char *path2)
 {
 	int ret=-1;
-	int pcmp;
-	struct sbuf *sb1=NULL;
-	struct sbuf *sb2=NULL;
-	struct manio *manio1=NULL;
-	struct manio *manio2=NULL;
-	char *manifest_dir1=NULL;
-	char *manifest_dir2=NULL;
+	size_t got1;
+	size_t got2;
+	char buf1[32768];
+	char buf2[32768];
+	struct stat statp1;
+	struct stat statp2;
+	struct fzp *fzp1=NULL;
+	struct fzp *fzp2=NULL;
 
-	if(!(manifest_dir1=get_manifest_path(fullpath1, protocol))
-	  || !(manifest_dir2=get_manifest_path(fullpath2, protocol))
-	  || !(manio1=manio_open(manifest_dir1, "rb", protocol))
-	  || !(manio2=manio_open(manifest_dir2, "rb", protocol))
-	  || !(sb1=sbuf_alloc(protocol))
-	  || !(sb2=sbuf_alloc(protocol)))
+	if(lstat(path1, &statp1) || lstat(path2, &statp2))
 	{
-		log_and_send_oom(asfd);
-		goto end;
+		logp("Could not stat manifest chunks %s and %s\n",
+			path1, path2);
+		return -1;
 	}
-
-	while(manio1 || manio2)
+	if(statp1.st_dev==statp2.st_dev
+	  && statp1.st_ino==statp2.st_ino)
+		return 1;
+	if(statp1.st_size!=statp2.st_size)
+		return 0;
+	if(!(fzp1=fzp_open(path1, "rb"))
+	  || !(fzp2=fzp_open(path2, "rb")))
+		goto end;
+	while(1)
 	{
-		if(manio1
-		  && !sb1->path.buf)
+		got1=fzp_read(fzp1, buf1, sizeof(buf1));
+		got2=fzp_read(fzp2, buf2, sizeof(buf2));
+		if(got1!=got2 || memcmp(buf1, buf2, got1))
 		{
-			switch(manio_read(manio1, sb1))
-			{
-				case -1: goto end;
-				case 1: manio_close(&manio1);
-			}
+			ret=0;
+			break;
 		}
-
-		if(manio2
-		  && !sb2->path.buf)
+		if(got1<sizeof(buf1))
 		{
-			switch(manio_read(manio2, sb2))
-			{
-				case -1: goto end;
-				case 1: manio_close(&manio2);
-			}
+			ret=fzp_eof(fzp1) && fzp_eof(fzp2);
+			if(!ret)
+				ret=-1;
+			break;
 		}
+	}
+end:
+	fzp_close(&fzp1);
+	fzp_close(&fzp2);
+	return ret;
+}
 
-		if(sb1->path.buf && !sb2->path.buf)
-		{
-			if(send_deletion(asfd, sb1))
-				goto end;
-			sbuf_free_content(sb1);
-		}
-		else if(!sb1->path.buf && sb2->path.buf)
+// Reads the next entry in the range of the unit. At the end of it, the
+// manio is closed and the sbuf left empty.
+static int read_range(struct manio **manio, struct sbuf *sb,
+	struct diff_unit *unit)
+{
+	while(*manio)
+	{
+		sbuf_free_content(sb);
+		switch(manio_read(*manio, sb))
 		{
-			if(send_addition(asfd, sb2))
-				goto end;
-			sbuf_free_content(sb2);
+			case 0: break;
+			case 1: goto finished;
+			default: return -1;
 		}
-		else if(!sb1->path.buf && !sb2->path.buf)
-		{
+		if((*manio)->protocol==PROTO_2 && sb->endfile.buf)
 			continue;
+		if(unit->lo && pathcmp(sb->path.buf, unit->lo)<0)
+			continue;
+		if(unit->hi && pathcmp(sb->path.buf, unit->hi)>=0)
+			goto finished;
+		return 0;
+	}
+finished:
+	sbuf_free_content(sb);
+	manio_close(manio);
+	return 0;
+}
+
+static struct manio *open_range(const char *manifest,
+	enum protocol protocol, struct manio_index *index,
+	struct diff_unit *unit)
+{
+	struct manio *manio;
+	if(!(manio=manio_open(manifest, "rb", protocol)))
+		return NULL;
+	// Each sbuf is only read into again once it has been dealt with, so
+	// it can point into the manifest blocks.
+	manio->views=1;
+	if(index && unit->lo
+	  && manio_index_seek_in(index, manio, unit->lo)<0)
+		manio_close(&manio);
+	return manio;
+}
+
+static int diff_unit(struct diff *d, struct diff_unit *unit,
+	struct asfd *asfd)
+{
+	int ret=-1;
+	int pcmp;
+	struct sbuf *sb1=NULL;
+	struct sbuf *sb2=NULL;
+	struct manio *manio1=NULL;
+	struct manio *manio2=NULL;
+
+	if(unit->chunk1)
+	{
+		switch(same_file(unit->chunk1, unit->chunk2))
+		{
+			case 0: break;
+			case 1: __sync_fetch_and_add(&d->skipped, 1);
+				return 0;
+			default: return -1;
 		}
-		else if(!(pcmp=sbuf_pathcmp(sb1, sb2)))
+	}
+
+	if(!(manio1=open_range(d->manifest1, d->protocol, d->index1, unit))
+	  || !(manio2=open_range(d->manifest2, d->protocol, d->index2, unit))
+	  || !(sb1=sbuf_alloc(d->protocol))
+	  || !(sb2=sbuf_alloc(d->protocol))
+	  || read_range(&manio1, sb1, unit)
+	  || read_range(&manio2, sb2, unit))
+		goto end;
+
+	while(sb1->path.buf || sb2->path.buf)
+	{
+		if(!sb1->path.buf)
+			pcmp=1;
+		else if(!sb2->path.buf)
+			pcmp=-1;
+		else
+			pcmp=sbuf_pathcmp(sb1, sb2);
+
+		if(pcmp<0)
 		{
-			if(sb1->statp.st_mtime!=sb2->statp.st_mtime)
-			{
-				if(send_deletion(asfd, sb1)
-				  || send_addition(asfd, sb2))
-					goto end;
-			}
-			sbuf_free_content(sb1);
-			sbuf_free_content(sb2);
+			if(send_deletion(asfd, unit, sb1)
+			  || read_range(&manio1, sb1, unit))
+				goto end;
 		}
-		else if(pcmp<0)
+		else if(pcmp>0)
 		{
-			if(send_deletion(asfd, sb1))
+			if(send_addition(asfd, unit, sb2)
+			  || read_range(&manio2, sb2, unit))
 				goto end;
-			sbuf_free_content(sb1);
 		}
 		else
 		{
-			if(send_addition(asfd, sb2))
+			if(sb1->statp.st_mtime!=sb2->statp.st_mtime
+			  && (send_deletion(asfd, unit, sb1)
+				|| send_addition(asfd, unit, sb2)))
+					goto end;
+			if(read_range(&manio1, sb1, unit)
+			  || read_range(&manio2, sb2, unit))
 				goto end;
-			sbuf_free_content(sb2);
 		}
 	}
 
@@ -137,13 +336,260 @@ static int diff_manifests(struct asfd *asfd, const char *fullpath1,
 end:
 	sbuf_free(&sb1);
 	sbuf_free(&sb2);
-	free_w(&manifest_dir1);
-	free_w(&manifest_dir2);
 	manio_close(&manio1);
 	manio_close(&manio2);
 	return ret;
 }
 
+static struct diff_unit *unit_add(struct diff *d)
+{
+	struct diff_unit *tmp;
+	if(d->count>=d->alloc)
+	{
+		size_t alloc=d->alloc?d->alloc*2:16;
+		if(!(tmp=(struct diff_unit *)realloc_w(d->units,
+			alloc*sizeof(struct diff_unit), __func__)))
+				return NULL;
+		d->units=tmp;
+		d->alloc=alloc;
+	}
+	tmp=&d->units[d->count++];
+	memset(tmp, 0, sizeof(struct diff_unit));
+	return tmp;
+}
+
+static char *get_chunk_path(const char *manifest, uint64_t chunk)
+{
+	char tmp[32];
+	snprintf(tmp, sizeof(tmp), "%08" PRIX64, chunk);
+	return prepend_s(manifest, tmp);
+}
+
+static int dup_path(char **dst, const char *src)
+{
+	free_w(dst);
+	if(!src)
+		return 0;
+	if(!(*dst=strdup_w(src, __func__)))
+		return -1;
+	return 0;
+}
+
+static const char *earliest(const char *a, const char *b)
+{
+	if(!a) return b;
+	if(!b) return a;
+	return pathcmp(a, b)<=0?a:b;
+}
+
+// Walks through the starts of the chunks of both manifests in order,
+// making a unit for the range up to the next one.
+static int plan_units(struct diff *d)
+{
+	int open=0;
+	uint64_t i=0;
+	uint64_t j=0;
+	const char *b;
+	const char *first1;
+	const char *first2;
+	const char *next1;
+	const char *next2;
+	struct diff_unit *unit=NULL;
+
+	if(!(d->index1=manio_index_load(d->manifest1))
+	  || !(d->index2=manio_index_load(d->manifest2))
+	  || !manio_index_chunks(d->index1)
+	  || !manio_index_chunks(d->index2))
+	{
+		// Compare everything in one go.
+		manio_index_free(&d->index1);
+		manio_index_free(&d->index2);
+		return unit_add(d)?0:-1;
+	}
+
+	first1=manio_index_first(d->index1, i);
+	first2=manio_index_first(d->index2, j);
+	while((b=earliest(first1, first2)))
+	{
+		next1=manio_index_first(d->index1, i+1);
+		next2=manio_index_first(d->index2, j+1);
+		if(first1 && first2
+		  && !pathcmp(first1, first2)
+		  && !pathcmp(next1, next2))
+		{
+			// A chunk in each manifest, covering the same range.
+			if(!(unit=unit_add(d))
+			  || dup_path(&unit->lo, b)
+			  || !(unit->chunk1=get_chunk_path(d->manifest1, i))
+			  || !(unit->chunk2=get_chunk_path(d->manifest2, j)))
+				return -1;
+			open=0;
+		}
+		else
+		{
+			if(!open
+			  && (!(unit=unit_add(d))
+				|| dup_path(&unit->lo, b)))
+					return -1;
+			if(++open==DIFF_UNIT_CHUNKS)
+				open=0;
+		}
+
+		if(first1 && !pathcmp(first1, b))
+			first1=manio_index_first(d->index1, ++i);
+		if(first2 && !pathcmp(first2, b))
+			first2=manio_index_first(d->index2, ++j);
+		if(dup_path(&unit->hi, earliest(first1, first2)))
+			return -1;
+	}
+	// The first one starts at the beginning.
+	free_w(&d->units[0].lo);
+	return 0;
+}
+
+static int send_unit(struct asfd *asfd, struct diff_unit *unit)
+{
+	int ret=0;
+	size_t i;
+	for(i=0; i<unit->count; i++)
+		if((ret=asfd->write(asfd, &unit->msgs[i])))
+			break;
+	diff_unit_free_msgs(unit);
+	return ret;
+}
+
+#ifdef HAVE_PTHREAD
+static void *worker(void *arg)
+{
+	size_t u;
+	struct diff_unit *unit;
+	struct diff *d=(struct diff *)arg;
+
+	pthread_mutex_lock(&d->lock);
+	while(1)
+	{
+		while(!d->stop && d->next<d->count
+		  && d->next>=d->sent+d->threads*DIFF_UNITS_AHEAD)
+			pthread_cond_wait(&d->cond, &d->lock);
+		if(d->stop || d->next>=d->count)
+			break;
+		u=d->next++;
+		pthread_mutex_unlock(&d->lock);
+		unit=&d->units[u];
+		if(diff_unit(d, unit, NULL))
+			unit->error=1;
+		pthread_mutex_lock(&d->lock);
+		unit->done=1;
+		pthread_cond_broadcast(&d->cond);
+	}
+	pthread_mutex_unlock(&d->lock);
+	return NULL;
+}
+
+// Returns -1 on error, 1 if no threads could be started, otherwise 0.
+static int run_threads(struct diff *d, struct asfd *asfd)
+{
+	int t;
+	int ret=-1;
+	int started=0;
+	size_t u;
+	pthread_t *threads;
+	struct diff_unit *unit;
+
+	if(!(threads=(pthread_t *)
+		calloc_w(d->threads, sizeof(pthread_t), __func__)))
+			return -1;
+	for(t=0; t<d->threads; t++)
+	{
+		if(pthread_create(&threads[t], NULL, worker, d))
+			break;
+		started++;
+	}
+	if(!started)
+	{
+		free_v((void **)&threads);
+		return 1;
+	}
+
+	for(u=0; u<d->count; u++)
+	{
+		unit=&d->units[u];
+		pthread_mutex_lock(&d->lock);
+		while(!unit->done)
+			pthread_cond_wait(&d->cond, &d->lock);
+		pthread_mutex_unlock(&d->lock);
+		if(unit->error
+		  || send_unit(asfd, unit))
+			goto end;
+		pthread_mutex_lock(&d->lock);
+		d->sent++;
+		pthread_cond_broadcast(&d->cond);
+		pthread_mutex_unlock(&d->lock);
+	}
+	ret=0;
+end:
+	pthread_mutex_lock(&d->lock);
+	d->stop=1;
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->lock);
+	for(t=0; t<started; t++)
+		pthread_join(threads[t], NULL);
+	free_v((void **)&threads);
+	return ret;
+}
+#endif
+
+#ifndef UTEST
+static
+#endif
+int diff_manifests(struct asfd *asfd, const char *fullpath1,
+	const char *fullpath2, enum protocol protocol, int threads)
+{
+	int ret=-1;
+	size_t u;
+	struct diff d;
+
+	memset(&d, 0, sizeof(d));
+	d.protocol=protocol;
+#ifdef HAVE_PTHREAD
+	d.threads=threads>0?threads:0;
+	pthread_mutex_init(&d.lock, NULL);
+	pthread_cond_init(&d.cond, NULL);
+#endif
+	if(!(d.manifest1=get_manifest_path(fullpath1, protocol))
+	  || !(d.manifest2=get_manifest_path(fullpath2, protocol))
+	  || plan_units(&d))
+	{
+		log_and_send_oom(asfd);
+		goto end;
+	}
+
+#ifdef HAVE_PTHREAD
+	if(d.threads && d.count>1)
+	{
+		switch(run_threads(&d, asfd))
+		{
+			case 0: goto done;
+			case 1: break; // Do it all here instead.
+			default: goto end;
+		}
+	}
+#endif
+	for(u=0; u<d.count; u++)
+		if(diff_unit(&d, &d.units[u], asfd))
+			goto end;
+#ifdef HAVE_PTHREAD
+done:
+#endif
+	if(d.skipped)
+		logp("Skipped %zu manifest chunk%s that were the same\n",
+			d.skipped, d.skipped==1?"":"s");
+	ret=0;
+end:
+	diff_free_content(&d);
+	return ret;
+}
+
 static int send_backup_name_to_client(struct asfd *asfd, struct bu *bu)
 {
 	char msg[64]="";
@@ -152,7 +598,8 @@ static int send_backup_name_to_client(struct asfd *asfd, struct bu *bu)
 }
 
 int do_diff_server(struct asfd *asfd, struct sdirs *sdirs, struct cntr *cntr,
-	enum protocol protocol, const char *backup1, const char *backup2)
+	enum protocol protocol, int threads,
+	const char *backup1, const char *backup2)
 {
 	int ret=-1;
 	unsigned long bno1=0;
@@ -197,7 +644,7 @@ int do_diff_server(struct asfd *asfd, struct sdirs *sdirs, struct cntr *cntr,
 	if(write_status(CNTR_STATUS_DIFFING, NULL, cntr))
 		goto end;
 
-	if(diff_manifests(asfd, bu1->path, bu2->path, protocol))
+	if(diff_manifests(asfd, bu1->path, bu2->path, protocol, threads))
 		goto end;
 
 	ret=0;
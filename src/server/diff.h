@@ -3,6 +3,11 @@
 
 extern int do_diff_server(struct asfd *asfd,
 	struct sdirs *sdirs, struct cntr *cntr, enum protocol protocol,
-	const char *backup1, const char *backup2);
+	int threads, const char *backup1, const char *backup2);
+
+#ifdef UTEST
+extern int diff_manifests(struct asfd *asfd, const char *fullpath1,
+	const char *fullpath2, enum protocol protocol, int threads);
+#endif
 
 #endif
@@ -5,6 +5,8 @@
 #include "../lock.h"
 #include "../log.h"
 #include "dpth.h"
+#include "durable.h"
+#include "protocol2/datfile.h"
 
 struct dpth *dpth_alloc(void)
 {
@@ -16,10 +18,23 @@ void dpth_free(struct dpth **dpth)
 	if(!dpth || !*dpth) return;
 	dpth_release_all(*dpth);
 	fzp_close(&(*dpth)->cfile_fzp);
+	free_v((void **)&((*dpth)->data_index));
 	free_w(&((*dpth)->base_path));
 	free_v((void **)dpth);
 }
 
+static int close_data_file(struct dpth *dpth)
+{
+	int ret=0;
+	if(!dpth->fzp) return 0;
+	if(dpth->data_index
+	  && datfile_write_index(dpth->fzp, dpth->data_index))
+		ret=-1;
+	if(durable_add_fd(fzp_fileno(dpth->fzp))) ret=-1;
+	if(fzp_close(&dpth->fzp)) ret=-1;
+	return ret;
+}
+
 int dpth_release_and_move_to_next_in_list(struct dpth *dpth)
 {
 	int ret=0;
@@ -27,7 +42,7 @@ int dpth_release_and_move_to_next_in_list(struct dpth *dpth)
 
 	// Try to release (and unlink) the lock even if fzp_close failed, just
 	// to be tidy.
-	if(fzp_close(&dpth->fzp)) ret=-1;
+	if(close_data_file(dpth)) ret=-1;
 	if(lock_release(dpth->head->lock)) ret=-1;
 	lock_free(&dpth->head->lock);
 
@@ -42,7 +57,7 @@ int dpth_release_all(struct dpth *dpth)
 {
 	int ret=0;
 	if(!dpth) return 0;
-	if(dpth->fzp && fzp_close(&dpth->fzp)) ret=-1;
+	if(close_data_file(dpth)) ret=-1;
 	while(dpth->head)
 		if(dpth_release_and_move_to_next_in_list(dpth)) ret=-1;
 	return ret;
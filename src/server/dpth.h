@@ -3,6 +3,8 @@
 
 #include "../burp.h"
 
+struct datfile_index;
+
 // ext3 maximum number of subdirs is 32000, so leave a little room.
 #define MAX_STORAGE_SUBDIRS	30000
 
@@ -30,6 +32,8 @@ struct dpth
 	// Currently open data file. Only one is open at a time, while many
 	// may be locked.
 	struct fzp *fzp;
+	// Where the blocks in the currently open data file start.
+	struct datfile_index *data_index;
 	// For keeping track of files that were created, in case the backup
 	// is interrupted and cleanup is required.
 	struct fzp *cfile_fzp;
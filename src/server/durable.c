@@ -0,0 +1,257 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../log.h"
+#include "durable.h"
+
+// Past this many files, it is cheaper to flush the whole filesystem that
+// they are on than to flush them one by one. It also stops us holding too
+// many fds open.
+#define DURABLE_FDS_MAX		64
+
+struct dfd
+{
+	int fd;
+	dev_t dev;
+	ino_t ino;
+};
+
+// Files to flush one by one.
+static struct dfd files[DURABLE_FDS_MAX];
+static int file_count=0;
+// One fd for each filesystem to flush as a whole.
+static struct dfd filesystems[DURABLE_FDS_MAX];
+static int filesystem_count=0;
+// Set when even that overflows, and everything has to be flushed.
+static int sync_everything=0;
+
+static int interval=0;
+static time_t last_commit=0;
+
+void durable_set_interval(int i)
+{
+	interval=i;
+	last_commit=time(NULL);
+}
+
+static void close_all(struct dfd *d, int *count)
+{
+	int i;
+	for(i=0; i<*count; i++)
+		close(d[i].fd);
+	*count=0;
+}
+
+void durable_release(void)
+{
+	close_all(files, &file_count);
+	close_all(filesystems, &filesystem_count);
+	sync_everything=0;
+}
+
+static int find_file(struct stat *statp)
+{
+	int i;
+	for(i=0; i<file_count; i++)
+		if(files[i].dev==statp->st_dev
+		  && files[i].ino==statp->st_ino)
+			return 1;
+	return 0;
+}
+
+static int find_filesystem(dev_t dev)
+{
+	int i;
+	for(i=0; i<filesystem_count; i++)
+		if(filesystems[i].dev==dev)
+			return 1;
+	return 0;
+}
+
+// Swap the files for the filesystems that they are on.
+static void files_to_filesystems(void)
+{
+	int i;
+#ifndef HAVE_SYNCFS
+	// Without syncfs(), the only way to flush a filesystem is to flush
+	// all of them.
+	sync_everything=1;
+#endif
+	for(i=0; i<file_count; i++)
+	{
+		if(sync_everything
+		  || find_filesystem(files[i].dev))
+		{
+			close(files[i].fd);
+			continue;
+		}
+		if(filesystem_count==DURABLE_FDS_MAX)
+		{
+			close(files[i].fd);
+			sync_everything=1;
+			continue;
+		}
+		filesystems[filesystem_count++]=files[i];
+	}
+	file_count=0;
+	if(sync_everything)
+		close_all(filesystems, &filesystem_count);
+}
+
+int durable_add_fd(int fd)
+{
+	int dfd;
+	struct stat statp;
+
+	if(interval<0 || sync_everything)
+		return 0;
+	if(fstat(fd, &statp))
+	{
+		logp("Could not fstat in %s: %s\n", __func__, strerror(errno));
+		return -1;
+	}
+	if(find_file(&statp)
+	  || find_filesystem(statp.st_dev))
+		return 0;
+	if(file_count==DURABLE_FDS_MAX)
+	{
+		files_to_filesystems();
+		return durable_add_fd(fd);
+	}
+	if((dfd=dup(fd))<0)
+	{
+		logp("Could not dup in %s: %s\n", __func__, strerror(errno));
+		return -1;
+	}
+	files[file_count].fd=dfd;
+	files[file_count].dev=statp.st_dev;
+	files[file_count].ino=statp.st_ino;
+	file_count++;
+	return 0;
+}
+
+int durable_add_path(const char *path)
+{
+	int fd;
+	int ret;
+	if(interval<0 || sync_everything)
+		return 0;
+	if((fd=open(path, O_RDONLY))<0)
+	{
+		logp("Could not open %s in %s: %s\n",
+			path, __func__, strerror(errno));
+		return -1;
+	}
+	ret=durable_add_fd(fd);
+	close(fd);
+	return ret;
+}
+
+static int flush_file(int fd)
+{
+#ifdef HAVE_FDATASYNC
+	return fdatasync(fd);
+#else
+	return fsync(fd);
+#endif
+}
+
+static int flush_filesystem(int fd)
+{
+#ifdef HAVE_SYNCFS
+	return syncfs(fd);
+#else
+	// Not reached, see files_to_filesystems().
+	(void)fd;
+	return 0;
+#endif
+}
+
+int durable_flush_fd(int fd)
+{
+	if(interval<0 || !flush_file(fd))
+		return 0;
+	logp("Could not sync file in %s: %s\n", __func__, strerror(errno));
+	return -1;
+}
+
+int durable_flush_dir(const char *path)
+{
+	int fd;
+	int ret=-1;
+	char *dir=NULL;
+	char *cp;
+
+	if(interval<0)
+		return 0;
+	if(!(dir=strdup_w(path, __func__)))
+		goto end;
+	if(!(cp=strrchr(dir, '/')))
+		strcpy(dir, ".");
+	else if(cp==dir)
+		cp[1]='\0';
+	else
+		*cp='\0';
+	if((fd=open(dir, O_RDONLY))<0)
+	{
+		logp("Could not open %s in %s: %s\n",
+			dir, __func__, strerror(errno));
+		goto end;
+	}
+	if(fsync(fd))
+		logp("Could not sync %s in %s: %s\n",
+			dir, __func__, strerror(errno));
+	else
+		ret=0;
+	close(fd);
+end:
+	free_w(&dir);
+	return ret;
+}
+
+int durable_commit(int force)
+{
+	int i;
+	int ret=0;
+	time_t now;
+
+	if(!file_count && !filesystem_count && !sync_everything)
+		return 0;
+	now=time(NULL);
+	if(!force && interval>0 && now-last_commit<interval)
+		return 0;
+	// Flushing the data of each file does not flush the directories
+	// that they were created or renamed in.
+	if(force)
+		files_to_filesystems();
+
+	if(sync_everything)
+		sync();
+	for(i=0; i<filesystem_count; i++)
+	{
+		if(!flush_filesystem(filesystems[i].fd))
+			continue;
+		logp("Could not sync filesystem in %s: %s\n",
+			__func__, strerror(errno));
+		ret=-1;
+	}
+	for(i=0; i<file_count; i++)
+	{
+		if(!flush_file(files[i].fd))
+			continue;
+		logp("Could not sync file in %s: %s\n",
+			__func__, strerror(errno));
+		ret=-1;
+	}
+	durable_release();
+	last_commit=now;
+	return ret;
+}
+
+#ifdef UTEST
+int durable_pending(void)
+{
+	if(sync_everything)
+		return -1;
+	return file_count+filesystem_count;
+}
+#endif
@@ -0,0 +1,42 @@
+#ifndef _DURABLE_H
+#define _DURABLE_H
+
+// Collects the files that a backup has written, so that they can be flushed
+// to disk together at commit points, rather than syncing each file as it is
+// closed, or syncing every filesystem on the machine.
+// There is one set of files per process.
+
+// With an interval of 0, every commit point flushes. With an interval of N,
+// commit points flush at most once every N seconds, unless forced. A
+// negative interval never flushes, and leaves it to the operating system.
+extern void durable_set_interval(int interval);
+
+// Remember a file that has been written to, but is not closed yet. Anything
+// buffered in user space needs to be flushed to the fd before the next
+// commit.
+extern int durable_add_fd(int fd);
+// Remember a file that has been written to and closed. Compressed files
+// have to be added this way, because zlib does not give out its fd.
+extern int durable_add_path(const char *path);
+
+// Flush a file straight away, for when it has to be on disk before
+// something else is written.
+extern int durable_flush_fd(int fd);
+// Flush the directory that a path is in, so that a file just created there
+// is still there after a crash.
+extern int durable_flush_dir(const char *path);
+
+// Commits that are not forced flush the data of the files. Forced commits
+// flush the whole filesystems that the files are on, which also makes the
+// names of new files and renames durable.
+// Returns 0 for OK, -1 for error.
+extern int durable_commit(int force);
+
+// Forget everything without flushing it.
+extern void durable_release(void);
+
+#ifdef UTEST
+extern int durable_pending(void);
+#endif
+
+#endif
@@ -151,6 +151,11 @@ static int send_features(struct asfd *asfd, struct conf **cconfs,
 	if(append_to_feat(&feat, "msg:"))
 		goto end;
 
+	/* Clients can choose how files are compressed when the server
+	   has to compress them during a restore. */
+	if(append_to_feat(&feat, "restore_compression:"))
+		goto end;
+
 	if(protocol==PROTO_AUTO)
 	{
 		/* If the server is configured to use either protocol, let the
@@ -406,6 +411,17 @@ static int extra_comms_read(struct async *as,
 			set_int(cconfs[OPT_MESSAGE], 1);
 			set_int(globalcs[OPT_MESSAGE], 1);
 		}
+		else if(!strncmp_w(rbuf->buf, "restore_compression="))
+		{
+			const char *cp=rbuf->buf+strlen("restore_compression=");
+			if(strlen(cp)!=1 || !isdigit(*cp))
+			{
+				logp("Client is trying to use restore_compression=%s, which is not a compression level\n", cp);
+				goto end;
+			}
+			set_int(cconfs[OPT_RESTORE_COMPRESSION], atoi(cp));
+			set_int(globalcs[OPT_RESTORE_COMPRESSION], atoi(cp));
+		}
 		else
 		{
 			iobuf_log_unexpected(rbuf, __func__);
@@ -449,6 +465,10 @@ int extra_comms(struct async *as,
 		set_int(cconfs[OPT_DIRECTORY_TREE], 0);
 	}
 
+	// Clients that do not choose a restore_compression expect level 9.
+	set_int(confs[OPT_RESTORE_COMPRESSION], 9);
+	set_int(cconfs[OPT_RESTORE_COMPRESSION], 9);
+
 	// Clients before 1.2.7 did not know how to do extra comms, so skip
 	// this section for them.
 	if(vers.cli<vers.min)
@@ -14,6 +14,7 @@
 #include "child.h"
 #include "list.h"
 #include "manio.h"
+#include "manio_index.h"
 
 enum list_mode
 {
@@ -143,11 +144,29 @@ int check_browsedir(const char *browsedir,
 		free_w(&copy);
 		return 0;
 	}
-	free_w(&mb->path.buf);
-	mb->path.buf=copy;
 	free_w(last_bd_match);
 	if(!(*last_bd_match=strdup_w(copy, __func__)))
 		goto error;
+	if(mb->flags & SBUF_VIEW)
+	{
+		// Cannot free a view, but the copy is never longer.
+		size_t len=strlen(copy);
+		if(len>mb->path.len)
+		{
+			logp("Path too short in %s: %s\n", __func__, copy);
+			free_w(&copy);
+			return -1;
+		}
+		memcpy(mb->path.buf, copy, len+1);
+		mb->path.len=len;
+		free_w(&copy);
+	}
+	else
+	{
+		free_w(&mb->path.buf);
+		mb->path.buf=copy;
+		mb->path.len=strlen(copy);
+	}
 	return 1;
 error:
 	free_w(&copy);
@@ -172,8 +191,11 @@ static int list_manifest(const char *fullpath)
 		log_and_send_oom(asfd);
 		goto error;
 	}
+	manio->views=1;
 
 	if(browsedir) bdlen=strlen(browsedir);
+	if(bdlen && manio_index_seek(manio, browsedir)<0)
+		goto error;
 
 	while(1)
 	{
@@ -182,16 +204,14 @@ static int list_manifest(const char *fullpath)
 		switch(manio_read(manio, sb))
 		{
 			case 0: break;
-			case 1: if(browsedir && *browsedir && !last_bd_match)
-					asfd_write_wrapper_str(asfd,
-						CMD_ERROR,
-						"directory not found");
-				goto end; // Finished OK.
+			case 1: goto finished;
 			default: goto error;
 		}
 
 		if(protocol==PROTO_2 && sb->endfile.buf)
 			continue;
+		if(bdlen && manio_index_past(browsedir, sb->path.buf))
+			goto finished;
 		if(sbuf_is_metadata(sb))
 			continue;
 
@@ -218,6 +238,10 @@ static int list_manifest(const char *fullpath)
 			goto error;
 	}
 
+finished:
+	if(browsedir && *browsedir && !last_bd_match)
+		asfd_write_wrapper_str(asfd, CMD_ERROR, "directory not found");
+	goto end; // Finished OK.
 error:
 	ret=-1;
 end:
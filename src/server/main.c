@@ -733,7 +733,7 @@ static int run_server(struct conf **confs, const char *conffile)
 		goto end;
 	}
 
-	if(!(mainas=async_alloc())
+	if(!(mainas=async_alloc_epoll())
 	  || mainas->init(mainas, 0))
 		goto end;
 
@@ -9,14 +9,26 @@
 #include "../prepend.h"
 #include "../protocol2/blk.h"
 #include "../sbuf.h"
+#include "durable.h"
 #include "manio.h"
+#include "manio_v2.h"
 #include "protocol2/champ_chooser/champ_chooser.h"
+#include "protocol2/dindex_file.h"
 #include "protocol2/dpth.h"
 
 #define MANIO_MODE_READ		"rb"
 #define MANIO_MODE_WRITE	"wb"
 #define MANIO_MODE_APPEND	"ab"
 
+// One md5sum for each chunk, in order.
+#define MANIO_DIGESTS		"digests"
+
+struct manio_chunk
+{
+	uint8_t digest[MD5_DIGEST_LENGTH];
+	uint64_t chunk;
+};
+
 static void man_off_t_free_content(man_off_t *offset)
 {
 	if(!offset) return;
@@ -70,6 +82,28 @@ static char *get_next_fpath(struct manio *manio, man_off_t *offset)
 	return prepend_s(manio->manifest, tmp);
 }
 
+// Pick the format from the file when reading.
+static int manio_open_fpath_compressed(struct manio *manio, const char *fpath)
+{
+	int v2=manio->write_v2;
+	if(!strcmp(manio->mode, MANIO_MODE_READ)
+	  && (v2=manio_v2_sniff(fpath))<0)
+		return -1;
+	if(v2)
+	{
+		if(!(manio->v2=manio_v2_open(fpath, manio->mode,
+			MANIO_V2_CODEC_DEFLATE))) return -1;
+		return 0;
+	}
+	if(!(manio->fzp=fzp_gzopen(fpath, manio->mode))) return -1;
+	return 0;
+}
+
+int manio_is_open(struct manio *manio)
+{
+	return manio->fzp || manio->v2;
+}
+
 static int manio_open_next_fpath(struct manio *manio)
 {
 	static struct stat statp;
@@ -86,6 +120,11 @@ static int manio_open_next_fpath(struct manio *manio)
 
 	if(build_path_w(offset->fpath))
 		return -1;
+	// A reused chunk is a hard link into a previous manifest, and a
+	// resumed backup writes its manifest again over the top.
+	if(!strcmp(manio->mode, MANIO_MODE_WRITE)
+	  && unlink_for_write(offset->fpath, __func__))
+		return -1;
 	switch(manio->phase)
 	{
 		case 2:
@@ -95,9 +134,8 @@ static int manio_open_next_fpath(struct manio *manio)
 		case 1:
 		case 3:
 		default:
-			if(!(manio->fzp=fzp_gzopen(offset->fpath,
-				manio->mode))) return -1;
-			return 0;
+			return manio_open_fpath_compressed(manio,
+				offset->fpath);
 	}
 }
 
@@ -129,6 +167,8 @@ static struct manio *do_manio_open(const char *manifest, const char *mode,
 		goto error;
 	manio->protocol=protocol;
 	manio->phase=phase;
+	// Finished protocol2 manifests are written in format 2.
+	manio->write_v2=(protocol==PROTO_2 && phase==3);
 	if(!strcmp(manio->mode, MANIO_MODE_APPEND))
 	{
 		if(manio->phase!=2)
@@ -206,6 +246,9 @@ static void manio_free_content(struct manio *manio)
 	free_v((void **)&manio->hook_sort);
 	free_w(&manio->dindex_dir);
 	free_v((void **)&manio->dindex_sort);
+	free_v((void **)&manio->digests);
+	free_w(&manio->reuse_manifest);
+	free_v((void **)&manio->reuse);
 	memset(manio, 0, sizeof(struct manio));
 }
 
@@ -309,6 +352,7 @@ static int sort_and_write_hooks(struct manio *manio)
 	snprintf(msg, sizeof(msg), "%08" PRIX64, manio->offset->fcount-1);
 	if(!(path=prepend_s(manio->hook_dir, msg))
 	  || build_path_w(path)
+	  || unlink_for_write(path, __func__)
 	  || !(fzp=fzp_gzopen(path, MANIO_MODE_WRITE)))
 		goto end;
 
@@ -330,7 +374,8 @@ static int sort_and_write_hooks(struct manio *manio)
 			path, __func__, strerror(errno));
 		goto end;
 	}
-	if(manio_write_fcount(manio)) goto end;
+	if(durable_add_path(path)
+	  || manio_write_fcount(manio)) goto end;
 	manio->hook_count=0;
 	ret=0;
 end:
@@ -339,47 +384,216 @@ end:
 	return ret;
 }
 
+static char *get_chunk_path(const char *manifest, const char *dir,
+	uint64_t chunk)
+{
+	char tmp[32];
+	snprintf(tmp, sizeof(tmp), "%s%08" PRIX64, dir, chunk);
+	return prepend_s(manifest, tmp);
+}
+
+// Links path to the file in dir of the previous manifest for the chunk that
+// the one just written is the same as. Anything already at path is only
+// replaced once the link is in place.
+// Returns 0 if it was linked, 1 if it could not be, or -1 on error.
+static int link_reused(struct manio *manio, const char *dir, const char *path)
+{
+	int ret=-1;
+	char *src=NULL;
+	char *tmp=NULL;
+	if(!(src=get_chunk_path(manio->reuse_manifest,
+		dir, manio->reused_from))
+	  || !(tmp=prepend(path, ".reuse")))
+		goto end;
+	unlink(tmp);
+	if(link(src, tmp))
+	{
+		logp("Could not link %s to %s: %s\n",
+			src, tmp, strerror(errno));
+		ret=1;
+		goto end;
+	}
+	if(do_rename(tmp, path))
+		goto end;
+	ret=0;
+end:
+	free_w(&src);
+	free_w(&tmp);
+	return ret;
+}
+
+static int manio_chunk_cmp(const void *a, const void *b)
+{
+	return memcmp(((struct manio_chunk *)a)->digest,
+		((struct manio_chunk *)b)->digest, MD5_DIGEST_LENGTH);
+}
+
+// Remember the md5sum of the chunk that has just been written. When the
+// previous manifest has a chunk with the same records, swap the new one for
+// a link to that.
+static int chunk_written(struct manio *manio, uint8_t *digest)
+{
+	uint8_t *digests;
+	struct manio_chunk key;
+	struct manio_chunk *found;
+	uint64_t chunk=manio->offset->fcount-1;
+
+	if(chunk!=manio->digest_count)
+	{
+		logp("Expected chunk %" PRIu64 " of %s, not %" PRIu64 "\n",
+			manio->digest_count, manio->manifest, chunk);
+		return -1;
+	}
+	if(!(digests=(uint8_t *)realloc_w(manio->digests,
+		(chunk+1)*MD5_DIGEST_LENGTH, __func__)))
+			return -1;
+	manio->digests=digests;
+	memcpy(digests+chunk*MD5_DIGEST_LENGTH, digest, MD5_DIGEST_LENGTH);
+	manio->digest_count++;
+
+	if(!manio->reuse)
+		return 0;
+	memcpy(key.digest, digest, MD5_DIGEST_LENGTH);
+	if(!(found=(struct manio_chunk *)bsearch(&key, manio->reuse,
+		manio->reuse_count, sizeof(struct manio_chunk),
+		manio_chunk_cmp)))
+			return 0;
+	manio->reused_from=found->chunk;
+	switch(link_reused(manio, "", manio->offset->fpath))
+	{
+		case 0:
+			manio->reused=1;
+			manio->chunks_reused++;
+			return 0;
+		case 1:
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+static int write_digests(struct manio *manio)
+{
+	int ret=-1;
+	size_t len;
+	char *path=NULL;
+	struct fzp *fzp=NULL;
+
+	if(!(path=prepend_s(manio->manifest, MANIO_DIGESTS))
+	  || !(fzp=fzp_open(path, MANIO_MODE_WRITE)))
+		goto end;
+	len=manio->digest_count*MD5_DIGEST_LENGTH;
+	if(len && fzp_write(fzp, manio->digests, len)!=len)
+	{
+		logp("Short write to %s\n", path);
+		goto end;
+	}
+	if(fzp_close(&fzp))
+	{
+		logp("Error closing %s in %s\n", path, __func__);
+		goto end;
+	}
+	if(durable_add_path(path))
+		goto end;
+	ret=0;
+end:
+	fzp_close(&fzp);
+	free_w(&path);
+	return ret;
+}
+
+int manio_reuse_chunks_from(struct manio *manio, const char *manifest)
+{
+	int ret=-1;
+	uint64_t i;
+	struct stat statp;
+	struct fzp *fzp=NULL;
+	char *path=NULL;
+
+	if(!manio->dindex_sort)
+		return 0;
+	if(!(path=prepend_s(manifest, MANIO_DIGESTS)))
+		goto end;
+	// Manifests from before the digests were kept have nothing to reuse.
+	if(lstat(path, &statp)
+	  || !statp.st_size
+	  || statp.st_size%MD5_DIGEST_LENGTH)
+	{
+		ret=0;
+		goto end;
+	}
+	manio->reuse_count=(uint64_t)statp.st_size/MD5_DIGEST_LENGTH;
+	if(!(manio->reuse=(struct manio_chunk *)calloc_w(manio->reuse_count,
+		sizeof(struct manio_chunk), __func__))
+	  || !(manio->reuse_manifest=strdup_w(manifest, __func__))
+	  || !(fzp=fzp_open(path, MANIO_MODE_READ)))
+		goto end;
+	for(i=0; i<manio->reuse_count; i++)
+	{
+		if(fzp_read_ensure(fzp, manio->reuse[i].digest,
+			MD5_DIGEST_LENGTH, __func__))
+		{
+			logp("Could not read %s\n", path);
+			goto end;
+		}
+		manio->reuse[i].chunk=i;
+	}
+	qsort(manio->reuse, manio->reuse_count, sizeof(struct manio_chunk),
+		manio_chunk_cmp);
+	ret=0;
+end:
+	if(ret)
+	{
+		free_v((void **)&manio->reuse);
+		manio->reuse_count=0;
+	}
+	fzp_close(&fzp);
+	free_w(&path);
+	return ret;
+}
+
 static int sort_and_write_dindex(struct manio *manio)
 {
 	int i;
 	int ret=-1;
-	struct fzp *fzp=NULL;
+	struct dindex_file *df=NULL;
 	char msg[32]="";
 	char *path=NULL;
-	struct iobuf wbuf;
-	struct blk blk;
 	int dindex_count=manio->dindex_count;
 	uint64_t *dindex_sort=manio->dindex_sort;
 	if(!dindex_sort) return 0;
 
 	snprintf(msg, sizeof(msg), "%08" PRIX64, manio->offset->fcount-1);
 	if(!(path=prepend_s(manio->dindex_dir, msg))
-	  || build_path_w(path)
-	  || !(fzp=fzp_gzopen(path, MANIO_MODE_WRITE)))
+	  || build_path_w(path))
+		goto end;
+	if(manio->reused)
+	{
+		// The same savepaths as the chunk that it was linked to.
+		manio->reused=0;
+		switch(link_reused(manio, "dindex/", path))
+		{
+			case 0: manio->dindex_count=0; ret=0; goto end;
+			case 1: break;
+			default: goto end;
+		}
+	}
+	if(!(df=dindex_file_open(path, MANIO_MODE_WRITE)))
 		goto end;
 
 	qsort(dindex_sort, dindex_count, sizeof(uint64_t), uint64_t_sort);
 
+	// Duplicates are dropped by dindex_file_write().
 	for(i=0; i<dindex_count; i++)
-	{
-		// Do not bother with duplicates.
-		if(i && dindex_sort[i]==dindex_sort[i-1])
-			continue;
-
-		blk.savepath=dindex_sort[i];
-		blk_to_iobuf_savepath(&blk, &wbuf);
-		if(iobuf_send_msg_fzp(&wbuf, fzp)) return -1;
-	}
-	if(fzp_close(&fzp))
-	{
-		logp("Error closing %s in %s: %s\n",
-			path, __func__, strerror(errno));
+		if(dindex_file_write(df, dindex_sort[i]))
+			goto end;
+	if(dindex_file_close(&df)
+	  || durable_add_path(path))
 		goto end;
-	}
 	manio->dindex_count=0;
 	ret=0;
 end:
-	fzp_close(&fzp);
+	dindex_file_close(&df);
 	free_w(&path);
 	return ret;
 }
@@ -390,32 +604,50 @@ static int sort_and_write_hooks_and_dindex(struct manio *manio)
 	  || sort_and_write_dindex(manio);
 }
 
+// Close the current file, and remember to flush it to disk if we wrote it.
+static int manio_close_fzp(struct manio *manio)
+{
+	int v2=0;
+	uint8_t digest[MD5_DIGEST_LENGTH];
+	if(!manio_is_open(manio)) return 0;
+	if(manio->v2)
+	{
+		v2=1;
+		if(manio_v2_close_with_digest(&manio->v2, digest)) return -1;
+	}
+	else if(fzp_close(&manio->fzp)) return -1;
+	if(!strcmp(manio->mode, MANIO_MODE_READ)) return 0;
+	if(v2 && manio->dindex_sort
+	  && chunk_written(manio, digest))
+		return -1;
+	return durable_add_path(manio->offset->fpath);
+}
+
 int manio_close(struct manio **manio)
 {
 	int ret=0;
-//	int fd;
 	if(!manio || !*manio) return ret;
+	if((*manio)->copied_raw || (*manio)->copied_blk)
+		logp("%s: copied %" PRIu64 " signatures as read, %" PRIu64
+			" through a blk\n", (*manio)->manifest,
+			(*manio)->copied_raw, (*manio)->copied_blk);
+	// The chunk has to be closed first, to find out whether it is the
+	// same as one that has a dindex file already.
+	if(manio_close_fzp(*manio))
+		ret=-1;
 	if(sort_and_write_hooks_and_dindex(*manio))
 		ret=-1;
-/*
-	There is no gzfileno()
-	if((fd=fzp_fileno((*manio)->fzp))<0)
-	{
-		logp("Could not get fileno in %s for %s: %s\n", __func__,
-			(*manio)->manifest, strerror(errno));
+	if(!ret && (*manio)->dindex_sort
+	  && strcmp((*manio)->mode, MANIO_MODE_READ)
+	  && write_digests(*manio))
 		ret=-1;
-	}
-	// Should probably have a flush before fsync too.
-	if(fsync(fd))
-	{
-		logp("Error in fsync in %s for %s: %s\n", __func__,
-			(*manio)->manifest, strerror(errno));
-		ret=-1;
-	}
-*/
-	if(fzp_close(&((*manio)->fzp)))
+	if((*manio)->chunks_reused)
+		logp("%s: reused %" PRIu64 " of %" PRIu64 " chunks from %s\n",
+			(*manio)->manifest, (*manio)->chunks_reused,
+			(*manio)->digest_count, (*manio)->reuse_manifest);
+	// The end of a manifest is a commit point.
+	if(durable_commit(0))
 		ret=-1;
-	sync();
 	manio_free_content(*manio);
 	free_v((void **)manio);
 	return ret;
@@ -426,13 +658,16 @@ int manio_read_with_blk(struct manio *manio, struct sbuf *sb, struct blk *blk)
 {
 	while(1)
 	{
-		if(!manio->fzp)
+		if(!manio_is_open(manio))
 		{
 			if(manio_open_next_fpath(manio)) goto error;
-			if(!manio->fzp) return 1; // No more files to read.
+			// No more files to read.
+			if(!manio_is_open(manio)) return 1;
 		}
 
-		switch(sbuf_fill_from_file(sb, manio->fzp, blk))
+		switch(manio->v2?
+			manio_v2_read(manio->v2, sb, blk, manio->views):
+			sbuf_fill_from_file(sb, manio->fzp, blk))
 		{
 			case 0: return 0; // Got something.
 			case 1: break; // Keep going.
@@ -442,7 +677,7 @@ int manio_read_with_blk(struct manio *manio, struct sbuf *sb, struct blk *blk)
 		// Reached the end of the current file.
 		// Maybe there is another file to continue with.
 		if(sort_and_write_hooks_and_dindex(manio)
-		  || fzp_close(&manio->fzp)) goto error;
+		  || manio_close_fzp(manio)) goto error;
 
 		if(is_single_file(manio)) return 1;
 	}
@@ -458,8 +693,10 @@ int manio_read(struct manio *manio, struct sbuf *sb)
 
 static int reset_sig_count_and_close(struct manio *manio)
 {
+	if(manio_close_fzp(manio)) return -1;
 	if(sort_and_write_hooks_and_dindex(manio)) return -1;
-	if(fzp_close(&manio->fzp)) return -1;
+	// So is the end of each chunk of it.
+	if(durable_commit(0)) return -1;
 	manio->sig_count=0;
 	if(manio_open_next_fpath(manio)) return -1;
 	return 0;
@@ -515,18 +752,25 @@ static int check_sig_count(struct manio *manio, struct blk *blk)
 	return 0;
 }
 
+int manio_write_iobuf(struct manio *manio, struct iobuf *iobuf)
+{
+	if(!manio_is_open(manio) && manio_open_next_fpath(manio)) return -1;
+	if(manio->v2)
+		return manio_v2_write_iobuf(manio->v2, iobuf);
+	return iobuf_send_msg_fzp(iobuf, manio->fzp);
+}
+
 static int write_sig_msg(struct manio *manio, struct blk *blk)
 {
 	struct iobuf wbuf;
-	if(!manio->fzp && manio_open_next_fpath(manio)) return -1;
+	if(!manio_is_open(manio) && manio_open_next_fpath(manio)) return -1;
 	blk_to_iobuf_sig_and_savepath(blk, &wbuf);
-	if(iobuf_send_msg_fzp(&wbuf, manio->fzp)) return -1;
+	if(manio_write_iobuf(manio, &wbuf)) return -1;
 	return check_sig_count(manio, blk);
 }
 
-int manio_write_sig_and_path(struct manio *manio, struct blk *blk)
+static void add_hook_and_dindex(struct manio *manio, struct blk *blk)
 {
-	if(manio->protocol==PROTO_1) return 0;
 	if(manio->hook_sort && blk_fingerprint_is_hook(blk))
 	{
 		// Add to list of hooks for this manifest chunk.
@@ -544,15 +788,175 @@ int manio_write_sig_and_path(struct manio *manio, struct blk *blk)
 			manio->dindex_sort[manio->dindex_count++]=savepath;
 		}
 	}
+}
+
+int manio_write_sig_and_path(struct manio *manio, struct blk *blk)
+{
+	if(manio->protocol==PROTO_1) return 0;
+	add_hook_and_dindex(manio, blk);
 	return write_sig_msg(manio, blk);
 }
 
 int manio_write_sbuf(struct manio *manio, struct sbuf *sb)
 {
-	if(!manio->fzp && manio_open_next_fpath(manio)) return -1;
+	if(!manio_is_open(manio) && manio_open_next_fpath(manio)) return -1;
+	if(manio->v2)
+		return manio_v2_write_sbuf(manio->v2, sb);
 	return sbuf_to_manifest(sb, manio->fzp);
 }
 
+// Signatures and the ends of files make up most of a protocol2 manifest.
+// While copying an entry, they are moved across as the bytes that were read,
+// without an allocation or a sscanf for each one. The data is kept lined up
+// so that the blk code can still load the numbers that the hooks, dindex and
+// chunk boundaries need straight out of it.
+#define RAW_LEAD	5
+#define RAW_DATA	8
+#define RAW_MAX		256
+
+struct raw_record
+{
+	enum cmd cmd;
+	size_t len;
+	// The text lead goes just before the data.
+	union { char c[RAW_DATA+RAW_MAX+1]; uint64_t v[1]; } buf;
+};
+
+static int raw_is_wanted(int cmd, size_t len)
+{
+	return (cmd==CMD_SIG || cmd==CMD_END_FILE) && len<=RAW_MAX;
+}
+
+static int hex_digit(char c)
+{
+	if(c>='0' && c<='9') return c-'0';
+	if(c>='A' && c<='F') return c-'A'+10;
+	if(c>='a' && c<='f') return c-'a'+10;
+	return -1;
+}
+
+// Return -1 for error, 0 for a record read, 1 for something else next.
+static int raw_read_fzp(struct fzp *fzp, struct raw_record *raw)
+{
+	int i;
+	int c;
+	int x;
+	char *lead=raw->buf.c+RAW_DATA-RAW_LEAD;
+
+	if((c=fzp_getc(fzp))==EOF)
+		return 1;
+	if(!raw_is_wanted(c, 0))
+	{
+		if(fzp_ungetc(fzp, c)==EOF)
+		{
+			logp("Could not push back manifest cmd in %s\n",
+				__func__);
+			return -1;
+		}
+		return 1;
+	}
+	lead[0]=(char)c;
+	if(fzp_read_ensure(fzp, lead+1, RAW_LEAD-1, __func__))
+		goto bad;
+	raw->len=0;
+	for(i=1; i<RAW_LEAD; i++)
+	{
+		if((x=hex_digit(lead[i]))<0)
+			goto bad;
+		raw->len=(raw->len<<4)|x;
+	}
+	if(!raw_is_wanted(c, raw->len)
+	  || fzp_read_ensure(fzp, raw->buf.c+RAW_DATA, raw->len+1, __func__)
+	  || raw->buf.c[RAW_DATA+raw->len]!='\n')
+		goto bad;
+	raw->cmd=(enum cmd)c;
+	return 0;
+bad:
+	logp("Bad manifest record in %s\n", __func__);
+	return -1;
+}
+
+static int raw_read_v2(struct manio_v2 *mv2, struct raw_record *raw)
+{
+	int ret;
+	struct iobuf rec;
+	if((ret=manio_v2_read_record(mv2, &rec)))
+		return ret;
+	if(!raw_is_wanted(rec.cmd, rec.len))
+	{
+		manio_v2_unread_record(mv2);
+		return 1;
+	}
+	raw->cmd=rec.cmd;
+	raw->len=rec.len;
+	memcpy(raw->buf.c+RAW_DATA, rec.buf, rec.len);
+	return 0;
+}
+
+static int raw_write(struct manio *manio, struct raw_record *raw)
+{
+	int i;
+	size_t len;
+	struct iobuf iobuf;
+	char *lead=raw->buf.c+RAW_DATA-RAW_LEAD;
+	static const char hex[]="0123456789ABCDEF";
+
+	if(!manio_is_open(manio) && manio_open_next_fpath(manio)) return -1;
+	if(manio->v2)
+	{
+		iobuf_set(&iobuf, raw->cmd, raw->buf.c+RAW_DATA, raw->len);
+		return manio_v2_write_iobuf(manio->v2, &iobuf);
+	}
+	lead[0]=(char)raw->cmd;
+	for(i=RAW_LEAD-1, len=raw->len; i>0; i--, len>>=4)
+		lead[i]=hex[len&0xF];
+	raw->buf.c[RAW_DATA+raw->len]='\n';
+	len=RAW_LEAD+raw->len+1;
+	if(fzp_write(manio->fzp, lead, len)!=len)
+	{
+		logp("Short write to %s in %s\n",
+			manio->offset->fpath, __func__);
+		return -1;
+	}
+	return 0;
+}
+
+// Copies signatures and ends of files until something else turns up, or the
+// current source file runs out. Either way, that is left for
+// manio_read_with_blk() to deal with.
+static int copy_raw_records(struct manio *srcmanio, struct manio *dstmanio,
+	struct blk *blk)
+{
+	int ret;
+	struct raw_record raw;
+	struct iobuf iobuf;
+
+	while(manio_is_open(srcmanio))
+	{
+		if((ret=srcmanio->v2?
+			raw_read_v2(srcmanio->v2, &raw):
+			raw_read_fzp(srcmanio->fzp, &raw)))
+				return ret<0?-1:0;
+		if(!dstmanio)
+			continue;
+		if(raw.cmd==CMD_END_FILE)
+		{
+			if(raw_write(dstmanio, &raw))
+				return -1;
+			continue;
+		}
+		iobuf_set(&iobuf, raw.cmd, raw.buf.c+RAW_DATA, raw.len);
+		if(blk_set_from_iobuf_sig_and_savepath(blk, &iobuf))
+			return -1;
+		add_hook_and_dindex(dstmanio, blk);
+		if(raw_write(dstmanio, &raw)
+		  || check_sig_count(dstmanio, blk))
+			return -1;
+		dstmanio->copied_raw++;
+	}
+	return 0;
+}
+
 // Return -1 on error, 0 on OK, 1 for srcmanio finished.
 int manio_copy_entry(struct sbuf *csb, struct sbuf *sb,
 	struct manio *srcmanio, struct manio *dstmanio)
@@ -581,6 +985,8 @@ int manio_copy_entry(struct sbuf *csb, struct sbuf *sb,
 		goto error;
 	while(1)
 	{
+		if(copy_raw_records(srcmanio, dstmanio, blk))
+			goto error;
 		if((ars=manio_read_with_blk(srcmanio, csb, blk))<0)
 			goto error;
 		else if(ars>0)
@@ -602,14 +1008,14 @@ int manio_copy_entry(struct sbuf *csb, struct sbuf *sb,
 		}
 		if(dstmanio)
 		{
-			if(!dstmanio->fzp
+			if(!manio_is_open(dstmanio)
 			  && manio_open_next_fpath(dstmanio))
 				goto error;
 
 			if(csb->endfile.buf)
 			{
-				if(iobuf_send_msg_fzp(&csb->endfile,
-					dstmanio->fzp)) goto error;
+				if(manio_write_iobuf(dstmanio,
+					&csb->endfile)) goto error;
 			}
 			else
 			{
@@ -617,6 +1023,7 @@ int manio_copy_entry(struct sbuf *csb, struct sbuf *sb,
 				// Write it to the destination manifest.
 				if(manio_write_sig_and_path(dstmanio, blk))
 					goto error;
+				dstmanio->copied_blk++;
 			}
 		}
 	}
@@ -637,14 +1044,15 @@ int manio_forward_through_sigs(struct sbuf *csb, struct manio *manio)
 man_off_t *manio_tell(struct manio *manio)
 {
 	man_off_t *offset=NULL;
-	if(!manio->fzp)
+	if(!manio_is_open(manio))
 	{
 		logp("manio_tell called on null fzp\n");
 		goto error;
 	}
 	if(!(offset=man_off_t_alloc())
 	  || !(offset->fpath=strdup_w(manio->offset->fpath, __func__))
-	  || (offset->offset=fzp_tell(manio->fzp))<0)
+	  || (offset->offset=manio->v2?
+		manio_v2_tell(manio->v2):fzp_tell(manio->fzp))<0)
 		goto error;
 	offset->fcount=manio->offset->fcount;
 	return offset;
@@ -656,9 +1064,21 @@ error:
 int manio_seek(struct manio *manio, man_off_t *offset)
 {
 	fzp_close(&manio->fzp);
-	if(!(manio->fzp=fzp_gzopen(offset->fpath, manio->mode))
-	  || fzp_seek(manio->fzp, offset->offset, SEEK_SET))
+	manio_v2_close(&manio->v2);
+	if(manio_open_fpath_compressed(manio, offset->fpath))
 		return -1;
+	// An offset of zero is the start of the file, where it already is.
+	// That is not a valid position inside manifest format 2.
+	if(offset->offset)
+	{
+		if(manio->v2)
+		{
+			if(manio_v2_seek(manio->v2, offset->offset))
+				return -1;
+		}
+		else if(fzp_seek(manio->fzp, offset->offset, SEEK_SET))
+			return -1;
+	}
 	man_off_t_free_content(manio->offset);
 	if(!(manio->offset->fpath=strdup_w(offset->fpath, __func__)))
 		return -1;
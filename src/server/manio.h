@@ -6,6 +6,9 @@
 #include "sdirs.h"
 
 struct blk;
+struct iobuf;
+struct manio_chunk;
+struct manio_v2;
 struct sbuf;
 
 struct man_off
@@ -25,6 +28,12 @@ typedef struct man_off man_off_t;
 struct manio
 {
 	struct fzp *fzp;	// File pointer.
+	struct manio_v2 *v2;	// Used instead of fzp for files in manifest
+				// format 2.
+	int write_v2;		// Whether to write new files in format 2.
+	int views;		// When reading format 2, fill sbufs in with
+				// views instead of allocating. See
+				// manio_v2_read().
 	char *manifest;
 	char *mode;		// Mode with which to open the files.
 	int sig_count;		// When writing, need to split the files
@@ -41,6 +50,21 @@ struct manio
 	int dindex_count;
 	enum protocol protocol;	// Whether running in protocol1/2 mode.
 	int phase;
+	uint64_t copied_raw;	// Signatures written by manio_copy_entry(),
+	uint64_t copied_blk;	// as the bytes that were read, or by going
+				// through a blk.
+	// When writing a final protocol2 manifest, the md5sum of the records
+	// in each chunk is kept, and written out at the end.
+	uint8_t *digests;
+	uint64_t digest_count;
+	// New chunks that come out the same as one in this manifest get linked
+	// to that one, instead of taking up more space. Sorted by md5sum.
+	char *reuse_manifest;
+	struct manio_chunk *reuse;
+	uint64_t reuse_count;
+	int reused;		// Whether the chunk just written was linked,
+	uint64_t reused_from;	// and to which one.
+	uint64_t chunks_reused;
 
 	man_off_t *offset;
 };
@@ -54,6 +78,9 @@ extern struct manio *manio_open_phase2(const char *manifest, const char *mode,
 extern struct manio *manio_open_phase3(const char *manifest, const char *mode,
 	enum protocol protocol, const char *rmanifest);
 extern int manio_close(struct manio **manio);
+// Link chunks that come out the same as the ones in the previous manifest
+// to those, and do the same with their dindex files.
+extern int manio_reuse_chunks_from(struct manio *manio, const char *manifest);
 
 extern int manio_read_fcount(struct manio *manio);
 
@@ -63,6 +90,8 @@ extern int manio_read(struct manio *manio, struct sbuf *sb);
 
 extern int manio_write_sig_and_path(struct manio *manio, struct blk *blk);
 extern int manio_write_sbuf(struct manio *manio, struct sbuf *sb);
+extern int manio_is_open(struct manio *manio);
+extern int manio_write_iobuf(struct manio *manio, struct iobuf *iobuf);
 
 extern int manio_copy_entry(struct sbuf *csb, struct sbuf *sb,
 	struct manio *srcmanio, struct manio *dstmanio);
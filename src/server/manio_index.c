@@ -0,0 +1,390 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../cmd.h"
+#include "../fsops.h"
+#include "../fzp.h"
+#include "../iobuf.h"
+#include "../log.h"
+#include "../msg.h"
+#include "../pathcmp.h"
+#include "../prepend.h"
+#include "../sbuf.h"
+#include "durable.h"
+#include "manio.h"
+#include "manio_index.h"
+
+// The index is a gzipped file of messages, in manifest order:
+//   CMD_FILE for a point that can be sought to, as
+//     '<chunk> <offset> <path>', with the numbers in hex.
+//   CMD_END_FILE after the last point of each chunk, as
+//     '<chunk> <path>', with the last path in the chunk.
+// Every chunk gets a point for its first entry, then another one every
+// MANIO_INDEX_INTERVAL entries.
+
+#define MANIO_INDEX_FILE	"index"
+#define MANIO_INDEX_INTERVAL	1024
+
+struct point
+{
+	uint64_t chunk;
+	off_t offset;
+	char *path;
+};
+
+struct manio_index
+{
+	struct point *points;
+	size_t count;
+	char **lasts; // The last path in each chunk.
+	size_t *firsts; // The first point in each chunk.
+	uint64_t chunks;
+};
+
+static int write_point(struct fzp *fzp,
+	uint64_t chunk, off_t offset, const char *path)
+{
+	int ret=-1;
+	char *msg=NULL;
+	size_t len=strlen(path)+40;
+	if(!(msg=(char *)malloc_w(len, __func__)))
+		goto end;
+	snprintf(msg, len, "%" PRIX64 " %" PRIX64 " %s",
+		chunk, (uint64_t)offset, path);
+	ret=send_msg_fzp(fzp, CMD_FILE, msg, strlen(msg));
+end:
+	free_w(&msg);
+	return ret;
+}
+
+static int write_chunk_end(struct fzp *fzp, uint64_t chunk, const char *last)
+{
+	int ret=-1;
+	char *msg=NULL;
+	size_t len=strlen(last)+20;
+	if(!(msg=(char *)malloc_w(len, __func__)))
+		goto end;
+	snprintf(msg, len, "%" PRIX64 " %s", chunk, last);
+	ret=send_msg_fzp(fzp, CMD_END_FILE, msg, strlen(msg));
+end:
+	free_w(&msg);
+	return ret;
+}
+
+static int set_last(char **last, size_t *alloc, struct iobuf *path)
+{
+	char *tmp;
+	if(path->len>=*alloc)
+	{
+		if(!(tmp=(char *)realloc_w(*last, path->len+1, __func__)))
+			return -1;
+		*last=tmp;
+		*alloc=path->len+1;
+	}
+	memcpy(*last, path->buf, path->len+1);
+	return 0;
+}
+
+int manio_index_write(const char *manifest)
+{
+	int ret=-1;
+	int was_open;
+	int have_chunk=0;
+	uint64_t chunk=0;
+	uint64_t fcount;
+	uint64_t entries=0;
+	off_t pos=0;
+	char *path=NULL;
+	char *tmp=NULL;
+	char *last=NULL;
+	size_t last_alloc=0;
+	struct fzp *fzp=NULL;
+	struct sbuf *sb=NULL;
+	struct manio *manio=NULL;
+	man_off_t *offset=NULL;
+
+	logp("Writing manifest index\n");
+
+	if(!(path=prepend_s(manifest, MANIO_INDEX_FILE))
+	  || !(tmp=prepend(path, ".tmp"))
+	  || !(manio=manio_open(manifest, "rb", PROTO_2))
+	  || !(sb=sbuf_alloc(PROTO_2))
+	  || !(fzp=fzp_gzopen(tmp, "wb")))
+		goto end;
+	manio->views=1;
+
+	while(1)
+	{
+		was_open=manio_is_open(manio);
+		fcount=manio->offset->fcount;
+		// Only ask where we are when the next entry might need a
+		// point.
+		man_off_t_free(&offset);
+		if(was_open
+		  && (!have_chunk || fcount-1!=chunk
+			|| !(entries%MANIO_INDEX_INTERVAL))
+		  && !(offset=manio_tell(manio)))
+			goto end;
+
+		switch(manio_read(manio, sb))
+		{
+			case 0: break;
+			case 1: goto finished;
+			default: goto end;
+		}
+		if(sb->endfile.buf)
+			continue;
+
+		// The manio has moved on to this chunk by now.
+		if(!have_chunk || manio->offset->fcount-1!=chunk)
+		{
+			if(have_chunk && write_chunk_end(fzp, chunk, last))
+				goto end;
+			chunk=manio->offset->fcount-1;
+			have_chunk=1;
+			entries=0;
+		}
+		if(!(entries++%MANIO_INDEX_INTERVAL))
+		{
+			// If reading this entry opened the chunk, the entry
+			// is at the start of it.
+			pos=0;
+			if(offset && manio->offset->fcount==fcount)
+				pos=offset->offset;
+			if(write_point(fzp, chunk, pos, sb->path.buf))
+				goto end;
+		}
+		if(set_last(&last, &last_alloc, &sb->path))
+			goto end;
+	}
+
+finished:
+	if(have_chunk && write_chunk_end(fzp, chunk, last))
+		goto end;
+	if(fzp_close(&fzp))
+	{
+		logp("Error closing %s in %s\n", tmp, __func__);
+		goto end;
+	}
+	if(do_rename(tmp, path)
+	  || durable_add_path(path))
+		goto end;
+	ret=0;
+end:
+	fzp_close(&fzp);
+	manio_close(&manio);
+	man_off_t_free(&offset);
+	sbuf_free(&sb);
+	free_w(&last);
+	free_w(&tmp);
+	free_w(&path);
+	return ret;
+}
+
+void manio_index_free(struct manio_index **index)
+{
+	size_t i;
+	if(!index || !*index) return;
+	for(i=0; i<(*index)->count; i++)
+		free_w(&(*index)->points[i].path);
+	for(i=0; i<(*index)->chunks; i++)
+		free_w(&(*index)->lasts[i]);
+	free_v((void **)&(*index)->points);
+	free_v((void **)&(*index)->lasts);
+	free_v((void **)&(*index)->firsts);
+	free_v((void **)index);
+}
+
+static int add_point(struct manio_index *index, struct iobuf *rbuf)
+{
+	int n=0;
+	uint64_t chunk;
+	uint64_t offset;
+	struct point *tmp;
+	if(sscanf(rbuf->buf, "%" SCNx64 " %" SCNx64 " %n",
+		&chunk, &offset, &n)!=2 || !n
+	  || chunk!=index->chunks)
+		return -1;
+	if(!(tmp=(struct point *)realloc_w(index->points,
+		(index->count+1)*sizeof(struct point), __func__)))
+			return -1;
+	index->points=tmp;
+	tmp=&index->points[index->count];
+	tmp->chunk=chunk;
+	tmp->offset=(off_t)offset;
+	if(!(tmp->path=strdup_w(rbuf->buf+n, __func__)))
+		return -1;
+	index->count++;
+	return 0;
+}
+
+static int add_chunk_end(struct manio_index *index, struct iobuf *rbuf)
+{
+	int n=0;
+	uint64_t chunk;
+	size_t first;
+	char **tmp;
+	size_t *firsts;
+	if(sscanf(rbuf->buf, "%" SCNx64 " %n", &chunk, &n)!=1 || !n
+	  || chunk!=index->chunks)
+		return -1;
+	// Every chunk has a point at its first entry.
+	first=index->chunks?index->firsts[index->chunks-1]:0;
+	for(; first<index->count && index->points[first].chunk!=chunk; first++)
+		{ }
+	if(first>=index->count)
+		return -1;
+	if(!(tmp=(char **)realloc_w(index->lasts,
+		(index->chunks+1)*sizeof(char *), __func__)))
+			return -1;
+	index->lasts=tmp;
+	if(!(firsts=(size_t *)realloc_w(index->firsts,
+		(index->chunks+1)*sizeof(size_t), __func__)))
+			return -1;
+	index->firsts=firsts;
+	index->firsts[index->chunks]=first;
+	if(!(index->lasts[index->chunks]=strdup_w(rbuf->buf+n, __func__)))
+		return -1;
+	index->chunks++;
+	return 0;
+}
+
+struct manio_index *manio_index_load(const char *manifest)
+{
+	int ret=-1;
+	char *path=NULL;
+	struct fzp *fzp=NULL;
+	struct iobuf rbuf;
+	struct stat statp;
+	struct manio_index *index=NULL;
+
+	iobuf_init(&rbuf);
+	if(!(path=prepend_s(manifest, MANIO_INDEX_FILE))
+	  || lstat(path, &statp)
+	  || !(index=(struct manio_index *)
+		calloc_w(1, sizeof(struct manio_index), __func__))
+	  || !(fzp=fzp_gzopen(path, "rb")))
+		goto end;
+	while(1)
+	{
+		iobuf_free_content(&rbuf);
+		switch(iobuf_fill_from_fzp(&rbuf, fzp))
+		{
+			case 0: break;
+			case 1: ret=0; goto end;
+			default: goto end;
+		}
+		switch(rbuf.cmd)
+		{
+			case CMD_FILE:
+				if(add_point(index, &rbuf))
+					goto bad;
+				break;
+			case CMD_END_FILE:
+				if(add_chunk_end(index, &rbuf))
+					goto bad;
+				break;
+			default:
+				goto bad;
+		}
+	}
+bad:
+	logp("Bad entry in %s: %s\n", path, iobuf_to_printable(&rbuf));
+end:
+	iobuf_free_content(&rbuf);
+	fzp_close(&fzp);
+	free_w(&path);
+	if(ret) manio_index_free(&index);
+	return index;
+}
+
+// Find the last point before anything that starts with prefix, or -1 if
+// there is none.
+static ssize_t find_point(struct manio_index *index, const char *prefix)
+{
+	ssize_t found=-1;
+	size_t low=0;
+	size_t high=index->count;
+	size_t mid;
+	while(low<high)
+	{
+		mid=low+(high-low)/2;
+		if(pathcmp(index->points[mid].path, prefix)<0)
+		{
+			found=(ssize_t)mid;
+			low=mid+1;
+		}
+		else
+			high=mid;
+	}
+	return found;
+}
+
+int manio_index_seek_in(struct manio_index *index,
+	struct manio *manio, const char *prefix)
+{
+	int ret=-1;
+	ssize_t i;
+	char tmp[32];
+	struct point *point;
+	man_off_t offset;
+
+	memset(&offset, 0, sizeof(offset));
+	if(manio->protocol!=PROTO_2
+	  || !prefix || !*prefix)
+		return 0;
+	if((i=find_point(index, prefix))<0)
+		// It is all at the start anyway.
+		return 0;
+	point=&index->points[i];
+	offset.fcount=point->chunk;
+	offset.offset=point->offset;
+	if(point->chunk<index->chunks
+	  && pathcmp(index->lasts[point->chunk], prefix)<0
+	  && point->chunk+1<index->chunks)
+	{
+		// Nothing else in this chunk is wanted, so start with the
+		// next one.
+		offset.fcount++;
+		offset.offset=0;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%08" PRIX64, offset.fcount++);
+	if(!(offset.fpath=prepend_s(manio->manifest, tmp))
+	  || manio_seek(manio, &offset))
+		goto end;
+	ret=1;
+end:
+	free_w(&offset.fpath);
+	return ret;
+}
+
+int manio_index_seek(struct manio *manio, const char *prefix)
+{
+	int ret;
+	struct manio_index *index=NULL;
+	if(manio->protocol!=PROTO_2
+	  || !prefix || !*prefix
+	  || !(index=manio_index_load(manio->manifest)))
+		return 0;
+	ret=manio_index_seek_in(index, manio, prefix);
+	manio_index_free(&index);
+	return ret;
+}
+
+uint64_t manio_index_chunks(struct manio_index *index)
+{
+	return index->chunks;
+}
+
+const char *manio_index_first(struct manio_index *index, uint64_t chunk)
+{
+	if(chunk>=index->chunks)
+		return NULL;
+	return index->points[index->firsts[chunk]].path;
+}
+
+int manio_index_past(const char *prefix, const char *path)
+{
+	return pathcmp(path, prefix)>0
+	  && strncmp(path, prefix, strlen(prefix));
+}
@@ -0,0 +1,39 @@
+#ifndef _MANIO_INDEX_H
+#define _MANIO_INDEX_H
+
+#include "manio.h"
+
+// An index of the paths in a finished protocol2 manifest, so that readers
+// that only want one part of the tree do not have to start at the
+// beginning. It is written into the manifest directory at the end of
+// phase4.
+
+struct manio_index;
+
+extern int manio_index_write(const char *manifest);
+
+// Move a manio that has just been opened for reading to somewhere before
+// the first entry whose path starts with prefix. Without an index, it is
+// left at the start.
+// Returns 1 if it moved, 0 if it was left at the start, or -1 on error.
+extern int manio_index_seek(struct manio *manio, const char *prefix);
+
+// The same, with an index that is already loaded, so that it can be used
+// many times, and from more than one thread at once.
+extern int manio_index_seek_in(struct manio_index *index,
+	struct manio *manio, const char *prefix);
+
+// Returns NULL if there is no index, or it could not be read.
+extern struct manio_index *manio_index_load(const char *manifest);
+extern void manio_index_free(struct manio_index **index);
+
+// Chunks are numbered from zero, like the files in the manifest directory.
+extern uint64_t manio_index_chunks(struct manio_index *index);
+extern const char *manio_index_first(struct manio_index *index,
+	uint64_t chunk);
+
+// Manifests are sorted, so once this returns 1, nothing further on in the
+// manifest can start with prefix.
+extern int manio_index_past(const char *prefix, const char *path);
+
+#endif
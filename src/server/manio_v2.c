@@ -0,0 +1,800 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../attribs.h"
+#include "../cmd.h"
+#include "../fsops.h"
+#include "../fzp.h"
+#include "../iobuf.h"
+#include "../log.h"
+#include "../protocol2/blk.h"
+#include "../sbuf.h"
+#include "manio_v2.h"
+
+// The file starts with the magic string and one byte for the codec. Then
+// there are blocks, each with a header of:
+//   the length of the records in the block, as four big endian bytes;
+//   the length of the block as stored, as four big endian bytes;
+//   the crc32 of the records, as four big endian bytes.
+// If the stored length is less than the length of the records, the block
+// was compressed with the codec. Otherwise it is stored as it is.
+// A block with no records marks the end, so a truncated file is noticed.
+//
+// Each record is:
+//   one byte for the cmd;
+//   the length of the data, as a varint;
+//   the data, followed by a zero byte so that it can be used as a string.
+// Records never cross from one block into the next, so a reader can hand out
+// pointers into the block that it has just decoded.
+//
+// The data for CMD_ATTRIBS is a varint count of fields, followed by each
+// field as a zigzag varint. Readers ignore fields that they do not know
+// about, and fields that are missing are zero.
+
+#define MANIO_V2_MAGIC		"burpman2"
+#define MANIO_V2_MAGIC_LEN	8
+#define MANIO_V2_HDR_LEN	(MANIO_V2_MAGIC_LEN+1)
+#define MANIO_V2_BLOCK_HDR_LEN	12
+// Start a new block once this much is in the current one.
+#define MANIO_V2_BLOCK_TARGET	65536
+// Bits of a position used for the offset of a record inside its block.
+#define MANIO_V2_POS_BITS	24
+#define MANIO_V2_BLOCK_MAX	((1<<MANIO_V2_POS_BITS)-1)
+#define MANIO_V2_RECORD_MAX	(1<<20)
+#define MANIO_V2_VARINT_MAX	10
+#define MANIO_V2_ATTR_FIELDS	17
+
+struct manio_v2
+{
+	struct fzp *fzp;
+	char *path;
+	uint8_t writing;
+	uint8_t finished;
+	enum manio_v2_codec codec;
+
+	// The records of the current block.
+	uint8_t *raw;
+	size_t raw_len;
+	size_t raw_alloc;
+	size_t raw_pos;
+	// Where the last record read starts, for stepping back over it.
+	size_t rec_pos;
+	// Where the current block starts in the file, and where the one after
+	// it starts.
+	off_t block_start;
+	off_t next_block;
+
+	// The block as stored.
+	uint8_t *zbuf;
+	size_t zbuf_alloc;
+
+	// Of the records written, whichever blocks they went into.
+	MD5_CTX md5;
+
+	// Attributes are turned back into text in here when reading views.
+	char attr[256];
+	// The blk code loads the numbers in a signature straight out of its
+	// buffer, so signatures are copied in here to line them up.
+	union { char c[32]; uint64_t v[4]; } sig;
+};
+
+static void put_be32(uint8_t *b, uint32_t v)
+{
+	v=htonl(v);
+	memcpy(b, &v, sizeof(v));
+}
+
+static uint32_t get_be32(const uint8_t *b)
+{
+	uint32_t v;
+	memcpy(&v, b, sizeof(v));
+	return ntohl(v);
+}
+
+static size_t varint_put(uint8_t *b, uint64_t v)
+{
+	size_t len=0;
+	while(v>=0x80)
+	{
+		b[len++]=(uint8_t)(v|0x80);
+		v>>=7;
+	}
+	b[len++]=(uint8_t)v;
+	return len;
+}
+
+static int varint_get(const uint8_t **b, const uint8_t *end, uint64_t *v)
+{
+	int s=0;
+	*v=0;
+	while(1)
+	{
+		if(*b>=end || s>63)
+			return -1;
+		*v|=(uint64_t)(**b&0x7F)<<s;
+		if(!(*(*b)++&0x80))
+			return 0;
+		s+=7;
+	}
+}
+
+static uint64_t zigzag(int64_t v)
+{
+	return ((uint64_t)v<<1)^(uint64_t)(v>>63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+	return (int64_t)(v>>1)^-(int64_t)(v&1);
+}
+
+static int corrupt(struct manio_v2 *mv2, const char *why)
+{
+	logp("Corrupt manifest file %s: %s\n", mv2->path, why);
+	return -1;
+}
+
+static int reserve(uint8_t **buf, size_t *alloc, size_t want)
+{
+	uint8_t *tmp;
+	if(want<=*alloc)
+		return 0;
+	if(want<*alloc*2)
+		want=*alloc*2;
+	if(!(tmp=(uint8_t *)realloc_w(*buf, want, __func__)))
+		return -1;
+	*buf=tmp;
+	*alloc=want;
+	return 0;
+}
+
+int manio_v2_sniff(const char *path)
+{
+	int ret=-1;
+	struct fzp *fzp=NULL;
+	char magic[MANIO_V2_MAGIC_LEN];
+
+	if(!(fzp=fzp_open(path, "rb")))
+		goto end;
+	// Anything too short for the magic string is not format 2.
+	ret=fzp_read(fzp, magic, sizeof(magic))==sizeof(magic)
+	  && !memcmp(magic, MANIO_V2_MAGIC, sizeof(magic));
+end:
+	fzp_close(&fzp);
+	return ret;
+}
+
+static void manio_v2_free(struct manio_v2 **mv2)
+{
+	if(!mv2 || !*mv2) return;
+	fzp_close(&(*mv2)->fzp);
+	free_w(&(*mv2)->path);
+	free_v((void **)&(*mv2)->raw);
+	free_v((void **)&(*mv2)->zbuf);
+	free_v((void **)mv2);
+}
+
+static int open_for_write(struct manio_v2 *mv2)
+{
+	uint8_t hdr[MANIO_V2_HDR_LEN];
+
+	if(unlink_for_write(mv2->path, __func__)
+	  || !(mv2->fzp=fzp_open(mv2->path, "wb")))
+		return -1;
+	if(!MD5_Init(&mv2->md5))
+	{
+		logp("MD5_Init() failed for %s\n", mv2->path);
+		return -1;
+	}
+	memcpy(hdr, MANIO_V2_MAGIC, MANIO_V2_MAGIC_LEN);
+	hdr[MANIO_V2_MAGIC_LEN]=(uint8_t)mv2->codec;
+	if(fzp_write(mv2->fzp, hdr, sizeof(hdr))!=sizeof(hdr))
+	{
+		logp("Could not write header to %s\n", mv2->path);
+		return -1;
+	}
+	mv2->block_start=MANIO_V2_HDR_LEN;
+	return 0;
+}
+
+static int open_for_read(struct manio_v2 *mv2)
+{
+	uint8_t hdr[MANIO_V2_HDR_LEN];
+
+	if(!(mv2->fzp=fzp_open(mv2->path, "rb")))
+		return -1;
+	if(fzp_read_ensure(mv2->fzp, hdr, sizeof(hdr), __func__)
+	  || memcmp(hdr, MANIO_V2_MAGIC, MANIO_V2_MAGIC_LEN))
+		return corrupt(mv2, "bad header");
+	switch(hdr[MANIO_V2_MAGIC_LEN])
+	{
+		case MANIO_V2_CODEC_NONE:
+		case MANIO_V2_CODEC_DEFLATE:
+			mv2->codec=(enum manio_v2_codec)hdr[MANIO_V2_MAGIC_LEN];
+			break;
+		default:
+			return corrupt(mv2, "unknown codec");
+	}
+	mv2->next_block=MANIO_V2_HDR_LEN;
+	return 0;
+}
+
+struct manio_v2 *manio_v2_open(const char *path, const char *mode,
+	enum manio_v2_codec codec)
+{
+	struct manio_v2 *mv2=NULL;
+
+	if(!(mv2=(struct manio_v2 *)
+		calloc_w(1, sizeof(struct manio_v2), __func__))
+	  || !(mv2->path=strdup_w(path, __func__)))
+		goto error;
+	mv2->codec=codec;
+	if(*mode=='w')
+	{
+		mv2->writing=1;
+		if(open_for_write(mv2))
+			goto error;
+	}
+	else if(open_for_read(mv2))
+		goto error;
+	return mv2;
+error:
+	manio_v2_free(&mv2);
+	return NULL;
+}
+
+static int flush_block(struct manio_v2 *mv2)
+{
+	uLongf zlen;
+	size_t stored_len;
+	const uint8_t *stored;
+	uint8_t hdr[MANIO_V2_BLOCK_HDR_LEN];
+
+	stored=mv2->raw;
+	stored_len=mv2->raw_len;
+	if(!MD5_Update(&mv2->md5, mv2->raw, mv2->raw_len))
+	{
+		logp("MD5_Update() failed for %s\n", mv2->path);
+		return -1;
+	}
+	if(mv2->codec==MANIO_V2_CODEC_DEFLATE && mv2->raw_len)
+	{
+		zlen=compressBound((uLong)mv2->raw_len);
+		if(reserve(&mv2->zbuf, &mv2->zbuf_alloc, zlen))
+			return -1;
+		if(compress2(mv2->zbuf, &zlen, mv2->raw,
+			(uLong)mv2->raw_len, Z_BEST_SPEED)!=Z_OK)
+		{
+			logp("Could not compress block for %s\n", mv2->path);
+			return -1;
+		}
+		// Keep it as it is if compressing did not help.
+		if(zlen<mv2->raw_len)
+		{
+			stored=mv2->zbuf;
+			stored_len=zlen;
+		}
+	}
+
+	put_be32(hdr, (uint32_t)mv2->raw_len);
+	put_be32(hdr+4, (uint32_t)stored_len);
+	put_be32(hdr+8, (uint32_t)crc32(0, mv2->raw, (uInt)mv2->raw_len));
+	if(fzp_write(mv2->fzp, hdr, sizeof(hdr))!=sizeof(hdr)
+	  || (stored_len
+		&& fzp_write(mv2->fzp, stored, stored_len)!=stored_len))
+	{
+		logp("Could not write block to %s\n", mv2->path);
+		return -1;
+	}
+	mv2->block_start+=sizeof(hdr)+stored_len;
+	mv2->raw_len=0;
+	return 0;
+}
+
+static size_t record_need(size_t len)
+{
+	return 1+MANIO_V2_VARINT_MAX+len+1;
+}
+
+// Start a new block if the current one cannot take need more bytes.
+static int make_room(struct manio_v2 *mv2, size_t need)
+{
+	if(mv2->raw_len
+	  && mv2->raw_len+need>MANIO_V2_BLOCK_TARGET)
+		return flush_block(mv2);
+	return 0;
+}
+
+// Returns somewhere to put a record with len bytes of data.
+static uint8_t *record_start(struct manio_v2 *mv2, enum cmd cmd, size_t len)
+{
+	uint8_t *b;
+	size_t need=record_need(len);
+
+	if(len>=MANIO_V2_RECORD_MAX)
+	{
+		logp("Record too long for %s: %lu\n",
+			mv2->path, (unsigned long)len);
+		return NULL;
+	}
+	if(make_room(mv2, need))
+		return NULL;
+	if(reserve(&mv2->raw, &mv2->raw_alloc, mv2->raw_len+need))
+		return NULL;
+	b=mv2->raw+mv2->raw_len;
+	*b++=(uint8_t)cmd;
+	b+=varint_put(b, len);
+	return b;
+}
+
+static void record_end(struct manio_v2 *mv2, uint8_t *b)
+{
+	*b++=0;
+	mv2->raw_len=b-mv2->raw;
+}
+
+static int write_record(struct manio_v2 *mv2,
+	enum cmd cmd, const char *buf, size_t len)
+{
+	uint8_t *b;
+	if(!(b=record_start(mv2, cmd, len)))
+		return -1;
+	memcpy(b, buf, len);
+	record_end(mv2, b+len);
+	return 0;
+}
+
+int manio_v2_write_iobuf(struct manio_v2 *mv2, struct iobuf *iobuf)
+{
+	return write_record(mv2, iobuf->cmd, iobuf->buf, iobuf->len);
+}
+
+static int write_attribs(struct manio_v2 *mv2, struct sbuf *sb)
+{
+	int i=0;
+	size_t len=0;
+	uint8_t *b;
+	int64_t f[MANIO_V2_ATTR_FIELDS];
+	uint8_t data[MANIO_V2_VARINT_MAX*(MANIO_V2_ATTR_FIELDS+1)];
+	struct stat *statp=&sb->statp;
+
+	f[i++]=sb->compression;
+	f[i++]=sb->encryption;
+	f[i++]=statp->st_dev;
+	f[i++]=statp->st_ino;
+	f[i++]=statp->st_mode;
+	f[i++]=statp->st_nlink;
+	f[i++]=statp->st_uid;
+	f[i++]=statp->st_gid;
+	f[i++]=statp->st_rdev;
+	f[i++]=statp->st_size;
+#ifdef HAVE_WIN32
+	f[i++]=0;
+	f[i++]=0;
+#else
+	f[i++]=statp->st_blksize;
+	f[i++]=statp->st_blocks;
+#endif
+	f[i++]=statp->st_atime;
+	f[i++]=statp->st_mtime;
+	f[i++]=statp->st_ctime;
+#ifdef HAVE_CHFLAGS
+	f[i++]=statp->st_flags;
+#else
+	f[i++]=0;
+#endif
+	f[i++]=(int64_t)sb->winattr;
+
+	len+=varint_put(data+len, MANIO_V2_ATTR_FIELDS);
+	for(i=0; i<MANIO_V2_ATTR_FIELDS; i++)
+		len+=varint_put(data+len, zigzag(f[i]));
+	if(!(b=record_start(mv2, CMD_ATTRIBS, len)))
+		return -1;
+	memcpy(b, data, len);
+	record_end(mv2, b+len);
+	return 0;
+}
+
+int manio_v2_write_sbuf(struct manio_v2 *mv2, struct sbuf *sb)
+{
+	if(!sb->path.buf) return 0;
+	if(!sb->protocol2)
+	{
+		logp("%s only handles protocol2\n", __func__);
+		return -1;
+	}
+	// Keep the records for the entry in one block, so that readers of
+	// views get all of them at once.
+	if(make_room(mv2,
+		record_need(MANIO_V2_VARINT_MAX*(MANIO_V2_ATTR_FIELDS+1))
+		+record_need(sb->path.len)
+		+(sb->link.buf?record_need(sb->link.len):0)))
+			return -1;
+	if(write_attribs(mv2, sb)
+	  || manio_v2_write_iobuf(mv2, &sb->path))
+		return -1;
+	if(sb->link.buf
+	  && manio_v2_write_iobuf(mv2, &sb->link))
+		return -1;
+	if(sb->endfile.buf
+	  && manio_v2_write_iobuf(mv2, &sb->endfile))
+		return -1;
+	return 0;
+}
+
+static int read_block(struct manio_v2 *mv2)
+{
+	size_t raw_len;
+	size_t stored_len;
+	uint8_t hdr[MANIO_V2_BLOCK_HDR_LEN];
+
+	mv2->raw_len=0;
+	mv2->raw_pos=0;
+	mv2->block_start=mv2->next_block;
+	switch(fzp_read_ensure(mv2->fzp, hdr, sizeof(hdr), __func__))
+	{
+		case 0: break;
+		case 1: return corrupt(mv2, "no end marker");
+		default: return -1;
+	}
+	raw_len=get_be32(hdr);
+	stored_len=get_be32(hdr+4);
+	if(!raw_len)
+	{
+		mv2->finished=1;
+		return 1;
+	}
+	if(raw_len>MANIO_V2_BLOCK_MAX
+	  || stored_len>raw_len
+	  || (stored_len<raw_len && mv2->codec==MANIO_V2_CODEC_NONE))
+		return corrupt(mv2, "bad block header");
+	mv2->next_block=mv2->block_start+sizeof(hdr)+stored_len;
+	if(reserve(&mv2->raw, &mv2->raw_alloc, raw_len))
+		return -1;
+	if(stored_len==raw_len)
+	{
+		if(fzp_read_ensure(mv2->fzp, mv2->raw, raw_len, __func__))
+			return corrupt(mv2, "short block");
+	}
+	else
+	{
+		uLongf zlen=(uLongf)raw_len;
+		if(reserve(&mv2->zbuf, &mv2->zbuf_alloc, stored_len))
+			return -1;
+		if(fzp_read_ensure(mv2->fzp, mv2->zbuf, stored_len, __func__))
+			return corrupt(mv2, "short block");
+		if(uncompress(mv2->raw, &zlen, mv2->zbuf,
+			(uLong)stored_len)!=Z_OK
+		  || zlen!=raw_len)
+			return corrupt(mv2, "could not decompress block");
+	}
+	if(get_be32(hdr+8)!=(uint32_t)crc32(0, mv2->raw, (uInt)raw_len))
+		return corrupt(mv2, "checksum mismatch");
+	mv2->raw_len=raw_len;
+	return 0;
+}
+
+// Points rec at the next record, reading the next block if needed.
+static int next_record(struct manio_v2 *mv2, struct iobuf *rec)
+{
+	int ret;
+	uint64_t len;
+	const uint8_t *b;
+	const uint8_t *end;
+
+	if(mv2->finished)
+		return 1;
+	if(mv2->raw_pos>=mv2->raw_len
+	  && (ret=read_block(mv2)))
+		return ret;
+
+	mv2->rec_pos=mv2->raw_pos;
+	b=mv2->raw+mv2->raw_pos;
+	end=mv2->raw+mv2->raw_len;
+	rec->cmd=(enum cmd)*b++;
+	if(varint_get(&b, end, &len)
+	  || len>=(uint64_t)(end-b))
+		return corrupt(mv2, "bad record length");
+	rec->buf=(char *)b;
+	rec->len=(size_t)len;
+	if(b[len])
+		return corrupt(mv2, "record not terminated");
+	mv2->raw_pos=(b+len+1)-mv2->raw;
+	return 0;
+}
+
+static struct iobuf *aligned_sig(struct manio_v2 *mv2, struct iobuf *rec,
+	struct iobuf *sig)
+{
+	// Leave anything too long for the blk code to complain about.
+	if(rec->len>sizeof(mv2->sig))
+		return rec;
+	memcpy(mv2->sig.c, rec->buf, rec->len);
+	iobuf_set(sig, rec->cmd, mv2->sig.c, rec->len);
+	return sig;
+}
+
+// Do casting according to unknown type to keep compiler happy.
+#define plug(st, val) st = (__typeof__(st))(val)
+
+static int read_attribs(struct manio_v2 *mv2, struct sbuf *sb,
+	struct iobuf *rec, int views)
+{
+	int i;
+	char *cp;
+	uint64_t n;
+	uint64_t v;
+	int64_t f[MANIO_V2_ATTR_FIELDS];
+	struct stat *statp=&sb->statp;
+	const uint8_t *b=(const uint8_t *)rec->buf;
+	const uint8_t *end=b+rec->len;
+
+	memset(f, 0, sizeof(f));
+	if(varint_get(&b, end, &n))
+		return corrupt(mv2, "bad attributes");
+	for(i=0; (uint64_t)i<n; i++)
+	{
+		if(varint_get(&b, end, &v))
+			return corrupt(mv2, "bad attributes");
+		if(i<MANIO_V2_ATTR_FIELDS)
+			f[i]=unzigzag(v);
+	}
+
+	i=0;
+	sb->compression=(int32_t)f[i++];
+	sb->encryption=(int32_t)f[i++];
+	plug(statp->st_dev, f[i++]);
+	plug(statp->st_ino, f[i++]);
+	plug(statp->st_mode, f[i++]);
+	plug(statp->st_nlink, f[i++]);
+	plug(statp->st_uid, f[i++]);
+	plug(statp->st_gid, f[i++]);
+	plug(statp->st_rdev, f[i++]);
+	plug(statp->st_size, f[i++]);
+#ifdef HAVE_WIN32
+	i+=2;
+#else
+	plug(statp->st_blksize, f[i++]);
+	plug(statp->st_blocks, f[i++]);
+#endif
+	plug(statp->st_atime, f[i++]);
+	plug(statp->st_mtime, f[i++]);
+	plug(statp->st_ctime, f[i++]);
+#ifdef HAVE_CHFLAGS
+	plug(statp->st_flags, f[i++]);
+#else
+	i++;
+#endif
+	sb->winattr=(uint64_t)f[i++];
+
+	// Other code wants the attributes as text too. Like the gzipped
+	// format, the file index is not kept, so leave it off the front.
+	sb->protocol2->index=0;
+	sb->attr.buf=views?mv2->attr:NULL;
+	if(attribs_encode(sb))
+		return -1;
+	if(!(cp=strchr(sb->attr.buf, ' ')))
+		return corrupt(mv2, "could not encode attributes");
+	sb->attr.len-=cp-sb->attr.buf;
+	if(views)
+		sb->attr.buf=cp;
+	else
+		memmove(sb->attr.buf, cp, sb->attr.len+1);
+	sb->attr.cmd=CMD_ATTRIBS;
+	return 0;
+}
+
+static int set_field(struct iobuf *field, struct iobuf *rec, int views)
+{
+	if(views)
+	{
+		iobuf_copy(field, rec);
+		return 0;
+	}
+	iobuf_free_content(field);
+	field->cmd=rec->cmd;
+	field->len=rec->len;
+	if(!(field->buf=(char *)malloc_w(rec->len+1, __func__)))
+		return -1;
+	memcpy(field->buf, rec->buf, rec->len+1);
+	return 0;
+}
+
+// Make sure that the sbuf is holding only views or only its own memory.
+static void prepare_sbuf(struct sbuf *sb, int views)
+{
+	if(views)
+	{
+		if(sb->flags & SBUF_VIEW)
+			return;
+		sbuf_free_content(sb);
+		sb->flags|=SBUF_VIEW;
+	}
+	else if(sb->flags & SBUF_VIEW)
+		sbuf_free_content(sb);
+}
+
+int manio_v2_read(struct manio_v2 *mv2, struct sbuf *sb,
+	struct blk *blk, int views)
+{
+	int ret;
+	struct iobuf rec;
+	struct iobuf sig;
+
+	if(!sb->protocol2)
+	{
+		logp("%s only handles protocol2\n", __func__);
+		return -1;
+	}
+
+	while(1)
+	{
+		if((ret=next_record(mv2, &rec)))
+			return ret;
+		switch(rec.cmd)
+		{
+			case CMD_ATTRIBS:
+				sbuf_free_content(sb);
+				if(views)
+					sb->flags|=SBUF_VIEW;
+				if(read_attribs(mv2, sb, &rec, views))
+					return -1;
+				continue;
+
+			case CMD_FILE:
+			case CMD_DIRECTORY:
+			case CMD_SOFT_LINK:
+			case CMD_HARD_LINK:
+			case CMD_SPECIAL:
+			case CMD_ENC_FILE:
+			case CMD_METADATA:
+			case CMD_ENC_METADATA:
+			case CMD_EFS_FILE:
+			case CMD_VSS:
+			case CMD_ENC_VSS:
+			case CMD_VSS_T:
+			case CMD_ENC_VSS_T:
+				if(!sb->attr.buf)
+					return corrupt(mv2,
+						"read cmd with no attribs");
+				prepare_sbuf(sb, views);
+				if(sb->flags & SBUF_NEED_LINK)
+				{
+					if(!cmd_is_link(rec.cmd))
+						return corrupt(mv2,
+						  "got non-link after link");
+					if(set_field(&sb->link, &rec, views))
+						return -1;
+					sb->flags &= ~SBUF_NEED_LINK;
+					return 0;
+				}
+				if(set_field(&sb->path, &rec, views))
+					return -1;
+				if(cmd_is_link(rec.cmd))
+				{
+					sb->flags |= SBUF_NEED_LINK;
+					continue;
+				}
+				return 0;
+
+			case CMD_SIG:
+				// Fill in the sig/block, if the caller
+				// provided a pointer for one.
+				if(!blk)
+					continue;
+				if(blk_set_from_iobuf_sig_and_savepath(blk,
+					aligned_sig(mv2, &rec, &sig)))
+						return -1;
+				blk->got_save_path=1;
+				return 0;
+
+			case CMD_FINGERPRINT:
+				if(blk
+				  && blk_set_from_iobuf_fingerprint(blk,
+					aligned_sig(mv2, &rec, &sig)))
+					return -1;
+				// Fall through.
+			case CMD_MANIFEST:
+				prepare_sbuf(sb, views);
+				if(set_field(&sb->path, &rec, views))
+					return -1;
+				return 0;
+
+			case CMD_END_FILE:
+				prepare_sbuf(sb, views);
+				if(set_field(&sb->endfile, &rec, views))
+					return -1;
+				return 0;
+
+			default:
+				iobuf_log_unexpected(&rec, __func__);
+				return -1;
+		}
+	}
+}
+
+int manio_v2_read_record(struct manio_v2 *mv2, struct iobuf *rec)
+{
+	return next_record(mv2, rec);
+}
+
+void manio_v2_unread_record(struct manio_v2 *mv2)
+{
+	mv2->raw_pos=mv2->rec_pos;
+}
+
+off_t manio_v2_tell(struct manio_v2 *mv2)
+{
+	if(mv2->writing)
+		return (mv2->block_start<<MANIO_V2_POS_BITS)|mv2->raw_len;
+	if(mv2->raw_pos>=mv2->raw_len)
+		// At the end of this block, which is the same as the start
+		// of the next one.
+		return mv2->next_block<<MANIO_V2_POS_BITS;
+	return (mv2->block_start<<MANIO_V2_POS_BITS)|mv2->raw_pos;
+}
+
+int manio_v2_seek(struct manio_v2 *mv2, off_t pos)
+{
+	int ret;
+	off_t block_start=pos>>MANIO_V2_POS_BITS;
+	size_t raw_pos=(size_t)(pos&MANIO_V2_BLOCK_MAX);
+
+	if(mv2->writing)
+	{
+		logp("%s only works when reading\n", __func__);
+		return -1;
+	}
+	mv2->finished=0;
+	if(block_start<MANIO_V2_HDR_LEN
+	  || fzp_seek(mv2->fzp, block_start, SEEK_SET))
+	{
+		logp("Could not seek to %" PRId64 " in %s\n",
+			(int64_t)pos, mv2->path);
+		return -1;
+	}
+	mv2->next_block=block_start;
+	if(!raw_pos)
+	{
+		// The next read will get the block.
+		mv2->raw_len=0;
+		mv2->raw_pos=0;
+		return 0;
+	}
+	if((ret=read_block(mv2)))
+		return ret<0?-1:corrupt(mv2, "seek past the end");
+	if(raw_pos>mv2->raw_len)
+		return corrupt(mv2, "seek past the end of a block");
+	mv2->raw_pos=raw_pos;
+	return 0;
+}
+
+int manio_v2_close(struct manio_v2 **mv2)
+{
+	return manio_v2_close_with_digest(mv2, NULL);
+}
+
+int manio_v2_close_with_digest(struct manio_v2 **mv2, uint8_t *digest)
+{
+	int ret=0;
+	if(!mv2 || !*mv2) return 0;
+	if((*mv2)->writing && (*mv2)->fzp)
+	{
+		// Flush what is left, then the end marker.
+		if(((*mv2)->raw_len && flush_block(*mv2))
+		  || flush_block(*mv2))
+			ret=-1;
+		if(digest && !MD5_Final(digest, &(*mv2)->md5))
+		{
+			logp("MD5_Final() failed for %s\n", (*mv2)->path);
+			ret=-1;
+		}
+		if(fzp_close(&(*mv2)->fzp))
+		{
+			logp("Error closing %s in %s\n",
+				(*mv2)->path, __func__);
+			ret=-1;
+		}
+	}
+	manio_v2_free(mv2);
+	return ret;
+}
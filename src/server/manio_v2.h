@@ -0,0 +1,61 @@
+#ifndef _MANIO_V2_H
+#define _MANIO_V2_H
+
+#include "../burp.h"
+
+struct blk;
+struct iobuf;
+struct sbuf;
+
+// Manifest format 2, for protocol2 manifest files. The records are the same
+// as in the gzipped format, but with binary lengths and attributes, inside
+// independently compressed blocks.
+
+enum manio_v2_codec
+{
+	MANIO_V2_CODEC_NONE=0,
+	MANIO_V2_CODEC_DEFLATE=1,
+};
+
+struct manio_v2;
+
+// Returns 1 if the file at path is in format 2, 0 if it is not, or -1 on
+// error.
+extern int manio_v2_sniff(const char *path);
+
+// The mode is "rb" or "wb". When writing, codec picks how blocks get
+// compressed. When reading, it is taken from the file.
+extern struct manio_v2 *manio_v2_open(const char *path, const char *mode,
+	enum manio_v2_codec codec);
+extern int manio_v2_close(struct manio_v2 **mv2);
+// When writing, also gives the md5sum of all of the records that were
+// written. It does not depend on how they were split into blocks or
+// compressed.
+extern int manio_v2_close_with_digest(struct manio_v2 **mv2,
+	uint8_t *digest);
+
+extern int manio_v2_write_iobuf(struct manio_v2 *mv2, struct iobuf *iobuf);
+// Protocol2 sbufs only.
+extern int manio_v2_write_sbuf(struct manio_v2 *mv2, struct sbuf *sb);
+
+// Return -1 for error, 0 for stuff read OK, 1 for end of file.
+// With views set, the sbuf fields point into the block that was read
+// instead of being allocated, and stay valid until the next read.
+extern int manio_v2_read(struct manio_v2 *mv2, struct sbuf *sb,
+	struct blk *blk, int views);
+
+// Points rec at the next record as it is stored, without decoding it. It
+// stays valid until the next read. Return -1 for error, 0 for OK, 1 for end
+// of file.
+extern int manio_v2_read_record(struct manio_v2 *mv2, struct iobuf *rec);
+// Steps back over the record that was just read, so that the next read gets
+// it again.
+extern void manio_v2_unread_record(struct manio_v2 *mv2);
+
+// Positions are the offset of a block in the file, and of a record in the
+// block, packed into one number.
+extern off_t manio_v2_tell(struct manio_v2 *mv2);
+// Reading only.
+extern int manio_v2_seek(struct manio_v2 *mv2, off_t pos);
+
+#endif
@@ -72,8 +72,9 @@ static int browse_manifest_start(struct cstat *cstat,
 	  || !(manio=manio_open(manifest, "rb", cstat->protocol))
 	  || !(sb=sbuf_alloc(cstat->protocol)))
 		goto end;
+	manio->views=1;
 	if(use_cache)
-		ret=cache_load(manio, sb, cstat->name, bu->bno);
+		ret=cache_load(manio, cstat->name, bu->bno);
 	else
 		ret=do_browse_manifest(manio, sb, browse);
 end:
@@ -94,9 +95,21 @@ int browse_manifest(struct cstat *cstat,
 	}
 	if(use_cache)
 	{
-		if(!cache_loaded(cstat->name, bu->bno)
-		  && browse_manifest_start(cstat, bu, browse, use_cache))
-			return -1;
+		if(!cache_loaded(cstat->name, bu->bno))
+		{
+			// Backups from before phase4 wrote a browse tree need
+			// it built from the manifest.
+			switch(cache_map(bu->path, cstat->name, bu->bno))
+			{
+				case 0: break;
+				case 1:
+					if(browse_manifest_start(cstat,
+						bu, browse, use_cache))
+							return -1;
+					break;
+				default: return -1;
+			}
+		}
 		return cache_lookup(browse);
 	}
 	return browse_manifest_start(cstat, bu, browse, use_cache);
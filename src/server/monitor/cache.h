@@ -2,8 +2,10 @@
 #define _CACHE_H
 
 extern int cache_loaded(const char *cname, unsigned long bno);
-extern int cache_load(struct manio *manio, struct sbuf *sb,
-	const char *cname, unsigned long bno);
+// Returns 1 if the backup directory has no tree to map.
+extern int cache_map(const char *dir, const char *cname, unsigned long bno);
+extern int cache_load(struct manio *manio, const char *cname,
+	unsigned long bno);
 extern int cache_lookup(const char *browse);
 extern void cache_free(void);
 
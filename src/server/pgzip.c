@@ -0,0 +1,559 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../log.h"
+#include "pgzip.h"
+
+#include <zlib.h>
+
+// Each block is deflated as raw deflate data that ends with a sync flush,
+// so that it finishes on a byte boundary and the next block can follow on
+// straight after it. An empty final block and the gzip trailer finish the
+// file. The check value of the whole file is put together from the check
+// values of the blocks.
+// The threads only deflate. The caller collects the finished blocks in
+// order, writes them and does all the logging.
+
+// How much input goes into each block.
+#define PGZIP_BLOCK		131072
+// How much of the previous input each block is primed with. This is as
+// far back as deflate can look.
+#define PGZIP_DICT		32768
+// How many blocks each thread can have waiting for each file, before the
+// file has to wait for them to be written out.
+#define PGZIP_AHEAD		2
+// A level that no stream has, for when there is no stream set up yet.
+#define PGZIP_NO_STREAM		(Z_DEFAULT_COMPRESSION-1)
+
+struct pgzip_job
+{
+	uint8_t *in;
+	size_t in_len;
+	uint8_t dict[PGZIP_DICT];
+	size_t dict_len;
+	int level;
+
+	int done;
+	int ret;
+	uLong crc;
+	uint8_t *out;
+	size_t out_len;
+
+	// The next block of the same file.
+	struct pgzip_job *next;
+	// The next job in the queue of the pool.
+	struct pgzip_job *qnext;
+};
+
+struct pgzip_pool;
+
+struct pgzip
+{
+	char *path;
+	FILE *fp;
+	int level;
+	int error;
+
+	// The block that is being filled, and what comes before it.
+	uint8_t *in;
+	size_t in_len;
+	uint8_t dict[PGZIP_DICT];
+	size_t dict_len;
+
+	// Blocks that have been handed out, but not written yet.
+	struct pgzip_job *head;
+	struct pgzip_job *tail;
+	int waiting;
+
+	uLong crc;
+	uint64_t total;
+
+	struct pgzip_pool *pool;
+	// For deflating without a pool.
+	z_stream strm;
+	int strm_level;
+};
+
+static void job_free(struct pgzip_job **job)
+{
+	if(!job || !*job) return;
+	free_v((void **)&(*job)->in);
+	free_v((void **)&(*job)->out);
+	free_v((void **)job);
+}
+
+// Returns 0 for OK, -1 for error.
+static int deflate_block(z_stream *strm, int *strm_level,
+	struct pgzip_job *job)
+{
+	int ret;
+	size_t alloc;
+	uint8_t *out;
+
+	if(*strm_level!=job->level)
+	{
+		if(*strm_level!=PGZIP_NO_STREAM)
+			deflateEnd(strm);
+		*strm_level=PGZIP_NO_STREAM;
+		memset(strm, 0, sizeof(z_stream));
+		if(deflateInit2(strm, job->level, Z_DEFLATED,
+			-MAX_WBITS, 8, Z_DEFAULT_STRATEGY)!=Z_OK)
+				return -1;
+		*strm_level=job->level;
+	}
+	else if(deflateReset(strm)!=Z_OK)
+		return -1;
+	if(job->dict_len
+	  && deflateSetDictionary(strm, job->dict, (uInt)job->dict_len)!=Z_OK)
+		return -1;
+
+	job->crc=crc32(crc32(0L, Z_NULL, 0), job->in, (uInt)job->in_len);
+
+	alloc=deflateBound(strm, (uLong)job->in_len)+16;
+	if(!(job->out=(uint8_t *)malloc_w(alloc, __func__)))
+		return -1;
+	strm->next_in=job->in;
+	strm->avail_in=(uInt)job->in_len;
+	while(1)
+	{
+		strm->next_out=job->out+job->out_len;
+		strm->avail_out=(uInt)(alloc-job->out_len);
+		ret=deflate(strm, Z_SYNC_FLUSH);
+		job->out_len=alloc-strm->avail_out;
+		if(ret!=Z_OK && ret!=Z_BUF_ERROR)
+			return -1;
+		// If the output filled up, there may be more to come.
+		if(!strm->avail_in && strm->avail_out)
+			return 0;
+		alloc*=2;
+		if(!(out=(uint8_t *)realloc_w(job->out, alloc, __func__)))
+			return -1;
+		job->out=out;
+	}
+}
+
+static void end_stream(z_stream *strm, int *strm_level)
+{
+	if(*strm_level!=PGZIP_NO_STREAM)
+		deflateEnd(strm);
+	*strm_level=PGZIP_NO_STREAM;
+}
+
+#ifdef HAVE_PTHREAD
+
+#include <pthread.h>
+
+struct pgzip_pool
+{
+	pthread_mutex_t lock;
+	pthread_cond_t work; // Threads wait on this.
+	pthread_cond_t done; // Files wait on this.
+	int stop;
+	struct pgzip_job *queue;
+	struct pgzip_job *queue_tail;
+	int threads;
+	int started;
+	pthread_t *workers;
+	// The pool does not survive a fork, so a child has to set up its
+	// own.
+	pid_t pid;
+};
+
+static int pool_threads=0;
+static struct pgzip_pool *pool=NULL;
+// Files can be opened on more than one thread.
+static pthread_mutex_t pool_lock=PTHREAD_MUTEX_INITIALIZER;
+
+static void *pool_worker(void *arg)
+{
+	int strm_level=PGZIP_NO_STREAM;
+	z_stream strm;
+	struct pgzip_job *job;
+	struct pgzip_pool *p=(struct pgzip_pool *)arg;
+
+	pthread_mutex_lock(&p->lock);
+	while(1)
+	{
+		while(!p->stop && !p->queue)
+			pthread_cond_wait(&p->work, &p->lock);
+		if(p->stop)
+			break;
+		job=p->queue;
+		if(!(p->queue=job->qnext))
+			p->queue_tail=NULL;
+		pthread_mutex_unlock(&p->lock);
+
+		job->ret=deflate_block(&strm, &strm_level, job);
+
+		pthread_mutex_lock(&p->lock);
+		job->done=1;
+		pthread_cond_broadcast(&p->done);
+	}
+	pthread_mutex_unlock(&p->lock);
+	end_stream(&strm, &strm_level);
+	return NULL;
+}
+
+static void pool_free(struct pgzip_pool **p)
+{
+	int i;
+	if(!p || !*p) return;
+	// Only the process that started the threads can stop them.
+	if((*p)->pid==getpid())
+	{
+		pthread_mutex_lock(&(*p)->lock);
+		(*p)->stop=1;
+		pthread_cond_broadcast(&(*p)->work);
+		pthread_mutex_unlock(&(*p)->lock);
+		for(i=0; i<(*p)->started; i++)
+			pthread_join((*p)->workers[i], NULL);
+		pthread_cond_destroy(&(*p)->work);
+		pthread_cond_destroy(&(*p)->done);
+		pthread_mutex_destroy(&(*p)->lock);
+	}
+	free_v((void **)&(*p)->workers);
+	free_v((void **)p);
+}
+
+static struct pgzip_pool *pool_alloc(int threads)
+{
+	struct pgzip_pool *p;
+	if(!(p=(struct pgzip_pool *)
+		calloc_w(1, sizeof(struct pgzip_pool), __func__)))
+			return NULL;
+	p->pid=getpid();
+	p->threads=threads;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->work, NULL);
+	pthread_cond_init(&p->done, NULL);
+	if(!(p->workers=(pthread_t *)
+		calloc_w(threads, sizeof(pthread_t), __func__)))
+			goto error;
+	for(p->started=0; p->started<threads; p->started++)
+	{
+		if(pthread_create(&p->workers[p->started], NULL,
+			pool_worker, p))
+		{
+			logp("Could not start compression thread %d\n",
+				p->started);
+			goto error;
+		}
+	}
+	return p;
+error:
+	pool_free(&p);
+	return NULL;
+}
+
+// If the pool cannot be set up, the blocks get deflated by whoever writes
+// them instead.
+static struct pgzip_pool *pool_get(void)
+{
+	struct pgzip_pool *p;
+	pthread_mutex_lock(&pool_lock);
+	if(pool && pool->pid!=getpid())
+		pool_free(&pool);
+	if(!pool && pool_threads>0)
+		pool=pool_alloc(pool_threads);
+	p=pool;
+	pthread_mutex_unlock(&pool_lock);
+	return p;
+}
+
+void pgzip_set_threads(int threads)
+{
+	if(threads<0)
+		threads=0;
+	pthread_mutex_lock(&pool_lock);
+	if(threads!=pool_threads)
+		pool_free(&pool);
+	pool_threads=threads;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+int pgzip_get_threads(void)
+{
+	return pool_threads;
+}
+
+static void pool_add(struct pgzip_pool *p, struct pgzip_job *job)
+{
+	pthread_mutex_lock(&p->lock);
+	if(p->queue_tail)
+		p->queue_tail->qnext=job;
+	else
+		p->queue=job;
+	p->queue_tail=job;
+	pthread_cond_signal(&p->work);
+	pthread_mutex_unlock(&p->lock);
+}
+
+// Returns 1 if the oldest block of the file is finished, waiting for it if
+// the file has more than keep blocks out.
+static int pool_wait(struct pgzip_pool *p, struct pgzip *pz, int keep)
+{
+	int done;
+	pthread_mutex_lock(&p->lock);
+	while(!pz->head->done && pz->waiting>keep)
+		pthread_cond_wait(&p->done, &p->lock);
+	done=pz->head->done;
+	pthread_mutex_unlock(&p->lock);
+	return done;
+}
+
+#else
+
+void pgzip_set_threads(int threads)
+{
+}
+
+int pgzip_get_threads(void)
+{
+	return 0;
+}
+
+#endif
+
+// Returns 0 for OK, -1 for error.
+static int write_out(struct pgzip *pz, const void *buf, size_t len)
+{
+	if(len && fwrite(buf, 1, len, pz->fp)!=len)
+	{
+		logp("Could not write to %s: %s\n", pz->path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// Writes out the finished blocks at the front of the list, waiting for
+// them while more than keep blocks are out.
+// Returns 0 for OK, -1 for error.
+static int collect(struct pgzip *pz, int keep)
+{
+	int ret=0;
+	struct pgzip_job *job;
+	while((job=pz->head))
+	{
+#ifdef HAVE_PTHREAD
+		if(pz->pool && !pool_wait(pz->pool, pz, keep))
+			return 0;
+#endif
+		if(!(pz->head=job->next))
+			pz->tail=NULL;
+		pz->waiting--;
+		if(job->ret)
+		{
+			logp("Could not compress a block of %s\n", pz->path);
+			ret=-1;
+		}
+		else
+		{
+			pz->crc=crc32_combine(pz->crc, job->crc,
+				(z_off_t)job->in_len);
+			ret=write_out(pz, job->out, job->out_len);
+		}
+		job_free(&job);
+		if(ret)
+			return ret;
+	}
+	return 0;
+}
+
+// Makes sure that nothing is left with the threads, whatever happened.
+static void abandon(struct pgzip *pz)
+{
+	struct pgzip_job *job;
+	while((job=pz->head))
+	{
+#ifdef HAVE_PTHREAD
+		if(pz->pool)
+			pool_wait(pz->pool, pz, 0);
+#endif
+		pz->head=job->next;
+		job_free(&job);
+	}
+	pz->tail=NULL;
+	pz->waiting=0;
+}
+
+// Keeps the end of the input, to prime the next block with.
+static void keep_dict(struct pgzip *pz, const uint8_t *buf, size_t len)
+{
+	size_t keep;
+	if(len>=PGZIP_DICT)
+	{
+		memcpy(pz->dict, buf+len-PGZIP_DICT, PGZIP_DICT);
+		pz->dict_len=PGZIP_DICT;
+		return;
+	}
+	keep=PGZIP_DICT-len;
+	if(keep<pz->dict_len)
+	{
+		memmove(pz->dict, pz->dict+pz->dict_len-keep, keep);
+		pz->dict_len=keep;
+	}
+	memcpy(pz->dict+pz->dict_len, buf, len);
+	pz->dict_len+=len;
+}
+
+// Hands the block that is being filled over to be deflated.
+// Returns 0 for OK, -1 for error.
+static int submit(struct pgzip *pz)
+{
+	struct pgzip_job *job;
+	if(!pz->in_len)
+		return 0;
+	if(!(job=(struct pgzip_job *)
+		calloc_w(1, sizeof(struct pgzip_job), __func__)))
+			return -1;
+	job->in=pz->in;
+	job->in_len=pz->in_len;
+	job->level=pz->level;
+	memcpy(job->dict, pz->dict, pz->dict_len);
+	job->dict_len=pz->dict_len;
+	keep_dict(pz, job->in, job->in_len);
+	pz->total+=job->in_len;
+	pz->in=NULL;
+	pz->in_len=0;
+
+	if(pz->tail)
+		pz->tail->next=job;
+	else
+		pz->head=job;
+	pz->tail=job;
+	pz->waiting++;
+
+#ifdef HAVE_PTHREAD
+	if(pz->pool)
+	{
+		pool_add(pz->pool, job);
+		return collect(pz, pz->pool->threads*PGZIP_AHEAD);
+	}
+#endif
+	job->ret=deflate_block(&pz->strm, &pz->strm_level, job);
+	job->done=1;
+	return collect(pz, 0);
+}
+
+static void pgzip_free(struct pgzip **pz)
+{
+	if(!pz || !*pz) return;
+	abandon(*pz);
+	end_stream(&(*pz)->strm, &(*pz)->strm_level);
+	free_v((void **)&(*pz)->in);
+	free_w(&(*pz)->path);
+	free_v((void **)pz);
+}
+
+struct pgzip *pgzip_open(const char *path, int level)
+{
+	struct pgzip *pz;
+	// No file name, no modification time, and made on Unix.
+	static const uint8_t header[10]={
+		0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3 };
+
+	if(!(pz=(struct pgzip *)calloc_w(1, sizeof(struct pgzip), __func__))
+	  || !(pz->path=strdup_w(path, __func__)))
+		goto error;
+	pz->level=level;
+	pz->strm_level=PGZIP_NO_STREAM;
+	pz->crc=crc32(0L, Z_NULL, 0);
+	if(!(pz->fp=fopen(path, "wb")))
+	{
+		logp("could not open %s: %s\n", path, strerror(errno));
+		goto error;
+	}
+#ifdef HAVE_PTHREAD
+	pz->pool=pool_get();
+#endif
+	if(write_out(pz, header, sizeof(header)))
+		goto error;
+	return pz;
+error:
+	if(pz && pz->fp)
+		fclose(pz->fp);
+	pgzip_free(&pz);
+	return NULL;
+}
+
+size_t pgzip_write(struct pgzip *pz, const void *buf, size_t len)
+{
+	size_t n;
+	size_t done=0;
+	if(pz->error)
+		return 0;
+	while(done<len)
+	{
+		if(!pz->in && !(pz->in=(uint8_t *)
+			malloc_w(PGZIP_BLOCK, __func__)))
+				goto error;
+		n=PGZIP_BLOCK-pz->in_len;
+		if(n>len-done)
+			n=len-done;
+		memcpy(pz->in+pz->in_len, (const uint8_t *)buf+done, n);
+		pz->in_len+=n;
+		done+=n;
+		if(pz->in_len==PGZIP_BLOCK && submit(pz))
+			goto error;
+	}
+	return len;
+error:
+	pz->error=1;
+	return 0;
+}
+
+int pgzip_flush(struct pgzip *pz)
+{
+	if(pz->error
+	  || submit(pz)
+	  || collect(pz, 0))
+		goto error;
+	if(fflush(pz->fp))
+	{
+		logp("Could not flush %s: %s\n", pz->path, strerror(errno));
+		goto error;
+	}
+	return 0;
+error:
+	pz->error=1;
+	return -1;
+}
+
+off_t pgzip_tell(struct pgzip *pz)
+{
+	return (off_t)(pz->total+pz->in_len);
+}
+
+static void put_le32(uint8_t *buf, uint32_t n)
+{
+	int i;
+	for(i=0; i<4; i++, n>>=8)
+		buf[i]=n&0xFF;
+}
+
+int pgzip_close(struct pgzip **pz)
+{
+	int ret=-1;
+	uint8_t trailer[10];
+	if(!pz || !*pz) return 0;
+	if((*pz)->error
+	  || submit(*pz)
+	  || collect(*pz, 0))
+		goto end;
+	// An empty final block with fixed codes, then the check value and
+	// the length.
+	trailer[0]=0x03;
+	trailer[1]=0x00;
+	put_le32(trailer+2, (uint32_t)(*pz)->crc);
+	put_le32(trailer+6, (uint32_t)((*pz)->total&0xFFFFFFFF));
+	if(write_out(*pz, trailer, sizeof(trailer)))
+		goto end;
+	ret=0;
+end:
+	if(fclose((*pz)->fp))
+	{
+		logp("fclose of %s failed: %s\n", (*pz)->path, strerror(errno));
+		ret=-1;
+	}
+	pgzip_free(pz);
+	return ret;
+}
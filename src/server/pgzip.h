@@ -0,0 +1,27 @@
+#ifndef _PGZIP_H
+#define _PGZIP_H
+
+// Writes gzip files with the deflating spread over a pool of threads, in
+// the way that pigz does. The input is cut into blocks, and each block is
+// deflated on its own, primed with the end of the block before so that
+// little is lost in compression. The blocks are written out in order as
+// one ordinary gzip stream, so anything that reads gzip can read it.
+// There is one pool per process, shared by every file being written.
+
+struct pgzip;
+
+// With 0 threads, nothing is set up and fzp_gzopen() uses zlib as usual.
+// Call it before opening any files. Changing it stops the current pool.
+extern void pgzip_set_threads(int threads);
+extern int pgzip_get_threads(void);
+
+// The level is a zlib compression level.
+extern struct pgzip *pgzip_open(const char *path, int level);
+extern size_t pgzip_write(struct pgzip *pz, const void *buf, size_t len);
+// Writes out everything so far.
+extern int pgzip_flush(struct pgzip *pz);
+// The number of uncompressed bytes written so far.
+extern off_t pgzip_tell(struct pgzip *pz);
+extern int pgzip_close(struct pgzip **pz);
+
+#endif
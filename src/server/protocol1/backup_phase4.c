@@ -13,6 +13,7 @@
 #include "../../prepend.h"
 #include "../../sbuf.h"
 #include "../../strlist.h"
+#include "../browse_tree.h"
 #include "../child.h"
 #include "../compress.h"
 #include "../timestamp.h"
@@ -25,7 +26,10 @@
 
 #include <librsync.h>
 
-// Also used by restore.c.
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 // FIX THIS: This stuff is very similar to make_rev_delta, can maybe share
 // some code.
 int do_patch(const char *dst, const char *del,
@@ -143,7 +147,34 @@ end:
 	return ret;
 }
 
-static int gen_rev_delta(const char *sigpath, const char *deltadir,
+// A changed file, that needs its forward delta applying to the old file,
+// and then a reverse delta generating.
+struct patch
+{
+	struct sbuf *sb;
+	char *oldpath;
+	char *newpath;
+	char *finpath;
+	char *deltafpath;
+	int ret;
+	int done;
+	// What there is to say about it. The worker threads cannot log, so
+	// this gets logged by finish_patch() instead.
+	char *msgs;
+};
+
+static void patch_msg(struct patch *patch, const char *fmt, ...)
+{
+	char buf[512]="";
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	astrcat(&patch->msgs, buf, __func__);
+}
+
+static int gen_rev_delta(struct patch *patch,
+	const char *sigpath, const char *deltadir,
 	const char *oldpath, const char *finpath, const char *path,
 	struct sbuf *sb, struct conf **cconfs)
 {
@@ -151,7 +182,7 @@ static int gen_rev_delta(const char *sigpath, const char *deltadir,
 	char *delpath=NULL;
 	if(!(delpath=prepend_s(deltadir, path)))
 	{
-		log_out_of_memory(__func__);
+		patch_msg(patch, "out of memory in %s\n", __func__);
 		goto end;
 	}
 	//logp("Generating reverse delta...\n");
@@ -163,19 +194,21 @@ static int gen_rev_delta(const char *sigpath, const char *deltadir,
 */
 	if(mkpath(&delpath, deltadir))
 	{
-		logp("could not mkpaths for: %s\n", delpath);
+		patch_msg(patch, "could not mkpaths for: %s\n", delpath);
 		goto end;
 	}
 	else if(make_rev_sig(finpath, sigpath,
 		sb->endfile.buf, sb->compression, cconfs))
 	{
-		logp("could not make signature from: %s\n", finpath);
+		patch_msg(patch, "could not make signature from: %s\n",
+			finpath);
 		goto end;
 	}
 	else if(make_rev_delta(oldpath, sigpath,
 		delpath, sb->compression, cconfs))
 	{
-		logp("could not make delta from: %s\n", oldpath);
+		patch_msg(patch, "could not make delta from: %s\n",
+			oldpath);
 		goto end;
 	}
 	else unlink(sigpath);	
@@ -186,7 +219,8 @@ end:
 	return ret;
 }
 
-static int inflate_oldfile(const char *opath, const char *infpath,
+static int inflate_oldfile(struct patch *patch,
+	const char *opath, const char *infpath,
 	struct stat *statp, struct cntr *cntr)
 {
 	int ret=0;
@@ -198,33 +232,35 @@ static int inflate_oldfile(const char *opath, const char *infpath,
 		// just close the destination and we have duplicated a
 		// zero length file.
 		if(!(dest=fzp_open(infpath, "wb"))) goto end;
-		logp("asked to inflate zero length file: %s\n", opath);
+		patch_msg(patch,
+			"asked to inflate zero length file: %s\n", opath);
 		if(fzp_close(&dest))
-			logp("error closing %s in %s\n", infpath, __func__);
+			patch_msg(patch, "error closing %s in %s\n",
+				infpath, __func__);
 	}
 	else if(zlib_inflate(NULL, opath, infpath, cntr))
 	{
-		logp("zlib_inflate returned error\n");
+		patch_msg(patch, "zlib_inflate returned error\n");
 		ret=-1;
 	}
 end:
 	return ret;
 }
 
-static int inflate_or_link_oldfile(const char *oldpath, const char *infpath,
-	int compression, struct conf **cconfs)
+static int inflate_or_link_oldfile(struct patch *patch,
+	const char *oldpath, const char *infpath,
+	int compression, struct cntr *cntr, struct conf **cconfs)
 {
 	struct stat statp;
 
 	if(lstat(oldpath, &statp))
 	{
-		logp("could not lstat %s\n", oldpath);
+		patch_msg(patch, "could not lstat %s\n", oldpath);
 		return -1;
 	}
 
 	if(dpth_protocol1_is_compressed(compression, oldpath))
-		return inflate_oldfile(oldpath, infpath, &statp,
-			get_cntr(cconfs));
+		return inflate_oldfile(patch, oldpath, infpath, &statp, cntr);
 
 	// If it was not a compressed file, just hard link it.
 	// It is possible that infpath already exists, if the server
@@ -233,80 +269,148 @@ static int inflate_or_link_oldfile(const char *oldpath, const char *infpath,
 		1 /* allow overwrite of infpath */);
 }
 
+// How many patches each thread can have queued up, before reading the
+// manifest waits for the oldest one to finish.
+#define PATCHES_AHEAD	4
+
+// Patches changed files, either one at a time as the manifest is read, or
+// on a pool of threads. Each file is independent of the others, and an
+// interrupted phase4 redoes any file that does not have its finished path
+// in place, so the files can be done in any order. The results are dealt
+// with in manifest order, so that the deletions file stays sorted.
+// The worker threads do not touch the counters, or the deletions file, and
+// leave their messages with the patch for the main process to log.
+struct patcher
+{
+	struct fdirs *fdirs;
+	const char *deltabdir;
+	const char *deltafdir;
+	const char *sigpath;
+	int hardlinked_current;
+	struct conf **cconfs;
+	struct fzp *delfp;
+
+	int threads;
+	int started;
+	struct patch_worker *workers;
+	struct patch *queue;
+	size_t alloc;
+	uint64_t added;
+	uint64_t taken;
+	uint64_t retired;
+	int stop;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+};
+
+struct patch_worker
+{
+	struct patcher *patcher;
+	int id;
+#ifdef HAVE_PTHREAD
+	pthread_t thread;
+#endif
+};
+
+static void lock(struct patcher *p)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&p->lock);
+#endif
+}
+
+static void unlock(struct patcher *p)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&p->lock);
+#endif
+}
+
+static void wake(struct patcher *p)
+{
+#ifdef HAVE_PTHREAD
+	pthread_cond_broadcast(&p->cond);
+#endif
+}
+
+static void patch_free_content(struct patch *patch)
+{
+	sbuf_free(&patch->sb);
+	free_w(&patch->msgs);
+	free_w(&patch->oldpath);
+	free_w(&patch->newpath);
+	free_w(&patch->finpath);
+	free_w(&patch->deltafpath);
+	memset(patch, 0, sizeof(struct patch));
+}
+
+// Each thread gets its own temporary files. Without threads, the names are
+// the same as they have always been.
+static int get_tmp_paths(struct patcher *p, struct patch *patch, int id,
+	char **infpath, char **sigpath)
+{
+	char suffix[16]="";
+	if(id>=0)
+		snprintf(suffix, sizeof(suffix), ".%d", id);
+	if(!(*infpath=prepend_s(p->deltafdir, "inflate"))
+	  || astrcat(infpath, suffix, __func__)
+	  || !(*sigpath=strdup_w(p->sigpath, __func__))
+	  || astrcat(sigpath, suffix, __func__))
+	{
+		patch_msg(patch, "out of memory in %s\n", __func__);
+		return -1;
+	}
+	return 0;
+}
+
+// Returns -1 on error, 0 if the file was patched, or 1 if librsync could
+// not patch it and the entry needs removing from the manifest.
 static int forward_patch_and_reverse_diff(
-	struct fdirs *fdirs,
-	struct fzp **delfp,
-	const char *deltabdir,
-	const char *deltafdir,
-	const char *deltafpath,
+	struct patcher *p,
+	struct patch *patch,
+	const char *infpath,
 	const char *sigpath,
-	const char *oldpath,
-	const char *newpath,
-	const char *datapth,
-	const char *finpath,
-	int hardlinked_current,
-	struct sbuf *sb,
-	struct conf **cconfs
+	struct cntr *cntr
 )
 {
 	int lrs;
-	int ret=-1;
-	char *infpath=NULL;
+	struct sbuf *sb=patch->sb;
+	const char *datapth=sb->protocol1->datapth.buf;
 
 	// Got a forward patch to do.
 	// First, need to gunzip the old file, otherwise the librsync patch
 	// will take forever, because it will be doing seeks all over the
 	// place, and gzseeks are slow.
-	if(!(infpath=prepend_s(deltafdir, "inflate")))
-	{
-		log_out_of_memory(__func__);
-		goto end;
-	}
-
 	//logp("Fixing up: %s\n", datapth);
-	if(inflate_or_link_oldfile(oldpath, infpath, sb->compression, cconfs))
+	if(inflate_or_link_oldfile(patch, patch->oldpath, infpath,
+		sb->compression, cntr, p->cconfs))
 	{
-		logp("error when inflating old file: %s\n", oldpath);
-		goto end;
+		patch_msg(patch, "error when inflating old file: %s\n",
+			patch->oldpath);
+		return -1;
 	}
 
-	if((lrs=do_patch(infpath, deltafpath, newpath,
+	if((lrs=do_patch(infpath, patch->deltafpath, patch->newpath,
 		sb->compression, sb->compression /* from manifest */)))
 	{
-		logp("WARNING: librsync error when patching %s: %d\n",
-			oldpath, lrs);
-		cntr_add(get_cntr(cconfs), CMD_WARNING, 1);
+		patch_msg(patch,
+			"WARNING: librsync error when patching %s: %d\n",
+			patch->oldpath, lrs);
 		// Try to carry on with the rest of the backup regardless.
 		// Remove anything that got written.
-		unlink(newpath);
-
-		// First, note that we want to remove this entry from
-		// the manifest.
-		if(!*delfp
-		  && !(*delfp=fzp_open(fdirs->deletionsfile, "ab")))
-		{
-			// Could not mark this file as deleted. Fatal.
-			goto end;
-		}
-		if(sbuf_to_manifest(sb, *delfp))
-			goto end;
-		if(fzp_flush(*delfp))
-		{
-			logp("error fflushing deletions file in %s: %s\n",
-				__func__, strerror(errno));
-			goto end;
-		}
-		ret=0;
-		goto end;
+		unlink(patch->newpath);
+		return 1;
 	}
 
 	// Need to generate a reverse diff, unless we are keeping a hardlinked
 	// archive.
-	if(!hardlinked_current)
+	if(!p->hardlinked_current)
 	{
-		if(gen_rev_delta(sigpath, deltabdir,
-			oldpath, newpath, datapth, sb, cconfs))
-				goto end;
+		if(gen_rev_delta(patch, sigpath, p->deltabdir, patch->oldpath,
+			patch->newpath, datapth, sb, p->cconfs))
+				return -1;
 	}
 
 	// Power interruptions should be recoverable. If it happens before this
@@ -316,37 +420,251 @@ static int forward_patch_and_reverse_diff(
 	// Use the fresh new file.
 	// Rename race condition is of no consequence, because finpath will
 	// just get recreated automatically.
-	if(do_rename(newpath, finpath))
-		goto end;
+	if(do_rename(patch->newpath, patch->finpath))
+		return -1;
 
 	// Remove the forward delta, as it is no longer needed. There is a
 	// reverse diff and the finished finished file is in place.
 	//logp("Deleting delta.forward...\n");
-	unlink(deltafpath);
+	unlink(patch->deltafpath);
 
 	// Remove the old file. If a power cut happens just before this, the
 	// old file will hang around forever.
 	// FIX THIS: maybe put in something to detect this.
 	// ie, both a reverse delta and the old file exist.
-	if(!hardlinked_current)
+	if(!p->hardlinked_current)
 	{
 		//logp("Deleting oldpath...\n");
-		unlink(oldpath);
+		unlink(patch->oldpath);
 	}
 
-	ret=0;
-end:
+	return 0;
+}
+
+static int run_patch(struct patcher *p, struct patch *patch, int id,
+	struct cntr *cntr)
+{
+	int ret=-1;
+	char *infpath=NULL;
+	char *sigpath=NULL;
+	if(!get_tmp_paths(p, patch, id, &infpath, &sigpath))
+		ret=forward_patch_and_reverse_diff(p, patch,
+			infpath, sigpath, cntr);
 	if(infpath)
 	{
 		unlink(infpath);
 		free_w(&infpath);
 	}
+	free_w(&sigpath);
 	return ret;
 }
 
-static int jiggle(struct sdirs *sdirs, struct fdirs *fdirs, struct sbuf *sb,
+static void log_patch_msgs(struct patch *patch)
+{
+	char *cp;
+	char *nl;
+	for(cp=patch->msgs; cp && *cp; cp=nl+1)
+	{
+		if(!(nl=strchr(cp, '\n')))
+		{
+			logp("%s\n", cp);
+			break;
+		}
+		logp("%.*s\n", (int)(nl-cp), cp);
+	}
+}
+
+static int finish_patch(struct patcher *p, struct patch *patch)
+{
+	log_patch_msgs(patch);
+	if(patch->ret<=0)
+		return patch->ret;
+
+	cntr_add(get_cntr(p->cconfs), CMD_WARNING, 1);
+
+	// Note that we want to remove this entry from the manifest.
+	if(!p->delfp
+	  && !(p->delfp=fzp_open(p->fdirs->deletionsfile, "ab")))
+	{
+		// Could not mark this file as deleted. Fatal.
+		return -1;
+	}
+	if(sbuf_to_manifest(patch->sb, p->delfp))
+		return -1;
+	if(fzp_flush(p->delfp))
+	{
+		logp("error fflushing deletions file in %s: %s\n",
+			__func__, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+#ifdef HAVE_PTHREAD
+static void *patch_worker(void *arg)
+{
+	struct patch *patch;
+	struct patch_worker *w=(struct patch_worker *)arg;
+	struct patcher *p=w->patcher;
+
+	lock(p);
+	while(1)
+	{
+		while(!p->stop && p->taken==p->added)
+			pthread_cond_wait(&p->cond, &p->lock);
+		if(p->stop)
+			break;
+		patch=&p->queue[p->taken++%p->alloc];
+		unlock(p);
+		patch->ret=run_patch(p, patch, w->id, NULL /* cntr */);
+		lock(p);
+		patch->done=1;
+		wake(p);
+	}
+	unlock(p);
+	return NULL;
+}
+
+static void patcher_start(struct patcher *p)
+{
+	int t;
+	if(!p->threads)
+		return;
+	p->alloc=p->threads*PATCHES_AHEAD;
+	if(!(p->queue=(struct patch *)
+		calloc_w(p->alloc, sizeof(struct patch), __func__))
+	  || !(p->workers=(struct patch_worker *)
+		calloc_w(p->threads, sizeof(struct patch_worker), __func__)))
+			goto end;
+	for(t=0; t<p->threads; t++)
+	{
+		p->workers[t].patcher=p;
+		p->workers[t].id=t;
+		if(pthread_create(&p->workers[t].thread, NULL,
+			patch_worker, &p->workers[t]))
+				break;
+		p->started++;
+	}
+end:
+	// Fall back to patching everything here.
+	if(!p->started)
+		free_v((void **)&p->queue);
+	else
+		logp("Patching changed files with %d thread%s\n",
+			p->started, p->started==1?"":"s");
+}
+
+static void patcher_stop(struct patcher *p)
+{
+	int t;
+	lock(p);
+	p->stop=1;
+	wake(p);
+	unlock(p);
+	for(t=0; t<p->started; t++)
+		pthread_join(p->workers[t].thread, NULL);
+	p->started=0;
+}
+#endif
+
+static void patcher_init(struct patcher *p, struct fdirs *fdirs,
+	const char *deltabdir, const char *deltafdir, const char *sigpath,
+	int hardlinked_current, struct conf **cconfs)
+{
+	memset(p, 0, sizeof(struct patcher));
+	p->fdirs=fdirs;
+	p->deltabdir=deltabdir;
+	p->deltafdir=deltafdir;
+	p->sigpath=sigpath;
+	p->hardlinked_current=hardlinked_current;
+	p->cconfs=cconfs;
+#ifdef HAVE_PTHREAD
+	p->threads=get_int(cconfs[OPT_DELTA_THREADS]);
+	if(p->threads<0)
+		p->threads=0;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	patcher_start(p);
+#endif
+}
+
+static void patcher_free_content(struct patcher *p)
+{
+#ifdef HAVE_PTHREAD
+	patcher_stop(p);
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->cond);
+#endif
+	for(; p->queue && p->retired<p->added; p->retired++)
+		patch_free_content(&p->queue[p->retired%p->alloc]);
+	free_v((void **)&p->queue);
+	free_v((void **)&p->workers);
+	fzp_close(&p->delfp);
+}
+
+// Deals with the finished patches in the order that they were added, waiting
+// until no more than 'left' are outstanding.
+static int patcher_retire(struct patcher *p, uint64_t left)
+{
+	int done;
+	struct patch *patch;
+	while(p->retired<p->added)
+	{
+		patch=&p->queue[p->retired%p->alloc];
+		lock(p);
+#ifdef HAVE_PTHREAD
+		while(!patch->done && p->added-p->retired>left)
+			pthread_cond_wait(&p->cond, &p->lock);
+#endif
+		done=patch->done;
+		unlock(p);
+		if(!done)
+			break;
+		if(finish_patch(p, patch))
+			return -1;
+		patch_free_content(patch);
+		p->retired++;
+	}
+	return 0;
+}
+
+// Takes over the contents of the patch.
+static int patcher_add(struct patcher *p, struct patch *patch)
+{
+	int ret;
+	if(!p->started)
+	{
+		patch->ret=run_patch(p, patch, -1, get_cntr(p->cconfs));
+		ret=finish_patch(p, patch);
+		patch_free_content(patch);
+		return ret;
+	}
+	if(patcher_retire(p, p->alloc-1))
+		return -1;
+	lock(p);
+	p->queue[p->added++%p->alloc]=*patch;
+	wake(p);
+	unlock(p);
+	memset(patch, 0, sizeof(struct patch));
+	return 0;
+}
+
+static int patcher_finish(struct patcher *p)
+{
+	if(p->started && patcher_retire(p, 0))
+		return -1;
+	if(fzp_close(&p->delfp))
+	{
+		logp("error closing %s in %s\n",
+			p->fdirs->deletionsfile, __func__);
+		return -1;
+	}
+	return 0;
+}
+
+static int jiggle(struct sdirs *sdirs, struct fdirs *fdirs, struct sbuf **sb,
 	int hardlinked_current, const char *deltabdir, const char *deltafdir,
-	const char *sigpath, struct fzp **delfp, struct conf **cconfs)
+	struct patcher *patcher, struct conf **cconfs)
 {
 	int ret=-1;
 	struct stat statp;
@@ -355,7 +673,9 @@ static int jiggle(struct sdirs *sdirs, struct fdirs *fdirs, struct sbuf *sb,
 	char *finpath=NULL;
 	char *deltafpath=NULL;
 	char *relinkpath=NULL;
-	const char *datapth=sb->protocol1->datapth.buf;
+	char *delpath=NULL;
+	struct patch patch;
+	const char *datapth=(*sb)->protocol1->datapth.buf;
 
 	// If the previous backup was a hardlinked_archive, there will not be
 	// a currentdup directory - just directly use the file in the previous
@@ -397,21 +717,27 @@ static int jiggle(struct sdirs *sdirs, struct fdirs *fdirs, struct sbuf *sb,
 			logp("could not create path for: %s\n", newpath);
 			goto end;
 		}
-		ret=forward_patch_and_reverse_diff(
-			fdirs,
-			delfp,
-			deltabdir,
-			deltafdir,
-			deltafpath,
-			sigpath,
-			oldpath,
-			newpath,
-			datapth,
-			finpath,
-			hardlinked_current,
-			sb,
-			cconfs
-		);
+		// The threads would race each other making the directories
+		// for the reverse deltas, so make them here.
+		if(!hardlinked_current)
+		{
+			if(!(delpath=prepend_s(deltabdir, datapth)))
+				goto end;
+			if(mkpath(&delpath, deltabdir))
+			{
+				logp("could not mkpaths for: %s\n", delpath);
+				goto end;
+			}
+		}
+		memset(&patch, 0, sizeof(patch));
+		patch.sb=*sb;
+		patch.oldpath=oldpath;
+		patch.newpath=newpath;
+		patch.finpath=finpath;
+		patch.deltafpath=deltafpath;
+		*sb=NULL;
+		oldpath=newpath=finpath=deltafpath=NULL;
+		ret=patcher_add(patcher, &patch);
 		goto end;
 	}
 
@@ -470,6 +796,7 @@ end:
 	free_w(&finpath);
 	free_w(&deltafpath);
 	free_w(&relinkpath);
+	free_w(&delpath);
 	return ret;
 }
 
@@ -525,9 +852,6 @@ static int maybe_delete_files_from_manifest(const char *manifesttmp,
 		return 0;
 	logp("Performing deletions on manifest\n");
 
-	if(!(manifesttmp=get_tmp_filename(fdirs->manifest)))
-		goto end;
-
         if(!(dfp=fzp_open(fdirs->deletionsfile, "rb"))
 	  || !(omzp=fzp_gzopen(fdirs->manifest, "rb"))
 	  || !(nmzp=fzp_gzopen(manifesttmp,
@@ -625,8 +949,8 @@ static int atomic_data_jiggle(struct sdirs *sdirs, struct fdirs *fdirs,
 	char *sigpath=NULL;
 	struct fzp *zp=NULL;
 	struct sbuf *sb=NULL;
-
-	struct fzp *delfp=NULL;
+	struct patcher patcher;
+	int patching=0;
 
 	logp("Doing the atomic data jiggle...\n");
 
@@ -655,8 +979,15 @@ static int atomic_data_jiggle(struct sdirs *sdirs, struct fdirs *fdirs,
 
 	mkdir(fdirs->datadir, 0777);
 
+	patcher_init(&patcher, fdirs, deltabdir, deltafdir, sigpath,
+		hardlinked_current, cconfs);
+	patching=1;
+
 	while(1)
 	{
+		// A changed file keeps its sbuf until it has been patched.
+		if(!sb && !(sb=sbuf_alloc(PROTO_1)))
+			goto error;
 		switch(sbuf_fill_from_file(sb, zp, NULL))
 		{
 			case 0: break;
@@ -667,21 +998,17 @@ static int atomic_data_jiggle(struct sdirs *sdirs, struct fdirs *fdirs,
 		{
 			if(write_status(CNTR_STATUS_SHUFFLING,
 				sb->protocol1->datapth.buf, get_cntr(cconfs))
-			  || jiggle(sdirs, fdirs, sb, hardlinked_current,
+			  || jiggle(sdirs, fdirs, &sb, hardlinked_current,
 				deltabdir, deltafdir,
-				sigpath, &delfp, cconfs))
+				&patcher, cconfs))
 					goto error;
 		}
-		sbuf_free_content(sb);
+		if(sb) sbuf_free_content(sb);
 	}
 
 end:
-	if(fzp_close(&delfp))
-	{
-		logp("error closing %s in atomic_data_jiggle\n",
-			fdirs->deletionsfile);
+	if(patcher_finish(&patcher))
 		goto error;
-	}
 
 	if(maybe_delete_files_from_manifest(tmpman, fdirs, cconfs))
 		goto error;
@@ -692,8 +1019,9 @@ end:
 
 	ret=0;
 error:
+	if(patching)
+		patcher_free_content(&patcher);
 	fzp_close(&zp);
-	fzp_close(&delfp);
 	sbuf_free(&sb);
 	free_w(&deltabdir);
 	free_w(&deltafdir);
@@ -807,6 +1135,7 @@ int backup_phase4_server_protocol1(struct sdirs *sdirs, struct conf **cconfs)
 		logp("could not finish up backup.\n");
 		goto end;
 	}
+	browse_tree_write(sdirs->finishing, PROTO_1);
 
 	if(write_status(CNTR_STATUS_SHUFFLING,
 		"deleting temporary files", get_cntr(cconfs)))
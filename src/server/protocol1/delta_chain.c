@@ -0,0 +1,581 @@
+#include "../../burp.h"
+#include "../../alloc.h"
+#include "../../async.h"
+#include "../../bfile.h"
+#include "../../fzp.h"
+#include "../../log.h"
+#include "../../prepend.h"
+#include "delta_chain.h"
+
+// The librsync delta format. Every number is big endian.
+// The stream starts with the magic number, and then has commands until
+// an end command.
+#define DELTA_MAGIC		0x72730236 // RS_DELTA_MAGIC
+#define OP_END			0x00
+// 0x01 to 0x40 are literals of that many bytes, which follow.
+#define OP_LITERAL_64		0x40
+// Literals with a 1, 2, 4 or 8 byte length.
+#define OP_LITERAL_N1		0x41
+#define OP_LITERAL_N8		0x44
+// Copies with 1, 2, 4 or 8 byte positions and lengths, the length size
+// changing fastest.
+#define OP_COPY_N1_N1		0x45
+#define OP_COPY_N8_N8		0x54
+
+// Deltas whose literal data is read out of order would be inflated from
+// the start again for every backward seek. Up to this size, they are read
+// into memory once, and past it they are inflated into a temporary file.
+#define DELTA_CACHE_MAX		(8*1024*1024)
+
+// A run of bytes in a version of the file. src is -1 for the newest
+// version, otherwise the delta that the bytes are literal data in.
+// off is where the run starts in the newest version, or in the
+// uncompressed delta.
+struct piece
+{
+	uint64_t start;
+	uint64_t len;
+	uint64_t off;
+	int src;
+};
+
+struct pieces
+{
+	struct piece *p;
+	size_t count;
+	size_t alloc;
+	uint64_t size;
+};
+
+struct delta_chain
+{
+	// First, so that the chain can be handed over as a BFILE.
+	struct BFILE bfd;
+
+	char **deltas;
+	int count;
+	struct pieces pieces;
+
+	// The uncompressed size of each delta.
+	uint64_t *dsizes;
+
+	struct fzp *base;
+	uint64_t base_pos;
+	struct fzp **dfzps;
+	uint64_t *dpos;
+	// For deltas read out of order, either the whole of it in memory, or
+	// the path of it inflated.
+	uint8_t **dbufs;
+	char **dtmps;
+	size_t cur;
+	uint64_t cur_off;
+};
+
+static void pieces_free_content(struct pieces *pieces)
+{
+	free_v((void **)&pieces->p);
+	memset(pieces, 0, sizeof(struct pieces));
+}
+
+static int pieces_add(struct pieces *pieces,
+	uint64_t len, uint64_t off, int src)
+{
+	struct piece *last;
+	if(!len)
+		return 0;
+	if(pieces->count)
+	{
+		last=&pieces->p[pieces->count-1];
+		if(last->src==src && last->off+last->len==off)
+		{
+			last->len+=len;
+			pieces->size+=len;
+			return 0;
+		}
+	}
+	if(pieces->count==pieces->alloc)
+	{
+		size_t alloc=pieces->alloc?pieces->alloc*2:64;
+		struct piece *p;
+		if(!(p=(struct piece *)realloc_w(pieces->p,
+			alloc*sizeof(struct piece), __func__)))
+				return -1;
+		pieces->p=p;
+		pieces->alloc=alloc;
+	}
+	last=&pieces->p[pieces->count++];
+	last->start=pieces->size;
+	last->len=len;
+	last->off=off;
+	last->src=src;
+	pieces->size+=len;
+	return 0;
+}
+
+// Finds the piece that a position in the version falls in.
+static size_t pieces_find(struct pieces *pieces, uint64_t pos)
+{
+	size_t lo=0;
+	size_t hi=pieces->count;
+	while(hi-lo>1)
+	{
+		size_t mid=lo+(hi-lo)/2;
+		if(pieces->p[mid].start<=pos)
+			lo=mid;
+		else
+			hi=mid;
+	}
+	return lo;
+}
+
+// Copies a run of the previous version into the next one. Before the first
+// delta, the previous version is the newest version of the file itself.
+static int pieces_copy(struct pieces *next, struct pieces *prev,
+	int first, uint64_t pos, uint64_t len)
+{
+	size_t i;
+	uint64_t skip;
+	uint64_t take;
+	struct piece *p;
+
+	if(first)
+		return pieces_add(next, len, pos, -1);
+	if(!len)
+		return 0;
+	if(pos>=prev->size || len>prev->size-pos)
+		return -1;
+	for(i=pieces_find(prev, pos); len; i++)
+	{
+		p=&prev->p[i];
+		skip=pos-p->start;
+		take=p->len-skip;
+		if(take>len)
+			take=len;
+		if(pieces_add(next, take, p->off+skip, p->src))
+			return -1;
+		pos+=take;
+		len-=take;
+	}
+	return 0;
+}
+
+struct delta_chain *delta_chain_alloc(struct cntr *cntr)
+{
+	struct delta_chain *chain;
+	if(!(chain=(struct delta_chain *)
+		calloc_w(1, sizeof(struct delta_chain), __func__)))
+			return NULL;
+	bfile_init(&chain->bfd, 0, cntr);
+	return chain;
+}
+
+static size_t cache_max=DELTA_CACHE_MAX;
+
+#ifdef UTEST
+void delta_chain_set_cache_max(size_t max)
+{
+	cache_max=max;
+}
+#endif
+
+static void delta_chain_close(struct delta_chain *chain)
+{
+	int i;
+	fzp_close(&chain->base);
+	for(i=0; i<chain->count; i++)
+	{
+		if(chain->dfzps)
+			fzp_close(&chain->dfzps[i]);
+		if(chain->dbufs)
+			free_v((void **)&chain->dbufs[i]);
+		if(chain->dtmps && chain->dtmps[i])
+		{
+			unlink(chain->dtmps[i]);
+			free_w(&chain->dtmps[i]);
+		}
+	}
+	free_v((void **)&chain->dfzps);
+	free_v((void **)&chain->dpos);
+	free_v((void **)&chain->dbufs);
+	free_v((void **)&chain->dtmps);
+	free_w(&chain->bfd.path);
+}
+
+void delta_chain_free(struct delta_chain **chain)
+{
+	int i;
+	if(!chain || !*chain)
+		return;
+	delta_chain_close(*chain);
+	for(i=0; i<(*chain)->count; i++)
+		free_w(&(*chain)->deltas[i]);
+	free_v((void **)&(*chain)->deltas);
+	free_v((void **)&(*chain)->dsizes);
+	pieces_free_content(&(*chain)->pieces);
+	free_v((void **)chain);
+}
+
+int delta_chain_add(struct delta_chain *chain, const char *path)
+{
+	char **deltas;
+	if(!(deltas=(char **)realloc_w(chain->deltas,
+		(chain->count+1)*sizeof(char *), __func__)))
+			return -1;
+	chain->deltas=deltas;
+	if(!(chain->deltas[chain->count]=strdup_w(path, __func__)))
+		return -1;
+	chain->count++;
+	return 0;
+}
+
+int delta_chain_length(struct delta_chain *chain)
+{
+	return chain->count;
+}
+
+static int read_number(struct fzp *fzp, int bytes,
+	uint64_t *number, uint64_t *pos)
+{
+	int i;
+	uint8_t buf[8];
+	if(fzp_read(fzp, buf, bytes)!=(size_t)bytes)
+		return -1;
+	*number=0;
+	for(i=0; i<bytes; i++)
+		*number=(*number<<8)|buf[i];
+	*pos+=bytes;
+	return 0;
+}
+
+static int skip_literal(struct fzp *fzp, uint64_t len, uint64_t *pos)
+{
+	size_t want;
+	uint8_t buf[ZCHUNK];
+	while(len)
+	{
+		want=len>sizeof(buf)?sizeof(buf):len;
+		if(fzp_read(fzp, buf, want)!=want)
+			return -1;
+		len-=want;
+		*pos+=want;
+	}
+	return 0;
+}
+
+// Reads the commands of delta number d, which turn the version in prev
+// into the one in next.
+static int compose_delta(struct delta_chain *chain, int d,
+	struct pieces *prev, struct pieces *next)
+{
+	int ret=-1;
+	int op;
+	uint8_t opbuf;
+	uint64_t pos=0;
+	uint64_t magic;
+	uint64_t len;
+	uint64_t where;
+	struct fzp *fzp;
+	const char *path=chain->deltas[d];
+
+	if(!(fzp=fzp_gzopen(path, "rb")))
+		return -1;
+	if(read_number(fzp, 4, &magic, &pos) || magic!=DELTA_MAGIC)
+	{
+		logp("%s is not a librsync delta\n", path);
+		goto end;
+	}
+	while(1)
+	{
+		if(fzp_read(fzp, &opbuf, 1)!=1)
+		{
+			logp("%s ended without an end command\n", path);
+			goto end;
+		}
+		pos++;
+		op=opbuf;
+		if(op==OP_END)
+		{
+			chain->dsizes[d]=pos;
+			break;
+		}
+		if(op<=OP_LITERAL_64)
+			len=op;
+		else if(op<=OP_LITERAL_N8)
+		{
+			if(read_number(fzp, 1<<(op-OP_LITERAL_N1), &len, &pos))
+				goto truncated;
+		}
+		else if(op<=OP_COPY_N8_N8)
+		{
+			op-=OP_COPY_N1_N1;
+			if(read_number(fzp, 1<<(op/4), &where, &pos)
+			  || read_number(fzp, 1<<(op%4), &len, &pos))
+				goto truncated;
+			if(pieces_copy(next, prev, !d, where, len))
+			{
+				logp("bad copy command in %s\n", path);
+				goto end;
+			}
+			continue;
+		}
+		else
+		{
+			logp("unknown command 0x%02X in %s\n", op, path);
+			goto end;
+		}
+		// A literal.
+		if(pieces_add(next, len, pos, d)
+		  || skip_literal(fzp, len, &pos))
+			goto truncated;
+	}
+	ret=0;
+	goto end;
+truncated:
+	logp("%s is truncated\n", path);
+end:
+	fzp_close(&fzp);
+	return ret;
+}
+
+int delta_chain_compose(struct delta_chain *chain)
+{
+	int d;
+	struct pieces prev;
+	memset(&prev, 0, sizeof(prev));
+	free_v((void **)&chain->dsizes);
+	if(!(chain->dsizes=(uint64_t *)
+		calloc_w(chain->count, sizeof(uint64_t), __func__)))
+			return -1;
+	for(d=0; d<chain->count; d++)
+	{
+		pieces_free_content(&prev);
+		prev=chain->pieces;
+		memset(&chain->pieces, 0, sizeof(chain->pieces));
+		if(compose_delta(chain, d, &prev, &chain->pieces))
+		{
+			pieces_free_content(&prev);
+			return -1;
+		}
+	}
+	pieces_free_content(&prev);
+	return 0;
+}
+
+static int src_in_order(struct delta_chain *chain, int src)
+{
+	size_t i;
+	uint64_t next=0;
+	struct piece *p;
+	for(i=0; i<chain->pieces.count; i++)
+	{
+		p=&chain->pieces.p[i];
+		if(p->src!=src)
+			continue;
+		if(p->off<next)
+			return 0;
+		next=p->off+p->len;
+	}
+	return 1;
+}
+
+int delta_chain_base_in_order(struct delta_chain *chain)
+{
+	return src_in_order(chain, -1);
+}
+
+uint64_t delta_chain_size(struct delta_chain *chain)
+{
+	return chain->pieces.size;
+}
+
+static ssize_t bfile_read(struct BFILE *bfd, void *buf, size_t count)
+{
+	return delta_chain_read((struct delta_chain *)bfd, buf, count);
+}
+
+// Reads a whole delta into memory.
+static int cache_delta(struct delta_chain *chain, int d)
+{
+	int ret=-1;
+	struct fzp *fzp;
+	size_t len=(size_t)chain->dsizes[d];
+	if(!(fzp=fzp_gzopen(chain->deltas[d], "rb")))
+		return -1;
+	if(!(chain->dbufs[d]=(uint8_t *)malloc_w(len?len:1, __func__)))
+		goto end;
+	if(len && fzp_read_ensure(fzp, chain->dbufs[d], len, __func__))
+		goto end;
+	ret=0;
+end:
+	fzp_close(&fzp);
+	return ret;
+}
+
+// Inflates a delta into a temporary file, which can be seeked in cheaply.
+static int inflate_delta(struct delta_chain *chain, int d, const char *tmpdir)
+{
+	int ret=-1;
+	int got;
+	char tmp[32];
+	uint8_t buf[ZCHUNK];
+	struct fzp *in=NULL;
+	struct fzp *out=NULL;
+	snprintf(tmp, sizeof(tmp), "delta_chain.%d", d);
+	if(!(chain->dtmps[d]=prepend_s(tmpdir, tmp))
+	  || !(in=fzp_gzopen(chain->deltas[d], "rb"))
+	  || !(out=fzp_open(chain->dtmps[d], "wb")))
+		goto end;
+	while((got=fzp_read(in, buf, sizeof(buf)))>0)
+		if(fzp_write(out, buf, got)!=(size_t)got)
+			goto end;
+	if(got<0)
+		goto end;
+	ret=0;
+end:
+	fzp_close(&in);
+	if(fzp_close(&out))
+		ret=-1;
+	if(ret)
+		logp("could not inflate %s to %s\n", chain->deltas[d],
+			chain->dtmps[d]?chain->dtmps[d]:tmpdir);
+	return ret;
+}
+
+static int prepare_deltas(struct delta_chain *chain, const char *tmpdir)
+{
+	int d;
+	if(!(chain->dbufs=(uint8_t **)
+		calloc_w(chain->count, sizeof(uint8_t *), __func__))
+	  || !(chain->dtmps=(char **)
+		calloc_w(chain->count, sizeof(char *), __func__)))
+			return -1;
+	for(d=0; d<chain->count; d++)
+	{
+		if(src_in_order(chain, d))
+			continue;
+		if(chain->dsizes[d]<=cache_max)
+		{
+			if(cache_delta(chain, d))
+				return -1;
+		}
+		else if(tmpdir)
+		{
+			if(inflate_delta(chain, d, tmpdir))
+				return -1;
+		}
+		// Otherwise it is read where it is. Seeking backwards in it
+		// is slow, but it is never held in memory all at once.
+	}
+	return 0;
+}
+
+int delta_chain_open(struct delta_chain *chain,
+	const char *base, int compressed, const char *tmpdir)
+{
+	delta_chain_close(chain);
+	chain->cur=0;
+	chain->cur_off=0;
+	chain->base_pos=0;
+	if(!(chain->bfd.path=strdup_w(base, __func__))
+	  || !(chain->dfzps=(struct fzp **)
+		calloc_w(chain->count, sizeof(struct fzp *), __func__))
+	  || !(chain->dpos=(uint64_t *)
+		calloc_w(chain->count, sizeof(uint64_t), __func__))
+	  || prepare_deltas(chain, tmpdir))
+			return -1;
+	if(compressed)
+		chain->base=fzp_gzopen(base, "rb");
+	else
+		chain->base=fzp_open(base, "rb");
+	if(!chain->base)
+		return -1;
+	chain->bfd.mode=BF_READ;
+	chain->bfd.read=bfile_read;
+	return 0;
+}
+
+// Gets the file that a piece is in, at the right place.
+static struct fzp *get_src(struct delta_chain *chain, struct piece *p,
+	uint64_t off)
+{
+	struct fzp **fzp;
+	uint64_t *pos;
+	if(p->src<0)
+	{
+		fzp=&chain->base;
+		pos=&chain->base_pos;
+	}
+	else
+	{
+		fzp=&chain->dfzps[p->src];
+		pos=&chain->dpos[p->src];
+		if(!*fzp)
+		{
+			if(chain->dtmps[p->src])
+				*fzp=fzp_open(chain->dtmps[p->src], "rb");
+			else
+				*fzp=fzp_gzopen(chain->deltas[p->src], "rb");
+			if(!*fzp)
+				return NULL;
+			*pos=0;
+		}
+	}
+	if(*pos!=off)
+	{
+		if(fzp_seek(*fzp, (off_t)off, SEEK_SET))
+		{
+			logp("could not seek to %" PRIu64 " in %s\n", off,
+				p->src<0?chain->bfd.path:chain->deltas[p->src]);
+			return NULL;
+		}
+		*pos=off;
+	}
+	return *fzp;
+}
+
+ssize_t delta_chain_read(struct delta_chain *chain, void *buf, size_t len)
+{
+	size_t got;
+	size_t want;
+	size_t total=0;
+	struct fzp *fzp;
+	struct piece *p;
+	while(len && chain->cur<chain->pieces.count)
+	{
+		p=&chain->pieces.p[chain->cur];
+		want=p->len-chain->cur_off>len?len:p->len-chain->cur_off;
+		if(p->src>=0 && chain->dbufs[p->src])
+		{
+			memcpy((uint8_t *)buf+total,
+				chain->dbufs[p->src]+p->off+chain->cur_off,
+				want);
+			got=want;
+		}
+		else if(!(fzp=get_src(chain, p, p->off+chain->cur_off)))
+			return -1;
+		else if(!(got=fzp_read(fzp, (uint8_t *)buf+total, want)))
+		{
+			logp("%s is shorter than its deltas need\n",
+				p->src<0?chain->bfd.path:chain->deltas[p->src]);
+			return -1;
+		}
+		if(p->src<0)
+			chain->base_pos+=got;
+		else
+			chain->dpos[p->src]+=got;
+		total+=got;
+		len-=got;
+		chain->cur_off+=got;
+		if(chain->cur_off==p->len)
+		{
+			chain->cur++;
+			chain->cur_off=0;
+		}
+	}
+	return (ssize_t)total;
+}
+
+struct BFILE *delta_chain_bfile(struct delta_chain *chain)
+{
+	return &chain->bfd;
+}
@@ -0,0 +1,42 @@
+#ifndef _DELTA_CHAIN_H
+#define _DELTA_CHAIN_H
+
+#include "../../bfile.h"
+
+// Restores an older version of a file from the newest version and the
+// chain of reverse deltas that leads back to it, without writing out each
+// version in between. The librsync command streams of the deltas are
+// resolved into one list of pieces, each copied either from the newest
+// version or from the literal data of one of the deltas, which can then be
+// read straight through.
+
+struct delta_chain;
+
+extern struct delta_chain *delta_chain_alloc(struct cntr *cntr);
+extern void delta_chain_free(struct delta_chain **chain);
+
+// Deltas are added in the order that they are applied.
+extern int delta_chain_add(struct delta_chain *chain, const char *path);
+extern int delta_chain_length(struct delta_chain *chain);
+
+extern int delta_chain_compose(struct delta_chain *chain);
+// Returns 1 if the composed file reads the newest version from start to end
+// without going backwards, so it can be read compressed.
+extern int delta_chain_base_in_order(struct delta_chain *chain);
+extern uint64_t delta_chain_size(struct delta_chain *chain);
+
+// Deltas that are read out of order are read into memory, or inflated into
+// temporary files in tmpdir if they are big. Without a tmpdir, big ones are
+// read where they are, which is slow.
+extern int delta_chain_open(struct delta_chain *chain,
+	const char *base, int compressed, const char *tmpdir);
+extern ssize_t delta_chain_read(struct delta_chain *chain,
+	void *buf, size_t len);
+// For sending to the client. Reading it reads the composed file.
+extern struct BFILE *delta_chain_bfile(struct delta_chain *chain);
+
+#ifdef UTEST
+extern void delta_chain_set_cache_max(size_t max);
+#endif
+
+#endif
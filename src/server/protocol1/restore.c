@@ -10,13 +10,13 @@
 #include "../../log.h"
 #include "../../prepend.h"
 #include "../../protocol1/handy.h"
-#include "../../server/protocol1/backup_phase4.h"
 #include "../../server/protocol1/link.h"
 #include "../../server/protocol1/zlibio.h"
 #include "../../server/protocol2/restore.h"
 #include "../../sbuf.h"
 #include "../../slist.h"
 #include "../sdirs.h"
+#include "delta_chain.h"
 #include "dpth.h"
 #include "restore.h"
 
@@ -69,58 +69,65 @@ static int inflate_or_link_oldfile(struct asfd *asfd, const char *oldpath,
 	return ret;
 }
 
+static enum send_e send_as_is(struct asfd *asfd, struct sbuf *sb,
+	struct BFILE *bfp, struct cntr *cntr)
+{
+	uint64_t bytes=0; // Unused.
+	return send_whole_filel(asfd,
+#ifdef HAVE_WIN32
+		sb->path.cmd,
+#endif
+		sb->protocol1->datapth.buf,
+		1, &bytes, cntr, bfp, NULL, 0);
+}
+
+// compression is the level that the client asked for on files that have to
+// be compressed during the send, where 0 means that it wants them as they are.
 static int do_send_file(struct asfd *asfd, struct sbuf *sb,
-	int patches, const char *best, struct cntr *cntr)
+	struct delta_chain *chain, const char *best, int compression,
+	struct cntr *cntr)
 {
 	enum send_e ret=SEND_FATAL;
 	struct BFILE bfd;
+	struct BFILE *bfp=&bfd;
 	uint64_t bytes=0; // Unused.
 
-	bfile_init(&bfd, 0, cntr);
-	if(bfd.open_for_send(&bfd, asfd, best, sb->winattr,
-		1 /* no O_NOATIME */, cntr, PROTO_1))
-			return SEND_FATAL;
-	if(asfd->write(asfd, &sb->path))
-		ret=SEND_FATAL;
-	else if(patches)
+	if(chain)
+		bfp=delta_chain_bfile(chain);
+	else
 	{
-		// If we did some patches, the resulting file
-		// is not gzipped. Gzip it during the send.
-		ret=send_whole_file_gzl(
-			asfd,
-			sb->protocol1->datapth.buf,
-			/*quick_read*/1,
-			&bytes,
-			/*encpassword*/NULL,
-			cntr,
-			/*compression*/9,
-			&bfd,
-			/*extrameta*/NULL,
-			/*elen*/0,
-			/*key_deriv*/ENCRYPTION_UNSET,
-			/*salt*/0
-		);
+		bfile_init(&bfd, 0, cntr);
+		if(bfd.open_for_send(&bfd, asfd, best, sb->winattr,
+			1 /* no O_NOATIME */, cntr, PROTO_1))
+				return SEND_FATAL;
 	}
-	else
+	if(asfd->write(asfd, &sb->path))
+		ret=SEND_FATAL;
+	else if(!chain && sbuf_is_encrypted(sb))
 	{
 		// If it was encrypted, it may or may not have been compressed
 		// before encryption. Send it as it as, and let the client
 		// sort it out.
-		if(sbuf_is_encrypted(sb))
-		{
-			ret=send_whole_filel(asfd,
-#ifdef HAVE_WIN32
-				sb->path.cmd
-#endif
-				sb->protocol1->datapth.buf,
-				1, &bytes, cntr, &bfd, NULL, 0);
-		}
-		// It might have been stored uncompressed. Gzip it during
-		// the send. If the client knew what kind of file it would be
-		// receiving, this step could disappear.
-		else if(!dpth_protocol1_is_compressed(sb->compression,
-			sb->protocol1->datapth.buf))
-		{
+		ret=send_as_is(asfd, sb, bfp, cntr);
+	}
+	else if(!chain && dpth_protocol1_is_compressed(sb->compression,
+		sb->protocol1->datapth.buf))
+	{
+		// If there were no deltas to apply, the resulting
+		// file might already be gzipped. Send it as it is.
+		ret=send_as_is(asfd, sb, bfp, cntr);
+	}
+	else
+	{
+		// If there were deltas to apply, or it was stored
+		// uncompressed, the resulting file is not gzipped. Gzip it
+		// during the send, unless the client asked for such files as
+		// they are, with a compression level of 0. The client still
+		// expects gzip for a file that was stored compressed.
+		if(chain && !compression && dpth_protocol1_is_compressed(
+			sb->compression, sb->protocol1->datapth.buf))
+				compression=1;
+		if(compression)
 			ret=send_whole_file_gzl(
 				asfd,
 				sb->protocol1->datapth.buf,
@@ -128,27 +135,18 @@ static int do_send_file(struct asfd *asfd, struct sbuf *sb,
 				&bytes,
 				/*encpassword*/NULL,
 				cntr,
-				/*compression*/9,
-				&bfd,
+				compression,
+				bfp,
 				/*extrameta*/NULL,
 				/*elen*/0,
 				/*key_deriv*/ENCRYPTION_UNSET,
 				/*salt*/0
 			);
-		}
 		else
-		{
-			// If we did not do some patches, the resulting
-			// file might already be gzipped. Send it as it is.
-			ret=send_whole_filel(asfd,
-#ifdef HAVE_WIN32
-				sb->path.cmd
-#endif
-				sb->protocol1->datapth.buf,
-				1, &bytes, cntr, &bfd, NULL, 0);
-		}
+			ret=send_as_is(asfd, sb, bfp, cntr);
 	}
-	bfd.close(&bfd, asfd);
+	if(!chain)
+		bfd.close(&bfd, asfd);
 
 	switch(ret)
 	{
@@ -165,7 +163,7 @@ static int do_send_file(struct asfd *asfd, struct sbuf *sb,
 static
 #endif
 int verify_file(struct asfd *asfd, struct sbuf *sb,
-	int patches, const char *best, struct cntr *cntr)
+	struct delta_chain *chain, const char *best, struct cntr *cntr)
 {
 	MD5_CTX md5;
 	int b=0;
@@ -189,22 +187,25 @@ int verify_file(struct asfd *asfd, struct sbuf *sb,
 		logp("MD5_Init() failed\n");
 		return -1;
 	}
-	if(patches
-	  || sb->path.cmd==CMD_ENC_FILE
-	  || sb->path.cmd==CMD_ENC_METADATA
-	  || sb->path.cmd==CMD_EFS_FILE
-	  || sb->path.cmd==CMD_ENC_VSS
-	  || (!patches && !dpth_protocol1_is_compressed(sb->compression, best)))
-		fzp=fzp_open(best, "rb");
-	else
-		fzp=fzp_gzopen(best, "rb");
-
-	if(!fzp)
+	if(!chain)
 	{
-		logw(asfd, cntr, "could not open %s\n", best);
-		return 0;
+		if(sb->path.cmd==CMD_ENC_FILE
+		  || sb->path.cmd==CMD_ENC_METADATA
+		  || sb->path.cmd==CMD_EFS_FILE
+		  || sb->path.cmd==CMD_ENC_VSS
+		  || !dpth_protocol1_is_compressed(sb->compression, best))
+			fzp=fzp_open(best, "rb");
+		else
+			fzp=fzp_gzopen(best, "rb");
+
+		if(!fzp)
+		{
+			logw(asfd, cntr, "could not open %s\n", best);
+			return 0;
+		}
 	}
-	while((b=fzp_read(fzp, in, ZCHUNK))>0)
+	while((b=chain?delta_chain_read(chain, in, ZCHUNK)
+		:(int)fzp_read(fzp, in, ZCHUNK))>0)
 	{
 		cbytes+=b;
 		if(!MD5_Update(&md5, in, b))
@@ -214,7 +215,7 @@ int verify_file(struct asfd *asfd, struct sbuf *sb,
 			return -1;
 		}
 	}
-	if(!fzp_eof(fzp))
+	if(chain?b<0:!fzp_eof(fzp))
 	{
 		logw(asfd, cntr, "error while reading %s\n", best);
 		fzp_close(&fzp);
@@ -249,23 +250,21 @@ static int process_data_dir_file(struct asfd *asfd,
 	struct conf **cconfs)
 {
 	int ret=-1;
-	int patches=0;
+	int compressed=0;
 	char *dpath=NULL;
+	char *tmppath=NULL;
 	struct stat dstatp;
-	const char *tmp=NULL;
-	const char *best=NULL;
-	static char *tmppath1=NULL;
-	static char *tmppath2=NULL;
+	const char *base=NULL;
+	struct delta_chain *chain=NULL;
 	struct cntr *cntr=NULL;
-	if(cconfs) cntr=get_cntr(cconfs);
-
-	if((!tmppath1 && !(tmppath1=prepend_s(bu->path, "tmp1")))
-	  || (!tmppath2 && !(tmppath2=prepend_s(bu->path, "tmp2"))))
-		goto end;
+	int restore_compression=9;
+	if(cconfs)
+	{
+		cntr=get_cntr(cconfs);
+		restore_compression=get_int(cconfs[OPT_RESTORE_COMPRESSION]);
+	}
 
-	best=path;
-	tmp=tmppath1;
-	// Now go down the list, applying any deltas.
+	// Now go down the list, collecting any deltas.
 	for(b=b->prev; b && b->next!=bu; b=b->prev)
 	{
 		free_w(&dpath);
@@ -275,46 +274,58 @@ static int process_data_dir_file(struct asfd *asfd,
 		if(lstat(dpath, &dstatp) || !S_ISREG(dstatp.st_mode))
 			continue;
 
-		if(!patches)
+		if((!chain && !(chain=delta_chain_alloc(cntr)))
+		  || delta_chain_add(chain, dpath))
+			goto end;
+	}
+
+	if(chain)
+	{
+		// Work out the old version from the whole chain of deltas
+		// at once, instead of writing out every version in between.
+		if(delta_chain_compose(chain))
 		{
-			// Need to gunzip the first one.
-			if(inflate_or_link_oldfile(asfd, best, tmp,
+			logw(asfd, cntr, "problem when patching %s\n", path);
+			ret=0;
+			goto end;
+		}
+
+		// Seeking backwards in a gzipped file is slow, so only
+		// inflate it first if the deltas need to do that.
+		base=path;
+		compressed=dpth_protocol1_is_compressed(sb->compression, path);
+		if(compressed && !delta_chain_base_in_order(chain))
+		{
+			if(!(tmppath=prepend_s(bu->path, "tmp1")))
+				goto end;
+			if(inflate_or_link_oldfile(asfd, path, tmppath,
 				cconfs, sb->compression))
 			{
 				logw(asfd, cntr,
-				  "problem when inflating %s\n", best);
+				  "problem when inflating %s\n", path);
 				ret=0;
 				goto end;
 			}
-			best=tmp;
-			if(tmp==tmppath1) tmp=tmppath2;
-			else tmp=tmppath1;
+			base=tmppath;
+			compressed=0;
 		}
-
-		if(do_patch(best, dpath, tmp,
-			0 /* do not gzip the result */,
-			sb->compression /* from the manifest */))
+		if(delta_chain_open(chain, base, compressed, bu->path))
 		{
-			logw(asfd, cntr, "problem when patching %s with %s\n", path, b->timestamp);
+			logw(asfd, cntr, "could not open %s\n", base);
 			ret=0;
 			goto end;
 		}
-
-		best=tmp;
-		if(tmp==tmppath1) tmp=tmppath2;
-		else tmp=tmppath1;
-		unlink(tmp);
-		patches++;
 	}
 
 	switch(act)
 	{
 		case ACTION_RESTORE:
-			if(do_send_file(asfd, sb, patches, best, cntr))
+			if(do_send_file(asfd, sb, chain, path,
+				restore_compression, cntr))
 				goto end;
 			break;
 		case ACTION_VERIFY:
-			if(verify_file(asfd, sb, patches, best, cntr))
+			if(verify_file(asfd, sb, chain, path, cntr))
 				goto end;
 			break;
 		default:
@@ -326,11 +337,13 @@ static int process_data_dir_file(struct asfd *asfd,
 
 	ret=0;
 end:
+	delta_chain_free(&chain);
 	free_w(&dpath);
-	if(tmppath1) unlink(tmppath1);
-	if(tmppath2) unlink(tmppath2);
-	free_w(&tmppath1);
-	free_w(&tmppath2);
+	if(tmppath)
+	{
+		unlink(tmppath);
+		free_w(&tmppath);
+	}
 	return ret;
 }
 
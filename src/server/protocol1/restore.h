@@ -10,8 +10,9 @@ extern int restore_sbuf_protocol1(struct asfd *asfd, struct sbuf *sb,
 	struct conf **cconfs);
 
 #ifdef UTEST
+struct delta_chain;
 extern int verify_file(struct asfd *asfd, struct sbuf *sb,
-	int patches, const char *best, struct cntr *cntr);
+	struct delta_chain *chain, const char *best, struct cntr *cntr);
 extern int restore_file(struct asfd *asfd, struct bu *bu,
         struct sbuf *sb, enum action act,
         struct sdirs *sdirs, struct conf **cconfs);
@@ -35,6 +35,9 @@
 
 static int breaking=0;
 static int breakcount=0;
+// Blocks that have been seen recently, for deduplicating against before the
+// champ chooser has replied.
+static struct hash_table *local_hash=NULL;
 
 static int data_needed(struct sbuf *sb)
 {
@@ -525,10 +528,10 @@ static int sbuf_needs_data(struct sbuf *sb, struct asfd *asfd,
 
 				// The champ chooser has the candidate. Now,
 				// empty our local hash table.
-				hash_delete_all();
+				hash_reset(local_hash);
 				// Add the most recent block, so identical
 				// adjacent blocks are deduplicated well.
-				if(hash_load_blk(blk))
+				if(hash_load_blk(local_hash, blk))
 					goto end;
 			}
 		}
@@ -707,30 +710,21 @@ static int mark_not_got(struct blk *blk, struct dpth *dpth)
 	blk->savepath=savepathstr_with_sig_to_uint64(path);
 	blk->got_save_path=1;
 	// Load it into our local hash table.
-	if(hash_load_blk(blk))
+	if(hash_load_blk(local_hash, blk))
 		return -1;
 	if(dpth_protocol2_incr_sig(dpth))
 		return -1;
 	return 0;
 }
 
-static struct hash_strong *in_local_hash(struct blk *blk)
-{
-	static struct hash_weak *hash_weak;
-
-	if(!(hash_weak=hash_weak_find(blk->fingerprint)))
-		return NULL;
-	return hash_strong_find(hash_weak, blk->md5sum);
-}
-
 static int simple_deduplicate_blk(struct blk *blk)
 {
-	static struct hash_strong *hash_strong;
+	static struct hash_entry *hash_entry;
 	if(blk->got!=BLK_INCOMING)
 		return 0;
-	if((hash_strong=in_local_hash(blk)))
+	if((hash_entry=hash_find(local_hash, blk->fingerprint, blk->md5sum)))
 	{
-		blk->savepath=hash_strong->savepath;
+		blk->savepath=hash_entry->savepath;
 		blk->got_save_path=1;
 		blk->got=BLK_GOT;
 		return 1;
@@ -900,6 +894,8 @@ int do_backup_phase2_server_protocol2(struct async *as, struct asfd *chfd,
 	}
 
 	blks_generate_init();
+	if(!(local_hash=hash_table_alloc()))
+		goto end;
 
 	logp("Phase 2 begin (recv backup data)\n");
 
@@ -1024,7 +1020,7 @@ end:
 	manios_close(&manios);
 	man_off_t_free(&p1pos);
 	blks_generate_free();
-	hash_delete_all();
+	hash_table_free(&local_hash);
 	return ret;
 }
 
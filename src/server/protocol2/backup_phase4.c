@@ -10,11 +10,15 @@
 #include "../../protocol2/blk.h"
 #include "../../sbuf.h"
 #include "../../strlist.h"
+#include "../../server/browse_tree.h"
 #include "../../server/bu_get.h"
 #include "../../server/manio.h"
+#include "../../server/manio_index.h"
 #include "../../server/sdirs.h"
 #include "champ_chooser/champ_chooser.h"
+#include "champ_chooser/sparse_index.h"
 #include "backup_phase4.h"
+#include "dindex_file.h"
 
 static int hookscmp(struct hooks *a, struct hooks *b)
 {
@@ -123,95 +127,175 @@ void hooks_free(struct hooks **hooks)
 	free_v((void **)hooks);
 }
 
-/* Merge two files of sorted sparse indexes into each other. */
+// A min-heap of source numbers, so that the next record to write out from
+// any number of sorted sources can be found cheaply.
+struct mheap
+{
+	int *s;
+	int len;
+	void *srcs;
+	int (*cmp)(void *srcs, int a, int b);
+};
+
+static void mheap_swap(struct mheap *h, int a, int b)
+{
+	int tmp=h->s[a];
+	h->s[a]=h->s[b];
+	h->s[b]=tmp;
+}
+
+static void mheap_sift_down(struct mheap *h, int i)
+{
+	while(1)
+	{
+		int m=i;
+		int l=2*i+1;
+		int r=2*i+2;
+		if(l<h->len && h->cmp(h->srcs, h->s[l], h->s[m])<0) m=l;
+		if(r<h->len && h->cmp(h->srcs, h->s[r], h->s[m])<0) m=r;
+		if(m==i) return;
+		mheap_swap(h, i, m);
+		i=m;
+	}
+}
+
+static void mheap_push(struct mheap *h, int src)
+{
+	int i=h->len++;
+	h->s[i]=src;
+	while(i)
+	{
+		int p=(i-1)/2;
+		if(h->cmp(h->srcs, h->s[i], h->s[p])>=0) return;
+		mheap_swap(h, i, p);
+		i=p;
+	}
+}
+
+static void mheap_pop(struct mheap *h)
+{
+	h->s[0]=h->s[--h->len];
+	mheap_sift_down(h, 0);
+}
+
+static int mheap_init(struct mheap *h, int count, void *srcs,
+	int cmp(void *srcs, int a, int b))
+{
+	memset(h, 0, sizeof(*h));
+	if(count && !(h->s=(int *)calloc_w(count, sizeof(int), __func__)))
+		return -1;
+	h->srcs=srcs;
+	h->cmp=cmp;
+	return 0;
+}
+
+static void mheap_free(struct mheap *h)
+{
+	free_v((void **)&h->s);
+}
+
+struct hooks_src
+{
+	struct fzp *fzp;
+	struct sbuf *sb;
+	struct hooks *cur;
+	char *path;
+	uint64_t *fingerprints;
+	size_t len;
+};
+
+// Equal hooks come out newest source first, so that is the one that is kept.
+static int hooks_src_cmp(void *srcs, int a, int b)
+{
+	int ret;
+	struct hooks_src *s=(struct hooks_src *)srcs;
+	if((ret=hookscmp(s[a].cur, s[b].cur))) return ret;
+	return b-a;
+}
+
+static int hooks_src_next(struct hooks_src *s)
+{
+	while(!s->cur && s->fzp)
+	{
+		switch(get_next_set_of_hooks(&s->cur, s->sb, s->fzp,
+			&s->path, &s->fingerprints, &s->len))
+		{
+			case -1: return -1;
+			case 1: fzp_close(&s->fzp); // Finished OK.
+		}
+	}
+	return 0;
+}
+
+static void hooks_srcs_free(struct hooks_src **srcs, int count)
+{
+	int i;
+	if(!*srcs) return;
+	for(i=0; i<count; i++)
+	{
+		struct hooks_src *s=&(*srcs)[i];
+		fzp_close(&s->fzp);
+		sbuf_free(&s->sb);
+		hooks_free(&s->cur);
+		free_v((void **)&s->fingerprints);
+		free_w(&s->path);
+	}
+	free_v((void **)srcs);
+}
+
+/* Merge any number of files of sorted sparse indexes into one. NULL sources
+   are skipped. Where sources have the same hooks, the later source wins. */
 #ifndef UTEST
 static
 #endif
-int merge_sparse_indexes(const char *dst, const char *srca, const char *srcb)
+int merge_sparse_indexes(const char *dst, const char **srcs, int count)
 {
-	int fcmp;
+	int i;
 	int ret=-1;
-	struct sbuf *asb=NULL;
-	struct sbuf *bsb=NULL;
-	uint64_t *afingerprints=NULL;
-	uint64_t *bfingerprints=NULL;
-	size_t aflen=0;
-	size_t bflen=0;
-	struct fzp *azp=NULL;
-	struct fzp *bzp=NULL;
+	struct mheap heap;
 	struct fzp *dzp=NULL;
-	struct hooks *anew=NULL;
-	struct hooks *bnew=NULL;
-	char *apath=NULL;
-	char *bpath=NULL;
+	struct hooks *last=NULL;
+	struct hooks_src *s=NULL;
+	struct hooks_src *hsrcs=NULL;
 
-	if(!(asb=sbuf_alloc(PROTO_2))
-	  || (srcb && !(bsb=sbuf_alloc(PROTO_2))))
-		goto end;
+	if(mheap_init(&heap, count, NULL, hooks_src_cmp)
+	  || (count && !(hsrcs=(struct hooks_src *)
+		calloc_w(count, sizeof(struct hooks_src), __func__))))
+			goto end;
+	heap.srcs=hsrcs;
 	if(build_path_w(dst))
 		goto end;
-	if((srca && !(azp=fzp_gzopen(srca, "rb")))
-	  || (srcb && !(bzp=fzp_gzopen(srcb, "rb")))
-	  || !(dzp=fzp_gzopen(dst, "wb")))
+	for(i=0; i<count; i++)
+	{
+		if(!srcs[i]) continue;
+		if(!(hsrcs[i].sb=sbuf_alloc(PROTO_2))
+		  || !(hsrcs[i].fzp=fzp_gzopen(srcs[i], "rb")))
+			goto end;
+	}
+	if(!(dzp=fzp_gzopen(dst, "wb")))
 		goto end;
 
-	while(azp || bzp || anew || bnew)
+	for(i=0; i<count; i++)
 	{
-		if(azp
-		  && asb
-		  && !anew)
-		{
-			switch(get_next_set_of_hooks(&anew, asb, azp,
-				&apath, &afingerprints, &aflen))
-			{
-				case -1: goto end;
-				case 1: fzp_close(&azp); // Finished OK.
-			}
-		}
-
-		if(bzp
-		  && bsb
-		  && !bnew)
-		{
-			switch(get_next_set_of_hooks(&bnew, bsb, bzp,
-				&bpath, &bfingerprints, &bflen))
-			{
-				case -1: goto end;
-				case 1: fzp_close(&bzp); // Finished OK.
-			}
-		}
+		if(hooks_src_next(&hsrcs[i])) goto end;
+		if(hsrcs[i].cur) mheap_push(&heap, i);
+	}
 
-		if(anew && !bnew)
-		{
-			if(hooks_gzprintf(dzp, anew)) goto end;
-			hooks_free(&anew);
-		}
-		else if(!anew && bnew)
-		{
-			if(hooks_gzprintf(dzp, bnew)) goto end;
-			hooks_free(&bnew);
-		}
-		else if(!anew && !bnew)
-		{
-			continue;
-		}
-		else if(!(fcmp=hookscmp(anew, bnew)))
-		{
-			// They were the same - write the new one.
-			if(hooks_gzprintf(dzp, bnew)) goto end;
-			hooks_free(&anew);
-			hooks_free(&bnew);
-		}
-		else if(fcmp<0)
-		{
-			if(hooks_gzprintf(dzp, anew)) goto end;
-			hooks_free(&anew);
-		}
+	while(heap.len)
+	{
+		s=&hsrcs[heap.s[0]];
+		if(last && !hookscmp(last, s->cur))
+			hooks_free(&s->cur);
 		else
 		{
-			if(hooks_gzprintf(dzp, bnew)) goto end;
-			hooks_free(&bnew);
+			if(hooks_gzprintf(dzp, s->cur)) goto end;
+			hooks_free(&last);
+			last=s->cur;
+			s->cur=NULL;
 		}
+		if(hooks_src_next(s)) goto end;
+		if(s->cur) mheap_sift_down(&heap, 0);
+		else mheap_pop(&heap);
 	}
 
 	if(fzp_close(&dzp))
@@ -222,156 +306,103 @@ int merge_sparse_indexes(const char *dst, const char *srca, const char *srcb)
 
 	ret=0;
 end:
-	fzp_close(&azp);
-	fzp_close(&bzp);
 	fzp_close(&dzp);
-	sbuf_free(&asb);
-	sbuf_free(&bsb);
-	hooks_free(&anew);
-	hooks_free(&bnew);
-	free_v((void **)&afingerprints);
-	free_v((void **)&bfingerprints);
-	free_w(&apath);
-	free_w(&bpath);
+	hooks_free(&last);
+	hooks_srcs_free(&hsrcs, count);
+	mheap_free(&heap);
 	return ret;
 }
 
-#ifndef UTEST
-static
-#endif
-int dindex_gzprintf(struct fzp *fzp, uint64_t *dindex)
+struct dindex_src
 {
-	struct blk blk;
-	struct iobuf wbuf;
-	blk.savepath=*dindex;
-	blk_to_iobuf_savepath(&blk, &wbuf);
-	return iobuf_send_msg_fzp(&wbuf, fzp);
-}
+	struct dindex_file *df;
+	uint64_t cur;
+};
 
-// Return 0 for OK, -1 for error, 1 for finished reading the file.
-static int get_next_dindex(uint64_t **dnew, struct sbuf *sb, struct fzp *fzp)
+static int dindex_src_cmp(void *srcs, int a, int b)
 {
-	static struct blk blk;
-	static struct iobuf rbuf;
-
-	memset(&rbuf, 0, sizeof(rbuf));
+	struct dindex_src *s=(struct dindex_src *)srcs;
+	if(s[a].cur>s[b].cur) return 1;
+	if(s[a].cur<s[b].cur) return -1;
+	return b-a;
+}
 
-	switch(iobuf_fill_from_fzp(&rbuf, fzp))
-	{
-		case -1: goto error;
-		case 1: return 1; // Reached the end.
-	}
-	if(rbuf.cmd==CMD_SAVE_PATH)
+// Returns 0 with the next dindex in s->cur, or 1 if the source has finished,
+// or -1 for error.
+static int dindex_src_next(struct dindex_src *s)
+{
+	if(!s->df) return 1;
+	switch(dindex_file_read(s->df, &s->cur))
 	{
-		if(blk_set_from_iobuf_savepath(&blk, &rbuf))
-			goto error;
-		*dnew=(uint64_t *)malloc_w(sizeof(uint64_t), __func__);
-		**dnew=blk.savepath;
-		iobuf_free_content(&rbuf);
-		return 0;
+		case -1: return -1;
+		case 1: dindex_file_close(&s->df); return 1; // Finished OK.
 	}
-	else
-		iobuf_log_unexpected(&sb->path, __func__);
+	return 0;
+}
 
-error:
-	iobuf_free_content(&rbuf);
-	return -1;
+static void dindex_srcs_free(struct dindex_src **srcs, int count)
+{
+	int i;
+	if(!*srcs) return;
+	for(i=0; i<count; i++)
+		dindex_file_close(&(*srcs)[i].df);
+	free_v((void **)srcs);
 }
 
-/* Merge two files of sorted dindexes into each other. */
-int merge_dindexes(const char *dst, const char *srca, const char *srcb)
+/* Merge any number of files of sorted dindexes into one. NULL sources are
+   skipped. */
+int merge_dindexes(const char *dst, const char **srcs, int count)
 {
+	int i;
 	int ret=-1;
-	struct sbuf *asb=NULL;
-	struct sbuf *bsb=NULL;
-	struct fzp *azp=NULL;
-	struct fzp *bzp=NULL;
-	struct fzp *dzp=NULL;
-	uint64_t *anew=NULL;
-	uint64_t *bnew=NULL;
-
-	if(!(asb=sbuf_alloc(PROTO_2))
-	  || (srcb && !(bsb=sbuf_alloc(PROTO_2))))
-		goto end;
+	struct mheap heap;
+	struct dindex_file *ddf=NULL;
+	struct dindex_src *s=NULL;
+	struct dindex_src *dsrcs=NULL;
+
+	if(mheap_init(&heap, count, NULL, dindex_src_cmp)
+	  || (count && !(dsrcs=(struct dindex_src *)
+		calloc_w(count, sizeof(struct dindex_src), __func__))))
+			goto end;
+	heap.srcs=dsrcs;
 	if(build_path_w(dst))
 		goto end;
-	if((srca && !(azp=fzp_gzopen(srca, "rb")))
-	  || (srcb && !(bzp=fzp_gzopen(srcb, "rb")))
-	  || !(dzp=fzp_gzopen(dst, "wb")))
+	for(i=0; i<count; i++)
+		if(srcs[i] && !(dsrcs[i].df=dindex_file_open(srcs[i], "rb")))
+			goto end;
+	if(!(ddf=dindex_file_open(dst, "wb")))
 		goto end;
 
-	while(azp || bzp || anew || bnew)
+	for(i=0; i<count; i++)
 	{
-		if(azp
-		  && asb
-		  && !anew)
+		switch(dindex_src_next(&dsrcs[i]))
 		{
-			switch(get_next_dindex(&anew, asb, azp))
-			{
-				case -1: goto end;
-				case 1: fzp_close(&azp); // Finished OK.
-			}
-		}
-
-		if(bzp
-		  && bsb
-		  && !bnew)
-		{
-			switch(get_next_dindex(&bnew, bsb, bzp))
-			{
-				case -1: goto end;
-				case 1: fzp_close(&bzp); // Finished OK.
-			}
+			case -1: goto end;
+			case 0: mheap_push(&heap, i);
 		}
+	}
 
-		if(anew && !bnew)
-		{
-			if(dindex_gzprintf(dzp, anew)) goto end;
-			free_v((void **)&anew);
-		}
-		else if(!anew && bnew)
-		{
-			if(dindex_gzprintf(dzp, bnew)) goto end;
-			free_v((void **)&bnew);
-		}
-		else if(!anew && !bnew)
-		{
-			continue;
-		}
-		else if(*anew==*bnew)
-		{
-			// They were the same - write the new one.
-			if(dindex_gzprintf(dzp, bnew)) goto end;
-			free_v((void **)&anew);
-			free_v((void **)&bnew);
-		}
-		else if(*anew<*bnew)
-		{
-			if(dindex_gzprintf(dzp, anew)) goto end;
-			free_v((void **)&anew);
-		}
-		else
+	while(heap.len)
+	{
+		// Duplicates are dropped by dindex_file_write().
+		s=&dsrcs[heap.s[0]];
+		if(dindex_file_write(ddf, s->cur)) goto end;
+		switch(dindex_src_next(s))
 		{
-			if(dindex_gzprintf(dzp, bnew)) goto end;
-			free_v((void **)&bnew);
+			case -1: goto end;
+			case 0: mheap_sift_down(&heap, 0); break;
+			default: mheap_pop(&heap); break;
 		}
 	}
 
-	if(fzp_close(&dzp))
-	{
-		logp("Error closing %s in %s\n", dst, __func__);
+	if(dindex_file_close(&ddf))
 		goto end;
-	}
 
 	ret=0;
 end:
-	fzp_close(&azp);
-	fzp_close(&bzp);
-	fzp_close(&dzp);
-	sbuf_free(&asb);
-	sbuf_free(&bsb);
-	free_v((void **)&anew);
-	free_v((void **)&bnew);
+	dindex_file_close(&ddf);
+	dindex_srcs_free(&dsrcs, count);
+	mheap_free(&heap);
 	return ret;
 }
 
@@ -386,6 +417,7 @@ int merge_into_global_sparse(const char *sparse, const char *global,
 	int ret=-1;
 	struct stat statp;
 	char *tmpfile=NULL;
+	const char *srcs[2];
 	const char *globalsrc=NULL;
 
 	if(lock->status!=GET_LOCK_GOT)
@@ -399,7 +431,9 @@ int merge_into_global_sparse(const char *sparse, const char *global,
 
 	if(!lstat(global, &statp)) globalsrc=global;
 
-	if(merge_sparse_indexes(tmpfile, globalsrc, sparse))
+	srcs[0]=globalsrc;
+	srcs[1]=sparse;
+	if(merge_sparse_indexes(tmpfile, srcs, 2))
 		goto end;
 
 	// FIX THIS: nasty race condition needs to be recoverable.
@@ -412,6 +446,14 @@ end:
 	return ret;
 }
 
+// Not fatal, because the champ chooser ignores a binary sparse index that
+// is out of date, and reads the gzipped one instead.
+static void write_binary_sparse(const char *global)
+{
+	if(sparse_index_write(global))
+		logp("Could not write binary version of %s\n", global);
+}
+
 static int lock_and_merge_into_global_sparse(const char *sparse,
 	const char *global)
 {
@@ -423,6 +465,7 @@ static int lock_and_merge_into_global_sparse(const char *sparse,
 
 	if(merge_into_global_sparse(sparse, global, lock))
 		goto end;
+	write_binary_sparse(global);
 
 	ret=0;
 end:
@@ -431,23 +474,33 @@ end:
 	return ret;
 }
 
+static void free_srcs(char **srcs, int count)
+{
+	int i;
+	for(i=0; i<count; i++)
+		free_w(&srcs[i]);
+}
+
+// Merges the fcount sequentially named files in srcdir, MERGE_FAN_IN at a
+// time, until there is only one left.
 int merge_files_in_dir(const char *final, const char *fmanifest,
 	const char *srcdir, uint64_t fcount,
-	int merge(const char *dst, const char *srca, const char *srcb))
+	int merge(const char *dst, const char **srcs, int count))
 {
 	int ret=-1;
+	int count=0;
 	uint64_t i=0;
 	uint64_t pass=0;
+	uint64_t merged=0;
+	time_t started;
 	char *m1dir=NULL;
 	char *m2dir=NULL;
-	char *srca=NULL;
-	char *srcb=NULL;
+	char *srcs[MERGE_FAN_IN];
 	char *dst=NULL;
-	char compa[32]="";
-	char compb[32]="";
-	char compd[32]="";
+	char comp[32]="";
 	char *fullsrcdir=NULL;
 
+	memset(srcs, 0, sizeof(srcs));
 	if(!(m1dir=prepend_s(fmanifest, "m1"))
 	  || !(m2dir=prepend_s(fmanifest, "m2"))
 	  || !(fullsrcdir=prepend_s(fmanifest, srcdir)))
@@ -455,7 +508,7 @@ int merge_files_in_dir(const char *final, const char *fmanifest,
 	if(recursive_delete(m1dir)
 	  || recursive_delete(m2dir))
 		goto end;
-	while(1)
+	while(fcount)
 	{
 		const char *srcdir=NULL;
 		const char *dstdir=NULL;
@@ -475,24 +528,31 @@ int merge_files_in_dir(const char *final, const char *fmanifest,
 			dstdir=m1dir;
 		}
 		pass++;
-		for(i=0; i<fcount; i+=2)
+		started=time(NULL);
+		for(i=0; i<fcount; i+=count)
 		{
-			free_w(&srca);
-			free_w(&srcb);
 			free_w(&dst);
-			snprintf(compa, sizeof(compa), "%08" PRIX64, i);
-			snprintf(compb, sizeof(compb), "%08" PRIX64, i+1);
-			snprintf(compd, sizeof(compd), "%08" PRIX64, i/2);
-			if(!(srca=prepend_s(srcdir, compa))
-			  || !(dst=prepend_s(dstdir, compd)))
-				goto end;
-			if(i+1<fcount
-			  && !(srcb=prepend_s(srcdir, compb)))
+			snprintf(comp, sizeof(comp),
+				"%08" PRIX64, i/MERGE_FAN_IN);
+			if(!(dst=prepend_s(dstdir, comp)))
 				goto end;
-			if(merge(dst, srca, srcb))
+			for(count=0;
+			  count<MERGE_FAN_IN && i+count<fcount; count++)
+			{
+				snprintf(comp, sizeof(comp),
+					"%08" PRIX64, i+count);
+				if(!(srcs[count]=prepend_s(srcdir, comp)))
+					goto end;
+			}
+			if(merge(dst, (const char **)srcs, count))
 				goto end;
+			free_srcs(srcs, count);
 		}
-		fcount=i/2;
+		merged=(fcount+MERGE_FAN_IN-1)/MERGE_FAN_IN;
+		logp("Merge pass %" PRIu64 ": %" PRIu64 " files from %s into %"
+			PRIu64 " in %lds\n", pass, fcount, srcdir, merged,
+			(long)(time(NULL)-started));
+		fcount=merged;
 		if(fcount<2) break;
 	}
 
@@ -506,25 +566,26 @@ int merge_files_in_dir(const char *final, const char *fmanifest,
 
 	ret=0;
 end:
+	free_srcs(srcs, MERGE_FAN_IN);
 	free_w(&m1dir);
 	free_w(&m2dir);
-	free_w(&srca);
-	free_w(&srcb);
 	free_w(&dst);
 	free_w(&fullsrcdir);
 	return ret;
 }
 
 int merge_files_in_dir_no_fcount(const char *final, const char *fmanifest,
-	int merge(const char *dst, const char *srca, const char *srcb))
+	int merge(const char *dst, const char **srcs, int count))
 {
 	int ret=-1;
 	int n=0;
 	int i=0;
+	int count=0;
 	char *dst=NULL;
 	char *dstdir=NULL;
 	char compd[32]="";
 	char *fullpath=NULL;
+	const char *srcs[MERGE_FAN_IN];
 	uint64_t fcount=0;
 	struct dirent **dir=NULL;
 	struct strlist *s=NULL;
@@ -559,23 +620,29 @@ int merge_files_in_dir_no_fcount(const char *final, const char *fmanifest,
 		// Have a good entry. Add it to the list.
 		if(strlist_add(&slist, fullpath, 0))
 			goto end;
-		fcount++;
 	}
 
-	// Merge them all into a directory, name the files sequentially.
-	i=0;
-	for(s=slist; s; s=s->next)
+	// Merge them into a directory, MERGE_FAN_IN at a time, naming the
+	// files sequentially.
+	for(s=slist; s; )
 	{
+		for(count=0; s && count<MERGE_FAN_IN; s=s->next)
+			srcs[count++]=s->path;
 		free_w(&dst);
-		snprintf(compd, sizeof(compd), "%08" PRIX64, (uint64_t)i++);
+		snprintf(compd, sizeof(compd), "%08" PRIX64, fcount++);
 		if(!(dst=prepend_s(dstdir, compd)))
 			goto end;
-		if(merge(dst, s->path, s->next?s->next->path:NULL))
+		if(merge(dst, srcs, count))
 			goto end;
 	}
 
-	// Now do a normal merge.
-	if(merge_files_in_dir(final, fmanifest, "n1", fcount, merge))
+	// Now do a normal merge, unless that got everything already.
+	if(fcount==1)
+	{
+		if(do_rename(dst, final))
+			goto end;
+	}
+	else if(merge_files_in_dir(final, fmanifest, "n1", fcount, merge))
 		goto end;
 
 	ret=0;
@@ -629,6 +696,12 @@ int backup_phase4_server_protocol2(struct sdirs *sdirs, struct conf **confs)
 	if(lock_and_merge_into_global_sparse(sparse, sdirs->global_sparse))
 		goto end;
 
+	if(manio_index_write(fmanifest))
+		goto end;
+	// Not fatal, because the status monitor can build it from the
+	// manifest instead.
+	browse_tree_write(sdirs->finishing, PROTO_2);
+
 	logp("End phase4 (sparse generation)\n");
 
 	ret=0;
@@ -797,6 +870,7 @@ int remove_from_global_sparse(const char *global_sparse,
 
 	// FIX THIS: nasty race condition needs to be recoverable.
 	if(do_rename(tmpfile, global_sparse)) goto end;
+	write_binary_sparse(global_sparse);
 
 	ret=0;
 end:
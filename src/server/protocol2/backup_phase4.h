@@ -5,6 +5,9 @@
 #include "../../lock.h"
 #include "../../sbuf.h"
 
+// The most files that are merged into one at a time.
+#define MERGE_FAN_IN	128
+
 struct hooks
 {
 	char *path;
@@ -16,13 +19,13 @@ extern int backup_phase4_server_protocol2(struct sdirs *sdirs,
 	struct conf **confs);
 // Never call regenerate_client_dindex() outside of backup phases 2 to 4!
 extern int regenerate_client_dindex(struct sdirs *sdirs);
-extern int merge_dindexes(const char *dst, const char *srca, const char *srcb);
+extern int merge_dindexes(const char *dst, const char **srcs, int count);
 extern int merge_files_in_dir(const char *final,
 	const char *fmanifest, const char *srcdir, uint64_t fcount,
-	int merge(const char *dst, const char *src, const char *srcb));
+	int merge(const char *dst, const char **srcs, int count));
 extern int merge_files_in_dir_no_fcount(const char *final,
 	const char *fmanifest,
-	int merge(const char *dst, const char *srca, const char *srcb));
+	int merge(const char *dst, const char **srcs, int count));
 
 extern int merge_into_global_sparse(const char *sparse, const char *global,
 	struct lock *lock);
@@ -31,8 +34,7 @@ extern int merge_into_global_sparse(const char *sparse, const char *global,
 extern void hooks_free(struct hooks **hooks);
 extern int hooks_gzprintf(struct fzp *fzp, struct hooks *hooks);
 extern int merge_sparse_indexes(const char *dst,
-	const char *srca, const char *srcb);
-extern int dindex_gzprintf(struct fzp *fzp, uint64_t *dindex);
+	const char **srcs, int count);
 extern int get_next_set_of_hooks(struct hooks **hnew, struct sbuf *sb,
 	struct fzp *spzp, char **path, uint64_t **fingerprints, size_t *len);
 #endif
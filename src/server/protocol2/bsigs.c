@@ -1,4 +1,5 @@
 #include "../../burp.h"
+#include "../../alloc.h"
 #include "../../attribs.h"
 #include "../../base64.h"
 #include "../../fzp.h"
@@ -7,6 +8,8 @@
 #include "../../iobuf.h"
 #include "../../log.h"
 #include "../../protocol2/blk.h"
+#include "../../sbuf.h"
+#include "../manio_v2.h"
 #include "bsigs.h"
 
 static const char *path=NULL;
@@ -62,6 +65,60 @@ end:
 	return ret;
 }
 
+// Finished manifests are in format 2. Its records are the same as the
+// gzipped ones, apart from the attributes, which are stored in binary.
+static int dump_v2(void)
+{
+	int ret=1;
+	struct iobuf rec;
+	struct iobuf rbuf;
+	struct blk blk;
+	struct sbuf *sb=NULL;
+	struct manio_v2 *mv2=NULL;
+	memset(&rbuf, 0, sizeof(struct iobuf));
+
+	if(!(sb=sbuf_alloc(PROTO_2))
+	  || !(mv2=manio_v2_open(path, "rb", MANIO_V2_CODEC_NONE)))
+		goto end;
+	while(1)
+	{
+		iobuf_free_content(&rbuf);
+		switch(manio_v2_read_record(mv2, &rec))
+		{
+			case 1: ret=0; // Finished OK.
+			case -1: goto end; // Error.
+		}
+
+		if(rec.cmd==CMD_ATTRIBS)
+		{
+			// Have them decoded, along with the path that
+			// follows them.
+			manio_v2_unread_record(mv2);
+			if(manio_v2_read(mv2, sb, NULL, 0)
+			  || parse_cmd(&sb->attr, &blk)
+			  || parse_cmd(&sb->path, &blk)
+			  || (sb->link.buf && parse_cmd(&sb->link, &blk)))
+				goto end;
+			continue;
+		}
+
+		// The record is in the middle of a block, so copy it out to
+		// somewhere that the blk code can read numbers from.
+		if(!(rbuf.buf=(char *)malloc_w(rec.len+1, __func__)))
+			goto end;
+		memcpy(rbuf.buf, rec.buf, rec.len+1);
+		rbuf.cmd=rec.cmd;
+		rbuf.len=rec.len;
+		if(parse_cmd(&rbuf, &blk)) goto end;
+	}
+
+end:
+	iobuf_free_content(&rbuf);
+	sbuf_free(&sb);
+	manio_v2_close(&mv2);
+	return ret;
+}
+
 int run_bsigs(int argc, char *argv[])
 {
 	int ret=1;
@@ -76,6 +133,12 @@ int run_bsigs(int argc, char *argv[])
 		return usage();
 	path=argv[1];
 
+	switch(manio_v2_sniff(path))
+	{
+		case 0: break;
+		case 1: return dump_v2();
+		default: return 1;
+	}
 	if(!(fzp=fzp_gzopen(path, "rb")))
 		goto end;
 	while(1)
@@ -17,6 +17,7 @@
 #include "../sdirs.h"
 #include "bsigs.h"
 #include "champ_chooser/champ_chooser.h"
+#include "champ_chooser/sparse_index.h"
 
 static struct cstat *clist=NULL;
 static struct lock *sparse_lock=NULL;
@@ -321,7 +322,8 @@ int run_bsparse(int argc, char *argv[])
 	if(get_client_locks())
 		goto end;
 
-	if(merge_in_all_sparse_indexes(sdirs->global_sparse))
+	if(merge_in_all_sparse_indexes(sdirs->global_sparse)
+	  || sparse_index_write(sdirs->global_sparse))
 		goto end;
 
 	ret=0;
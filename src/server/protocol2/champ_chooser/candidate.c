@@ -7,8 +7,7 @@
 #include "incoming.h"
 #include "scores.h"
 #include "sparse.h"
-
-#include <assert.h>
+#include "sparse_index.h"
 
 struct candidate **candidates=NULL;
 size_t candidates_len=0;
@@ -43,14 +42,7 @@ void candidates_free(void)
 	for(size_t c=0; c<candidates_len; c++)
 		candidate_free(&(candidates[c]));
 	free_v((void **)&candidates);
-}
-
-static void candidates_set_score_pointers(struct candidate **candidates,
-	struct scores *scores)
-{
-	size_t a;
-	for(a=0; candidates && a<candidates_len; a++)
-		candidates[a]->score=&(scores->scores[a]);
+	candidates_len=0;
 }
 
 struct candidate *candidates_add_new(void)
@@ -62,10 +54,45 @@ struct candidate *candidates_add_new(void)
 	if(!(candidates=(struct candidate **)realloc_w(candidates,
 		(candidates_len+1)*sizeof(struct candidate *), __func__)))
 			return NULL;
+	candidate->id=candidates_len;
 	candidates[candidates_len++]=candidate;
 	return candidate;
 }
 
+static int candidates_ready(struct scores *scores)
+{
+	if(scores_grow(scores, candidates_len))
+		return -1;
+	scores_reset(scores);
+	//logp("Now have %d candidates\n", (int)candidates_len);
+	return 0;
+}
+
+// Sets up the candidates from a mapped binary sparse index, which is then
+// owned by the sparse code.
+int candidates_load_index(struct sparse_index *si, struct scores *scores)
+{
+	uint32_t i;
+	uint32_t count;
+	const char *path;
+	struct candidate *candidate;
+
+	count=sparse_index_candidates(si);
+	sparse_set_index(si);
+	for(i=0; i<count; i++)
+	{
+		if(!(path=sparse_index_candidate_path(si, i)))
+		{
+			logp("Bad candidate path %u in sparse index\n", i);
+			return -1;
+		}
+		if(!(candidate=candidates_add_new())
+		  || !(candidate->path=strdup_w(path, __func__)))
+			return -1;
+	}
+	return candidates_ready(scores);
+}
+
 // This deals with reading in the sparse index, as well as actual candidate
 // manifests.
 enum cand_ret candidate_load(struct candidate *candidate, const char *path,
@@ -102,7 +129,9 @@ enum cand_ret candidate_load(struct candidate *candidate, const char *path,
 		}
 		if(blk_fingerprint_is_hook(blk))
 		{
-			if(sparse_add_candidate(&blk->fingerprint, candidate))
+			if(candidate
+			  && sparse_add_candidate(&blk->fingerprint,
+				candidate->id))
 			{
 				ret=CAND_RET_PERM;
 				goto error;
@@ -122,14 +151,11 @@ enum cand_ret candidate_load(struct candidate *candidate, const char *path,
 	}
 
 end:
-	if(scores_grow(scores, candidates_len))
+	if(candidates_ready(scores))
 	{
 		ret=CAND_RET_PERM;
 		goto error;
 	}
-	candidates_set_score_pointers(candidates, scores);
-	scores_reset(scores);
-	//logp("Now have %d candidates\n", (int)candidates_len);
 	ret=CAND_RET_OK;
 error:
 	fzp_close(&fzp);
@@ -163,7 +189,7 @@ int candidate_add_fresh(const char *path, const char *directory,
 			// candidates.
 			logp("Removing candidate.\n");
 			candidates_len--;
-			sparse_delete_fresh_candidate(candidate);
+			sparse_delete_fresh_candidate(candidate->id);
 			candidate_free(&candidate);
 			// Fall through.
 		case CAND_RET_OK:
@@ -174,78 +200,95 @@ error:
 	return -1;
 }
 
-struct candidate *candidates_choose_champ(struct incoming *in,
-	struct candidate *champ_last, struct scores *scores)
+static int fingerprint_cmp(const void *a, const void *b)
 {
-	static uint16_t i;
-	static uint16_t s;
-	static struct sparse *sparse;
-	static struct candidate *best;
-	static struct candidate *candidate;
-	static uint16_t *score;
+	uint64_t x=*(const uint64_t *)a;
+	uint64_t y=*(const uint64_t *)b;
+	if(x<y) return -1;
+	if(x>y) return 1;
+	return 0;
+}
 
-	best=NULL;
+// Sorts the incoming hooks so that repeats are only looked up once, finds
+// the candidates for each one, and adds up the scores. Choosing champs
+// afterwards does not need to look anything up again.
+void candidates_score(struct incoming *in, struct scores *scores)
+{
+	uint16_t i;
+	uint16_t j;
+	size_t len;
+	const uint32_t *ids;
+	struct hit *hit;
 
-	//struct timespec tstart={0,0}, tend={0,0};
-	//clock_gettime(CLOCK_MONOTONIC, &tstart);
+	in->hits_len=0;
+	if(!scores)
+		return;
+	scores_reset_touched(scores);
+	if(!in->size)
+		return;
+	qsort(in->fingerprints, in->size, sizeof(uint64_t), fingerprint_cmp);
+	for(i=0; i<in->size; i=j)
+	{
+		for(j=i+1; j<in->size
+		  && in->fingerprints[j]==in->fingerprints[i]; j++) { }
+		if(!sparse_find_candidates(&in->fingerprints[i], &ids, &len))
+			continue;
+		hit=&in->hits[in->hits_len++];
+		hit->ids=ids;
+		hit->len=len;
+		hit->weight=j-i;
+		hit->found=0;
+		scores_add(scores, hit->ids, hit->len, hit->weight);
+	}
+}
 
-	scores_reset(scores);
+// The highest scoring candidate that has not been deleted. If there is
+// a tie, the one that was added first wins.
+struct candidate *candidates_choose_champ(struct scores *scores)
+{
+	size_t t;
+	uint32_t id;
+	uint16_t score;
+	uint16_t best_score=0;
+	struct candidate *best=NULL;
 
-	for(i=0; i<in->size; i++)
+	if(!scores)
+		return NULL;
+	for(t=0; t<scores->touched_len; t++)
 	{
-		if(in->found[i]) continue;
+		id=scores->touched[t];
+		score=scores->scores[id];
+		if(score<best_score
+		  || !score
+		  || (score==best_score && id>best->id)
+		  || candidates[id]->deleted)
+			continue;
+		best=candidates[id];
+		best_score=score;
+	}
+	return best;
+}
 
-		if(!(sparse=sparse_find(&in->fingerprints[i])))
+// A champ has been loaded. Its hooks are no longer interesting, so take
+// them away from the scores of all the candidates that have them.
+void candidates_champ_chosen(struct incoming *in, struct scores *scores,
+	struct candidate *champ)
+{
+	size_t s;
+	uint16_t h;
+	struct hit *hit;
+
+	for(h=0; h<in->hits_len; h++)
+	{
+		hit=&in->hits[h];
+		if(hit->found)
 			continue;
-		for(s=0; s<sparse->size; s++)
-		{
-			candidate=sparse->candidates[s];
-			if(candidate->deleted) continue;
-			if(candidate==champ_last)
-			{
-				int t;
-				// Want to exclude sparse entries that have
-				// already been found.
-				in->found[i]=1;
-				// Need to go back up the list, subtracting
-				// scores.
-				for(t=s-1; t>=0; t--)
-				{
-					(*(sparse->candidates[t]->score))--;
-//	printf("%d %s   fix: %d\n", i, candidate->path, *(sparse->candidates[t]->score));
-				}
+		for(s=0; s<hit->len; s++)
+			if(hit->ids[s]==champ->id)
 				break;
-			}
-			score=candidate->score;
-			(*score)++;
-//			printf("%d %s score: %d\n", i, candidate->path, *score);
-			assert(*score<=in->size);
-			if(!best
-			// Maybe should check for candidate!=best here too.
-			  || *score>*(best->score))
-			{
-				best=candidate;
-/*
-				printf("%s is now best:\n",
-					best->path);
-				printf("    score %p %d\n",
-					best->score, *(best->score));
-*/
-			}
-			// FIX THIS: figure out a way of giving preference to
-			// newer candidates.
-		}
+		if(s==hit->len)
+			continue;
+		hit->found=1;
+		scores_subtract(scores, hit->ids, hit->len, hit->weight);
 	}
-	//clock_gettime(CLOCK_MONOTONIC, &tend);
-	//printf("champ_chooser took about %.5f seconds\n",
-	//	((double)tend.tv_sec + 1.0e-9*tend.tv_nsec) - 
-	//	((double)tstart.tv_sec + 1.0e-9*tstart.tv_nsec));
-
-/*
-	if(best)
-		printf("%s is choice:\nscore %p %d\n", best->path, best->score, *(best->score));
-	else
-		printf("no choice\n");
-*/
-	return best;
 }
@@ -3,6 +3,7 @@
 
 struct incoming;
 struct scores;
+struct sparse_index;
 
 enum cand_ret
 {
@@ -13,8 +14,8 @@ enum cand_ret
 
 struct candidate
 {
-	uint16_t *score;
 	uint16_t deleted;
+	uint32_t id;
 	char *path;
 };
 
@@ -23,12 +24,16 @@ extern size_t candidates_len;
 
 extern void candidates_free(void);
 extern struct candidate *candidates_add_new(void);
+extern int candidates_load_index(struct sparse_index *si,
+	struct scores *scores);
 extern enum cand_ret candidate_load(struct candidate *candidate,
 	const char *path, struct scores *scores);
 extern int candidate_add_fresh(const char *path, const char *directory,
 	struct scores *scores);
-extern struct candidate *candidates_choose_champ(struct incoming *in,
-	struct candidate *champ_last, struct scores *scores);
+extern void candidates_score(struct incoming *in, struct scores *scores);
+extern struct candidate *candidates_choose_champ(struct scores *scores);
+extern void candidates_champ_chosen(struct incoming *in,
+	struct scores *scores, struct candidate *champ);
 
 #ifdef UTEST
 extern struct candidate *candidate_alloc(void);
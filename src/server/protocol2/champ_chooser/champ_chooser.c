@@ -12,6 +12,7 @@
 #include "incoming.h"
 #include "scores.h"
 #include "sparse.h"
+#include "sparse_index.h"
 
 static void try_lock_msg(int seconds)
 {
@@ -77,6 +78,7 @@ static int load_existing_sparse(const char *datadir, struct scores *scores)
 	struct stat statp;
 	struct lock *lock=NULL;
 	char *sparse_path=NULL;
+	struct sparse_index *si=NULL;
 	if(!(sparse_path=prepend_s(datadir, "sparse"))) goto end;
 	// Best not let other things mess with the sparse lock while we are
 	// trying to read it.
@@ -87,7 +89,14 @@ static int load_existing_sparse(const char *datadir, struct scores *scores)
 		ret=0;
 		goto end;
 	}
-	if(candidate_load(NULL, sparse_path, scores))
+	// The binary version can be mapped rather than read, if it is there
+	// and up to date.
+	if((si=sparse_index_open(sparse_path)))
+	{
+		if(candidates_load_index(si, scores))
+			goto end;
+	}
+	else if(candidate_load(NULL, sparse_path, scores))
 		goto end;
 	ret=0;
 end:
@@ -97,6 +106,10 @@ end:
 	return ret;
 }
 
+// For when the clients are deduplicated one after the other, so that they
+// can all share it.
+static struct hash_table *serial_hash=NULL;
+
 struct scores *champ_chooser_init(const char *datadir)
 {
 	struct scores *scores=NULL;
@@ -113,101 +126,107 @@ void champ_chooser_free(struct scores **scores)
 {
 	candidates_free();
 	sparse_delete_all();
+	hash_table_free(&serial_hash);
 	scores_free(scores);
 }
 
-static int already_got_block(struct asfd *asfd, struct blk *blk)
+static void already_got_block(struct incoming *in,
+	struct hash_table *hash_table, struct blk *blk)
 {
-	static struct hash_weak *hash_weak;
+	struct hash_entry *hash_entry;
 
 	// If already got, need to overwrite the references.
-	if((hash_weak=hash_weak_find(blk->fingerprint)))
+	if((hash_entry=hash_find(hash_table, blk->fingerprint, blk->md5sum)))
 	{
-		static struct hash_strong *hash_strong;
-		if((hash_strong=hash_strong_find(
-			hash_weak, blk->md5sum)))
-		{
-			blk->savepath=hash_strong->savepath;
-//printf("FOUND: %s %s\n", blk->weak, blk->strong);
-//printf("F");
-			blk->got=BLK_GOT;
-			asfd->in->got++;
-			return 0;
-		}
-		else
-		{
-//      printf("COLLISION: %s %s\n", blk->weak, blk->strong);
-//                      collisions++;
-		}
+		blk->savepath=hash_entry->savepath;
+		blk->got=BLK_GOT;
+		in->got++;
+		return;
 	}
 
 	blk->got=BLK_NOT_GOT;
-//printf(".");
-	return 0;
 }
 
 #define CHAMPS_MAX 10
 
-int deduplicate(struct asfd *asfd, const char *directory, struct scores *scores)
+// Deduplicates the blocks from 'blk' to 'last', or to the end of the list
+// if 'last' is NULL. Nothing after 'last' is looked at, so the list can
+// grow while this is going on. Returns the number of champs that were
+// loaded, or -1 on error.
+int deduplicate_blks(struct blk *blk, struct blk *last,
+	struct incoming *in, struct hash_table *hash_table,
+	const char *directory, struct scores *scores)
 {
-	struct blk *blk;
-	struct incoming *in=asfd->in;
 	struct candidate *champ;
-	struct candidate *champ_last=NULL;
 	int count=0;
-	int blk_count=0;
-
-	if(!in) return 0;
 
 	incoming_found_reset(in);
-	count=0;
+	candidates_score(in, scores);
 	while(count!=CHAMPS_MAX
-	  && (champ=candidates_choose_champ(in, champ_last, scores)))
+	  && (champ=candidates_choose_champ(scores)))
 	{
-//		printf("Got champ: %s %d\n", champ->path, *(champ->score));
-		switch(hash_load(champ->path, directory))
+		switch(hash_load(hash_table, champ->path, directory))
 		{
 			case HASH_RET_OK:
 				count++;
-				champ_last=champ;
+				candidates_champ_chosen(in, scores, champ);
 				break;
 			case HASH_RET_PERM:
 				return -1;
 			case HASH_RET_TEMP:
-				champ->deleted=1;
+				// The candidates are shared, so leave them
+				// alone and just try the next best one.
+				scores_drop(scores, champ->id);
 				break;
 		}
 	}
 
-	blk_count=0;
-	for(blk=asfd->blist->blk_to_dedup; blk; blk=blk->next)
+	for(; blk; blk=blk->next)
 	{
-//printf("try: %lu\n", blk->index);
-		blk_count++;
-
 		if(blk_is_zero_length(blk))
 		{
-//printf("got: %s %s\n", blk->weak, blk->strong);
 			blk->got=BLK_GOT;
 			in->got++;
-			continue;
 		}
+		else
+		{
+			// If already got, this will set blk->savepath to be
+			// the location of the already got block.
+			already_got_block(in, hash_table, blk);
+		}
+		if(blk==last)
+			break;
+	}
 
-		// If already got, this function will set blk->save_path
-		// to be the location of the already got block.
-		if(already_got_block(asfd, blk)) return -1;
+	// Start the incoming array again.
+	in->size=0;
+	// Empty the deduplication hash table, ready for the next lot.
+	hash_reset(hash_table);
 
-//printf("after agb: %lu %d\n", blk->index, blk->got);
-	}
+	return count;
+}
+
+int deduplicate(struct asfd *asfd, const char *directory, struct scores *scores)
+{
+	struct blk *blk;
+	struct incoming *in=asfd->in;
+	int count=0;
+	int blk_count=0;
+
+	if(!in) return 0;
+
+	if(!serial_hash && !(serial_hash=hash_table_alloc()))
+		return -1;
+	if((count=deduplicate_blks(asfd->blist->blk_to_dedup, NULL,
+		in, serial_hash, directory, scores))<0)
+			return -1;
+
+	for(blk=asfd->blist->blk_to_dedup; blk; blk=blk->next)
+		blk_count++;
 
 	logp("%s: %04d/%04zu - %04d/%04d\n",
 		asfd->desc, count, candidates_len, in->got, blk_count);
 
-	// Start the incoming array again.
-	in->size=0;
-	// Destroy the deduplication hash table.
-	hash_delete_all();
-
 	asfd->blist->blk_to_dedup=NULL;
 
 	return 0;
@@ -2,10 +2,17 @@
 #define _CHAMP_CHOOSER_H
 
 struct asfd;
+struct blk;
+struct hash_table;
+struct incoming;
+struct scores;
 
 extern struct scores *champ_chooser_init(const char *datadir);
 extern void champ_chooser_free(struct scores **scores);
 
+extern int deduplicate_blks(struct blk *blk, struct blk *last,
+	struct incoming *in, struct hash_table *hash_table,
+	const char *directory, struct scores *scores);
 extern int deduplicate(struct asfd *asfd, const char *directory,
 	struct scores *scores);
 
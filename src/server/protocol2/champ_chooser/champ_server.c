@@ -12,16 +12,25 @@
 #include "../../../log.h"
 #include "../../../protocol2/blist.h"
 #include "../../../protocol2/blk.h"
+#include "../../deleter.h"
 #include "../../sdirs.h"
 #include "candidate.h"
 #include "champ_chooser.h"
 #include "champ_server.h"
+#include "dedup_pool.h"
 #include "dindex.h"
 #include "incoming.h"
 #include "scores.h"
 
 #include <sys/un.h>
 
+// How long to wait for the dedup threads before looking again, when there
+// are jobs that have not finished, in microseconds.
+#define DEDUP_POOL_WAIT_US	10000
+
+// Only set when deduplicating on threads.
+static struct dedup_pool *dedup_pool=NULL;
+
 static int champ_chooser_new_client(struct async *as, struct conf **confs)
 {
 	int fd=-1;
@@ -52,7 +61,9 @@ error:
 	return -1;
 }
 
-static int results_to_fd(struct asfd *asfd)
+// Sends the results for the blocks before 'busy', which is the first one
+// that has not been deduplicated yet.
+static int results_to_fd(struct asfd *asfd, struct blk *busy)
 {
 	static struct iobuf wbuf;
 	struct blk *b;
@@ -61,7 +72,7 @@ static int results_to_fd(struct asfd *asfd)
 	if(!asfd->blist->last_index) return 0;
 
 	// Need to start writing the results down the fd.
-	for(b=asfd->blist->head; b && b!=asfd->blist->blk_to_dedup; b=l)
+	for(b=asfd->blist->head; b && b!=busy; b=l)
 	{
 		if(b->got==BLK_GOT)
 		{
@@ -81,7 +92,7 @@ static int results_to_fd(struct asfd *asfd)
 		{
 			// If the last in the sequence is BLK_NOT_GOT,
 			// Send a 'wrap_up' message.
-			if(!b->next || b->next==asfd->blist->blk_to_dedup)
+			if(!b->next || b->next==busy)
 			{
 				blk_to_iobuf_wrap_up(b, &wbuf);
 				switch(asfd->append_all_to_write_buffer(asfd,
@@ -104,6 +115,16 @@ static int results_to_fd(struct asfd *asfd)
 	return 0;
 }
 
+static int deduplicate_or_queue(struct asfd *asfd,
+	const char *directory, struct scores *scores)
+{
+	if(dedup_pool)
+		return dedup_pool_add_blks(dedup_pool, asfd);
+	if(deduplicate(asfd, directory, scores)<0)
+		return -1;
+	return 0;
+}
+
 static int deduplicate_maybe(struct asfd *asfd,
 	struct blk *blk, const char *directory, struct scores *scores)
 {
@@ -120,10 +141,7 @@ static int deduplicate_maybe(struct asfd *asfd,
 		return 0;
 	asfd->blkcnt=0;
 
-	if(deduplicate(asfd, directory, scores)<0)
-		return -1;
-
-	return 0;
+	return deduplicate_or_queue(asfd, directory, scores);
 }
 
 #ifndef UTEST
@@ -171,7 +189,7 @@ static int deal_with_client_rbuf(struct asfd *asfd, const char *directory,
 		else if(!strncmp_w(asfd->rbuf->buf, "sigs_end"))
 		{
 			//printf("Was told no more sigs\n");
-			if(deduplicate(asfd, directory, scores)<0)
+			if(deduplicate_or_queue(asfd, directory, scores))
 				goto error;
 		}
 		else
@@ -189,8 +207,15 @@ static int deal_with_client_rbuf(struct asfd *asfd, const char *directory,
 	{
 		// Client has completed a manifest file. Want to start using
 		// it as a dedup candidate now.
-		if(candidate_add_fresh(asfd->rbuf->buf, directory, scores))
-			goto error;
+		if(dedup_pool)
+		{
+			if(dedup_pool_add_fresh(dedup_pool,
+				asfd, asfd->rbuf->buf))
+					goto error;
+		}
+		else if(candidate_add_fresh(asfd->rbuf->buf,
+			directory, scores))
+				goto error;
 	}
 	else
 	{
@@ -204,10 +229,24 @@ error:
 	return -1;
 }
 
+static int get_dedup_threads(struct conf **confs)
+{
+	int threads;
+	if((threads=get_int(confs[OPT_DEDUP_THREADS]))<=0)
+		return 0;
+#ifndef HAVE_PTHREAD
+	logp("Ignoring dedup_threads, because built without pthreads\n");
+	return 0;
+#else
+	return threads;
+#endif
+}
+
 int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 	int resume)
 {
 	int s;
+	int threads;
 	int ret=-1;
 	int len;
 	struct asfd *asfd=NULL;
@@ -216,6 +255,7 @@ int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 	struct async *as=NULL;
 	int started=0;
 	struct scores *scores=NULL;
+	struct deleter *deleter=NULL;
 	const char *directory=get_string(confs[OPT_DIRECTORY]);
 
 	if(!(lock=lock_alloc_and_init(sdirs->champlock))
@@ -260,7 +300,7 @@ int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 		goto end;
 	}
 
-	if(!(as=async_alloc())
+	if(!(as=async_alloc_epoll())
 	  || as->init(as, 0)
 	  || !(asfd=setup_asfd(as, "champ chooser main socket", &s,
 		/*port*/-1)))
@@ -272,20 +312,43 @@ int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 	// can fiddle with the dedup_group at this point.
 	// Cannot do it on a resume, or it will delete files that are
 	// referenced in the backup we are resuming.
-	if(delete_unused_data_files(sdirs, resume))
+	if(!(deleter=deleter_alloc_from_conf(confs))
+	  || delete_unused_data_files(sdirs, resume, deleter))
 		goto end;
+	deleter_free(&deleter);
 
 	// Load the sparse indexes for this dedup group.
 	if(!(scores=champ_chooser_init(sdirs->data)))
 		goto end;
 
+	if((threads=get_dedup_threads(confs)))
+	{
+		logp("Using %d dedup threads\n", threads);
+		if(!(dedup_pool=dedup_pool_alloc(threads, directory, scores)))
+			goto end;
+	}
+
 	while(1)
 	{
 		for(asfd=as->asfd->next; asfd; asfd=asfd->next)
 		{
+			struct blk *busy=asfd->blist->blk_to_dedup;
+			if(dedup_pool
+			  && dedup_pool_collect(dedup_pool, asfd, &busy))
+				goto end;
 			if(!asfd->blist->head
+			  || asfd->blist->head==busy
 			  || asfd->blist->head->got==BLK_INCOMING) continue;
-			if(results_to_fd(asfd)) goto end;
+			if(results_to_fd(asfd, busy)) goto end;
+		}
+		if(dedup_pool)
+		{
+			// Look for finished jobs more often while there are
+			// some on the go.
+			if(dedup_pool_outstanding(dedup_pool))
+				as->settimers(as, 0, DEDUP_POOL_WAIT_US);
+			else
+				as->settimers(as, 1, 0);
 		}
 
 		int removed;
@@ -332,6 +395,9 @@ int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 					as->asfd_remove(as, asfd);
 					logp("%s: disconnected fd %d\n",
 						asfd->desc, asfd->fd);
+					if(dedup_pool)
+						dedup_pool_remove(dedup_pool,
+							asfd);
 					a=asfd->next;
 					asfd_free(&asfd);
 					asfd=a;
@@ -353,6 +419,7 @@ int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 
 end:
 	logp("champ chooser exiting: %d\n", ret);
+	dedup_pool_free(&dedup_pool);
 	champ_chooser_free(&scores);
 	log_fzp_set(NULL, confs);
 	async_free(&as);
@@ -360,6 +427,7 @@ end:
 	close_fd(&s);
 	unlink(sdirs->champsock);
 // FIX THIS: free asfds.
+	deleter_free(&deleter);
 	lock_release(lock);
 	lock_free(&lock);
 	return ret;
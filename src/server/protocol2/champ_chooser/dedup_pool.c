@@ -0,0 +1,522 @@
+#include "../../../burp.h"
+#include "../../../alloc.h"
+#include "../../../asfd.h"
+#include "../../../log.h"
+#include "../../../protocol2/blist.h"
+#include "../../../protocol2/blk.h"
+#include "candidate.h"
+#include "champ_chooser.h"
+#include "dedup_pool.h"
+#include "hash.h"
+#include "incoming.h"
+#include "scores.h"
+
+// Deduplicates batches of blocks for the champ chooser clients on separate
+// threads. Each client gets a hash table of its own, and only one of its
+// jobs is worked on at a time, so its jobs finish in the order that they
+// were added. The candidates and the sparse index are shared. Any number of
+// threads can read them at once, but adding a fresh candidate has to wait
+// until nobody is reading them.
+// The main process does everything else, including the logging and the
+// talking to the clients.
+
+#ifdef HAVE_PTHREAD
+
+#include <pthread.h>
+
+enum dedup_job_type
+{
+	DEDUP_JOB_BLKS=0,
+	DEDUP_JOB_FRESH
+};
+
+enum dedup_job_state
+{
+	DEDUP_JOB_QUEUED=0,
+	DEDUP_JOB_RUNNING,
+	DEDUP_JOB_DONE
+};
+
+struct dedup_job
+{
+	enum dedup_job_type type;
+	enum dedup_job_state state;
+	int ret;
+
+	// For DEDUP_JOB_BLKS.
+	struct blk *first;
+	struct blk *last;
+	struct incoming *in;
+	int blks;
+	size_t candidates;
+
+	// For DEDUP_JOB_FRESH.
+	char *path;
+
+	struct dedup_job *next;
+};
+
+struct dedup_client
+{
+	struct asfd *asfd;
+	struct hash_table *hash_table;
+	// Jobs that have been added, but not collected yet.
+	int queued;
+	int queued_max;
+	struct dedup_job *head;
+	struct dedup_job *tail;
+	struct dedup_client *next;
+};
+
+struct dedup_worker
+{
+	pthread_t thread;
+	int started;
+	struct scores *scores;
+	struct dedup_pool *pool;
+};
+
+struct dedup_pool
+{
+	pthread_mutex_t lock;
+	pthread_cond_t work; // Threads wait on this.
+	pthread_cond_t done; // The main process waits on this.
+	pthread_rwlock_t candidates_lock;
+	int stop;
+	int outstanding;
+	const char *directory;
+	// Fresh candidates are loaded with this. Each thread has its own
+	// scores for choosing champs.
+	struct scores *scores;
+	struct dedup_client *clients;
+	int threads;
+	struct dedup_worker *workers;
+};
+
+static void dedup_job_free(struct dedup_job **job)
+{
+	if(!job || !*job) return;
+	incoming_free(&(*job)->in);
+	free_w(&(*job)->path);
+	free_v((void **)job);
+}
+
+static void dedup_client_free(struct dedup_client **client)
+{
+	struct dedup_job *job;
+	struct dedup_job *next;
+	if(!client || !*client) return;
+	for(job=(*client)->head; job; job=next)
+	{
+		next=job->next;
+		dedup_job_free(&job);
+	}
+	hash_table_free(&(*client)->hash_table);
+	free_v((void **)client);
+}
+
+static struct dedup_client *find_client(struct dedup_pool *pool,
+	struct asfd *asfd)
+{
+	struct dedup_client *client;
+	for(client=pool->clients; client; client=client->next)
+		if(client->asfd==asfd)
+			return client;
+	return NULL;
+}
+
+// Called with the lock held. The client that gets a job is moved to the end
+// of the list, so that the others get a turn.
+static struct dedup_job *job_to_run(struct dedup_pool *pool,
+	struct dedup_client **client)
+{
+	struct dedup_job *job;
+	struct dedup_client *c;
+	struct dedup_client *prev=NULL;
+	struct dedup_client *last;
+
+	for(c=pool->clients; c; prev=c, c=c->next)
+	{
+		for(job=c->head; job && job->state==DEDUP_JOB_DONE;
+			job=job->next) { }
+		if(!job || job->state!=DEDUP_JOB_QUEUED)
+			continue;
+		if(c->next)
+		{
+			if(prev)
+				prev->next=c->next;
+			else
+				pool->clients=c->next;
+			for(last=c->next; last->next; last=last->next) { }
+			last->next=c;
+			c->next=NULL;
+		}
+		*client=c;
+		return job;
+	}
+	return NULL;
+}
+
+static int scores_fit(struct scores *scores)
+{
+	if(scores->size>=candidates_len)
+		return 0;
+	if(scores_grow(scores, candidates_len))
+		return -1;
+	scores_reset(scores);
+	return 0;
+}
+
+static void run_job(struct dedup_worker *worker,
+	struct dedup_client *client, struct dedup_job *job)
+{
+	struct dedup_pool *pool=worker->pool;
+
+	job->state=DEDUP_JOB_RUNNING;
+	pthread_mutex_unlock(&pool->lock);
+
+	switch(job->type)
+	{
+		case DEDUP_JOB_BLKS:
+			pthread_rwlock_rdlock(&pool->candidates_lock);
+			job->candidates=candidates_len;
+			if(scores_fit(worker->scores))
+				job->ret=-1;
+			else
+				job->ret=deduplicate_blks(job->first,
+					job->last, job->in,
+					client->hash_table, pool->directory,
+					worker->scores);
+			pthread_rwlock_unlock(&pool->candidates_lock);
+			break;
+		case DEDUP_JOB_FRESH:
+			pthread_rwlock_wrlock(&pool->candidates_lock);
+			job->ret=candidate_add_fresh(job->path,
+				pool->directory, pool->scores);
+			pthread_rwlock_unlock(&pool->candidates_lock);
+			break;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	job->state=DEDUP_JOB_DONE;
+	pthread_cond_broadcast(&pool->done);
+}
+
+static void *dedup_worker_run(void *arg)
+{
+	struct dedup_job *job;
+	struct dedup_client *client=NULL;
+	struct dedup_worker *worker=(struct dedup_worker *)arg;
+	struct dedup_pool *pool=worker->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	while(!pool->stop)
+	{
+		if((job=job_to_run(pool, &client)))
+			run_job(worker, client, job);
+		else
+			pthread_cond_wait(&pool->work, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct dedup_pool *dedup_pool_alloc(int threads,
+	const char *directory, struct scores *scores)
+{
+	int t;
+	int r;
+	struct dedup_pool *pool;
+
+	if(!(pool=(struct dedup_pool *)
+		calloc_w(1, sizeof(struct dedup_pool), __func__)))
+			return NULL;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	pthread_rwlock_init(&pool->candidates_lock, NULL);
+	pool->directory=directory;
+	pool->scores=scores;
+
+	if(!(pool->workers=(struct dedup_worker *)
+		calloc_w(threads, sizeof(struct dedup_worker), __func__)))
+			goto error;
+	pool->threads=threads;
+	for(t=0; t<threads; t++)
+	{
+		struct dedup_worker *worker=&pool->workers[t];
+		worker->pool=pool;
+		if(!(worker->scores=scores_alloc()))
+			goto error;
+		if((r=pthread_create(&worker->thread, NULL,
+			dedup_worker_run, worker)))
+		{
+			logp("Could not start dedup thread: %s\n",
+				strerror(r));
+			goto error;
+		}
+		worker->started=1;
+	}
+	return pool;
+error:
+	dedup_pool_free(&pool);
+	return NULL;
+}
+
+void dedup_pool_free(struct dedup_pool **pool)
+{
+	int t;
+	struct dedup_client *client;
+	struct dedup_client *next;
+	struct dedup_pool *p;
+
+	if(!pool || !*pool) return;
+	p=*pool;
+
+	pthread_mutex_lock(&p->lock);
+	p->stop=1;
+	pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->lock);
+
+	if(p->workers)
+	{
+		for(t=0; t<p->threads; t++)
+		{
+			if(p->workers[t].started)
+				pthread_join(p->workers[t].thread, NULL);
+			scores_free(&p->workers[t].scores);
+		}
+		free_v((void **)&p->workers);
+	}
+
+	for(client=p->clients; client; client=next)
+	{
+		next=client->next;
+		dedup_client_free(&client);
+	}
+
+	pthread_rwlock_destroy(&p->candidates_lock);
+	pthread_cond_destroy(&p->done);
+	pthread_cond_destroy(&p->work);
+	pthread_mutex_destroy(&p->lock);
+	free_v((void **)pool);
+}
+
+static int add_job(struct dedup_pool *pool, struct asfd *asfd,
+	struct dedup_job *job)
+{
+	struct dedup_client *client;
+
+	// The threads move clients around in the list, so looking needs the
+	// lock. Only the main process adds them, though.
+	pthread_mutex_lock(&pool->lock);
+	client=find_client(pool, asfd);
+	pthread_mutex_unlock(&pool->lock);
+	if(!client)
+	{
+		if(!(client=(struct dedup_client *)
+			calloc_w(1, sizeof(struct dedup_client), __func__))
+		  || !(client->hash_table=hash_table_alloc()))
+		{
+			dedup_client_free(&client);
+			dedup_job_free(&job);
+			return -1;
+		}
+		client->asfd=asfd;
+		pthread_mutex_lock(&pool->lock);
+		client->next=pool->clients;
+		pool->clients=client;
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	if(client->tail)
+		client->tail->next=job;
+	else
+		client->head=job;
+	client->tail=job;
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	if(++client->queued>client->queued_max)
+		client->queued_max=client->queued;
+	pool->outstanding++;
+	return 0;
+}
+
+// Hands over the blocks that are waiting to be deduplicated, along with the
+// incoming hooks for them. The main process can carry on adding blocks to
+// the end of the list while they are worked on.
+int dedup_pool_add_blks(struct dedup_pool *pool, struct asfd *asfd)
+{
+	struct blk *blk;
+	struct dedup_job *job;
+
+	if(!asfd->in || !asfd->blist->blk_to_dedup)
+		return 0;
+	if(!(job=(struct dedup_job *)
+		calloc_w(1, sizeof(struct dedup_job), __func__)))
+			return -1;
+	job->type=DEDUP_JOB_BLKS;
+	job->first=asfd->blist->blk_to_dedup;
+	job->last=asfd->blist->tail;
+	for(blk=job->first; blk; blk=blk->next)
+		job->blks++;
+	job->in=asfd->in;
+	asfd->in=NULL;
+	asfd->blist->blk_to_dedup=NULL;
+	return add_job(pool, asfd, job);
+}
+
+// Fresh candidates wait for the earlier jobs from the same client.
+int dedup_pool_add_fresh(struct dedup_pool *pool, struct asfd *asfd,
+	const char *path)
+{
+	struct dedup_job *job;
+
+	if(!(job=(struct dedup_job *)
+		calloc_w(1, sizeof(struct dedup_job), __func__)))
+			return -1;
+	job->type=DEDUP_JOB_FRESH;
+	if(!(job->path=strdup_w(path, __func__)))
+	{
+		dedup_job_free(&job);
+		return -1;
+	}
+	return add_job(pool, asfd, job);
+}
+
+static void log_job(struct dedup_client *client, struct dedup_job *job)
+{
+	if(job->type!=DEDUP_JOB_BLKS)
+		return;
+	logp("%s: %04d/%04zu - %04d/%04d, queued %d\n",
+		client->asfd->desc, job->ret, job->candidates,
+		job->in->got, job->blks, client->queued);
+}
+
+// Takes away the jobs that have finished for the client, in order, and
+// points 'busy' at the first block that has not been deduplicated yet, or
+// NULL if they all have.
+int dedup_pool_collect(struct dedup_pool *pool, struct asfd *asfd,
+	struct blk **busy)
+{
+	int ret=0;
+	struct dedup_job *job;
+	struct dedup_client *client;
+
+	*busy=asfd->blist->blk_to_dedup;
+
+	pthread_mutex_lock(&pool->lock);
+	if(!(client=find_client(pool, asfd)))
+	{
+		pthread_mutex_unlock(&pool->lock);
+		return 0;
+	}
+	while((job=client->head) && job->state==DEDUP_JOB_DONE)
+	{
+		if(!(client->head=job->next))
+			client->tail=NULL;
+		pthread_mutex_unlock(&pool->lock);
+
+		client->queued--;
+		pool->outstanding--;
+		if(job->ret<0)
+			ret=-1;
+		else
+			log_job(client, job);
+		dedup_job_free(&job);
+
+		pthread_mutex_lock(&pool->lock);
+	}
+	for(job=client->head; job; job=job->next)
+	{
+		if(job->type!=DEDUP_JOB_BLKS)
+			continue;
+		*busy=job->first;
+		break;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return ret;
+}
+
+// The main process cannot block waiting for the threads, so it needs to
+// know when to look more often.
+int dedup_pool_outstanding(struct dedup_pool *pool)
+{
+	return pool->outstanding;
+}
+
+// Waits for anything that a thread is doing for the client, and throws
+// away the rest. Needs to be done before the asfd is freed.
+void dedup_pool_remove(struct dedup_pool *pool, struct asfd *asfd)
+{
+	struct dedup_job *job;
+	struct dedup_client *client;
+	struct dedup_client **c;
+
+	pthread_mutex_lock(&pool->lock);
+	if(!(client=find_client(pool, asfd)))
+	{
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+	while(1)
+	{
+		for(job=client->head; job; job=job->next)
+			if(job->state==DEDUP_JOB_RUNNING)
+				break;
+		if(!job)
+			break;
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	for(c=&pool->clients; *c!=client; c=&(*c)->next) { }
+	*c=client->next;
+	pthread_mutex_unlock(&pool->lock);
+
+	logp("%s: at most %d dedup jobs were queued\n",
+		asfd->desc, client->queued_max);
+	pool->outstanding-=client->queued;
+	dedup_client_free(&client);
+}
+
+#else
+
+struct dedup_pool *dedup_pool_alloc(int threads,
+	const char *directory, struct scores *scores)
+{
+	logp("%s() called, but built without pthreads\n", __func__);
+	return NULL;
+}
+
+void dedup_pool_free(struct dedup_pool **pool)
+{
+}
+
+int dedup_pool_add_blks(struct dedup_pool *pool, struct asfd *asfd)
+{
+	return -1;
+}
+
+int dedup_pool_add_fresh(struct dedup_pool *pool, struct asfd *asfd,
+	const char *path)
+{
+	return -1;
+}
+
+int dedup_pool_collect(struct dedup_pool *pool, struct asfd *asfd,
+	struct blk **busy)
+{
+	return -1;
+}
+
+int dedup_pool_outstanding(struct dedup_pool *pool)
+{
+	return 0;
+}
+
+void dedup_pool_remove(struct dedup_pool *pool, struct asfd *asfd)
+{
+}
+
+#endif
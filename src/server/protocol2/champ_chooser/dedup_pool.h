@@ -0,0 +1,20 @@
+#ifndef _CHAMP_CHOOSER_DEDUP_POOL_H
+#define _CHAMP_CHOOSER_DEDUP_POOL_H
+
+struct asfd;
+struct blk;
+struct dedup_pool;
+struct scores;
+
+extern struct dedup_pool *dedup_pool_alloc(int threads,
+	const char *directory, struct scores *scores);
+extern void dedup_pool_free(struct dedup_pool **pool);
+extern int dedup_pool_add_blks(struct dedup_pool *pool, struct asfd *asfd);
+extern int dedup_pool_add_fresh(struct dedup_pool *pool, struct asfd *asfd,
+	const char *path);
+extern int dedup_pool_collect(struct dedup_pool *pool, struct asfd *asfd,
+	struct blk **busy);
+extern int dedup_pool_outstanding(struct dedup_pool *pool);
+extern void dedup_pool_remove(struct dedup_pool *pool, struct asfd *asfd);
+
+#endif
@@ -8,8 +8,9 @@
 #include "../../../protocol2/blk.h"
 #include "../../../sbuf.h"
 #include "../../../strlist.h"
+#include "../../deleter.h"
 #include "../../sdirs.h"
-#include "../backup_phase4.h"
+#include "../savepath_bitmap.h"
 #include "dindex.h"
 
 static int backup_in_progress(const char *fullpath)
@@ -51,7 +52,7 @@ end:
 }
 
 // Returns 0 on OK, -1 on error, 1 if there were backups already in progress.
-static int get_dfiles_to_merge(struct sdirs *sdirs, struct strlist **s)
+static int get_dfiles_to_load(struct sdirs *sdirs, struct strlist **s)
 {
 	int i=0;
 	int n=0;
@@ -114,152 +115,163 @@ end:
 	return ret;
 }
 
-static int do_unlink(struct blk *oblk, const char *datadir)
+struct unused
+{
+	struct strlist *head;
+	struct strlist *tail;
+	uint64_t count;
+};
+
+static int add_unused(uint64_t savepath, void *data)
+{
+	struct unused *unused=(struct unused *)data;
+	struct strlist **sl=unused->tail?&unused->tail->next:&unused->head;
+	if(strlist_add(sl, uint64_to_savepathstr(savepath), 0))
+		return -1;
+	unused->tail=*sl;
+	unused->count++;
+	return 0;
+}
+
+// Unlink every data file that was allocated, but is not used by any backup.
+#ifndef UTEST
+static
+#endif
+int unlink_unused_data_files(struct savepath_bitmap *allocated,
+	struct savepath_bitmap *live, const char *datadir,
+	struct deleter *deleter)
 {
 	int ret=-1;
-	char *fullpath=NULL;
-	char *savepath=uint64_to_savepathstr(oblk->savepath);
-	if(!(fullpath=prepend_s(datadir, savepath)))
+	struct unused unused;
+	memset(&unused, 0, sizeof(unused));
+	if(savepath_bitmap_diff(allocated, live, add_unused, &unused))
 		goto end;
-	errno=0;
-	if(unlink(fullpath) && errno!=ENOENT)
+	if(unused.count)
+		logp("Deleting %" PRIu64 " unused data files\n", unused.count);
+	ret=deleter_unlink_files(deleter, datadir, unused.head);
+end:
+	strlists_free(&unused.head);
+	return ret;
+}
+
+// Add the lists of created files in the cfiles directory.
+static int load_cfiles(struct savepath_bitmap *sb, const char *cfiles)
+{
+	int i=0;
+	int n=0;
+	int ret=-1;
+	char *fullpath=NULL;
+	struct dirent **dir=NULL;
+
+	if((n=scandir(cfiles, &dir, filter_dot, NULL))<0)
 	{
-		logp("Could not unlink %s: %s\n", fullpath, strerror(errno));
+		logp("scandir failed for %s in %s: %s\n",
+			cfiles, __func__, strerror(errno));
 		goto end;
 	}
-	logp("Deleted %s\n", savepath);
+	for(i=0; i<n; i++)
+	{
+		free_w(&fullpath);
+		if(!(fullpath=prepend_s(cfiles, dir[i]->d_name)))
+			goto end;
+		switch(is_dir(fullpath, dir[i]))
+		{
+			case 0: break;
+			case 1: continue;
+			default: logp("is_dir(%s): %s\n",
+					fullpath, strerror(errno));
+				goto end;
+		}
+		if(savepath_bitmap_load_dindex(sb, fullpath))
+			goto end;
+	}
+
 	ret=0;
 end:
 	free_w(&fullpath);
+	if(dir)
+	{
+		for(i=0; i<n; i++)
+			free(dir[i]);
+		free(dir);
+	}
 	return ret;
 }
 
-#ifndef UTEST
-static
-#endif
-int compare_dindexes_and_unlink_datafiles(const char *dindex_old,
-	const char *dindex_new, const char *datadir)
+static int delete_unused(struct sdirs *sdirs, struct strlist *slist,
+	struct deleter *deleter)
 {
 	int ret=-1;
-	struct fzp *nzp=NULL;
-	struct fzp *ozp=NULL;
-	struct iobuf nbuf;
-	struct iobuf obuf;
-	struct blk nblk;
-	struct blk oblk;
+	time_t start=time(NULL);
+	char *dindex_tmp=NULL;
+	char *dindex_old=NULL;
+	struct strlist *s=NULL;
+	struct stat statp;
+	struct savepath_bitmap *allocated=NULL;
+	struct savepath_bitmap *live=NULL;
 
-	iobuf_init(&nbuf);
-	iobuf_init(&obuf);
-	memset(&nblk, 0, sizeof(struct blk));
-	memset(&oblk, 0, sizeof(struct blk));
-	
-	if(!(nzp=fzp_gzopen(dindex_new, "rb"))
-	  || !(ozp=fzp_gzopen(dindex_old, "rb")))
+	if(!(dindex_tmp=prepend_s(sdirs->data, "dindex.tmp"))
+	  || !(dindex_old=prepend_s(sdirs->data, "dindex"))
+	  || !(allocated=savepath_bitmap_alloc())
+	  || !(live=savepath_bitmap_alloc()))
 		goto end;
 
-	while(nzp || ozp)
-	{
-		if(nzp
-		  && !nbuf.buf)
-		{
-			switch(iobuf_fill_from_fzp(&nbuf, nzp))
-			{
-				case 1: fzp_close(&nzp);
-					break;
-				case 0: if(nbuf.cmd!=CMD_SAVE_PATH)
-					{
-						logp("unknown cmd in %s: %c\n",
-							__func__, nbuf.cmd);
-						goto end;
-					}
-					if(blk_set_from_iobuf_savepath(&nblk,
-						&nbuf)) goto end;
-					break;
-				default: goto end; // Error;
-			}
-		}
+	// The files that have been allocated are the ones from last time,
+	// plus the ones that have been created since then (this enables us
+	// to clean up data files that were created for interrupted backups).
+	if(!lstat(dindex_old, &statp)
+	  && savepath_bitmap_load_dindex(allocated, dindex_old))
+		goto end;
+	if(!lstat(sdirs->cfiles, &statp)
+	  && load_cfiles(allocated, sdirs->cfiles))
+		goto end;
 
-		if(ozp
-		  && !obuf.buf)
-		{
-			switch(iobuf_fill_from_fzp(&obuf, ozp))
-			{
-				case 1: fzp_close(&ozp);
-					break;
-				case 0: if(obuf.cmd!=CMD_SAVE_PATH)
-					{
-						logp("unknown cmd in %s: %c\n",
-							__func__, obuf.cmd);
-						goto end;
-					}
-					if(blk_set_from_iobuf_savepath(&oblk,
-						&obuf)) goto end;
-					break;
-				default: goto end; // Error;
-			}
-		}
+	// The files that are live are the ones in any backup.
+	for(s=slist; s; s=s->next)
+		if(savepath_bitmap_load_dindex(live, s->path))
+			goto end;
 
-		if(nbuf.buf && !obuf.buf)
-		{
-			// No more from the old file. Time to stop.
-			break;
-		}
-		else if(!nbuf.buf && obuf.buf)
-		{
-			// No more in the new file. Delete old entry.
-			if(do_unlink(&oblk, datadir))
-				goto end;
-			iobuf_free_content(&obuf);
-		}
-		else if(!nbuf.buf && !obuf.buf)
-		{
-			continue;
-		}
-		else if(nblk.savepath==oblk.savepath)
-		{
-			// Same, free both and continue;
-			iobuf_free_content(&nbuf);
-			iobuf_free_content(&obuf);
-		}
-		else if(nblk.savepath<oblk.savepath)
-		{
-			// Only in the new file.
-			iobuf_free_content(&nbuf);
-		}
-		else
-		{
-			// Only in the old file.
-			if(do_unlink(&oblk, datadir))
-				goto end;
-			iobuf_free_content(&obuf);
-		}
+	if(slist)
+	{
+		if(unlink_unused_data_files(allocated, live, sdirs->data,
+			deleter))
+			goto end;
+		if(savepath_bitmap_write_dindex(live, dindex_tmp)
+		  || do_rename(dindex_tmp, dindex_old))
+			goto end;
+		// No longer need the current cfiles directory.
+		if(recursive_delete(sdirs->cfiles))
+			goto end;
+	}
+	else if(savepath_bitmap_count(allocated))
+	{
+		// No backups to compare against, so just remember what was
+		// allocated.
+		if(savepath_bitmap_write_dindex(allocated, dindex_tmp)
+		  || do_rename(dindex_tmp, dindex_old))
+			goto end;
 	}
 
-
+	logp("Checked %" PRIu64 " data files against %" PRIu64
+		" in use in %lds\n",
+		savepath_bitmap_count(allocated),
+		savepath_bitmap_count(live),
+		(long)(time(NULL)-start));
 	ret=0;
 end:
-	iobuf_free_content(&nbuf);
-	iobuf_free_content(&obuf);
-	fzp_close(&nzp);
-	fzp_close(&ozp);
+	if(dindex_tmp) unlink(dindex_tmp);
+	savepath_bitmap_free(&allocated);
+	savepath_bitmap_free(&live);
+	free_w(&dindex_tmp);
+	free_w(&dindex_old);
 	return ret;
 }
 
-int delete_unused_data_files(struct sdirs *sdirs, int resume)
+int delete_unused_data_files(struct sdirs *sdirs, int resume,
+	struct deleter *deleter)
 {
 	int ret=-1;
-	uint64_t fcount=0;
-	char hfile[32];
-	char *hlinks=NULL;
-	char *fullpath=NULL;
-	char *cindex_tmp=NULL;
-	char *cindex_new=NULL;
-	char *dindex_tmp=NULL;
-	char *dindex_new=NULL;
-	char *dindex_old=NULL;
-	struct strlist *s=NULL;
 	struct strlist *slist=NULL;
-	struct stat statp;
 	struct lock *lock=NULL;
 
 	if(!sdirs)
@@ -294,7 +306,7 @@ int delete_unused_data_files(struct sdirs *sdirs, int resume)
 	logp("Attempting to clean up unused data files %s\n", sdirs->clients);
 
 	// Get all lists of files in all backups.
-	switch(get_dfiles_to_merge(sdirs, &slist))
+	switch(get_dfiles_to_load(sdirs, &slist))
 	{
 		case 0:
 			break; // OK.
@@ -306,98 +318,10 @@ int delete_unused_data_files(struct sdirs *sdirs, int resume)
 			goto end; // Error.
 	}
 
-	if(!(dindex_tmp=prepend_s(sdirs->data, "dindex.tmp"))
-	  || !(dindex_old=prepend_s(sdirs->data, "dindex")))
-		goto end;
-
-	// Get a list of the files that have been created since last time.
-	// (this enables us to clean up data files that were created for
-	// interrupted backups).
-	if(!(cindex_tmp=prepend_s(sdirs->cfiles, "cindex.tmp"))
-	  || recursive_delete(cindex_tmp))
-		goto end;
-	if(!lstat(sdirs->cfiles, &statp))
-	{
-		if(mkdir(cindex_tmp, 0777)
-		  || !(cindex_new=prepend_s(cindex_tmp, "cindex"))
-		  || merge_files_in_dir_no_fcount(cindex_new,
-			sdirs->cfiles, merge_dindexes))
-				goto end;
-		if(!lstat(cindex_new, &statp))
-		{
-			if(lstat(dindex_old, &statp))
-			{
-				// The dindex file does not exist.
-				// Just rename cindex_new.
-				if(do_rename(cindex_new, dindex_old))
-					goto end;
-			}
-			else
-			{
-				// Merge it into the previous list of files
-				// from all backups.
-				if(merge_dindexes(dindex_tmp,
-					dindex_old, cindex_new)
-				  || do_rename(dindex_tmp, dindex_old))
-					goto end;
-			}
-		}
-	}
-
-	// Create a directory of hardlinks to each list of files.
-	if(!(hlinks=prepend_s(dindex_tmp, "hlinks"))
-	  || recursive_delete(dindex_tmp)
-	  || mkdir(dindex_tmp, 0777)
-	  || mkdir(hlinks, 0777))
-		goto end;
-	for(s=slist; s; s=s->next)
-	{
-		snprintf(hfile, sizeof(hfile), "%08" PRIX64, fcount++);
-		free_w(&fullpath);
-		if(!(fullpath=prepend_s(hlinks, hfile)))
-			goto end;
-		if(link(s->path, fullpath))
-		{
-			logp("Could not hardlink %s to %s: %s\n",
-				fullpath, s->path, strerror(errno));
-			goto end;
-		}
-	}
-
-	// Create a single list of files in all backups.
-	if(!(dindex_new=prepend_s(dindex_tmp, "dindex")))
-		goto end;
-	if(merge_files_in_dir(dindex_new,
-		dindex_tmp, "hlinks", fcount, merge_dindexes))
-			goto end;
-
-	if(!lstat(dindex_new, &statp))
-	{
-		if(!lstat(dindex_old, &statp)
-		  && compare_dindexes_and_unlink_datafiles(dindex_old,
-			dindex_new, sdirs->data))
-				goto end;
-		if(do_rename(dindex_new, dindex_old))
-			goto end;
-
-		// No longer need the current cfiles directory.
-		if(recursive_delete(sdirs->cfiles))
-			goto end;
-	}
-
-	ret=0;
+	ret=delete_unused(sdirs, slist, deleter);
 end:
 	strlists_free(&slist);
-	if(cindex_tmp) recursive_delete(cindex_tmp);
-	if(dindex_tmp) recursive_delete(dindex_tmp);
 	lock_release(lock);
 	lock_free(&lock);
-	free_w(&fullpath);
-	free_w(&hlinks);
-	free_w(&cindex_tmp);
-	free_w(&cindex_new);
-	free_w(&dindex_tmp);
-	free_w(&dindex_new);
-	free_w(&dindex_old);
 	return ret;
 }
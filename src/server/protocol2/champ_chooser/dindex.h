@@ -1,11 +1,16 @@
 #ifndef _DINDEX_H
 #define _DINDEX_H
 
-extern int delete_unused_data_files(struct sdirs *sdirs, int resume);
+struct deleter;
+
+extern int delete_unused_data_files(struct sdirs *sdirs, int resume,
+	struct deleter *deleter);
 
 #ifdef UTEST
-extern int compare_dindexes_and_unlink_datafiles(const char *dindex_old,
-	const char *dindex_new, const char *datadir);
+struct savepath_bitmap;
+extern int unlink_unused_data_files(struct savepath_bitmap *allocated,
+	struct savepath_bitmap *live, const char *datadir,
+	struct deleter *deleter);
 #endif
 
 #endif
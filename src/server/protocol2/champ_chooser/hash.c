@@ -4,120 +4,195 @@
 #include "../../../prepend.h"
 #include "../../../protocol2/blk.h"
 #include "../../../sbuf.h"
+#include "../../manio_v2.h"
 #include "hash.h"
 
-struct hash_weak *hash_table=NULL;
+// Open addressing with linear probing. Each slot holds the bottom half of
+// the fingerprint and where the entry is in the arena, so that a probe can
+// usually skip entries that do not match without looking at them. The
+// entries themselves live in one array that is reused between loads.
+// Each champ chooser client has a table of its own, so that they can be
+// deduplicated on different threads.
 
-struct hash_weak *hash_weak_find(uint64_t weak)
+#define HASH_SLOTS_MIN	(1<<14)
+
+struct hash_slot
+{
+	uint32_t tag;
+	uint32_t entry; // Index into the arena plus one, or zero if empty.
+};
+
+struct hash_table
+{
+	struct hash_slot *slots;
+	uint64_t slots_mask;
+	struct hash_entry *entries;
+	size_t entries_len;
+	size_t entries_alloc;
+};
+
+struct hash_table *hash_table_alloc(void)
 {
-	struct hash_weak *hash_weak;
-	HASH_FIND_INT(hash_table, &weak, hash_weak);
-	return hash_weak;
+	return (struct hash_table *)
+		calloc_w(1, sizeof(struct hash_table), __func__);
 }
 
-struct hash_strong *hash_strong_find(struct hash_weak *hash_weak,
-	uint8_t *md5sum)
+void hash_table_free(struct hash_table **t)
 {
-	struct hash_strong *s;
-	for(s=hash_weak->strong; s; s=s->next)
-		if(!memcmp(s->md5sum, md5sum, MD5_DIGEST_LENGTH)) return s;
-	return NULL;
+	if(!t || !*t) return;
+	free_v((void **)&(*t)->slots);
+	free_v((void **)&(*t)->entries);
+	free_v((void **)t);
+}
+
+static inline uint64_t slot_index(uint64_t fingerprint)
+{
+	return (fingerprint*0x9E3779B97F4A7C15ULL)>>32;
 }
 
-struct hash_weak *hash_weak_add(uint64_t weakint)
+static void slot_insert(struct hash_table *t,
+	uint64_t fingerprint, uint32_t entry)
 {
-	struct hash_weak *newweak;
-	if(!(newweak=(struct hash_weak *)
-		malloc_w(sizeof(struct hash_weak), __func__)))
-			return NULL;
-	newweak->weak=weakint;
-//logp("addweak: %016lX\n", weakint);
-	newweak->strong=NULL;
-	HASH_ADD_INT(hash_table, weak, newweak);
-	return newweak;
+	uint64_t i;
+	for(i=slot_index(fingerprint)&t->slots_mask;
+		t->slots[i].entry; i=(i+1)&t->slots_mask) { }
+	t->slots[i].tag=(uint32_t)fingerprint;
+	t->slots[i].entry=entry;
 }
 
-static struct hash_strong *hash_strong_add(struct hash_weak *hash_weak,
-	struct blk *blk)
+static int slots_resize(struct hash_table *t, uint64_t len)
 {
-	struct hash_strong *newstrong;
-	if(!(newstrong=(struct hash_strong *)
-		malloc_w(sizeof(struct hash_strong), __func__)))
-			return NULL;
-	newstrong->savepath=blk->savepath;
-	memcpy(newstrong->md5sum, blk->md5sum, MD5_DIGEST_LENGTH);
-	newstrong->next=hash_weak->strong;
-	return newstrong;
+	size_t e;
+	struct hash_slot *new_slots;
+	if(!(new_slots=(struct hash_slot *)
+		calloc_w(len, sizeof(struct hash_slot), __func__)))
+			return -1;
+	free_v((void **)&t->slots);
+	t->slots=new_slots;
+	t->slots_mask=len-1;
+	for(e=0; e<t->entries_len; e++)
+		slot_insert(t, t->entries[e].fingerprint, e+1);
+	return 0;
 }
 
-static void hash_strongs_free(struct hash_strong *shead)
+static int make_room(struct hash_table *t)
 {
-	static struct hash_strong *s;
-	s=shead;
-	while(shead)
+	// Keep the table at most half full, so that probes stay short.
+	if(!t->slots || (t->entries_len+1)*2>t->slots_mask+1)
+	{
+		if(slots_resize(t,
+			t->slots?(t->slots_mask+1)*2:HASH_SLOTS_MIN))
+				return -1;
+	}
+	if(t->entries_len==t->entries_alloc)
 	{
-		s=shead;
-		shead=shead->next;
-		free_v((void **)&s);
+		size_t len=t->entries_alloc?
+			t->entries_alloc*2:HASH_SLOTS_MIN/2;
+		struct hash_entry *new_entries;
+		if(!(new_entries=(struct hash_entry *)realloc_w(t->entries,
+			len*sizeof(struct hash_entry), __func__)))
+				return -1;
+		t->entries=new_entries;
+		t->entries_alloc=len;
 	}
+	return 0;
 }
 
-void hash_delete_all(void)
+struct hash_entry *hash_find(struct hash_table *t,
+	uint64_t fingerprint, uint8_t *md5sum)
 {
-	struct hash_weak *tmp;
-	struct hash_weak *hash_weak;
-
-	HASH_ITER(hh, hash_table, hash_weak, tmp)
+	uint64_t i;
+	struct hash_entry *e;
+	uint32_t tag=(uint32_t)fingerprint;
+
+	if(!t->entries_len)
+		return NULL;
+	for(i=slot_index(fingerprint)&t->slots_mask;
+		t->slots[i].entry; i=(i+1)&t->slots_mask)
 	{
-		HASH_DEL(hash_table, hash_weak);
-		hash_strongs_free(hash_weak->strong);
-		free_v((void **)&hash_weak);
+		if(t->slots[i].tag!=tag)
+			continue;
+		e=&t->entries[t->slots[i].entry-1];
+		if(e->fingerprint==fingerprint
+		  && !memcmp(e->md5sum, md5sum, MD5_DIGEST_LENGTH))
+			return e;
 	}
-	hash_table=NULL;
+	return NULL;
 }
 
-int hash_load_blk(struct blk *blk)
+int hash_add(struct hash_table *t,
+	uint64_t fingerprint, uint8_t *md5sum, uint64_t savepath)
 {
-	static struct hash_weak *hash_weak;
+	struct hash_entry *e;
+	if(make_room(t))
+		return -1;
+	e=&t->entries[t->entries_len++];
+	e->fingerprint=fingerprint;
+	e->savepath=savepath;
+	memcpy(e->md5sum, md5sum, MD5_DIGEST_LENGTH);
+	slot_insert(t, fingerprint, t->entries_len);
+	return 0;
+}
 
-	hash_weak=hash_weak_find(blk->fingerprint);
+size_t hash_count(struct hash_table *t)
+{
+	return t->entries_len;
+}
 
-	// Add to hash table.
-	if(!hash_weak && !(hash_weak=hash_weak_add(blk->fingerprint)))
-		return -1;
-	if(!hash_strong_find(hash_weak, blk->md5sum))
-	{
-		if(!(hash_weak->strong=hash_strong_add(hash_weak, blk)))
-			return -1;
-	}
+// Empty the table, but keep the memory for the next load.
+void hash_reset(struct hash_table *t)
+{
+	if(!t->entries_len)
+		return;
+	memset(t->slots, 0, (t->slots_mask+1)*sizeof(struct hash_slot));
+	t->entries_len=0;
+}
 
-	return 0;
+int hash_load_blk(struct hash_table *t, struct blk *blk)
+{
+	if(hash_find(t, blk->fingerprint, blk->md5sum))
+		return 0;
+	return hash_add(t, blk->fingerprint, blk->md5sum, blk->savepath);
 }
 
-enum hash_ret hash_load(const char *champ, const char *directory)
+enum hash_ret hash_load(struct hash_table *t,
+	const char *champ, const char *directory)
 {
 	enum hash_ret ret=HASH_RET_PERM;
 	char *path=NULL;
 	struct fzp *fzp=NULL;
+	struct manio_v2 *mv2=NULL;
 	struct sbuf *sb=NULL;
-	static struct blk *blk=NULL;
+	struct blk *blk=NULL;
 
 	if(!(path=prepend_s(directory, champ)))
 		goto end;
-	if(!(fzp=fzp_gzopen(path, "rb")))
+	// Manifests might be in either format.
+	switch(manio_v2_sniff(path))
+	{
+		case 1:
+			mv2=manio_v2_open(path, "rb", MANIO_V2_CODEC_NONE);
+			break;
+		case 0:
+			fzp=fzp_gzopen(path, "rb");
+			break;
+	}
+	if(!fzp && !mv2)
 	{
 		ret=HASH_RET_TEMP;
 		goto end;
 	}
 
-	if((!sb && !(sb=sbuf_alloc(PROTO_2)))
-	  || (!blk && !(blk=blk_alloc())))
+	if(!(sb=sbuf_alloc(PROTO_2))
+	  || !(blk=blk_alloc()))
 		goto end;
 
 	while(1)
 	{
 		sbuf_free_content(sb);
-		switch(sbuf_fill_from_file(sb, fzp, blk))
+		// Only the blocks are wanted, so views are fine.
+		switch(mv2?manio_v2_read(mv2, sb, blk, 1 /* views */):
+			sbuf_fill_from_file(sb, fzp, blk))
 		{
 			case 1: ret=HASH_RET_OK;
 				goto end;
@@ -128,12 +203,15 @@ enum hash_ret hash_load(const char *champ, const char *directory)
 		}
 		if(!blk->got_save_path)
 			continue;
-		if(hash_load_blk(blk))
+		if(hash_load_blk(t, blk))
 			goto end;
 		blk->got_save_path=0;
 	}
 end:
 	free_w(&path);
 	fzp_close(&fzp);
+	manio_v2_close(&mv2);
+	sbuf_free(&sb);
+	blk_free(&blk);
 	return ret;
 }
@@ -1,12 +1,10 @@
 #ifndef _CHAMP_CHOOSER_HASH_H
 #define _CHAMP_CHOOSER_HASH_H
 
-#include <uthash.h>
 #include <openssl/md5.h>
 
 struct blk;
-
-typedef struct hash_strong hash_strong_t;
+struct hash_table;
 
 enum hash_ret
 {
@@ -15,30 +13,28 @@ enum hash_ret
 	HASH_RET_OK=0
 };
 
-struct hash_strong
+// Two of these fit in a cache line. Blocks with the same fingerprint but
+// a different md5sum get an entry each.
+struct hash_entry
 {
-	uint8_t md5sum[MD5_DIGEST_LENGTH];
-	hash_strong_t *next;
+	uint64_t fingerprint;
 	uint64_t savepath;
+	uint8_t md5sum[MD5_DIGEST_LENGTH];
 };
 
-struct hash_weak
-{
-	uint64_t weak;
-	struct hash_strong *strong;
-	UT_hash_handle hh;
-};
-
-extern struct hash_weak *hash_table;
+extern struct hash_table *hash_table_alloc(void);
+extern void hash_table_free(struct hash_table **t);
 
-extern struct hash_weak *hash_weak_find(uint64_t weak);
-extern struct hash_strong *hash_strong_find(struct hash_weak *hash_weak,
-	uint8_t *md5sum);
-extern struct hash_weak *hash_weak_add(uint64_t weakint);
+extern struct hash_entry *hash_find(struct hash_table *t,
+	uint64_t fingerprint, uint8_t *md5sum);
+extern int hash_add(struct hash_table *t,
+	uint64_t fingerprint, uint8_t *md5sum, uint64_t savepath);
+extern size_t hash_count(struct hash_table *t);
 
-extern void hash_delete_all(void);
-extern enum hash_ret hash_load(const char *champ, const char *directory);
+extern void hash_reset(struct hash_table *t);
+extern enum hash_ret hash_load(struct hash_table *t,
+	const char *champ, const char *directory);
 
-extern int hash_load_blk(struct blk *blk);
+extern int hash_load_blk(struct hash_table *t, struct blk *blk);
 
 #endif
@@ -11,7 +11,7 @@ struct incoming *incoming_alloc(void)
 static void incoming_free_content(struct incoming *in)
 {
 	free_v((void **)&in->fingerprints);
-	free_v((void **)&in->found);
+	free_v((void **)&in->hits);
 }
 
 void incoming_free(struct incoming **in)
@@ -30,8 +30,8 @@ int incoming_grow_maybe(struct incoming *in)
 	if((in->fingerprints=(uint64_t *)
 		realloc_w(in->fingerprints,
 			in->allocated*sizeof(uint64_t), __func__))
-	  && (in->found=(uint8_t *)
-		realloc_w(in->found, in->allocated*sizeof(uint8_t), __func__)))
+	  && (in->hits=(struct hit *)
+		realloc_w(in->hits, in->allocated*sizeof(struct hit), __func__)))
 			return 0;
 	return -1;
 }
@@ -39,6 +39,5 @@ int incoming_grow_maybe(struct incoming *in)
 void incoming_found_reset(struct incoming *in)
 {
 	in->got=0;
-	if(!in->found || !in->size) return;
-	memset(in->found, 0, sizeof(in->found[0])*in->size);
+	in->hits_len=0;
 }
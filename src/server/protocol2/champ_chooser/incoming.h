@@ -1,14 +1,28 @@
 #ifndef _CHAMP_CHOOSER_INCOMING_H
 #define _CHAMP_CHOOSER_INCOMING_H
 
+// An incoming hook that is in the sparse index, with the candidates that
+// have it.
+struct hit
+{
+	const uint32_t *ids;
+	size_t len;
+	// How many times it was in the incoming hooks.
+	uint16_t weight;
+	// Whether a champ that has already been chosen has it.
+	uint8_t found;
+};
+
 struct incoming
 {
 	uint64_t *fingerprints;
-	uint8_t *found;
 	uint16_t size;
 	uint16_t allocated;
 
 	uint16_t got;
+
+	struct hit *hits;
+	uint16_t hits_len;
 };
 
 extern struct incoming *incoming_alloc(void);
@@ -1,18 +1,27 @@
 #ifndef _CHAMP_CHOOSER_SCORES_H
 #define _CHAMP_CHOOSER_SCORES_H
 
-// Array to keep the scores. Candidates point at a unique entry in the
-// array for their scores. Keeping them in an array like this means
-// that all the scores can be reset quickly.
+// Array to keep the scores, indexed by candidate number. Keeping them in
+// an array like this means that all the scores can be reset quickly.
+// The candidates that have been given a score are remembered too, so that
+// only they need to be looked at when choosing, or reset afterwards.
 struct scores
 {
 	uint16_t *scores;
 	size_t size;
+	uint32_t *touched;
+	size_t touched_len;
 };
 
 extern struct scores *scores_alloc(void);
 extern void scores_free(struct scores **scores);
 extern int scores_grow(struct scores *scores, size_t count);
 extern void scores_reset(struct scores *scores);
+extern void scores_reset_touched(struct scores *scores);
+extern void scores_add(struct scores *scores,
+	const uint32_t *ids, size_t len, uint16_t weight);
+extern void scores_subtract(struct scores *scores,
+	const uint32_t *ids, size_t len, uint16_t weight);
+extern void scores_drop(struct scores *scores, uint32_t id);
 
 #endif
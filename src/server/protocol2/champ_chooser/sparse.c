@@ -1,9 +1,12 @@
 #include "../../../burp.h"
 #include "../../../alloc.h"
-#include "candidate.h"
 #include "sparse.h"
+#include "sparse_index.h"
 
+// Hooks from the mapped binary index are looked up there. Anything added
+// since it was mapped goes in the hash table, which is checked first.
 static struct sparse *sparse_table=NULL;
+static struct sparse_index *sparse_index=NULL;
 
 static struct sparse *sparse_add(uint64_t fingerprint)
 {
@@ -12,17 +15,62 @@ static struct sparse *sparse_add(uint64_t fingerprint)
 		calloc_w(1, sizeof(struct sparse), __func__)))
 			return NULL;
         sparse->fingerprint=fingerprint;
-	HASH_ADD_INT(sparse_table, fingerprint, sparse);
+	HASH_ADD(hh, sparse_table, fingerprint, sizeof(uint64_t), sparse);
         return sparse;
 }
 
-struct sparse *sparse_find(uint64_t *fingerprint)
+static struct sparse *sparse_find_added(uint64_t *fingerprint)
 {
 	struct sparse *sparse=NULL;
-	HASH_FIND_INT(sparse_table, fingerprint, sparse);
+	HASH_FIND(hh, sparse_table, fingerprint, sizeof(uint64_t), sparse);
 	return sparse;
 }
 
+// Takes ownership of the index.
+void sparse_set_index(struct sparse_index *si)
+{
+	sparse_index_close(&sparse_index);
+	sparse_index=si;
+}
+
+// Does not change anything, so more than one thread can look things up at
+// once, as long as nothing is being added.
+int sparse_find_candidates(uint64_t *fingerprint,
+	const uint32_t **ids, size_t *len)
+{
+	struct sparse *sparse;
+
+	if((sparse=sparse_find_added(fingerprint)))
+	{
+		*ids=sparse->candidates;
+		*len=sparse->size;
+		return 1;
+	}
+	if(!sparse_index
+	  || sparse_index_find(sparse_index, *fingerprint, ids, len)<=0)
+		return 0;
+	return 1;
+}
+
+struct sparse *sparse_find(uint64_t *fingerprint)
+{
+	size_t len;
+	const uint32_t *ids;
+	static struct sparse mapped;
+	struct sparse *sparse;
+
+	if((sparse=sparse_find_added(fingerprint)))
+		return sparse;
+	if(!sparse_find_candidates(fingerprint, &ids, &len))
+		return NULL;
+	// The map is read only, but nothing writes through a 'struct
+	// sparse' that sparse_find() returns.
+	mapped.fingerprint=*fingerprint;
+	mapped.size=len;
+	mapped.candidates=(uint32_t *)ids;
+	return &mapped;
+}
+
 void sparse_delete_all(void)
 {
 	struct sparse *tmp;
@@ -35,33 +83,55 @@ void sparse_delete_all(void)
 		free_v((void **)&sparse);
 	}
 	sparse_table=NULL;
+	sparse_index_close(&sparse_index);
+}
+
+// Start with a copy of what the mapped index has for the fingerprint, so
+// that the order of the candidates stays the same.
+static struct sparse *sparse_add_from_index(uint64_t *fingerprint)
+{
+	size_t len;
+	const uint32_t *ids;
+	struct sparse *sparse;
+
+	if(!(sparse=sparse_add(*fingerprint)))
+		return NULL;
+	if(!sparse_index
+	  || sparse_index_find(sparse_index, *fingerprint, &ids, &len)<=0)
+		return sparse;
+	if(!(sparse->candidates=(uint32_t *)
+		malloc_w(len*sizeof(uint32_t), __func__)))
+			return NULL;
+	memcpy(sparse->candidates, ids, len*sizeof(uint32_t));
+	sparse->size=len;
+	return sparse;
 }
 
-int sparse_add_candidate(uint64_t *fingerprint, struct candidate *candidate)
+int sparse_add_candidate(uint64_t *fingerprint, uint32_t id)
 {
 	static size_t s;
 	static struct sparse *sparse;
 
-	if((sparse=sparse_find(fingerprint)))
+	if((sparse=sparse_find_added(fingerprint)))
 	{
 		// Do not add it to the list if it has already been added.
 		for(s=0; s<sparse->size; s++)
-			if(sparse->candidates[s]==candidate)
+			if(sparse->candidates[s]==id)
 				return 0;
 	}
 
-	if(!sparse && !(sparse=sparse_add(*fingerprint)))
+	if(!sparse && !(sparse=sparse_add_from_index(fingerprint)))
 		return -1;
-	if(!(sparse->candidates=(struct candidate **)
+	if(!(sparse->candidates=(uint32_t *)
 		realloc_w(sparse->candidates,
-			(sparse->size+1)*sizeof(struct candidate *), __func__)))
+			(sparse->size+1)*sizeof(uint32_t), __func__)))
 				return -1;
-	sparse->candidates[sparse->size++]=candidate;
+	sparse->candidates[sparse->size++]=id;
 	
 	return 0;
 }
 
-void sparse_delete_fresh_candidate(struct candidate *candidate)
+void sparse_delete_fresh_candidate(uint32_t id)
 {
 	struct sparse *tmp;
 	struct sparse *sparse;
@@ -70,7 +140,7 @@ void sparse_delete_fresh_candidate(struct candidate *candidate)
 	{
 		// Only works if the candidate being deleted is the most recent
 		// one added. Which is fine for candidate_add_fresh().
-		if(sparse->candidates[sparse->size-1]==candidate)
+		if(sparse->size && sparse->candidates[sparse->size-1]==id)
 			sparse->size--;
 	}
 }
@@ -3,18 +3,23 @@
 
 #include <uthash.h>
 
+struct sparse_index;
+
+// The candidates are numbers in the global candidates array.
 struct sparse
 {
 	uint64_t fingerprint;
 	size_t size;
-	struct candidate **candidates;
+	uint32_t *candidates;
 	UT_hash_handle hh;
 };
 
+extern void sparse_set_index(struct sparse_index *si);
+extern int sparse_find_candidates(uint64_t *fingerprint,
+	const uint32_t **ids, size_t *len);
 extern struct sparse *sparse_find(uint64_t *fingerprint);
 extern void sparse_delete_all(void);
-extern int sparse_add_candidate(uint64_t *fingerprint,
-	struct candidate *candidate);
-extern void sparse_delete_fresh_candidate(struct candidate *candidate);
+extern int sparse_add_candidate(uint64_t *fingerprint, uint32_t id);
+extern void sparse_delete_fresh_candidate(uint32_t id);
 
 #endif
@@ -0,0 +1,421 @@
+#include "../../../burp.h"
+#include "../../../alloc.h"
+#include "../../../fsops.h"
+#include "../../../fzp.h"
+#include "../../../log.h"
+#include "../../../prepend.h"
+#include "../../../protocol2/blk.h"
+#include "../../../sbuf.h"
+#include "sparse_index.h"
+
+#include <sys/mman.h>
+
+// A binary copy of the global sparse index, kept next to it, that the
+// champ chooser can map instead of reading the gzipped original.
+// After the header come:
+//   the sorted hook fingerprints, as uint64_t;
+//   for each hook, where its candidates start in the postings, as uint64_t,
+//     with one extra on the end;
+//   for each candidate, where its path starts in the paths, as uint64_t;
+//   the postings - lists of candidate numbers, as uint32_t;
+//   the candidate paths, each one nul terminated.
+// Numbers are in the byte order of the machine that wrote it. The header
+// records which version of the gzipped file it was made from, so an
+// index that is out of date, or from another machine, is just ignored.
+
+#define SPARSE_INDEX_MAGIC	"burpspi1"
+#define SPARSE_INDEX_MAGIC_LEN	8
+#define SPARSE_INDEX_BYTE_ORDER	0x01020304
+
+struct sparse_index_header
+{
+	char magic[SPARSE_INDEX_MAGIC_LEN];
+	uint32_t byte_order;
+	uint32_t reserved;
+	uint64_t sparse_ino;
+	uint64_t sparse_size;
+	int64_t sparse_mtime;
+	uint64_t candidates;
+	uint64_t hooks;
+	uint64_t postings;
+	uint64_t paths_len;
+};
+
+struct sparse_index
+{
+	char *map;
+	size_t size;
+	const struct sparse_index_header *header;
+	const uint64_t *fingerprints;
+	const uint64_t *offsets;
+	const uint64_t *path_offsets;
+	const uint32_t *postings;
+	const char *paths;
+};
+
+struct hook
+{
+	uint64_t fingerprint;
+	uint32_t id;
+};
+
+static char *get_index_path(const char *global_sparse)
+{
+	return prepend_n(global_sparse, "idx", strlen("idx"), ".");
+}
+
+static void header_set_source(struct sparse_index_header *header,
+	struct stat *statp)
+{
+	header->sparse_ino=(uint64_t)statp->st_ino;
+	header->sparse_size=(uint64_t)statp->st_size;
+	header->sparse_mtime=(int64_t)statp->st_mtime;
+}
+
+static int grow(void **buf, size_t *alloc, size_t want, size_t size)
+{
+	size_t len;
+	void *newbuf;
+	if(want<=*alloc)
+		return 0;
+	len=*alloc?*alloc:1024;
+	while(len<want) len*=2;
+	if(!(newbuf=realloc_w(*buf, len*size, __func__)))
+		return -1;
+	*buf=newbuf;
+	*alloc=len;
+	return 0;
+}
+
+static int hookcmp(const void *a, const void *b)
+{
+	const struct hook *x=(const struct hook *)a;
+	const struct hook *y=(const struct hook *)b;
+	if(x->fingerprint<y->fingerprint) return -1;
+	if(x->fingerprint>y->fingerprint) return 1;
+	if(x->id<y->id) return -1;
+	if(x->id>y->id) return 1;
+	return 0;
+}
+
+static int write_all(struct fzp *fzp, const void *buf, size_t len)
+{
+	if(len && fzp_write(fzp, buf, len)!=len)
+		return -1;
+	return 0;
+}
+
+static int write_index(const char *path, struct sparse_index_header *header,
+	struct hook *hooks, size_t hooks_len,
+	uint64_t *path_offsets, const char *paths)
+{
+	size_t h;
+	size_t u;
+	uint64_t offset=0;
+	struct fzp *fzp=NULL;
+
+	if(!(fzp=fzp_open(path, "wb"))
+	  || write_all(fzp, header, sizeof(*header)))
+		goto error;
+	for(h=0; h<hooks_len; h=u)
+	{
+		for(u=h; u<hooks_len
+		  && hooks[u].fingerprint==hooks[h].fingerprint; u++) { }
+		if(write_all(fzp, &hooks[h].fingerprint, sizeof(uint64_t)))
+			goto error;
+	}
+	for(h=0; h<hooks_len; h=u)
+	{
+		for(u=h; u<hooks_len
+		  && hooks[u].fingerprint==hooks[h].fingerprint; u++) { }
+		if(write_all(fzp, &offset, sizeof(offset)))
+			goto error;
+		offset+=u-h;
+	}
+	if(write_all(fzp, &offset, sizeof(offset))
+	  || write_all(fzp, path_offsets,
+		header->candidates*sizeof(uint64_t)))
+			goto error;
+	for(h=0; h<hooks_len; h++)
+		if(write_all(fzp, &hooks[h].id, sizeof(uint32_t)))
+			goto error;
+	if(write_all(fzp, paths, header->paths_len))
+		goto error;
+	return fzp_close(&fzp);
+error:
+	logp("Could not write %s\n", path);
+	fzp_close(&fzp);
+	return -1;
+}
+
+// Reads the gzipped global sparse index, which must be locked, and writes
+// the binary version of it.
+int sparse_index_write(const char *global_sparse)
+{
+	int ret=-1;
+	size_t h;
+	size_t u;
+	struct stat statp;
+	char *path=NULL;
+	char *tmpfile=NULL;
+	struct fzp *spzp=NULL;
+	struct sbuf *sb=NULL;
+	struct blk *blk=NULL;
+	struct hook *hooks=NULL;
+	size_t hooks_len=0;
+	size_t hooks_alloc=0;
+	char *paths=NULL;
+	size_t paths_alloc=0;
+	uint64_t *path_offsets=NULL;
+	size_t path_offsets_alloc=0;
+	struct sparse_index_header header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SPARSE_INDEX_MAGIC, SPARSE_INDEX_MAGIC_LEN);
+	header.byte_order=SPARSE_INDEX_BYTE_ORDER;
+
+	if(!(path=get_index_path(global_sparse))
+	  || !(tmpfile=prepend_n(path, "tmp", strlen("tmp"), ".")))
+		goto end;
+	if(lstat(global_sparse, &statp))
+	{
+		// No sparse index, so there should be no binary one either.
+		if(unlink(path) && errno!=ENOENT)
+			goto end;
+		ret=0;
+		goto end;
+	}
+	header_set_source(&header, &statp);
+
+	if(!(sb=sbuf_alloc(PROTO_2))
+	  || !(blk=blk_alloc())
+	  || !(spzp=fzp_gzopen(global_sparse, "rb")))
+		goto end;
+	while(1)
+	{
+		sbuf_free_content(sb);
+		switch(sbuf_fill_from_file(sb, spzp, blk))
+		{
+			case 1: goto loaded;
+			case -1:
+				logp("Error reading %s in %s\n",
+					global_sparse, __func__);
+				goto end;
+		}
+		if(blk_fingerprint_is_hook(blk))
+		{
+			if(!header.candidates)
+				continue;
+			if(grow((void **)&hooks, &hooks_alloc,
+				hooks_len+1, sizeof(struct hook)))
+					goto end;
+			hooks[hooks_len].fingerprint=blk->fingerprint;
+			hooks[hooks_len++].id=header.candidates-1;
+		}
+		else if(sb->path.cmd==CMD_MANIFEST)
+		{
+			if(header.candidates>=UINT32_MAX
+			  || grow((void **)&path_offsets, &path_offsets_alloc,
+				header.candidates+1, sizeof(uint64_t))
+			  || grow((void **)&paths, &paths_alloc,
+				header.paths_len+sb->path.len+1, 1))
+					goto end;
+			path_offsets[header.candidates++]=header.paths_len;
+			memcpy(paths+header.paths_len,
+				sb->path.buf, sb->path.len);
+			header.paths_len+=sb->path.len;
+			paths[header.paths_len++]='\0';
+		}
+		blk->fingerprint=0;
+	}
+loaded:
+	// Sort by fingerprint, keeping the candidates for each fingerprint
+	// in the order that they were read, and drop any repeats.
+	if(hooks_len)
+		qsort(hooks, hooks_len, sizeof(struct hook), hookcmp);
+	for(h=0, u=0; h<hooks_len; h++)
+	{
+		if(u && !hookcmp(&hooks[u-1], &hooks[h]))
+			continue;
+		if(!u || hooks[u-1].fingerprint!=hooks[h].fingerprint)
+			header.hooks++;
+		hooks[u++]=hooks[h];
+	}
+	hooks_len=u;
+	header.postings=hooks_len;
+
+	if(write_index(tmpfile, &header, hooks, hooks_len,
+		path_offsets, paths)
+	  || do_rename(tmpfile, path))
+		goto end;
+	ret=0;
+end:
+	if(ret && tmpfile)
+		unlink(tmpfile);
+	fzp_close(&spzp);
+	sbuf_free(&sb);
+	blk_free(&blk);
+	free_v((void **)&hooks);
+	free_v((void **)&path_offsets);
+	free_w(&paths);
+	free_w(&tmpfile);
+	free_w(&path);
+	return ret;
+}
+
+static int check_header(struct sparse_index *si, struct stat *statp)
+{
+	size_t need;
+	struct sparse_index_header source;
+	const struct sparse_index_header *h=si->header;
+
+	if(memcmp(h->magic, SPARSE_INDEX_MAGIC, SPARSE_INDEX_MAGIC_LEN)
+	  || h->byte_order!=SPARSE_INDEX_BYTE_ORDER)
+		return -1;
+	header_set_source(&source, statp);
+	if(h->sparse_ino!=source.sparse_ino
+	  || h->sparse_size!=source.sparse_size
+	  || h->sparse_mtime!=source.sparse_mtime)
+		return -1;
+	// Check each count before adding them up, so that nothing can
+	// overflow.
+	if(h->candidates>UINT32_MAX
+	  || h->hooks>si->size
+	  || h->postings>si->size
+	  || h->paths_len>si->size)
+		return -1;
+	need=sizeof(struct sparse_index_header)
+		+h->hooks*sizeof(uint64_t)
+		+(h->hooks+1)*sizeof(uint64_t)
+		+h->candidates*sizeof(uint64_t)
+		+h->postings*sizeof(uint32_t)
+		+h->paths_len;
+	if(need!=si->size)
+		return -1;
+
+	si->fingerprints=(const uint64_t *)(si->map
+		+sizeof(struct sparse_index_header));
+	si->offsets=si->fingerprints+h->hooks;
+	si->path_offsets=si->offsets+h->hooks+1;
+	si->postings=(const uint32_t *)(si->path_offsets+h->candidates);
+	si->paths=(const char *)(si->postings+h->postings);
+
+	if(si->offsets[h->hooks]!=h->postings
+	  || (h->paths_len && si->paths[h->paths_len-1]))
+		return -1;
+	return 0;
+}
+
+// Returns NULL if there is no usable binary index, in which case the
+// gzipped one should be read instead.
+struct sparse_index *sparse_index_open(const char *global_sparse)
+{
+	int fd=-1;
+	char *path=NULL;
+	struct stat statp;
+	struct stat sparse_statp;
+	struct sparse_index *si=NULL;
+
+	if(lstat(global_sparse, &sparse_statp)
+	  || !(path=get_index_path(global_sparse)))
+		goto error;
+	if((fd=open(path, O_RDONLY))<0)
+	{
+		if(errno!=ENOENT)
+			logp("Could not open %s: %s\n", path, strerror(errno));
+		goto error;
+	}
+	if(fstat(fd, &statp)
+	  || (size_t)statp.st_size<sizeof(struct sparse_index_header))
+		goto ignored;
+	if(!(si=(struct sparse_index *)
+		calloc_w(1, sizeof(struct sparse_index), __func__)))
+			goto error;
+	si->size=(size_t)statp.st_size;
+	si->map=(char *)mmap(NULL, si->size, PROT_READ, MAP_SHARED, fd, 0);
+	if(si->map==MAP_FAILED)
+	{
+		si->map=NULL;
+		logp("Could not mmap %s: %s\n", path, strerror(errno));
+		goto error;
+	}
+	close(fd);
+	fd=-1;
+	si->header=(const struct sparse_index_header *)si->map;
+	if(check_header(si, &sparse_statp))
+		goto ignored;
+
+	logp("Mapped %s: %" PRIu64 " candidates, %" PRIu64 " hooks\n",
+		path, si->header->candidates, si->header->hooks);
+	free_w(&path);
+	return si;
+ignored:
+	logp("Ignoring out of date or unusable %s\n", path);
+error:
+	if(fd>=0) close(fd);
+	sparse_index_close(&si);
+	free_w(&path);
+	return NULL;
+}
+
+void sparse_index_close(struct sparse_index **si)
+{
+	if(!si || !*si) return;
+	if((*si)->map)
+		munmap((*si)->map, (*si)->size);
+	free_v((void **)si);
+}
+
+uint32_t sparse_index_candidates(struct sparse_index *si)
+{
+	return (uint32_t)si->header->candidates;
+}
+
+const char *sparse_index_candidate_path(struct sparse_index *si, uint32_t id)
+{
+	uint64_t offset;
+	if(id>=si->header->candidates)
+		return NULL;
+	offset=si->path_offsets[id];
+	if(offset>=si->header->paths_len)
+		return NULL;
+	return si->paths+offset;
+}
+
+// Returns 1 and points *ids at the candidates for the fingerprint if it is
+// a hook, 0 if it is not, or -1 if the index is corrupt.
+int sparse_index_find(struct sparse_index *si, uint64_t fingerprint,
+	const uint32_t **ids, size_t *len)
+{
+	size_t i;
+	size_t lo=0;
+	size_t hi=si->header->hooks;
+	uint64_t start;
+	uint64_t end;
+
+	while(lo<hi)
+	{
+		size_t mid=lo+(hi-lo)/2;
+		if(si->fingerprints[mid]<fingerprint)
+			lo=mid+1;
+		else
+			hi=mid;
+	}
+	if(lo>=si->header->hooks
+	  || si->fingerprints[lo]!=fingerprint)
+		return 0;
+
+	start=si->offsets[lo];
+	end=si->offsets[lo+1];
+	if(start>end || end>si->header->postings)
+		goto corrupt;
+	for(i=start; i<end; i++)
+		if(si->postings[i]>=si->header->candidates)
+			goto corrupt;
+	*ids=si->postings+start;
+	*len=end-start;
+	return 1;
+corrupt:
+	logp("Corrupt sparse index entry for %016" PRIX64 "\n", fingerprint);
+	return -1;
+}
@@ -0,0 +1,16 @@
+#ifndef _CHAMP_CHOOSER_SPARSE_INDEX_H
+#define _CHAMP_CHOOSER_SPARSE_INDEX_H
+
+struct sparse_index;
+
+extern int sparse_index_write(const char *global_sparse);
+extern struct sparse_index *sparse_index_open(const char *global_sparse);
+extern void sparse_index_close(struct sparse_index **si);
+
+extern uint32_t sparse_index_candidates(struct sparse_index *si);
+extern const char *sparse_index_candidate_path(struct sparse_index *si,
+	uint32_t id);
+extern int sparse_index_find(struct sparse_index *si, uint64_t fingerprint,
+	const uint32_t **ids, size_t *len);
+
+#endif
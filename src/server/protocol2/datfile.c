@@ -0,0 +1,258 @@
+#include "../../burp.h"
+#include "../../alloc.h"
+#include "../../cmd.h"
+#include "../../fzp.h"
+#include "../../log.h"
+#include "datfile.h"
+
+#include <sys/mman.h>
+
+// A data file is a series of blocks, each one a five byte tag ('a' for
+// CMD_DATA, then the length in four hex digits) followed by the data.
+// Files written since the index was added also have, on the end, the
+// offset of each tag as four big endian bytes, then the number of blocks
+// as four big endian bytes, then the magic string.
+// Files without the index are still readable - the tags are scanned for
+// when they are opened.
+
+#define DATFILE_TAG_LEN		5
+#define DATFILE_MAGIC		"burpdix1"
+#define DATFILE_MAGIC_LEN	8
+#define DATFILE_TRAILER_LEN	(4+DATFILE_MAGIC_LEN)
+
+struct datfile
+{
+	char *map;
+	size_t size;
+	// Either points into the map, or to 'scanned'.
+	const unsigned char *index;
+	uint32_t *scanned;
+	uint16_t count;
+	// Blocks may not extend into the index.
+	size_t data_end;
+};
+
+static void put_be32(unsigned char *b, uint32_t v)
+{
+	b[0]=(v>>24)&0xFF;
+	b[1]=(v>>16)&0xFF;
+	b[2]=(v>>8)&0xFF;
+	b[3]=v&0xFF;
+}
+
+static uint32_t get_be32(const unsigned char *b)
+{
+	return ((uint32_t)b[0]<<24)
+		| ((uint32_t)b[1]<<16)
+		| ((uint32_t)b[2]<<8)
+		| (uint32_t)b[3];
+}
+
+static int fprint_tag(struct fzp *fzp, enum cmd cmd, unsigned int s)
+{
+	if(fzp_printf(fzp, "%c%04X", cmd, s)!=DATFILE_TAG_LEN)
+	{
+		logp("Short fprintf\n");
+		return -1;
+	}
+	return 0;
+}
+
+int datfile_write_blk(struct fzp *fzp, struct datfile_index *index,
+	const char *buf, uint32_t len)
+{
+	size_t bytes;
+	if(index->count>=DATA_FILE_SIG_MAX)
+	{
+		logp("Too many blocks for one data file\n");
+		return -1;
+	}
+	if(fprint_tag(fzp, CMD_DATA, len)) return -1;
+	if((bytes=fzp_write(fzp, buf, len))!=len)
+	{
+		logp("Short write: %d\n", (int)bytes);
+		return -1;
+	}
+	index->offsets[index->count++]=index->offset;
+	index->offset+=DATFILE_TAG_LEN+len;
+	return 0;
+}
+
+int datfile_write_index(struct fzp *fzp, struct datfile_index *index)
+{
+	uint16_t i;
+	unsigned char b[4];
+
+	for(i=0; i<index->count; i++)
+	{
+		put_be32(b, index->offsets[i]);
+		if(fzp_write(fzp, b, sizeof(b))!=sizeof(b))
+			goto error;
+	}
+	put_be32(b, index->count);
+	if(fzp_write(fzp, b, sizeof(b))!=sizeof(b)
+	  || fzp_write(fzp, DATFILE_MAGIC, DATFILE_MAGIC_LEN)
+		!=DATFILE_MAGIC_LEN)
+			goto error;
+	return 0;
+error:
+	logp("Could not write data file index\n");
+	return -1;
+}
+
+static int read_index(struct datfile *datfile)
+{
+	uint32_t count;
+	size_t index_len;
+	const unsigned char *trailer;
+
+	if(datfile->size<DATFILE_TRAILER_LEN)
+		return -1;
+	trailer=(const unsigned char *)datfile->map
+		+datfile->size-DATFILE_TRAILER_LEN;
+	if(memcmp(trailer+4, DATFILE_MAGIC, DATFILE_MAGIC_LEN))
+		return -1;
+	count=get_be32(trailer);
+	index_len=count*4;
+	if(count>DATA_FILE_SIG_MAX
+	  || index_len>datfile->size-DATFILE_TRAILER_LEN)
+		return -1;
+	datfile->count=count;
+	datfile->data_end=datfile->size-DATFILE_TRAILER_LEN-index_len;
+	datfile->index=trailer-index_len;
+	return 0;
+}
+
+// For data files written before the index was added.
+static int scan_index(struct datfile *datfile, const char *path)
+{
+	unsigned int len;
+	size_t offset=0;
+	char lead[DATFILE_TAG_LEN+1];
+
+	if(!(datfile->scanned=(uint32_t *)calloc_w(DATA_FILE_SIG_MAX,
+		sizeof(uint32_t), __func__)))
+			return -1;
+	while(offset+DATFILE_TAG_LEN<=datfile->size
+	  && datfile->count<DATA_FILE_SIG_MAX)
+	{
+		memcpy(lead, datfile->map+offset, DATFILE_TAG_LEN);
+		lead[DATFILE_TAG_LEN]='\0';
+		if(lead[0]!=CMD_DATA
+		  || sscanf(lead+1, "%04X", &len)!=1)
+		{
+			logp("unknown cmd in %s: %c\n", path, lead[0]);
+			return -1;
+		}
+		// A partly written block at the end is ignored, as it was
+		// before.
+		if(offset+DATFILE_TAG_LEN+len>datfile->size)
+			break;
+		datfile->scanned[datfile->count++]=offset;
+		offset+=DATFILE_TAG_LEN+len;
+	}
+	datfile->data_end=datfile->size;
+	return 0;
+}
+
+struct datfile *datfile_open(const char *path)
+{
+	int fd=-1;
+	struct stat statp;
+	struct datfile *datfile=NULL;
+
+	if((fd=open(path, O_RDONLY))<0)
+	{
+		logp("Could not open %s: %s\n", path, strerror(errno));
+		goto error;
+	}
+	if(fstat(fd, &statp))
+	{
+		logp("Could not fstat %s: %s\n", path, strerror(errno));
+		goto error;
+	}
+	if(!(datfile=(struct datfile *)
+		calloc_w(1, sizeof(struct datfile), __func__)))
+			goto error;
+	datfile->size=(size_t)statp.st_size;
+	if(datfile->size)
+	{
+		datfile->map=(char *)mmap(NULL, datfile->size,
+			PROT_READ, MAP_SHARED, fd, 0);
+		if(datfile->map==MAP_FAILED)
+		{
+			datfile->map=NULL;
+			logp("Could not mmap %s: %s\n", path, strerror(errno));
+			goto error;
+		}
+	}
+	close(fd);
+	fd=-1;
+
+	if(read_index(datfile)
+	  && scan_index(datfile, path))
+		goto error;
+	return datfile;
+error:
+	if(fd>=0) close(fd);
+	datfile_close(&datfile);
+	return NULL;
+}
+
+void datfile_close(struct datfile **datfile)
+{
+	if(!datfile || !*datfile) return;
+	if((*datfile)->map)
+		munmap((*datfile)->map, (*datfile)->size);
+	free_v((void **)&(*datfile)->scanned);
+	free_v((void **)datfile);
+}
+
+size_t datfile_size(struct datfile *datfile)
+{
+	return datfile->size;
+}
+
+// Ask the kernel to start reading the file in.
+void datfile_willneed(struct datfile *datfile)
+{
+	if(datfile->map)
+		posix_madvise(datfile->map, datfile->size,
+			POSIX_MADV_WILLNEED);
+}
+
+// Points *data at block number datno, without copying it.
+int datfile_get(struct datfile *datfile, uint16_t datno,
+	char **data, size_t *len)
+{
+	size_t offset;
+	unsigned int s;
+	char lead[DATFILE_TAG_LEN+1];
+
+	if(datno>=datfile->count)
+	{
+		logp("dat index %d is not less than the block count: %d\n",
+			datno, datfile->count);
+		return -1;
+	}
+	if(datfile->scanned)
+		offset=datfile->scanned[datno];
+	else
+		offset=get_be32(datfile->index+datno*4);
+
+	if(offset+DATFILE_TAG_LEN>datfile->data_end)
+		goto corrupt;
+	memcpy(lead, datfile->map+offset, DATFILE_TAG_LEN);
+	lead[DATFILE_TAG_LEN]='\0';
+	if(lead[0]!=CMD_DATA
+	  || sscanf(lead+1, "%04X", &s)!=1
+	  || offset+DATFILE_TAG_LEN+s>datfile->data_end)
+		goto corrupt;
+
+	*data=datfile->map+offset+DATFILE_TAG_LEN;
+	*len=s;
+	return 0;
+corrupt:
+	logp("Bad block %d in data file\n", datno);
+	return -1;
+}
@@ -0,0 +1,30 @@
+#ifndef _DATFILE_H
+#define _DATFILE_H
+
+#include "../../protocol2/blk.h"
+
+struct fzp;
+
+// Where each block starts in the data file that is being written, so that
+// the offsets can be written to the end of it when it is closed.
+struct datfile_index
+{
+	uint32_t offset;
+	uint16_t count;
+	uint32_t offsets[DATA_FILE_SIG_MAX];
+};
+
+extern int datfile_write_blk(struct fzp *fzp, struct datfile_index *index,
+	const char *buf, uint32_t len);
+extern int datfile_write_index(struct fzp *fzp, struct datfile_index *index);
+
+struct datfile;
+
+extern struct datfile *datfile_open(const char *path);
+extern void datfile_close(struct datfile **datfile);
+extern size_t datfile_size(struct datfile *datfile);
+extern void datfile_willneed(struct datfile *datfile);
+extern int datfile_get(struct datfile *datfile, uint16_t datno,
+	char **data, size_t *len);
+
+#endif
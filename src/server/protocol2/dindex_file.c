@@ -0,0 +1,333 @@
+#include "../../burp.h"
+#include "../../alloc.h"
+#include "../../cmd.h"
+#include "../../fsops.h"
+#include "../../fzp.h"
+#include "../../iobuf.h"
+#include "../../log.h"
+#include "../../protocol2/blk.h"
+#include "dindex_file.h"
+
+// The file starts with the magic string, and then there are blocks of up to
+// DINDEX_BLOCK_MAX savepaths. Each block has a header of:
+//   the number of savepaths, as four big endian bytes;
+//   the length of the encoded savepaths, as four big endian bytes;
+//   how many bits the savepaths are shifted right by, as one byte;
+//   the crc32 of the encoded savepaths, as four big endian bytes.
+// The encoded savepaths are varints - the first one is the shifted savepath
+// itself and each after that is the difference from the one before.
+// Savepaths in the dindex have the bottom 16 bits clear, so the shift
+// saves two bytes each.
+// A block with no savepaths marks the end, so a truncated file is noticed.
+// Each block can be decoded without reference to any other.
+//
+// Files without the magic string are the old format, which is gzipped
+// CMD_SAVE_PATH records.
+
+#define DINDEX_FILE_MAGIC	"burpdin1"
+#define DINDEX_FILE_MAGIC_LEN	8
+#define DINDEX_BLOCK_MAX	1024
+#define DINDEX_BLOCK_HDR_LEN	13
+#define DINDEX_VARINT_MAX	10
+
+struct dindex_file
+{
+	struct fzp *fzp;
+	char *path;
+	uint8_t writing;
+	uint8_t legacy;
+	uint8_t finished;
+	uint8_t have_last;
+	uint64_t last;
+	uint32_t count;
+	uint32_t pos;
+	uint64_t values[DINDEX_BLOCK_MAX];
+	uint8_t payload[DINDEX_BLOCK_MAX*DINDEX_VARINT_MAX];
+};
+
+static void put_be32(uint8_t *b, uint32_t v)
+{
+	v=htonl(v);
+	memcpy(b, &v, sizeof(v));
+}
+
+static uint32_t get_be32(const uint8_t *b)
+{
+	uint32_t v;
+	memcpy(&v, b, sizeof(v));
+	return ntohl(v);
+}
+
+static size_t varint_put(uint8_t *b, uint64_t v)
+{
+	size_t len=0;
+	while(v>=0x80)
+	{
+		b[len++]=(uint8_t)(v|0x80);
+		v>>=7;
+	}
+	b[len++]=(uint8_t)v;
+	return len;
+}
+
+static void dindex_file_free(struct dindex_file **df)
+{
+	if(!df || !*df) return;
+	fzp_close(&(*df)->fzp);
+	free_w(&(*df)->path);
+	free_v((void **)df);
+}
+
+static int open_for_write(struct dindex_file *df)
+{
+	if(unlink_for_write(df->path, __func__)
+	  || !(df->fzp=fzp_open(df->path, "wb")))
+		return -1;
+	if(fzp_write(df->fzp, DINDEX_FILE_MAGIC, DINDEX_FILE_MAGIC_LEN)
+		!=DINDEX_FILE_MAGIC_LEN)
+	{
+		logp("Could not write header to %s\n", df->path);
+		return -1;
+	}
+	return 0;
+}
+
+static int open_for_read(struct dindex_file *df)
+{
+	char magic[DINDEX_FILE_MAGIC_LEN];
+
+	if(!(df->fzp=fzp_open(df->path, "rb")))
+		return -1;
+	switch(fzp_read_ensure(df->fzp, magic, sizeof(magic), __func__))
+	{
+		case 0:
+			if(!memcmp(magic, DINDEX_FILE_MAGIC, sizeof(magic)))
+				return 0;
+			break;
+		case 1:
+			break;
+		default:
+			return -1;
+	}
+
+	// The old format.
+	fzp_close(&df->fzp);
+	if(!(df->fzp=fzp_gzopen(df->path, "rb")))
+		return -1;
+	df->legacy=1;
+	return 0;
+}
+
+struct dindex_file *dindex_file_open(const char *path, const char *mode)
+{
+	struct dindex_file *df=NULL;
+
+	if(!(df=(struct dindex_file *)
+		calloc_w(1, sizeof(struct dindex_file), __func__))
+	  || !(df->path=strdup_w(path, __func__)))
+		goto error;
+	if(*mode=='w')
+	{
+		df->writing=1;
+		if(open_for_write(df))
+			goto error;
+	}
+	else if(open_for_read(df))
+		goto error;
+	return df;
+error:
+	dindex_file_free(&df);
+	return NULL;
+}
+
+static int flush_block(struct dindex_file *df)
+{
+	uint32_t i;
+	size_t len=0;
+	uint8_t shift=0;
+	uint64_t all=0;
+	uint64_t prev=0;
+	uint8_t hdr[DINDEX_BLOCK_HDR_LEN];
+
+	for(i=0; i<df->count; i++)
+		all|=df->values[i];
+	if(all)
+		while(!(all&1))
+		{
+			all>>=1;
+			shift++;
+		}
+
+	for(i=0; i<df->count; i++)
+	{
+		uint64_t v=df->values[i]>>shift;
+		len+=varint_put(df->payload+len, v-prev);
+		prev=v;
+	}
+
+	put_be32(hdr, df->count);
+	put_be32(hdr+4, (uint32_t)len);
+	hdr[8]=shift;
+	put_be32(hdr+9, (uint32_t)crc32(0, df->payload, (uInt)len));
+	if(fzp_write(df->fzp, hdr, sizeof(hdr))!=sizeof(hdr)
+	  || (len && fzp_write(df->fzp, df->payload, len)!=len))
+	{
+		logp("Could not write block to %s\n", df->path);
+		return -1;
+	}
+	df->count=0;
+	return 0;
+}
+
+int dindex_file_write(struct dindex_file *df, uint64_t savepath)
+{
+	if(df->have_last)
+	{
+		if(savepath==df->last)
+			return 0;
+		if(savepath<df->last)
+		{
+			logp("Savepaths out of order when writing %s: %016"
+				PRIX64 " after %016" PRIX64 "\n",
+				df->path, savepath, df->last);
+			return -1;
+		}
+	}
+	df->values[df->count++]=savepath;
+	df->last=savepath;
+	df->have_last=1;
+	if(df->count==DINDEX_BLOCK_MAX)
+		return flush_block(df);
+	return 0;
+}
+
+static int read_legacy(struct dindex_file *df, uint64_t *savepath)
+{
+	int ret=-1;
+	struct blk blk;
+	struct iobuf rbuf;
+
+	iobuf_init(&rbuf);
+	switch(iobuf_fill_from_fzp(&rbuf, df->fzp))
+	{
+		case -1: goto end;
+		case 1: return 1; // Reached the end.
+	}
+	if(rbuf.cmd!=CMD_SAVE_PATH)
+	{
+		iobuf_log_unexpected(&rbuf, __func__);
+		goto end;
+	}
+	if(blk_set_from_iobuf_savepath(&blk, &rbuf))
+		goto end;
+	*savepath=blk.savepath;
+	ret=0;
+end:
+	iobuf_free_content(&rbuf);
+	return ret;
+}
+
+static int corrupt(struct dindex_file *df, const char *why)
+{
+	logp("Corrupt dindex file %s: %s\n", df->path, why);
+	return -1;
+}
+
+// Decodes a whole block at once, so the inner loop does nothing but pull
+// varints out of memory.
+static int decode_block(struct dindex_file *df, uint32_t len, uint8_t shift)
+{
+	uint32_t i;
+	uint64_t prev=0;
+	const uint8_t *b=df->payload;
+	const uint8_t *end=df->payload+len;
+
+	for(i=0; i<df->count; i++)
+	{
+		int s=0;
+		uint64_t v=0;
+		while(1)
+		{
+			if(b>=end || s>63)
+				return corrupt(df, "bad varint");
+			v|=(uint64_t)(*b&0x7F)<<s;
+			if(!(*b++&0x80))
+				break;
+			s+=7;
+		}
+		prev+=v;
+		df->values[i]=prev<<shift;
+	}
+	if(b!=end)
+		return corrupt(df, "block length mismatch");
+	return 0;
+}
+
+static int read_block(struct dindex_file *df)
+{
+	uint32_t len;
+	uint8_t shift;
+	uint8_t hdr[DINDEX_BLOCK_HDR_LEN];
+
+	df->pos=0;
+	switch(fzp_read_ensure(df->fzp, hdr, sizeof(hdr), __func__))
+	{
+		case 0: break;
+		case 1: return corrupt(df, "no end marker");
+		default: return -1;
+	}
+	df->count=get_be32(hdr);
+	len=get_be32(hdr+4);
+	shift=hdr[8];
+	if(!df->count)
+	{
+		df->finished=1;
+		return 1;
+	}
+	if(df->count>DINDEX_BLOCK_MAX
+	  || len>df->count*DINDEX_VARINT_MAX
+	  || shift>63)
+		return corrupt(df, "bad block header");
+	if(fzp_read_ensure(df->fzp, df->payload, len, __func__))
+		return corrupt(df, "short block");
+	if(get_be32(hdr+9)!=(uint32_t)crc32(0, df->payload, (uInt)len))
+		return corrupt(df, "checksum mismatch");
+	return decode_block(df, len, shift);
+}
+
+int dindex_file_read(struct dindex_file *df, uint64_t *savepath)
+{
+	if(df->legacy)
+		return read_legacy(df, savepath);
+	if(df->finished)
+		return 1;
+	if(df->pos>=df->count)
+	{
+		int ret;
+		if((ret=read_block(df)))
+			return ret;
+	}
+	*savepath=df->values[df->pos++];
+	return 0;
+}
+
+int dindex_file_close(struct dindex_file **df)
+{
+	int ret=0;
+	if(!df || !*df) return 0;
+	if((*df)->writing && (*df)->fzp)
+	{
+		// Flush what is left, then the end marker.
+		if(((*df)->count && flush_block(*df))
+		  || flush_block(*df))
+			ret=-1;
+		if(fzp_close(&(*df)->fzp))
+		{
+			logp("Error closing %s in %s\n",
+				(*df)->path, __func__);
+			ret=-1;
+		}
+	}
+	dindex_file_free(df);
+	return ret;
+}
@@ -0,0 +1,19 @@
+#ifndef _DINDEX_FILE_H
+#define _DINDEX_FILE_H
+
+// A sorted list of data file savepaths, as kept in the dindex, cindex and
+// dfiles files.
+
+struct dindex_file;
+
+// The mode is "rb" or "wb". Files in the old gzipped text format can still
+// be read.
+extern struct dindex_file *dindex_file_open(const char *path,
+	const char *mode);
+// Savepaths need to be written in ascending order. Duplicates are dropped.
+extern int dindex_file_write(struct dindex_file *df, uint64_t savepath);
+// Return 0 for OK, -1 for error, 1 for finished reading the file.
+extern int dindex_file_read(struct dindex_file *df, uint64_t *savepath);
+extern int dindex_file_close(struct dindex_file **df);
+
+#endif
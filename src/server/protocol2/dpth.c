@@ -1,6 +1,5 @@
 #include "../../burp.h"
 #include "../../alloc.h"
-#include "../../cmd.h"
 #include "../../fsops.h"
 #include "../../hexmap.h"
 #include "../../iobuf.h"
@@ -8,6 +7,8 @@
 #include "../../log.h"
 #include "../../prepend.h"
 #include "../../protocol2/blk.h"
+#include "../durable.h"
+#include "datfile.h"
 #include "dpth.h"
 
 static int get_data_lock(struct lock *lock, const char *path)
@@ -191,6 +192,9 @@ static int open_cfile_fzp(struct dpth *dpth,
 	}
 	if(!(dpth->cfile_fzp=fzp_dopen(fd, "wb")))
 		goto end;
+	// Otherwise the data files that it lists could outlive it.
+	if(durable_flush_dir(fullpath))
+		goto end;
 
 	ret=0;
 end:
@@ -260,29 +264,6 @@ end:
 	return ret;
 }
 
-static int fprint_tag(struct fzp *fzp, enum cmd cmd, unsigned int s)
-{
-	if(fzp_printf(fzp, "%c%04X", cmd, s)!=5)
-	{
-		logp("Short fprintf\n");
-		return -1;
-	}
-	return 0;
-}
-
-static int fwrite_buf(enum cmd cmd,
-	const char *buf, unsigned int s, struct fzp *fzp)
-{
-	static size_t bytes;
-	if(fprint_tag(fzp, cmd, s)) return -1;
-	if((bytes=fzp_write(fzp, buf, s))!=s)
-	{
-		logp("Short write: %d\n", (int)bytes);
-		return -1;
-	}
-	return 0;
-}
-
 static struct fzp *file_open_w(const char *path)
 {
 	if(build_path_w(path)) return NULL;
@@ -297,12 +278,10 @@ static int write_to_cfile(struct dpth *dpth, struct blk *blk)
 		return -1;
 	if(fzp_flush(dpth->cfile_fzp))
 		return -1;
-	if(fsync(fzp_fileno(dpth->cfile_fzp)))
-	{
-		logp("fsync on cfile_fzp failed: %s\n", strerror(errno));
-		return -1;
-	}
-	return 0;
+	// The entry has to be on disk before the data file is created.
+	// Otherwise, after a crash, there could be a data file that no cfile
+	// lists, and it would never be deleted.
+	return durable_flush_fd(fzp_fileno(dpth->cfile_fzp));
 }
 
 static struct fzp *open_data_file_for_write(struct dpth *dpth, struct blk *blk)
@@ -351,8 +330,18 @@ int dpth_protocol2_fwrite(struct dpth *dpth,
 		return -1;
 
 	// Open the current list head if we have no fzp.
-	if(!dpth->fzp
-	  && !(dpth->fzp=open_data_file_for_write(dpth, blk))) return -1;
+	if(!dpth->fzp)
+	{
+		if(!dpth->data_index
+		  && !(dpth->data_index=(struct datfile_index *)calloc_w(1,
+			sizeof(struct datfile_index), __func__)))
+				return -1;
+		dpth->data_index->offset=0;
+		dpth->data_index->count=0;
+		if(!(dpth->fzp=open_data_file_for_write(dpth, blk)))
+			return -1;
+	}
 
-	return fwrite_buf(CMD_DATA, iobuf->buf, iobuf->len, dpth->fzp);
+	return datfile_write_blk(dpth->fzp, dpth->data_index,
+		iobuf->buf, iobuf->len);
 }
@@ -0,0 +1,149 @@
+#include "../../burp.h"
+#include "../../alloc.h"
+#include "../../hexmap.h"
+#include "../../log.h"
+#include "../../sbuf.h"
+#include "../../protocol2/blk.h"
+#include "../manio.h"
+#include "../manio_index.h"
+#include "rblk.h"
+#include "prefetch.h"
+
+// How many blocks to read ahead of the restore in the manifest.
+#define PREFETCH_BLKS_AHEAD	DATA_FILE_SIG_MAX*4
+
+// Reads through the manifest ahead of the restore, with its own manio, and
+// asks for the data files that are about to be needed to be loaded in the
+// background.
+struct prefetch
+{
+	struct manio *manio;
+	struct sbuf *sb;
+	struct blk *blk;
+	const char *prefix; // Stop at the end of the paths with this prefix.
+	const char *datadir;
+	prefetch_want_func want;
+	void *want_arg;
+	int want_data; // The blocks of the current entry will be restored.
+	int ended;
+	uint64_t blks_seen;
+	char *pending; // Data file that did not fit in the queue last time.
+	char last[256];
+};
+
+struct prefetch *prefetch_alloc(const char *manifest, const char *prefix,
+	const char *datadir, prefetch_want_func want, void *want_arg)
+{
+	struct prefetch *prefetch;
+	if(!(prefetch=(struct prefetch *)
+		calloc_w(1, sizeof(struct prefetch), __func__)))
+			return NULL;
+	prefetch->prefix=prefix;
+	prefetch->datadir=datadir;
+	prefetch->want=want;
+	prefetch->want_arg=want_arg;
+	if(!(prefetch->manio=manio_open(manifest, "rb", PROTO_2))
+	  || manio_index_seek(prefetch->manio, prefix)<0
+	  || !(prefetch->sb=sbuf_alloc(PROTO_2))
+	  || !(prefetch->blk=blk_alloc()))
+		prefetch_free(&prefetch);
+	return prefetch;
+}
+
+void prefetch_free(struct prefetch **prefetch)
+{
+	if(!prefetch || !*prefetch) return;
+	manio_close(&(*prefetch)->manio);
+	sbuf_free(&(*prefetch)->sb);
+	blk_free(&(*prefetch)->blk);
+	free_w(&(*prefetch)->pending);
+	free_v((void **)prefetch);
+}
+
+// Returns 0 if the data file was queued, 1 if the queue was full.
+static int queue_datpath(struct prefetch *prefetch, const char *datpath)
+{
+	switch(rblk_prefetch(datpath))
+	{
+		case 0:
+			return 0;
+		case 1:
+			if(!(prefetch->pending=strdup_w(datpath, __func__)))
+				return -1;
+			return 1;
+		default:
+			return -1;
+	}
+}
+
+static int got_blk(struct prefetch *prefetch)
+{
+	uint16_t datno;
+	char datpath[256];
+
+	prefetch->blks_seen++;
+	snprintf(datpath, sizeof(datpath), "%s/%s", prefetch->datadir,
+		uint64_to_savepathstr_with_sig_uint(prefetch->blk->savepath,
+			&datno));
+	// Blocks from the same data file tend to come together.
+	if(!strcmp(datpath, prefetch->last))
+		return 0;
+	snprintf(prefetch->last, sizeof(prefetch->last), "%s", datpath);
+	return queue_datpath(prefetch, datpath);
+}
+
+// Keep reading ahead until PREFETCH_BLKS_AHEAD blocks ahead of the restore,
+// which has used blks_done blocks so far.
+// Returns 0 for OK, -1 for error.
+int prefetch_advance(struct prefetch *prefetch, uint64_t blks_done)
+{
+	struct sbuf *sb=prefetch->sb;
+	struct blk *blk=prefetch->blk;
+
+	if(prefetch->pending)
+	{
+		switch(rblk_prefetch(prefetch->pending))
+		{
+			case 0: free_w(&prefetch->pending); break;
+			case 1: return 0;
+			default: return -1;
+		}
+	}
+
+	while(!prefetch->ended
+	  && prefetch->blks_seen<blks_done+PREFETCH_BLKS_AHEAD)
+	{
+		blk->got_save_path=0;
+		switch(manio_read_with_blk(prefetch->manio,
+			sb, prefetch->want_data?blk:NULL))
+		{
+			case 0: break;
+			case 1: prefetch->ended=1; return 0;
+			default: return -1;
+		}
+
+		if(blk->got_save_path)
+		{
+			switch(got_blk(prefetch))
+			{
+				case 0: continue;
+				case 1: return 0;
+				default: return -1;
+			}
+		}
+		if(sb->endfile.buf)
+			prefetch->want_data=0;
+		else if(prefetch->prefix
+		  && manio_index_past(prefetch->prefix, sb->path.buf))
+		{
+			prefetch->ended=1;
+			return 0;
+		}
+		else
+			prefetch->want_data=(sbuf_is_filedata(sb)
+				|| sbuf_is_vssdata(sb))
+			  && prefetch->want(sb, prefetch->want_arg);
+		sbuf_free_content(sb);
+	}
+	return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef _PREFETCH_H
+#define _PREFETCH_H
+
+struct prefetch;
+struct sbuf;
+
+typedef int (*prefetch_want_func)(struct sbuf *sb, void *arg);
+
+// With a prefix, only the part of the manifest with paths that start with
+// it is read.
+extern struct prefetch *prefetch_alloc(const char *manifest,
+	const char *prefix, const char *datadir,
+	prefetch_want_func want, void *want_arg);
+extern void prefetch_free(struct prefetch **prefetch);
+extern int prefetch_advance(struct prefetch *prefetch, uint64_t blks_done);
+
+#endif
@@ -1,122 +1,370 @@
 #include "../../burp.h"
 #include "../../alloc.h"
-#include "../../cmd.h"
-#include "../../fzp.h"
 #include "../../hexmap.h"
-#include "../../iobuf.h"
 #include "../../log.h"
 #include "../../protocol2/blk.h"
+#include "datfile.h"
 #include "rblk.h"
 
-#define RBLK_MAX	10
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+// How much of the data files to keep mapped. A full one is 4096 blocks of
+// up to 8KB each.
+#define RBLK_CACHE_MAX		256*1024*1024
+// How many data files may be waiting to be loaded in the background.
+#define RBLK_QUEUE_MAX		8
+
+enum rblk_state
+{
+	RBLK_LOADING=0,
+	RBLK_READY,
+	RBLK_FAILED
+};
 
 // For retrieving stored data.
 struct rblk
 {
 	char *datpath;
-	struct iobuf readbuf[DATA_FILE_SIG_MAX];
-	uint16_t readbuflen;
+	struct datfile *datfile;
+	size_t bytes;
+	enum rblk_state state;
+	// The list is kept in order of use, most recent first.
+	struct rblk *prev;
+	struct rblk *next;
 };
 
-static struct rblk *rblks=NULL;
+struct rblk_queued
+{
+	char *datpath;
+	struct rblk_queued *next;
+};
 
-int rblk_init(void)
+struct rblk_cache
+{
+	struct rblk *head;
+	struct rblk *tail;
+	// The data last handed out is still in use, so is never evicted.
+	struct rblk *current;
+	size_t bytes;
+	struct rblk_queued *queue_head;
+	struct rblk_queued *queue_tail;
+	int queued;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t loaded;
+	pthread_t thread;
+	int started;
+	int stop;
+#endif
+};
+
+static struct rblk_cache *cache=NULL;
+
+static void cache_lock(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&cache->lock);
+#endif
+}
+
+static void cache_unlock(void)
 {
-	rblks=(struct rblk *)calloc_w(RBLK_MAX, sizeof(struct rblk), __func__);
-	if(!rblks) return -1;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&cache->lock);
+#endif
+}
+
+static struct rblk *rblk_alloc(char *datpath)
+{
+	struct rblk *rblk;
+	if(!(rblk=(struct rblk *)calloc_w(1, sizeof(struct rblk), __func__)))
+		return NULL;
+	rblk->datpath=datpath;
+	return rblk;
+}
+
+static void rblk_free_one(struct rblk **rblk)
+{
+	if(!rblk || !*rblk) return;
+	free_w(&(*rblk)->datpath);
+	datfile_close(&(*rblk)->datfile);
+	free_v((void **)rblk);
+}
+
+static void list_remove(struct rblk *rblk)
+{
+	if(rblk->prev) rblk->prev->next=rblk->next;
+	else cache->head=rblk->next;
+	if(rblk->next) rblk->next->prev=rblk->prev;
+	else cache->tail=rblk->prev;
+	rblk->prev=rblk->next=NULL;
+}
+
+static void list_add_head(struct rblk *rblk)
+{
+	rblk->prev=NULL;
+	rblk->next=cache->head;
+	if(cache->head) cache->head->prev=rblk;
+	else cache->tail=rblk;
+	cache->head=rblk;
+}
+
+static struct rblk *list_find(const char *datpath)
+{
+	struct rblk *rblk;
+	if(cache->current && !strcmp(cache->current->datpath, datpath))
+		return cache->current;
+	for(rblk=cache->head; rblk; rblk=rblk->next)
+		if(!strcmp(rblk->datpath, datpath))
+			return rblk;
+	return NULL;
+}
+
+static void discard(struct rblk *rblk)
+{
+	list_remove(rblk);
+	if(rblk==cache->current)
+		cache->current=NULL;
+	if(rblk->state==RBLK_READY)
+		cache->bytes-=rblk->bytes;
+	rblk_free_one(&rblk);
+}
+
+// Drop the least recently used data files until under the limit.
+static void evict(void)
+{
+	struct rblk *rblk;
+	struct rblk *prev;
+	for(rblk=cache->tail; rblk && cache->bytes>RBLK_CACHE_MAX; rblk=prev)
+	{
+		prev=rblk->prev;
+		if(rblk==cache->current
+		  || rblk->state==RBLK_LOADING)
+			continue;
+		discard(rblk);
+	}
+}
+
+// Called without the lock held, so that the other thread can carry on.
+static int load_rblk(struct rblk *rblk)
+{
+	if(!(rblk->datfile=datfile_open(rblk->datpath)))
+		return -1;
+	rblk->bytes=datfile_size(rblk->datfile);
 	return 0;
 }
 
-void rblk_free(void)
+// Called with the lock held, after load_rblk().
+static void load_finished(struct rblk *rblk, int r)
 {
-	if(!rblks) return;
-	for(int i=0; i<RBLK_MAX; i++)
+	if(r)
+		rblk->state=RBLK_FAILED;
+	else
 	{
-		free_w(&rblks[i].datpath);
-		for(int j=0; j<DATA_FILE_SIG_MAX; j++)
-			iobuf_free_content(&rblks[i].readbuf[j]);
+		rblk->state=RBLK_READY;
+		cache->bytes+=rblk->bytes;
+		evict();
 	}
-	free_v((void **)&rblks);
+#ifdef HAVE_PTHREAD
+	pthread_cond_broadcast(&cache->loaded);
+#endif
 }
 
-static int load_rblk(struct rblk *rblks, int ind, const char *datpath)
+#ifdef HAVE_PTHREAD
+static void *prefetch_run(void *arg)
 {
 	int r;
-	int ret=-1;
-	int done=0;
-	struct fzp *fzp=NULL;
-	struct iobuf rbuf;
+	struct rblk *rblk;
+	struct rblk_queued *q;
 
-	iobuf_init(&rbuf);
+	cache_lock();
+	while(!cache->stop)
+	{
+		if(!(q=cache->queue_head))
+		{
+			pthread_cond_wait(&cache->work, &cache->lock);
+			continue;
+		}
+		if(!(cache->queue_head=q->next))
+			cache->queue_tail=NULL;
+		cache->queued--;
 
-	free_w(&rblks[ind].datpath);
-	if(!(rblks[ind].datpath=strdup_w(datpath, __func__)))
-		goto end;
+		if(!list_find(q->datpath)
+		  && (rblk=rblk_alloc(q->datpath)))
+		{
+			q->datpath=NULL;
+			list_add_head(rblk);
+			cache_unlock();
+			if(!(r=load_rblk(rblk)))
+				datfile_willneed(rblk->datfile);
+			cache_lock();
+			load_finished(rblk, r);
+		}
+		free_w(&q->datpath);
+		free_v((void **)&q);
+	}
+	cache_unlock();
+	return NULL;
+}
+#endif
 
-	logp("swap %d to: %s\n", ind, datpath);
+int rblk_init(void)
+{
+#ifdef HAVE_PTHREAD
+	int r;
+#endif
+	if(!(cache=(struct rblk_cache *)
+		calloc_w(1, sizeof(struct rblk_cache), __func__)))
+			return -1;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&cache->lock, NULL);
+	pthread_cond_init(&cache->work, NULL);
+	pthread_cond_init(&cache->loaded, NULL);
+	if((r=pthread_create(&cache->thread, NULL, prefetch_run, NULL)))
+		logp("Could not start restore prefetch thread: %s\n",
+			strerror(r));
+	else
+		cache->started=1;
+#endif
+	return 0;
+}
 
-	if(!(fzp=fzp_open(datpath, "rb")))
+void rblk_free(void)
+{
+	struct rblk_queued *q;
+	if(!cache) return;
+#ifdef HAVE_PTHREAD
+	cache_lock();
+	cache->stop=1;
+	pthread_cond_broadcast(&cache->work);
+	cache_unlock();
+	if(cache->started)
+		pthread_join(cache->thread, NULL);
+	pthread_cond_destroy(&cache->loaded);
+	pthread_cond_destroy(&cache->work);
+	pthread_mutex_destroy(&cache->lock);
+#endif
+	while(cache->head)
+		discard(cache->head);
+	while((q=cache->queue_head))
+	{
+		cache->queue_head=q->next;
+		free_w(&q->datpath);
+		free_v((void **)&q);
+	}
+	free_v((void **)&cache);
+}
+
+// Returns 1 if data files can be loaded in the background.
+int rblk_can_prefetch(void)
+{
+#ifdef HAVE_PTHREAD
+	return cache && cache->started;
+#else
+	return 0;
+#endif
+}
+
+// Ask for a data file to be loaded in the background, ready for when it is
+// needed. Returns 0 if it was queued or is already loaded, 1 if the queue
+// is full, and -1 on error.
+int rblk_prefetch(const char *fulldatpath)
+{
+	int ret=0;
+	struct rblk_queued *q;
+
+	if(!rblk_can_prefetch())
+		return 0;
+	cache_lock();
+	if(list_find(fulldatpath))
 		goto end;
-	for(r=0; r<DATA_FILE_SIG_MAX; r++)
+	for(q=cache->queue_head; q; q=q->next)
+		if(!strcmp(q->datpath, fulldatpath))
+			goto end;
+	if(cache->queued>=RBLK_QUEUE_MAX)
 	{
-		switch(iobuf_fill_from_fzp_data(&rbuf, fzp))
-		{
-			case 0: if(rbuf.cmd!=CMD_DATA)
-				{
-					logp("unknown cmd in %s: %c\n",
-						__func__, rbuf.cmd);
-					goto end;
-				}
-				iobuf_free_content(&rblks[ind].readbuf[r]);
-				iobuf_move(&rblks[ind].readbuf[r], &rbuf);
-				continue;
-			case 1: done++;
-				break;
-			default: goto end;
-		}
-		if(done) break;
+		ret=1;
+		goto end;
+	}
+	if(!(q=(struct rblk_queued *)
+		calloc_w(1, sizeof(struct rblk_queued), __func__))
+	  || !(q->datpath=strdup_w(fulldatpath, __func__)))
+	{
+		free_v((void **)&q);
+		ret=-1;
+		goto end;
 	}
-	rblks[ind].readbuflen=r;
-	ret=0;
+	if(cache->queue_tail)
+		cache->queue_tail->next=q;
+	else
+		cache->queue_head=q;
+	cache->queue_tail=q;
+	cache->queued++;
+#ifdef HAVE_PTHREAD
+	pthread_cond_signal(&cache->work);
+#endif
 end:
-	fzp_close(&fzp);
+	cache_unlock();
 	return ret;
 }
 
-static struct rblk *get_rblk(struct rblk *rblks, const char *datpath)
+static struct rblk *get_rblk(const char *datpath)
 {
-	static int current_ind=0;
-	static int last_swap_ind=0;
-	int ind=current_ind;
+	int r;
+	char *path;
+	struct rblk *rblk;
 
-	while(1)
+	cache_lock();
+	rblk=list_find(datpath);
+#ifdef HAVE_PTHREAD
+	while(rblk && rblk->state==RBLK_LOADING)
 	{
-		if(!rblks[ind].datpath)
-		{
-			if(load_rblk(rblks, ind, datpath)) return NULL;
-			last_swap_ind=ind;
-			current_ind=ind;
-			return &rblks[current_ind];
-		}
-		else if(!strcmp(rblks[ind].datpath, datpath))
-		{
-			current_ind=ind;
-			return &rblks[current_ind];
-		}
-		ind++;
-		if(ind==RBLK_MAX) ind=0;
-		if(ind==current_ind)
-		{
-			// Went through all RBLK_MAX entries.
-			// Replace the oldest one.
-			ind=last_swap_ind+1;
-			if(ind==RBLK_MAX) ind=0;
-			if(load_rblk(rblks, ind, datpath)) return NULL;
-			last_swap_ind=ind;
-			current_ind=ind;
-			return &rblks[current_ind];
-		}
+		// Already being loaded in the background.
+		pthread_cond_wait(&cache->loaded, &cache->lock);
+		rblk=list_find(datpath);
 	}
+#endif
+	if(rblk && rblk->state==RBLK_FAILED)
+	{
+		// Try again, so that the error gets logged in the usual way.
+		discard(rblk);
+		rblk=NULL;
+	}
+
+	if(rblk)
+	{
+		list_remove(rblk);
+		list_add_head(rblk);
+		cache->current=rblk;
+		cache_unlock();
+		return rblk;
+	}
+
+	if(!(path=strdup_w(datpath, __func__))
+	  || !(rblk=rblk_alloc(path)))
+	{
+		free_w(&path);
+		cache_unlock();
+		return NULL;
+	}
+	list_add_head(rblk);
+	cache->current=rblk;
+	cache_unlock();
+
+	r=load_rblk(rblk);
+
+	cache_lock();
+	load_finished(rblk, r);
+	if(r)
+	{
+		discard(rblk);
+		rblk=NULL;
+	}
+	cache_unlock();
+	return rblk;
 }
 
 char *rblk_get_fulldatpath(const char *datpath,
@@ -131,23 +379,18 @@ char *rblk_get_fulldatpath(const char *datpath,
 int rblk_retrieve_data(const char *fulldatpath,
 	struct blk *blk, uint16_t datno)
 {
+	size_t len;
 	struct rblk *rblk;
 
-	if(!(rblk=get_rblk(rblks, fulldatpath)))
+	if(!(rblk=get_rblk(fulldatpath)))
 	{
 		return -1;
 	}
 
-//	printf("lookup: %s (%s)\n", fulldatpath, cp);
-	if(datno>rblk->readbuflen)
-	{
-		logp("dat index %d is greater than readbuflen: %d\n",
-			datno, rblk->readbuflen);
+	// Points straight into the mapped data file.
+	if(datfile_get(rblk->datfile, datno, &blk->data, &len))
 		return -1;
-	}
-	blk->data=rblk->readbuf[datno].buf;
-	blk->length=rblk->readbuf[datno].len;
-//	printf("length: %d\n", blk->length);
+	blk->length=len;
 
-        return 0;
+	return 0;
 }
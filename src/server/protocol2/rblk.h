@@ -3,6 +3,8 @@
 
 extern int rblk_init(void);
 extern void rblk_free(void);
+extern int rblk_can_prefetch(void);
+extern int rblk_prefetch(const char *fulldatpath);
 extern char *rblk_get_fulldatpath(const char *datpath,
 	struct blk *blk, uint16_t *datno);
 extern int rblk_retrieve_data(const char *fulldatpath,
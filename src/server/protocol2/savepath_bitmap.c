@@ -0,0 +1,393 @@
+#include "../../burp.h"
+#include "../../alloc.h"
+#include "../../log.h"
+#include "dindex_file.h"
+#include "savepath_bitmap.h"
+
+// This works like a roaring bitmap. The first two components of a savepath
+// pick a container, and the third picks a bit in it. Sparse containers are
+// kept as sorted arrays, and converted to plain bitmaps once they get big
+// enough that the bitmap is the smaller of the two. Since data files are
+// allocated in order, most containers end up as bitmaps.
+
+#define CONTAINER_BITS		65536
+#define CONTAINER_WORDS		(CONTAINER_BITS/64)
+#define ARRAY_MAX		4096
+
+struct container
+{
+	uint32_t key;
+	uint32_t card;
+	uint32_t alloc;
+	uint16_t *array;
+	uint64_t *bits;
+};
+
+struct savepath_bitmap
+{
+	struct container *c;
+	size_t len;
+	size_t alloc;
+};
+
+static uint32_t to_key(uint64_t savepath)
+{
+	return (uint32_t)(savepath>>32);
+}
+
+static uint16_t to_low(uint64_t savepath)
+{
+	return (uint16_t)(savepath>>16);
+}
+
+static uint64_t to_savepath(uint32_t key, uint16_t low)
+{
+	return ((uint64_t)key<<32)|((uint64_t)low<<16);
+}
+
+static int popcount64(uint64_t v)
+{
+	int n=0;
+	for(; v; n++)
+		v&=v-1;
+	return n;
+}
+
+struct savepath_bitmap *savepath_bitmap_alloc(void)
+{
+	return (struct savepath_bitmap *)
+		calloc_w(1, sizeof(struct savepath_bitmap), __func__);
+}
+
+static void container_free_content(struct container *c)
+{
+	free_v((void **)&c->array);
+	free_v((void **)&c->bits);
+}
+
+void savepath_bitmap_free(struct savepath_bitmap **sb)
+{
+	size_t i;
+	if(!sb || !*sb) return;
+	for(i=0; i<(*sb)->len; i++)
+		container_free_content(&(*sb)->c[i]);
+	free_v((void **)&(*sb)->c);
+	free_v((void **)sb);
+}
+
+// Returns the index of the container with the key, or where it would go.
+static size_t find_container(struct savepath_bitmap *sb, uint32_t key)
+{
+	size_t lo=0;
+	size_t hi=sb->len;
+	// Savepaths mostly arrive in order, so try the end first.
+	if(sb->len && sb->c[sb->len-1].key<key)
+		return sb->len;
+	while(lo<hi)
+	{
+		size_t mid=lo+(hi-lo)/2;
+		if(sb->c[mid].key<key)
+			lo=mid+1;
+		else
+			hi=mid;
+	}
+	return lo;
+}
+
+static struct container *get_container(struct savepath_bitmap *sb,
+	uint32_t key)
+{
+	size_t i=find_container(sb, key);
+	if(i<sb->len && sb->c[i].key==key)
+		return &sb->c[i];
+	return NULL;
+}
+
+static struct container *get_or_add_container(struct savepath_bitmap *sb,
+	uint32_t key)
+{
+	size_t i=find_container(sb, key);
+	if(i<sb->len && sb->c[i].key==key)
+		return &sb->c[i];
+	if(sb->len==sb->alloc)
+	{
+		size_t alloc=sb->alloc?sb->alloc*2:16;
+		struct container *c;
+		if(!(c=(struct container *)realloc_w(sb->c,
+			alloc*sizeof(struct container), __func__)))
+				return NULL;
+		sb->c=c;
+		sb->alloc=alloc;
+	}
+	memmove(&sb->c[i+1], &sb->c[i], (sb->len-i)*sizeof(struct container));
+	memset(&sb->c[i], 0, sizeof(struct container));
+	sb->c[i].key=key;
+	sb->len++;
+	return &sb->c[i];
+}
+
+// Returns the index of the value in the array, or where it would go.
+static uint32_t array_find(struct container *c, uint16_t low)
+{
+	uint32_t lo=0;
+	uint32_t hi=c->card;
+	if(c->card && c->array[c->card-1]<low)
+		return c->card;
+	while(lo<hi)
+	{
+		uint32_t mid=lo+(hi-lo)/2;
+		if(c->array[mid]<low)
+			lo=mid+1;
+		else
+			hi=mid;
+	}
+	return lo;
+}
+
+static int container_contains(struct container *c, uint16_t low)
+{
+	uint32_t i;
+	if(c->bits)
+		return (c->bits[low/64]>>(low%64))&1;
+	i=array_find(c, low);
+	return i<c->card && c->array[i]==low;
+}
+
+static int container_to_bits(struct container *c)
+{
+	uint32_t i;
+	if(c->bits)
+		return 0;
+	if(!(c->bits=(uint64_t *)
+		calloc_w(CONTAINER_WORDS, sizeof(uint64_t), __func__)))
+			return -1;
+	for(i=0; i<c->card; i++)
+		c->bits[c->array[i]/64]|=1ULL<<(c->array[i]%64);
+	free_v((void **)&c->array);
+	c->alloc=0;
+	return 0;
+}
+
+static int array_reserve(struct container *c, uint32_t want)
+{
+	uint32_t alloc;
+	uint16_t *array;
+	if(want<=c->alloc)
+		return 0;
+	alloc=c->alloc?c->alloc:16;
+	while(alloc<want)
+		alloc*=2;
+	if(alloc>ARRAY_MAX)
+		alloc=ARRAY_MAX;
+	if(!(array=(uint16_t *)realloc_w(c->array,
+		alloc*sizeof(uint16_t), __func__)))
+			return -1;
+	c->array=array;
+	c->alloc=alloc;
+	return 0;
+}
+
+static int container_add(struct container *c, uint16_t low)
+{
+	uint32_t i;
+	if(!c->bits)
+	{
+		i=array_find(c, low);
+		if(i<c->card && c->array[i]==low)
+			return 0;
+		if(c->card<ARRAY_MAX)
+		{
+			if(array_reserve(c, c->card+1))
+				return -1;
+			memmove(&c->array[i+1], &c->array[i],
+				(c->card-i)*sizeof(uint16_t));
+			c->array[i]=low;
+			c->card++;
+			return 0;
+		}
+		if(container_to_bits(c))
+			return -1;
+	}
+	if(!((c->bits[low/64]>>(low%64))&1))
+	{
+		c->bits[low/64]|=1ULL<<(low%64);
+		c->card++;
+	}
+	return 0;
+}
+
+int savepath_bitmap_add(struct savepath_bitmap *sb, uint64_t savepath)
+{
+	struct container *c;
+	if(!(c=get_or_add_container(sb, to_key(savepath))))
+		return -1;
+	return container_add(c, to_low(savepath));
+}
+
+int savepath_bitmap_contains(struct savepath_bitmap *sb, uint64_t savepath)
+{
+	struct container *c;
+	if(!(c=get_container(sb, to_key(savepath))))
+		return 0;
+	return container_contains(c, to_low(savepath));
+}
+
+uint64_t savepath_bitmap_count(struct savepath_bitmap *sb)
+{
+	size_t i;
+	uint64_t count=0;
+	for(i=0; i<sb->len; i++)
+		count+=sb->c[i].card;
+	return count;
+}
+
+static int container_or(struct container *dst, struct container *src)
+{
+	uint32_t i;
+	uint32_t card=0;
+
+	if(!dst->bits && !src->bits && dst->card+src->card<=ARRAY_MAX)
+	{
+		for(i=0; i<src->card; i++)
+			if(container_add(dst, src->array[i]))
+				return -1;
+		return 0;
+	}
+
+	if(container_to_bits(dst))
+		return -1;
+	if(src->bits)
+	{
+		for(i=0; i<CONTAINER_WORDS; i++)
+		{
+			dst->bits[i]|=src->bits[i];
+			card+=popcount64(dst->bits[i]);
+		}
+		dst->card=card;
+		return 0;
+	}
+	for(i=0; i<src->card; i++)
+		if(container_add(dst, src->array[i]))
+			return -1;
+	return 0;
+}
+
+int savepath_bitmap_or(struct savepath_bitmap *dst,
+	struct savepath_bitmap *src)
+{
+	size_t i;
+	struct container *c;
+	for(i=0; i<src->len; i++)
+	{
+		if(!(c=get_or_add_container(dst, src->c[i].key))
+		  || container_or(c, &src->c[i]))
+			return -1;
+	}
+	return 0;
+}
+
+static int container_diff(struct container *c, struct container *except,
+	int func(uint64_t savepath, void *data), void *data)
+{
+	uint32_t i;
+	uint32_t w;
+
+	if(!c->bits)
+	{
+		for(i=0; i<c->card; i++)
+		{
+			if(except && container_contains(except, c->array[i]))
+				continue;
+			if(func(to_savepath(c->key, c->array[i]), data))
+				return -1;
+		}
+		return 0;
+	}
+
+	for(w=0; w<CONTAINER_WORDS; w++)
+	{
+		int b;
+		uint64_t word=c->bits[w];
+		if(except && except->bits)
+			word&=~except->bits[w];
+		for(b=0; word; b++, word>>=1)
+		{
+			uint16_t low=(uint16_t)(w*64+b);
+			if(!(word&1))
+				continue;
+			if(except && !except->bits
+			  && container_contains(except, low))
+				continue;
+			if(func(to_savepath(c->key, low), data))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+int savepath_bitmap_diff(struct savepath_bitmap *sb,
+	struct savepath_bitmap *except,
+	int func(uint64_t savepath, void *data), void *data)
+{
+	size_t i;
+	size_t e=0;
+	for(i=0; i<sb->len; i++)
+	{
+		struct container *x=NULL;
+		// Both lists of containers are sorted, so walk them together.
+		if(except)
+		{
+			while(e<except->len && except->c[e].key<sb->c[i].key)
+				e++;
+			if(e<except->len && except->c[e].key==sb->c[i].key)
+				x=&except->c[e];
+		}
+		if(container_diff(&sb->c[i], x, func, data))
+			return -1;
+	}
+	return 0;
+}
+
+int savepath_bitmap_load_dindex(struct savepath_bitmap *sb, const char *path)
+{
+	int ret=-1;
+	uint64_t savepath;
+	struct dindex_file *df=NULL;
+
+	if(!(df=dindex_file_open(path, "rb")))
+		goto end;
+	while(!(ret=dindex_file_read(df, &savepath)))
+	{
+		if(savepath_bitmap_add(sb, savepath))
+		{
+			ret=-1;
+			goto end;
+		}
+	}
+	if(ret==1)
+		ret=0;
+end:
+	if(ret)
+		logp("Could not load %s in %s\n", path, __func__);
+	dindex_file_close(&df);
+	return ret;
+}
+
+static int write_savepath(uint64_t savepath, void *data)
+{
+	return dindex_file_write((struct dindex_file *)data, savepath);
+}
+
+int savepath_bitmap_write_dindex(struct savepath_bitmap *sb, const char *path)
+{
+	int ret=-1;
+	struct dindex_file *df=NULL;
+
+	if(!(df=dindex_file_open(path, "wb"))
+	  || savepath_bitmap_diff(sb, NULL, write_savepath, df))
+		goto end;
+	ret=dindex_file_close(&df);
+end:
+	dindex_file_close(&df);
+	return ret;
+}
@@ -0,0 +1,31 @@
+#ifndef _SAVEPATH_BITMAP_H
+#define _SAVEPATH_BITMAP_H
+
+// A compressed set of data files, keyed by the first three components of
+// their savepaths. The block number in the bottom 16 bits is ignored.
+
+struct savepath_bitmap;
+
+extern struct savepath_bitmap *savepath_bitmap_alloc(void);
+extern void savepath_bitmap_free(struct savepath_bitmap **sb);
+
+extern int savepath_bitmap_add(struct savepath_bitmap *sb, uint64_t savepath);
+extern int savepath_bitmap_contains(struct savepath_bitmap *sb,
+	uint64_t savepath);
+extern uint64_t savepath_bitmap_count(struct savepath_bitmap *sb);
+// Adds everything in src to dst.
+extern int savepath_bitmap_or(struct savepath_bitmap *dst,
+	struct savepath_bitmap *src);
+// Calls func, in ascending order, for each savepath in sb that is not in
+// except. The except bitmap may be NULL.
+extern int savepath_bitmap_diff(struct savepath_bitmap *sb,
+	struct savepath_bitmap *except,
+	int func(uint64_t savepath, void *data), void *data);
+
+// Adds everything in a dindex file.
+extern int savepath_bitmap_load_dindex(struct savepath_bitmap *sb,
+	const char *path);
+extern int savepath_bitmap_write_dindex(struct savepath_bitmap *sb,
+	const char *path);
+
+#endif
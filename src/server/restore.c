@@ -20,8 +20,10 @@
 #include "child.h"
 #include "compress.h"
 #include "manio.h"
+#include "manio_index.h"
 #include "protocol1/restore.h"
 #include "protocol2/dpth.h"
+#include "protocol2/prefetch.h"
 #include "protocol2/rblk.h"
 #include "protocol2/restore.h"
 #include "../protocol2/rabin/rabin.h"
@@ -89,6 +91,20 @@ static int want_to_restore(int srestore, struct sbuf *sb,
 	  && (!regex || regex_check(regex, sb->path.buf));
 }
 
+struct want_args
+{
+	int srestore;
+	regex_t *regex;
+	enum action act;
+	struct conf **cconfs;
+};
+
+static int prefetch_want(struct sbuf *sb, void *arg)
+{
+	struct want_args *w=(struct want_args *)arg;
+	return want_to_restore(w->srestore, sb, w->regex, w->act, w->cconfs);
+}
+
 static int setup_cntr(struct asfd *asfd, const char *manifest,
 	regex_t *regex, int srestore, struct conf **cconfs, enum action act,
 	struct bu *bu)
@@ -146,6 +162,10 @@ static int restore_sbuf(struct asfd *asfd, struct sbuf *sb, struct bu *bu,
 	struct conf **cconfs, struct sbuf *need_data, const char *manifest,
 	struct slist *slist);
 
+// Set while a restore is reading from part way into the manifest. The
+// entries before it were never seen, so are not in the linkhash.
+static const char *restore_from=NULL;
+
 // Used when restoring a hard link that we have not restored the destination
 // for. Read through the manifest from the beginning and substitute the path
 // and data to the new location.
@@ -265,7 +285,18 @@ static int restore_sbuf(struct asfd *asfd, struct sbuf *sb, struct bu *bu,
 	{
 		struct f_link *lp=NULL;
 		struct f_link **bucket=NULL;
-		if((lp=linkhash_search(&sb->statp, &bucket)))
+		struct f_link skipped;
+		if(!(lp=linkhash_search(&sb->statp, &bucket))
+		  && restore_from
+		  && pathcmp(sb->link.buf, restore_from)<0)
+		{
+			// The destination was in the part of the manifest
+			// that was not read, so it was skipped too.
+			memset(&skipped, 0, sizeof(skipped));
+			skipped.name=sb->link.buf;
+			lp=&skipped;
+		}
+		if(lp)
 		{
 			// It is in the list of stuff that is in the manifest,
 			// but was skipped on this restore.
@@ -432,6 +463,10 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 	struct iobuf interrupt;
 	char *fulldatpath=NULL;
 	uint16_t datno=0;
+	struct prefetch *prefetch=NULL;
+	struct want_args want_args={srestore, regex, act, cconfs};
+	uint64_t blks_done=0;
+	char *prefix=NULL;
 
 	iobuf_init(&interrupt);
 
@@ -456,8 +491,35 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 	  || !(sb=sbuf_alloc(protocol)))
 		goto end;
 
+	// Without a list of paths, an anchored regex says where the wanted
+	// entries start and end in the manifest.
+	if(!srestore
+	  && (prefix=regex_literal_prefix(get_string(cconfs[OPT_REGEX]))))
+	{
+		switch(manio_index_seek(manio, prefix))
+		{
+			case 0: break;
+			case 1: restore_from=prefix; break;
+			default: goto end;
+		}
+	}
+
+	// Read ahead in the manifest so that data files can be loaded before
+	// they are needed.
+	if(protocol==PROTO_2
+	  && rblk_can_prefetch()
+	  && !(prefetch=prefetch_alloc(manifest, prefix, sdirs->data,
+		prefetch_want, &want_args)))
+			goto end;
+
 	while(1)
 	{
+		if(prefetch && prefetch_advance(prefetch, blks_done))
+		{
+			// Only an optimisation, so carry on without it.
+			logp("Restore prefetch stopped\n");
+			prefetch_free(&prefetch);
+		}
 		iobuf_free_content(rbuf);
 		if(asfd->as->read_quick(asfd->as))
 		{
@@ -541,6 +603,7 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 			if(blk->got_save_path)
 			{
 				blk->got_save_path=0;
+				blks_done++;
 				fulldatpath=rblk_get_fulldatpath(sdirs->data,
 					blk, &datno);
 				if(rblk_retrieve_data(fulldatpath, blk, datno))
@@ -563,6 +626,13 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 			sbuf_free_content(need_data);
 		}
 
+		if(prefix && manio_index_past(prefix, sb->path.buf))
+		{
+			// Nothing else can match.
+			ret=0;
+			goto end;
+		}
+
 		if(want_to_restore(srestore, sb, regex, act, cconfs))
 		{
 			last_ent_was_skipped=0;
@@ -594,6 +664,9 @@ end:
 	iobuf_free_content(rbuf);
 	iobuf_free_content(&interrupt);
 	manio_close(&manio);
+	prefetch_free(&prefetch);
+	restore_from=NULL;
+	free_w(&prefix);
 	return ret;
 }
 
@@ -13,6 +13,7 @@
 #include "../run_script.h"
 #include "backup.h"
 #include "delete.h"
+#include "deleter.h"
 #include "diff.h"
 #include "list.h"
 #include "protocol2/restore.h"
@@ -267,7 +268,9 @@ end:
 static int run_delete(struct asfd *asfd,
 	struct sdirs *sdirs, struct conf **cconfs)
 {
+	int ret=-1;
 	char *backupno=NULL;
+	struct deleter *deleter=NULL;
 	struct iobuf *rbuf=asfd->rbuf;
 	const char *cname=get_string(cconfs[OPT_CNAME]);
 	if(!client_can_generic(cconfs, OPT_CLIENT_CAN_DELETE))
@@ -277,9 +280,13 @@ static int run_delete(struct asfd *asfd,
 		return -1;
 	}
 	backupno=rbuf->buf+strlen("delete ");
-	return do_delete_server(asfd, sdirs,
+	if(!(deleter=deleter_alloc_from_conf(cconfs)))
+		return -1;
+	ret=do_delete_server(asfd, sdirs,
 		get_cntr(cconfs), cname, backupno,
-		get_string(cconfs[OPT_MANUAL_DELETE]));
+		get_string(cconfs[OPT_MANUAL_DELETE]), deleter);
+	deleter_free(&deleter);
+	return ret;
 }
 
 static int run_list(struct asfd *asfd,
@@ -373,7 +380,8 @@ static int run_diff(struct asfd *asfd,
 	iobuf_free_content(asfd->rbuf);
 
 	ret=do_diff_server(asfd, sdirs,
-		get_cntr(cconfs), get_protocol(cconfs), backup1, backup2);
+		get_cntr(cconfs), get_protocol(cconfs),
+		get_int(cconfs[OPT_DIFF_THREADS]), backup1, backup2);
 end:
 	free_w(&backup1);
 	free_w(&backup2);
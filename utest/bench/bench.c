@@ -0,0 +1,56 @@
+#include "bench.h"
+#include "../../src/alloc.h"
+#include "../../src/hexmap.h"
+#include "../../src/log.h"
+
+struct bench
+{
+	const char *name;
+	int (*func)(int argc, char *argv[]);
+	const char *usage;
+};
+
+static struct bench benches[] = {
+	{ "hash", bench_hash, "[entries]" },
+	{ "rabin", bench_rabin, "[megabytes]" },
+	{ NULL, NULL, NULL }
+};
+
+double bench_time(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+void bench_report(const char *name, uint64_t bytes, double secs)
+{
+	if(secs<=0) secs=0.000001;
+	printf("%-24s %10.1f MB/s (%" PRIu64 " bytes in %.3fs)\n",
+		name, bytes/secs/(1024*1024), bytes, secs);
+}
+
+static void usage(const char *prog)
+{
+	struct bench *b;
+	printf("usage: %s <benchmark> [args]\n", prog);
+	for(b=benches; b->name; b++)
+		printf("  %s %s\n", b->name, b->usage);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench *b;
+
+	if(argc<2)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	hexmap_init();
+	for(b=benches; b->name; b++)
+		if(!strcmp(b->name, argv[1]))
+			return b->func(argc-1, argv+1)?1:0;
+	usage(argv[0]);
+	return 1;
+}
@@ -0,0 +1,15 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include "../../src/burp.h"
+
+// Benchmarks are not unit tests, so they are kept out of the 'runner' and
+// built separately with 'make bench'.
+
+extern double bench_time(void);
+extern void bench_report(const char *name, uint64_t bytes, double secs);
+
+extern int bench_hash(int argc, char *argv[]);
+extern int bench_rabin(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,199 @@
+#include "bench.h"
+#include "../prng.h"
+#include "../../src/alloc.h"
+#include "../../src/server/protocol2/champ_chooser/hash.h"
+#include <uthash.h>
+
+// The node per fingerprint uthash table that the champ chooser used
+// before, kept here so that the two can be compared.
+
+struct old_strong
+{
+	uint8_t md5sum[MD5_DIGEST_LENGTH];
+	struct old_strong *next;
+	uint64_t savepath;
+};
+
+struct old_weak
+{
+	uint64_t weak;
+	struct old_strong *strong;
+	UT_hash_handle hh;
+};
+
+static struct old_weak *old_table=NULL;
+
+static struct old_strong *old_find(uint64_t fingerprint, uint8_t *md5sum)
+{
+	struct old_weak *w;
+	struct old_strong *s;
+	HASH_FIND_INT(old_table, &fingerprint, w);
+	if(!w)
+		return NULL;
+	for(s=w->strong; s; s=s->next)
+		if(!memcmp(s->md5sum, md5sum, MD5_DIGEST_LENGTH))
+			return s;
+	return NULL;
+}
+
+static int old_add(uint64_t fingerprint, uint8_t *md5sum, uint64_t savepath)
+{
+	struct old_weak *w;
+	struct old_strong *s;
+	HASH_FIND_INT(old_table, &fingerprint, w);
+	if(!w)
+	{
+		if(!(w=(struct old_weak *)
+			malloc_w(sizeof(struct old_weak), __func__)))
+				return -1;
+		w->weak=fingerprint;
+		w->strong=NULL;
+		HASH_ADD_INT(old_table, weak, w);
+	}
+	if(!(s=(struct old_strong *)
+		malloc_w(sizeof(struct old_strong), __func__)))
+			return -1;
+	memcpy(s->md5sum, md5sum, MD5_DIGEST_LENGTH);
+	s->savepath=savepath;
+	s->next=w->strong;
+	w->strong=s;
+	return 0;
+}
+
+static void old_delete_all(void)
+{
+	struct old_weak *w;
+	struct old_weak *tmp;
+	struct old_strong *s;
+	HASH_ITER(hh, old_table, w, tmp)
+	{
+		HASH_DEL(old_table, w);
+		while((s=w->strong))
+		{
+			w->strong=s->next;
+			free_v((void **)&s);
+		}
+		free_v((void **)&w);
+	}
+	old_table=NULL;
+}
+
+struct sig
+{
+	uint64_t fingerprint;
+	uint8_t md5sum[MD5_DIGEST_LENGTH];
+};
+
+static void report(const char *name, size_t ops, double secs)
+{
+	if(secs<=0) secs=0.000001;
+	printf("%-24s %10.1f Mops/s (%zu in %.3fs)\n",
+		name, ops/secs/1000000, ops, secs);
+}
+
+// Half of the lookups hit and half miss, which is roughly what
+// deduplication against a good set of champions looks like.
+static int run(const char *name, struct sig *sigs, size_t entries,
+	int (*add)(uint64_t, uint8_t *, uint64_t),
+	void *(*find)(uint64_t, uint8_t *),
+	void (*reset)(void), int rounds)
+{
+	int r;
+	size_t i;
+	size_t hits;
+	double start;
+	double add_secs=0;
+	double find_secs=0;
+	double reset_secs=0;
+	char label[64];
+
+	for(r=0; r<rounds; r++)
+	{
+		start=bench_time();
+		for(i=0; i<entries; i++)
+			if(add(sigs[i].fingerprint, sigs[i].md5sum, i))
+				return -1;
+		add_secs+=bench_time()-start;
+
+		hits=0;
+		start=bench_time();
+		for(i=entries/2; i<entries+entries/2; i++)
+			if(find(sigs[i].fingerprint, sigs[i].md5sum))
+				hits++;
+		find_secs+=bench_time()-start;
+		if(hits!=entries-entries/2)
+		{
+			printf("%s: expected %zu hits, got %zu\n",
+				name, entries-entries/2, hits);
+			return -1;
+		}
+
+		start=bench_time();
+		reset();
+		reset_secs+=bench_time()-start;
+	}
+	snprintf(label, sizeof(label), "%s add", name);
+	report(label, entries*rounds, add_secs);
+	snprintf(label, sizeof(label), "%s find", name);
+	report(label, entries*rounds, find_secs);
+	snprintf(label, sizeof(label), "%s reset", name);
+	report(label, entries*rounds, reset_secs);
+	return 0;
+}
+
+static void *old_find_v(uint64_t fingerprint, uint8_t *md5sum)
+{
+	return old_find(fingerprint, md5sum);
+}
+
+static struct hash_table *table=NULL;
+
+static int hash_add_v(uint64_t fingerprint, uint8_t *md5sum, uint64_t savepath)
+{
+	return hash_add(table, fingerprint, md5sum, savepath);
+}
+
+static void *hash_find_v(uint64_t fingerprint, uint8_t *md5sum)
+{
+	return hash_find(table, fingerprint, md5sum);
+}
+
+static void hash_reset_v(void)
+{
+	hash_reset(table);
+}
+
+int bench_hash(int argc, char *argv[])
+{
+	int ret=-1;
+	size_t i;
+	size_t entries=1000000;
+	struct sig *sigs=NULL;
+
+	if(argc>1) entries=strtoul(argv[1], NULL, 10);
+	if(!entries) entries=1;
+
+	// Twice as many as get added, so that there are some to miss.
+	if(!(sigs=(struct sig *)
+		malloc_w(entries*2*sizeof(struct sig), __func__))
+	  || !(table=hash_table_alloc()))
+			goto end;
+	prng_init(0);
+	for(i=0; i<entries*2; i++)
+	{
+		sigs[i].fingerprint=prng_next64();
+		prng_md5sum(sigs[i].md5sum);
+	}
+
+	if(run("uthash", sigs, entries,
+		old_add, old_find_v, old_delete_all, 3)
+	  || run("open addressing", sigs, entries,
+		hash_add_v, hash_find_v, hash_reset_v, 3))
+			goto end;
+	ret=0;
+end:
+	old_delete_all();
+	hash_table_free(&table);
+	free_v((void **)&sigs);
+	return ret;
+}
@@ -0,0 +1,133 @@
+#include "bench.h"
+#include "../prng.h"
+#include "../../src/alloc.h"
+#include "../../src/conf.h"
+#include "../../src/fsops.h"
+#include "../../src/log.h"
+#include "../../src/sbuf.h"
+#include "../../src/client/protocol2/rabin_read.h"
+#include "../../src/protocol2/blist.h"
+#include "../../src/protocol2/blk.h"
+#include "../../src/protocol2/rabin/rabin.h"
+
+#define BASE		"bench_rabin"
+#define BENCH_FILE	BASE "/data"
+
+// Mostly random data, with some runs of zeroes to give the chunker some
+// repetition to find.
+static int build_data_file(size_t len)
+{
+	size_t i;
+	FILE *fp;
+	uint32_t r;
+	uint32_t buf[1024];
+
+	if(build_path_w(BENCH_FILE)
+	  || !(fp=fopen(BENCH_FILE, "wb")))
+		return -1;
+	prng_init(0);
+	for(i=0; i<len; i+=sizeof(buf))
+	{
+		size_t j;
+		for(j=0; j<sizeof(buf)/sizeof(buf[0]); j++)
+		{
+			r=prng_next();
+			buf[j]=(r%23)?r:0;
+		}
+		if(fwrite(buf, sizeof(buf), 1, fp)!=1)
+		{
+			fclose(fp);
+			return -1;
+		}
+	}
+	return fclose(fp);
+}
+
+static void free_blocks(struct blist *blist, uint64_t *blocks)
+{
+	struct blk *b;
+	while((b=blist->head))
+	{
+		blist->head=b->next;
+		blk_free(&b);
+		(*blocks)++;
+	}
+	blist->tail=NULL;
+}
+
+static int chunk_file(struct conf **confs, const char *engine)
+{
+	int r;
+	int ret=-1;
+	int opened=0;
+	int just_opened=1;
+	uint64_t blocks=0;
+	double start;
+	char name[64];
+	char *path=NULL;
+	struct sbuf *sb=NULL;
+	struct blist *blist=NULL;
+
+	if(!(blist=blist_alloc())
+	  || !(sb=sbuf_alloc(PROTO_2))
+	  || !(path=strdup_w(BENCH_FILE, __func__)))
+		goto end;
+	iobuf_from_str(&sb->path, CMD_FILE, path);
+	if(rabin_open_file(sb, NULL, NULL, confs)!=1)
+		goto end;
+	opened=1;
+	if(blks_generate_init()
+	  || blks_generate_set_engine(engine))
+		goto end;
+
+	start=bench_time();
+	while(!(r=blks_generate(sb, blist, just_opened)))
+	{
+		just_opened=0;
+		// blks_generate() also fills in the md5sum of each block.
+		free_blocks(blist, &blocks);
+	}
+	free_blocks(blist, &blocks);
+	if(r<0) goto end;
+
+	snprintf(name, sizeof(name), "%s chunk+md5", engine);
+	bench_report(name, sb->protocol2->bytes_read, bench_time()-start);
+	printf("%-24s %10" PRIu64 " blocks, average %" PRIu64 " bytes\n",
+		"", blocks, blocks?sb->protocol2->bytes_read/blocks:0);
+	ret=0;
+end:
+	blks_generate_free();
+	if(opened)
+		rabin_close_file(sb, NULL);
+	blist_free(&blist);
+	sbuf_free(&sb);
+	return ret;
+}
+
+// Single threaded, so the MB/s reported is per core.
+int bench_rabin(int argc, char *argv[])
+{
+	int ret=-1;
+	size_t megabytes=256;
+	struct conf **confs=NULL;
+
+	if(argc>1) megabytes=strtoul(argv[1], NULL, 10);
+	if(!megabytes) megabytes=1;
+
+	if(!(confs=confs_alloc())
+	  || confs_init(confs)
+	  || recursive_delete(BASE)
+	  || build_data_file(megabytes*1024*1024))
+		goto end;
+
+	// The file was only just written, so it should be in the page cache
+	// and this measures CPU rather than disk.
+	if(chunk_file(confs, "rabin")
+	  || chunk_file(confs, "gear"))
+		goto end;
+	ret=0;
+end:
+	recursive_delete(BASE);
+	confs_free(&confs);
+	return ret;
+}
@@ -145,8 +145,8 @@ static struct slist *do_build_manifest(struct manio *manio,
 				struct iobuf endfile;
 				iobuf_from_str(&endfile,
 					CMD_END_FILE, (char *)"0:0");
-				fail_unless(!iobuf_send_msg_fzp(&endfile,
-					manio->fzp));
+				fail_unless(!manio_write_iobuf(manio,
+					&endfile));
 			}
 			hack_protocol2_attr(&sb->attr);
 		}
@@ -271,8 +271,8 @@ void build_manifest_phase2_from_slist(const char *path,
 				struct iobuf endfile;
 				iobuf_from_str(&endfile,
 					CMD_END_FILE, (char *)"0:0");
-				fail_unless(!iobuf_send_msg_fzp(&endfile,
-					manio->fzp));
+				fail_unless(!manio_write_iobuf(manio,
+					&endfile));
 			}
 			hack_protocol2_attr(&sb->attr);
 		}
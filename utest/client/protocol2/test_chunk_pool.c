@@ -0,0 +1,194 @@
+#include "../../test.h"
+#include "../../builders/build_file.h"
+#include "../../prng.h"
+#include "../../../src/alloc.h"
+#include "../../../src/asfd.h"
+#include "../../../src/client/protocol2/chunk_pool.h"
+#include "../../../src/client/protocol2/rabin_read.h"
+#include "../../../src/conffile.h"
+#include "../../../src/fsops.h"
+#include "../../../src/hexmap.h"
+#include "../../../src/protocol2/blist.h"
+#include "../../../src/protocol2/blk.h"
+#include "../../../src/protocol2/rabin/rabin.h"
+#include "../../../src/sbuf.h"
+
+#define BASE		"utest_client_protocol2_chunk_pool"
+#define CONFFILE	BASE "/burp.conf"
+
+#ifdef HAVE_PTHREAD
+
+static size_t sizes[] = {
+	0, 1, 5000, 100000, 1024*1024, 3, 300000
+};
+#define FILES	(sizeof(sizes)/sizeof(sizes[0]))
+
+static struct conf **setup_conf(void)
+{
+	struct conf **confs=NULL;
+	fail_unless((confs=confs_alloc())!=NULL);
+	fail_unless(!confs_init(confs));
+	return confs;
+}
+
+static void build_random_file(const char *path, size_t len, uint32_t seed)
+{
+	size_t i;
+	FILE *fp;
+	uint8_t c;
+	fail_unless(!build_path_w(path));
+	fail_unless((fp=fopen(path, "wb"))!=NULL);
+	prng_init(seed);
+	for(i=0; i<len; i++)
+	{
+		c=(uint8_t)prng_next();
+		fail_unless(fwrite(&c, 1, 1, fp)==1);
+	}
+	fail_unless(!fclose(fp));
+}
+
+static struct sbuf *setup_sbuf(struct conf **confs, size_t f)
+{
+	char path[64];
+	char *mypath;
+	struct sbuf *sb;
+	snprintf(path, sizeof(path), BASE "/file%d", (int)f);
+	fail_unless((sb=sbuf_alloc(PROTO_2))!=NULL);
+	fail_unless((mypath=strdup_w(path, __func__))!=NULL);
+	iobuf_from_str(&sb->path, CMD_FILE, mypath);
+	fail_unless(rabin_open_file(sb, NULL, NULL, confs)==1);
+	return sb;
+}
+
+// Chunk the files one after the other, the way the client does without
+// threads.
+static void chunk_serial(struct conf **confs, struct blist *blist)
+{
+	int r;
+	size_t f;
+	struct sbuf *sb;
+	fail_unless(!blks_generate_init());
+	for(f=0; f<FILES; f++)
+	{
+		sb=setup_sbuf(confs, f);
+		r=blks_generate(sb, blist, 1/*just_opened*/);
+		while(!r)
+			r=blks_generate(sb, blist, 0);
+		fail_unless(r==1);
+		fail_unless(sb->protocol2->bend==blist->tail);
+		fail_unless(!rabin_close_file(sb, NULL/*asfd*/));
+		sbuf_free(&sb);
+	}
+	blks_generate_free();
+}
+
+static void chunk_pool(struct conf **confs, struct blist *blist, int threads)
+{
+	int r;
+	int threaded;
+	size_t f;
+	struct sbuf *sb[FILES];
+	struct chunk_pool *pool;
+
+	fail_unless((pool=chunk_pool_alloc(threads, NULL))!=NULL);
+	for(f=0; f<FILES; f++)
+	{
+		sb[f]=setup_sbuf(confs, f);
+		fail_unless(!chunk_pool_add(pool, sb[f], 1/*threaded*/));
+	}
+	fail_unless(chunk_pool_jobs(pool)==(int)FILES);
+	fail_unless(chunk_pool_last(pool)==sb[FILES-1]);
+	for(f=0; f<FILES; f++)
+	{
+		fail_unless(chunk_pool_head(pool, &threaded)==sb[f]);
+		fail_unless(threaded==1);
+		while(!(r=chunk_pool_take(pool, blist))) { }
+		fail_unless(r==1);
+		fail_unless(sb[f]->protocol2->bend==blist->tail);
+		fail_unless(!rabin_close_file(sb[f], NULL/*asfd*/));
+		sbuf_free(&sb[f]);
+	}
+	fail_unless(!chunk_pool_jobs(pool));
+	chunk_pool_free(&pool);
+	fail_unless(!pool);
+}
+
+static void assert_same_blks(struct blist *a, struct blist *b)
+{
+	struct blk *x;
+	struct blk *y;
+	for(x=a->head, y=b->head; x && y; x=x->next, y=y->next)
+	{
+		fail_unless(x->index==y->index);
+		fail_unless(x->length==y->length);
+		fail_unless(x->fingerprint==y->fingerprint);
+		fail_unless(!memcmp(x->md5sum, y->md5sum, MD5_DIGEST_LENGTH));
+	}
+	fail_unless(!x && !y);
+}
+
+static void do_test_chunk_pool(int threads)
+{
+	size_t f;
+	struct blist *serial;
+	struct blist *pooled;
+	struct conf **confs;
+
+	alloc_check_init();
+	fail_unless(!recursive_delete(BASE));
+	hexmap_init();
+	build_file(CONFFILE, MIN_CLIENT_CONF);
+	confs=setup_conf();
+	fail_unless(!conf_load_global_only(CONFFILE, confs));
+	for(f=0; f<FILES; f++)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), BASE "/file%d", (int)f);
+		build_random_file(path, sizes[f], f);
+	}
+
+	fail_unless((serial=blist_alloc())!=NULL);
+	fail_unless((pooled=blist_alloc())!=NULL);
+	chunk_serial(confs, serial);
+	chunk_pool(confs, pooled, threads);
+	assert_same_blks(serial, pooled);
+
+	blist_free(&serial);
+	blist_free(&pooled);
+	confs_free(&confs);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+START_TEST(test_chunk_pool_one_thread)
+{
+	do_test_chunk_pool(1);
+}
+END_TEST
+
+START_TEST(test_chunk_pool_threads)
+{
+	do_test_chunk_pool(3);
+}
+END_TEST
+
+#endif
+
+Suite *suite_client_protocol2_chunk_pool(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("client_protocol2_chunk_pool");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+
+#ifdef HAVE_PTHREAD
+	tcase_add_test(tc_core, test_chunk_pool_one_thread);
+	tcase_add_test(tc_core, test_chunk_pool_threads);
+#endif
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
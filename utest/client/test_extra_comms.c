@@ -397,6 +397,27 @@ static void setup_msg(struct asfd *asfd, struct conf **confs)
 	setup_extra_comms_end(asfd, &r, &w);
 }
 
+static void check_restore_compression(struct conf **confs,
+	enum action action, const char *incexc)
+{
+	fail_unless(get_int(confs[OPT_RESTORE_COMPRESSION])==1);
+}
+
+static void setup_restore_compression(struct asfd *asfd, struct conf **confs)
+{
+	int r=0; int w=0;
+	set_int(confs[OPT_RESTORE_COMPRESSION], 1);
+	setup_extra_comms_begin(asfd, &r, &w, "restore_compression");
+	asfd_assert_write(asfd, &w, 0, CMD_GEN, "restore_compression=1");
+	setup_extra_comms_end(asfd, &r, &w);
+}
+
+static void check_restore_compression_old_server(struct conf **confs,
+	enum action action, const char *incexc)
+{
+	fail_unless(get_int(confs[OPT_RESTORE_COMPRESSION])==9);
+}
+
 static void check_rshash(struct conf **confs,
 	enum action action, const char *incexc)
 {
@@ -447,6 +468,10 @@ START_TEST(test_client_extra_comms)
 	run_test(0,  ACTION_BACKUP, setup_forceproto2, check_proto2);
 	run_test(-1, ACTION_BACKUP, setup_forceproto2_proto1, NULL);
 	run_test(0,  ACTION_BACKUP, setup_msg, check_msg);
+	run_test(0,  ACTION_RESTORE,
+		setup_restore_compression, check_restore_compression);
+	run_test(0,  ACTION_RESTORE,
+		setup_msg, check_restore_compression_old_server);
 	run_test(0,  ACTION_BACKUP, setup_rshash, check_rshash);
 }
 END_TEST
@@ -27,6 +27,7 @@ int main(void)
 #endif
 #endif
 	srunner_add_suite(sr, suite_client_monitor_lline());
+	srunner_add_suite(sr, suite_client_protocol2_chunk_pool());
 	srunner_add_suite(sr, suite_client_protocol2_rabin_read());
 #ifdef HAVE_XATTR
 	srunner_add_suite(sr, suite_client_xattr());
@@ -44,6 +45,7 @@ int main(void)
 	srunner_add_suite(sr, suite_protocol2_rabin_rconf());
 	srunner_add_suite(sr, suite_protocol2_rabin_win());
 	srunner_add_suite(sr, suite_protocol2_sbuf_protocol2());
+	srunner_add_suite(sr, suite_regexp());
 	srunner_add_suite(sr, suite_slist());
 	srunner_add_suite(sr, suite_times());
 
@@ -58,6 +60,7 @@ int main(void)
 	// These compile for Windows, but do not run correctly and the whole
 	// utest process crashes out.
 	srunner_add_suite(sr, suite_asfd());
+	srunner_add_suite(sr, suite_async());
 	srunner_add_suite(sr, suite_client_monitor());
 	srunner_add_suite(sr, suite_client_protocol1_backup_phase2());
 	srunner_add_suite(sr, suite_client_protocol2_backup_phase2());
@@ -72,34 +75,49 @@ int main(void)
 	srunner_add_suite(sr, suite_server_autoupgrade());
 	srunner_add_suite(sr, suite_server_ca());
 	srunner_add_suite(sr, suite_server_backup_phase3());
+	srunner_add_suite(sr, suite_server_browse_tree());
 	srunner_add_suite(sr, suite_server_bu_get());
 	srunner_add_suite(sr, suite_server_delete());
+	srunner_add_suite(sr, suite_server_deleter());
+	srunner_add_suite(sr, suite_server_diff());
+	srunner_add_suite(sr, suite_server_durable());
 	srunner_add_suite(sr, suite_server_extra_comms());
 	srunner_add_suite(sr, suite_server_list());
 	srunner_add_suite(sr, suite_server_manio());
+	srunner_add_suite(sr, suite_server_manio_index());
+	srunner_add_suite(sr, suite_server_manio_v2());
 	srunner_add_suite(sr, suite_server_monitor_browse());
 	srunner_add_suite(sr, suite_server_monitor_cache());
 	srunner_add_suite(sr, suite_server_monitor_cstat());
 	srunner_add_suite(sr, suite_server_monitor_json_output());
 	srunner_add_suite(sr, suite_server_monitor_status_server());
+	srunner_add_suite(sr, suite_server_pgzip());
 	srunner_add_suite(sr, suite_server_protocol1_backup_phase2());
 	srunner_add_suite(sr, suite_server_protocol1_backup_phase4());
 	srunner_add_suite(sr, suite_server_protocol1_bedup());
 	srunner_add_suite(sr, suite_server_protocol1_blocklen());
+	srunner_add_suite(sr, suite_server_protocol1_delta_chain());
 	srunner_add_suite(sr, suite_server_protocol1_dpth());
 	srunner_add_suite(sr, suite_server_protocol1_fdirs());
 	srunner_add_suite(sr, suite_server_protocol1_restore());
 	srunner_add_suite(sr, suite_server_protocol2_backup_phase2());
 	srunner_add_suite(sr, suite_server_protocol2_backup_phase4());
 	srunner_add_suite(sr, suite_server_protocol2_bsparse());
+	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_candidate());
 	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_champ_chooser());
 	srunner_add_suite(sr,
 		suite_server_protocol2_champ_chooser_champ_server());
+	srunner_add_suite(sr,
+		suite_server_protocol2_champ_chooser_dedup_pool());
 	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_dindex());
 	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_hash());
 	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_scores());
 	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_sparse());
+	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_sparse_index());
+	srunner_add_suite(sr, suite_server_protocol2_datfile());
+	srunner_add_suite(sr, suite_server_protocol2_dindex_file());
 	srunner_add_suite(sr, suite_server_protocol2_dpth());
+	srunner_add_suite(sr, suite_server_protocol2_savepath_bitmap());
 	srunner_add_suite(sr, suite_server_restore());
 	srunner_add_suite(sr, suite_server_resume());
 	srunner_add_suite(sr, suite_server_run_action());
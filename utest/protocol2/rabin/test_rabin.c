@@ -1,5 +1,6 @@
 #include "../../test.h"
 #include "../../builders/build_file.h"
+#include "../../prng.h"
 #include "../../../src/alloc.h"
 #include "../../../src/asfd.h"
 #include "../../../src/client/protocol2/rabin_read.h"
@@ -8,7 +9,9 @@
 #include "../../../src/hexmap.h"
 #include "../../../src/protocol2/blist.h"
 #include "../../../src/protocol2/blk.h"
+#include "../../../src/protocol2/rabin/gear.h"
 #include "../../../src/protocol2/rabin/rabin.h"
+#include "../../../src/protocol2/rabin/rconf.h"
 #include "../../../src/sbuf.h"
 
 #define BASE		"utest_protocol2_rabin_rabin"
@@ -101,8 +104,111 @@ START_TEST(test_rabin_blks_generate_empty_file)
 	alloc_check();
 }
 END_TEST
+
+static void build_random_file(const char *path, size_t len)
+{
+	size_t i;
+	FILE *fp;
+	uint32_t r;
+	fail_unless(!build_path_w(path));
+	fail_unless((fp=fopen(path, "wb"))!=NULL);
+	prng_init(0);
+	for(i=0; i<len; i+=sizeof(r))
+	{
+		r=prng_next();
+		fail_unless(fwrite(&r, sizeof(r), 1, fp)==1);
+	}
+	fail_unless(!fclose(fp));
+}
+
+static uint64_t chunk_file(struct conf **confs, const char *path,
+	const char *engine, uint64_t *blocks)
+{
+	int r;
+	int just_opened=1;
+	uint64_t total=0;
+	char *mypath;
+	struct blk *b;
+	struct blist *blist;
+	struct sbuf *sb;
+
+	*blocks=0;
+	fail_unless((blist=blist_alloc())!=NULL);
+	fail_unless((sb=sbuf_alloc(PROTO_2))!=NULL);
+	fail_unless((mypath=strdup_w(path, __func__))!=NULL);
+	iobuf_from_str(&sb->path, CMD_FILE, mypath);
+	fail_unless(rabin_open_file(sb, NULL, NULL, confs)==1);
+	fail_unless(!blks_generate_init());
+	fail_unless(!blks_generate_set_engine(engine));
+	while(!(r=blks_generate(sb, blist, just_opened)))
+		just_opened=0;
+	fail_unless(r==1);
+	for(b=blist->head; b; b=b->next)
+	{
+		fail_unless(b->length<=RABIN_MAX);
+		if(b->next)
+			fail_unless(b->length>=RABIN_MIN);
+		fail_unless(blk_verify_fingerprint(b->fingerprint,
+			b->data, b->length)==1);
+		total+=b->length;
+		(*blocks)++;
+	}
+	blks_generate_free();
+	fail_unless(!rabin_close_file(sb, NULL/*asfd*/));
+	blist_free(&blist);
+	sbuf_free(&sb);
+	return total;
+}
+
+START_TEST(test_rabin_blks_generate_engines)
+{
+	size_t len=1024*1024;
+	uint64_t rabin_blocks;
+	uint64_t gear_blocks;
+	struct conf **confs;
+
+	alloc_check_init();
+	fail_unless(!recursive_delete(BASE));
+	hexmap_init();
+	build_file(CONFFILE, MIN_CLIENT_CONF);
+	confs=setup_conf();
+	fail_unless(!conf_load_global_only(CONFFILE, confs));
+	build_random_file(BASE "/myfile", len);
+
+	fail_unless(chunk_file(confs, BASE "/myfile",
+		"rabin", &rabin_blocks)==len);
+	fail_unless(chunk_file(confs, BASE "/myfile",
+		"gear", &gear_blocks)==len);
+	fail_unless(rabin_blocks>len/RABIN_MAX);
+	fail_unless(gear_blocks>len/RABIN_MAX);
+
+	fail_unless(blks_generate_set_engine("bogus")==-1);
+
+	confs_free(&confs);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+END_TEST
 #endif
 
+// Every client has to chunk the same way, so the table must stay what it
+// was generated as.
+START_TEST(test_rabin_gear_table)
+{
+	int i;
+	uint64_t z;
+	uint64_t seed=0x6275727067656172ULL;
+	for(i=0; i<256; i++)
+	{
+		seed+=0x9E3779B97F4A7C15ULL;
+		z=seed;
+		z=(z^(z>>30))*0xBF58476D1CE4E5B9ULL;
+		z=(z^(z>>27))*0x94D049BB133111EBULL;
+		fail_unless(gear_table[i]==(z^(z>>31)));
+	}
+}
+END_TEST
+
 Suite *suite_protocol2_rabin_rabin(void)
 {
 	Suite *s;
@@ -113,8 +219,10 @@ Suite *suite_protocol2_rabin_rabin(void)
 	tc_core=tcase_create("Core");
 
 	tcase_add_test(tc_core, test_rabin_blk_verify_fingerprint);
+	tcase_add_test(tc_core, test_rabin_gear_table);
 #ifndef HAVE_WIN32
 	tcase_add_test(tc_core, test_rabin_blks_generate_empty_file);
+	tcase_add_test(tc_core, test_rabin_blks_generate_engines);
 #endif
 	suite_add_tcase(s, tc_core);
 
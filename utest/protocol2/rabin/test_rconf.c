@@ -20,6 +20,26 @@ START_TEST(test_rconf_init)
 	fail_unless(rconf.blk_min  <  rconf.blk_max);
 	fail_unless(rconf.blk_avg  >= rconf.blk_min);
 	fail_unless(rconf.blk_avg  <= rconf.blk_max);
+	fail_unless(rconf.engine==RCONF_ENGINE_RABIN);
+	fail_unless(rconf.gear_mask!=0);
+
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_rconf_set_engine)
+{
+	struct rconf rconf;
+	alloc_check_init();
+	rconf_init(&rconf);
+
+	fail_unless(!rconf_set_engine(&rconf, "gear"));
+	fail_unless(rconf.engine==RCONF_ENGINE_GEAR);
+	fail_unless(!rconf_set_engine(&rconf, "rabin"));
+	fail_unless(rconf.engine==RCONF_ENGINE_RABIN);
+	fail_unless(!rconf_set_engine(&rconf, NULL));
+	fail_unless(rconf.engine==RCONF_ENGINE_RABIN);
+	fail_unless(rconf_set_engine(&rconf, "bogus")==-1);
 
 	tear_down();
 }
@@ -35,6 +55,7 @@ Suite *suite_protocol2_rabin_rconf(void)
 	tc_core=tcase_create("Core");
 
 	tcase_add_test(tc_core, test_rconf_init);
+	tcase_add_test(tc_core, test_rconf_set_engine);
 	suite_add_tcase(s, tc_core);
 
 	return s;
@@ -4,6 +4,7 @@
 #include "../../../src/base64.h"
 #include "../../../src/fsops.h"
 #include "../../../src/hexmap.h"
+#include "../../../src/server/browse_tree.h"
 #include "../../../src/server/manio.h"
 #include "../../../src/server/monitor/cache.h"
 #include "../../../src/server/sdirs.h"
@@ -45,7 +46,6 @@ static struct sdirs *setup(void)
 
 START_TEST(test_server_monitor_cache)
 {
-	struct sbuf *sb;
 	struct sdirs *sdirs;
 	struct slist *slist;
 	struct manio *manio;
@@ -56,10 +56,9 @@ START_TEST(test_server_monitor_cache)
 	slist=build_manifest(sdirs->manifest,
 		protocol, /*manio_enties*/20, /*phase*/0);
         fail_unless((manio=manio_open(sdirs->manifest, "rb", protocol))!=NULL);
-        fail_unless((sb=sbuf_alloc(protocol))!=NULL);
 
 	fail_unless(!cache_loaded(CLIENTNAME, bno));
-	fail_unless(!cache_load(manio, sb, CLIENTNAME, bno));
+	fail_unless(!cache_load(manio, CLIENTNAME, bno));
 	fail_unless(cache_loaded(CLIENTNAME, bno));
 	fail_unless(!cache_loaded(CLIENTNAME, bno+1));
 // FIX THIS: do an actual lookup.
@@ -68,7 +67,33 @@ START_TEST(test_server_monitor_cache)
 	fail_unless(!cache_loaded(CLIENTNAME, bno));
 
 	manio_close(&manio);
-	sbuf_free(&sb);
+	slist_free(&slist);
+	tear_down(&sdirs);
+}
+END_TEST
+
+START_TEST(test_server_monitor_cache_map)
+{
+	struct sdirs *sdirs;
+	struct slist *slist;
+	unsigned long bno=5;
+	enum protocol protocol=PROTO_2;
+
+	sdirs=setup();
+	slist=build_manifest(sdirs->manifest,
+		protocol, /*manio_enties*/20, /*phase*/0);
+
+	// No tree written yet.
+	fail_unless(cache_map(sdirs->working, CLIENTNAME, bno)==1);
+	fail_unless(!cache_loaded(CLIENTNAME, bno));
+
+	fail_unless(!browse_tree_write(sdirs->working, protocol));
+	fail_unless(!cache_map(sdirs->working, CLIENTNAME, bno));
+	fail_unless(cache_loaded(CLIENTNAME, bno));
+	fail_unless(!cache_loaded(CLIENTNAME, bno+1));
+	cache_free();
+	fail_unless(!cache_loaded(CLIENTNAME, bno));
+
 	slist_free(&slist);
 	tear_down(&sdirs);
 }
@@ -85,6 +110,7 @@ Suite *suite_server_monitor_cache(void)
 	tcase_set_timeout(tc_core, 5);
 
 	tcase_add_test(tc_core, test_server_monitor_cache);
+	tcase_add_test(tc_core, test_server_monitor_cache_map);
 
 	suite_add_tcase(s, tc_core);
 
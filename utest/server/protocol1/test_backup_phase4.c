@@ -5,11 +5,15 @@
 #include "../../../src/attribs.h"
 #include "../../../src/base64.h"
 #include "../../../src/bu.h"
+#include "../../../src/fzp.h"
+#include "../../../src/handy.h"
 #include "../../../src/hexmap.h"
 #include "../../../src/fsops.h"
 #include "../../../src/iobuf.h"
 #include "../../../src/log.h"
+#include "../../../src/protocol1/rs_buf.h"
 #include "../../../src/server/protocol1/backup_phase4.h"
+#include "../../../src/server/protocol1/blocklen.h"
 #include "../../../src/server/protocol1/fdirs.h"
 #include "../../../src/server/protocol1/link.h"
 #include "../../../src/server/sdirs.h"
@@ -210,6 +214,238 @@ START_TEST(test_atomic_data_jiggle)
 }
 END_TEST
 
+#define TS_CURRENT	"0000001 1970-01-01 00:00:00"
+#define TS_FINISHING	"0000002 1970-01-02 00:00:00"
+
+static struct sd sd12[] = {
+	{ TS_CURRENT, 1, 1, BU_CURRENT },
+	{ TS_FINISHING, 2, 2, BU_FINISHING },
+};
+
+enum change
+{
+	CHANGE_NONE=0,
+	CHANGE_NEW_FILE,
+	CHANGE_DELTA,
+	CHANGE_BAD_DELTA
+};
+
+static enum change get_change(int i)
+{
+	switch(i%4)
+	{
+		case 0: return CHANGE_NONE;
+		case 1: return CHANGE_NEW_FILE;
+		case 2: return CHANGE_DELTA;
+		default: return (i/4)%2?CHANGE_DELTA:CHANGE_BAD_DELTA;
+	}
+}
+
+static char *backup_path(struct sdirs *sdirs, const char *timestamp,
+	const char *dir, struct sbuf *s)
+{
+	static char path[256]="";
+	snprintf(path, sizeof(path), "%s/%s/%s/%s", sdirs->client,
+		timestamp, dir, s->protocol1->datapth.buf);
+	return path;
+}
+
+static char *old_content(struct sbuf *s)
+{
+	static char content[256]="";
+	snprintf(content, sizeof(content), "old content of %s", s->path.buf);
+	return content;
+}
+
+static char *new_content(struct sbuf *s)
+{
+	static char content[256]="";
+	snprintf(content, sizeof(content), "new content of %s", s->path.buf);
+	return content;
+}
+
+static void write_data(const char *path, const char *content, int compressed)
+{
+	struct fzp *fzp;
+	size_t len=strlen(content);
+	fail_unless(!build_path_w(path));
+	if(compressed)
+		fzp=fzp_gzopen(path, "wb");
+	else
+		fzp=fzp_open(path, "wb");
+	fail_unless(fzp!=NULL);
+	fail_unless(fzp_write(fzp, content, len)==len);
+	fail_unless(!fzp_close(&fzp));
+}
+
+// Makes a forward delta in the same way that the client does.
+static void build_forward_delta(const char *path,
+	const char *from, const char *to, struct conf **confs)
+{
+	struct fzp *oldfzp;
+	struct fzp *newfzp;
+	struct fzp *sigfzp;
+	struct fzp *delfzp;
+	rs_signature_t *sumset=NULL;
+	write_data(BASE "/delta_old", from, 0);
+	write_data(BASE "/delta_new", to, 0);
+
+	fail_unless((oldfzp=fzp_open(BASE "/delta_old", "rb"))!=NULL);
+	fail_unless((sigfzp=fzp_open(BASE "/delta_sig", "wb"))!=NULL);
+	fail_unless(rs_sig_gzfile(oldfzp, sigfzp,
+		get_librsync_block_len("0:0"),
+		RS_DEFAULT_STRONG_LEN, confs)==RS_DONE);
+	fail_unless(!fzp_close(&oldfzp));
+	fail_unless(!fzp_close(&sigfzp));
+
+	fail_unless((sigfzp=fzp_open(BASE "/delta_sig", "rb"))!=NULL);
+	fail_unless(rs_loadsig_fzp(sigfzp, &sumset)==RS_DONE);
+	fail_unless(rs_build_hash_table(sumset)==RS_DONE);
+	fail_unless(!fzp_close(&sigfzp));
+
+	fail_unless(!build_path_w(path));
+	fail_unless((newfzp=fzp_open(BASE "/delta_new", "rb"))!=NULL);
+	fail_unless((delfzp=fzp_gzopen(path, "wb"))!=NULL);
+	fail_unless(rs_delta_gzfile(sumset, newfzp, delfzp)==RS_DONE);
+	fail_unless(!fzp_close(&newfzp));
+	fail_unless(!fzp_close(&delfzp));
+	rs_free_sumset(sumset);
+}
+
+static void setup_changes(struct sdirs *sdirs, struct fdirs *fdirs,
+	struct slist *slist, struct conf **confs)
+{
+	int i=0;
+	char *path;
+	struct sbuf *s;
+	for(s=slist->head; s; s=s->next)
+	{
+		if(!s->protocol1->datapth.buf)
+			continue;
+		write_data(backup_path(sdirs, TS_CURRENT, "data", s),
+			old_content(s),
+			dpth_protocol1_is_compressed(s->compression,
+				s->protocol1->datapth.buf));
+		path=backup_path(sdirs, TS_FINISHING, "deltas.forward", s);
+		switch(get_change(i++))
+		{
+			case CHANGE_NONE:
+				break;
+			case CHANGE_NEW_FILE:
+				write_data(backup_path(sdirs, TS_FINISHING,
+					"data.tmp", s), new_content(s), 1);
+				break;
+			case CHANGE_DELTA:
+				build_forward_delta(path,
+					old_content(s), new_content(s), confs);
+				break;
+			case CHANGE_BAD_DELTA:
+				build_file(path, "not a delta");
+				break;
+		}
+	}
+}
+
+static void assert_changes(struct sdirs *sdirs, struct fdirs *fdirs,
+	struct slist *slist)
+{
+	int i=0;
+	struct sbuf *s;
+	struct sbuf *mb;
+	struct fzp *fzp;
+	int change;
+	struct stat statp;
+
+	fail_unless((fzp=fzp_gzopen(fdirs->manifest, "rb"))!=NULL);
+	fail_unless((mb=sbuf_alloc(PROTO_1))!=NULL);
+	for(s=slist->head; s; s=s->next)
+	{
+		if(s->protocol1->datapth.buf)
+			change=get_change(i++);
+		else
+			change=-1;
+		switch(change)
+		{
+			case CHANGE_NONE:
+				assert_file_content(backup_path(sdirs,
+					TS_FINISHING, "data", s),
+					old_content(s));
+				// Moved to the new backup.
+				fail_unless(lstat(backup_path(sdirs,
+					TS_CURRENT, "data", s), &statp));
+				break;
+			case CHANGE_NEW_FILE:
+				assert_file_content(backup_path(sdirs,
+					TS_FINISHING, "data", s),
+					new_content(s));
+				assert_file_content(backup_path(sdirs,
+					TS_CURRENT, "data", s),
+					old_content(s));
+				break;
+			case CHANGE_DELTA:
+				assert_file_content(backup_path(sdirs,
+					TS_FINISHING, "data", s),
+					new_content(s));
+				// The previous backup gets a reverse delta
+				// instead of the old file.
+				fail_unless(!lstat(backup_path(sdirs,
+					TS_CURRENT, "deltas.reverse", s),
+					&statp));
+				fail_unless(lstat(backup_path(sdirs,
+					TS_CURRENT, "data", s), &statp));
+				break;
+			case CHANGE_BAD_DELTA:
+				// Taken out of the manifest.
+				fail_unless(lstat(backup_path(sdirs,
+					TS_FINISHING, "data", s), &statp));
+				assert_file_content(backup_path(sdirs,
+					TS_CURRENT, "data", s),
+					old_content(s));
+				continue;
+			default:
+				break;
+		}
+		sbuf_free_content(mb);
+		fail_unless(!sbuf_fill_from_file(mb, fzp, NULL));
+		fail_unless(!strcmp(mb->path.buf, s->path.buf));
+	}
+	sbuf_free_content(mb);
+	fail_unless(sbuf_fill_from_file(mb, fzp, NULL)==1);
+	sbuf_free(&mb);
+	fzp_close(&fzp);
+}
+
+static void run_test_deltas(int entries, int threads)
+{
+	struct conf **confs;
+	struct sdirs *sdirs;
+	struct fdirs *fdirs;
+	struct slist *slist;
+
+	setup(&sdirs, &fdirs, &confs);
+	set_int(confs[OPT_DELTA_THREADS], threads);
+
+	build_storage_dirs(sdirs, sd12, ARR_LEN(sd12));
+	slist=build_manifest(fdirs->manifest, PROTO_1, entries, /*phase*/ 3);
+	setup_changes(sdirs, fdirs, slist, confs);
+
+	fail_unless(!backup_phase4_server_protocol1(sdirs, confs));
+	log_fzp_set(NULL, confs);
+
+	assert_changes(sdirs, fdirs, slist);
+
+	slist_free(&slist);
+	tear_down(&sdirs, &fdirs, &confs);
+}
+
+START_TEST(test_atomic_data_jiggle_deltas)
+{
+	run_test_deltas(100, 0);
+	run_test_deltas(100, 1);
+	run_test_deltas(100, 4);
+}
+END_TEST
+
 Suite *suite_server_protocol1_backup_phase4(void)
 {
 	Suite *s;
@@ -221,6 +457,7 @@ Suite *suite_server_protocol1_backup_phase4(void)
 	tcase_set_timeout(tc_core, 60);
 
 	tcase_add_test(tc_core, test_atomic_data_jiggle);
+	tcase_add_test(tc_core, test_atomic_data_jiggle_deltas);
 
 	suite_add_tcase(s, tc_core);
 
@@ -0,0 +1,354 @@
+#include "../../test.h"
+#include "../../../src/alloc.h"
+#include "../../../src/fsops.h"
+#include "../../../src/fzp.h"
+#include "../../../src/server/protocol1/delta_chain.h"
+#include "../../prng.h"
+
+#define BASE		"utest_delta_chain"
+#define MAX_SIZE	20000
+
+static char path[256];
+
+static void tear_down(void)
+{
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static char *delta_path(int d)
+{
+	snprintf(path, sizeof(path), BASE "/delta%d", d);
+	return path;
+}
+
+static int width(uint64_t n)
+{
+	if(n<=0xFF) return 0;
+	if(n<=0xFFFF) return 1;
+	if(n<=0xFFFFFFFF) return 2;
+	return 3;
+}
+
+static void put_number(struct fzp *fzp, uint64_t n, int w)
+{
+	int i;
+	uint8_t buf[8];
+	int bytes=1<<w;
+	for(i=bytes-1; i>=0; i--, n>>=8)
+		buf[i]=n&0xFF;
+	fail_unless(fzp_write(fzp, buf, bytes)==(size_t)bytes);
+}
+
+static void put_op(struct fzp *fzp, uint8_t op)
+{
+	fail_unless(fzp_write(fzp, &op, 1)==1);
+}
+
+// Sometimes use wider numbers than needed, as librsync is allowed to.
+static int pick_width(uint64_t n)
+{
+	int w=width(n);
+	if(w<3 && !(prng_next()%5)) w++;
+	return w;
+}
+
+static void put_literal(struct fzp *fzp, const uint8_t *data, uint64_t len)
+{
+	int w;
+	if(len<=64 && prng_next()%2)
+		put_op(fzp, (uint8_t)len);
+	else
+	{
+		w=pick_width(len);
+		put_op(fzp, 0x41+w);
+		put_number(fzp, len, w);
+	}
+	fail_unless(fzp_write(fzp, data, len)==len);
+}
+
+static void put_copy(struct fzp *fzp, uint64_t pos, uint64_t len)
+{
+	int pw=pick_width(pos);
+	int lw=pick_width(len);
+	put_op(fzp, 0x45+pw*4+lw);
+	put_number(fzp, pos, pw);
+	put_number(fzp, len, lw);
+}
+
+static struct fzp *open_delta(int d, int compressed)
+{
+	struct fzp *fzp;
+	if(compressed)
+		fzp=fzp_gzopen(delta_path(d), "wb");
+	else
+		fzp=fzp_open(delta_path(d), "wb");
+	fail_unless(fzp!=NULL);
+	put_number(fzp, 0x72730236, 2);
+	return fzp;
+}
+
+// Writes a random delta from one version to the next, and works out the
+// next version the slow way.
+static void build_delta(int d, const uint8_t *from, size_t flen,
+	uint8_t *to, size_t *tlen, int in_order)
+{
+	size_t i;
+	uint64_t pos=0;
+	uint64_t len;
+	struct fzp *fzp;
+	fzp=open_delta(d, d%2);
+	*tlen=0;
+	while(*tlen<MAX_SIZE/2)
+	{
+		len=1+prng_next()%500;
+		if(*tlen+len>MAX_SIZE)
+			break;
+		if(flen && prng_next()%3)
+		{
+			if(!in_order)
+				pos=prng_next()%flen;
+			if(pos>=flen)
+				break;
+			if(len>flen-pos)
+				len=flen-pos;
+			put_copy(fzp, pos, len);
+			memcpy(to+*tlen, from+pos, len);
+			pos+=len;
+		}
+		else
+		{
+			for(i=0; i<len; i++)
+				to[*tlen+i]=(uint8_t)prng_next();
+			put_literal(fzp, to+*tlen, len);
+		}
+		*tlen+=len;
+	}
+	put_op(fzp, 0);
+	fail_unless(!fzp_close(&fzp));
+}
+
+static void build_base(const uint8_t *data, size_t len, int compressed)
+{
+	struct fzp *fzp;
+	fail_unless(!build_path_w(BASE "/base"));
+	if(compressed)
+		fzp=fzp_gzopen(BASE "/base", "wb");
+	else
+		fzp=fzp_open(BASE "/base", "wb");
+	fail_unless(fzp!=NULL);
+	fail_unless(fzp_write(fzp, data, len)==len);
+	fail_unless(!fzp_close(&fzp));
+}
+
+static int count_tmp_files(int deltas)
+{
+	int d;
+	int count=0;
+	char tmp[64];
+	struct stat statp;
+	for(d=0; d<deltas; d++)
+	{
+		snprintf(tmp, sizeof(tmp), BASE "/delta_chain.%d", d);
+		if(!lstat(tmp, &statp))
+			count++;
+	}
+	return count;
+}
+
+static void run_test(int deltas, int compressed, int in_order,
+	const char *tmpdir)
+{
+	int d;
+	size_t i;
+	ssize_t got;
+	size_t len;
+	size_t flen;
+	uint8_t *from;
+	uint8_t *to;
+	uint8_t *buf;
+	struct delta_chain *chain;
+
+	fail_unless(!recursive_delete(BASE));
+	fail_unless((from=(uint8_t *)malloc_w(MAX_SIZE, __func__))!=NULL);
+	fail_unless((to=(uint8_t *)malloc_w(MAX_SIZE, __func__))!=NULL);
+	fail_unless((buf=(uint8_t *)malloc_w(MAX_SIZE, __func__))!=NULL);
+	flen=MAX_SIZE/2;
+	for(i=0; i<flen; i++)
+		from[i]=(uint8_t)prng_next();
+	build_base(from, flen, compressed);
+
+	fail_unless((chain=delta_chain_alloc(NULL))!=NULL);
+	for(d=0; d<deltas; d++)
+	{
+		build_delta(d, from, flen, to, &len, in_order);
+		memcpy(from, to, len);
+		flen=len;
+		fail_unless(!delta_chain_add(chain, delta_path(d)));
+	}
+	fail_unless(delta_chain_length(chain)==deltas);
+	fail_unless(!delta_chain_compose(chain));
+	fail_unless(delta_chain_size(chain)==flen);
+	if(in_order)
+		fail_unless(delta_chain_base_in_order(chain));
+	fail_unless(!delta_chain_open(chain, BASE "/base", compressed, tmpdir));
+	// Deltas whose literals are read out of order got inflated.
+	if(tmpdir && !in_order && deltas>2)
+		fail_unless(count_tmp_files(deltas)>0);
+
+	// Read it in odd sized bits.
+	for(len=0; len<flen; len+=got)
+	{
+		got=delta_chain_read(chain, buf+len, 1+prng_next()%3000);
+		fail_unless(got>0);
+	}
+	fail_unless(len==flen);
+	fail_unless(!delta_chain_read(chain, buf, 1));
+	fail_unless(!memcmp(buf, from, flen));
+
+	delta_chain_free(&chain);
+	fail_unless(!count_tmp_files(deltas));
+	free_v((void **)&from);
+	free_v((void **)&to);
+	free_v((void **)&buf);
+	tear_down();
+}
+
+START_TEST(test_delta_chain)
+{
+	int d;
+	prng_init(0);
+	for(d=1; d<8; d++)
+	{
+		run_test(d, 0 /*compressed*/, 0 /*in_order*/, NULL);
+		run_test(d, 1 /*compressed*/, 0 /*in_order*/, NULL);
+		run_test(d, 1 /*compressed*/, 1 /*in_order*/, NULL);
+	}
+}
+END_TEST
+
+START_TEST(test_delta_chain_inflated_deltas)
+{
+	int d;
+	prng_init(0);
+	// Anything out of order gets inflated into a temporary file.
+	delta_chain_set_cache_max(0);
+	for(d=1; d<8; d++)
+	{
+		run_test(d, 0 /*compressed*/, 0 /*in_order*/, BASE);
+		run_test(d, 1 /*compressed*/, 1 /*in_order*/, BASE);
+	}
+	delta_chain_set_cache_max(8*1024*1024);
+}
+END_TEST
+
+START_TEST(test_delta_chain_big_deltas_without_tmpdir)
+{
+	int d;
+	prng_init(0);
+	// With nowhere to inflate them, big deltas are read where they are.
+	delta_chain_set_cache_max(0);
+	for(d=1; d<4; d++)
+		run_test(d, 0 /*compressed*/, 0 /*in_order*/, NULL);
+	delta_chain_set_cache_max(8*1024*1024);
+}
+END_TEST
+
+static void run_bad_delta(void (*write_ops)(struct fzp *fzp))
+{
+	struct fzp *fzp;
+	struct delta_chain *chain;
+
+	fail_unless(!recursive_delete(BASE));
+	build_base((const uint8_t *)"0123456789", 10, 0);
+	fzp=open_delta(0, 0);
+	put_copy(fzp, 0, 10);
+	put_op(fzp, 0);
+	fail_unless(!fzp_close(&fzp));
+	fzp=open_delta(1, 0);
+	write_ops(fzp);
+	fail_unless(!fzp_close(&fzp));
+
+	fail_unless((chain=delta_chain_alloc(NULL))!=NULL);
+	fail_unless(!delta_chain_add(chain, delta_path(0)));
+	fail_unless(!delta_chain_add(chain, delta_path(1)));
+	fail_unless(delta_chain_compose(chain)==-1);
+	delta_chain_free(&chain);
+	tear_down();
+}
+
+static void copy_past_end(struct fzp *fzp)
+{
+	put_copy(fzp, 5, 6);
+	put_op(fzp, 0);
+}
+
+static void no_end(struct fzp *fzp)
+{
+	put_copy(fzp, 5, 5);
+}
+
+static void truncated_literal(struct fzp *fzp)
+{
+	put_op(fzp, 10);
+	fail_unless(fzp_write(fzp, "abc", 3)==3);
+}
+
+static void unknown_command(struct fzp *fzp)
+{
+	put_op(fzp, 0x55);
+	put_op(fzp, 0);
+}
+
+START_TEST(test_delta_chain_bad_deltas)
+{
+	run_bad_delta(copy_past_end);
+	run_bad_delta(no_end);
+	run_bad_delta(truncated_literal);
+	run_bad_delta(unknown_command);
+}
+END_TEST
+
+START_TEST(test_delta_chain_short_base)
+{
+	char buf[32];
+	struct fzp *fzp;
+	struct delta_chain *chain;
+
+	fail_unless(!recursive_delete(BASE));
+	build_base((const uint8_t *)"0123456789", 10, 0);
+	fzp=open_delta(0, 0);
+	put_copy(fzp, 5, 20);
+	put_op(fzp, 0);
+	fail_unless(!fzp_close(&fzp));
+
+	fail_unless((chain=delta_chain_alloc(NULL))!=NULL);
+	fail_unless(!delta_chain_add(chain, delta_path(0)));
+	// The size of the base is only found out when reading it.
+	fail_unless(!delta_chain_compose(chain));
+	fail_unless(!delta_chain_open(chain, BASE "/base", 0, NULL));
+	fail_unless(delta_chain_read(chain, buf, sizeof(buf))==-1);
+	delta_chain_free(&chain);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_protocol1_delta_chain(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol1_delta_chain");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+
+	tcase_add_test(tc_core, test_delta_chain);
+	tcase_add_test(tc_core, test_delta_chain_inflated_deltas);
+	tcase_add_test(tc_core, test_delta_chain_big_deltas_without_tmpdir);
+	tcase_add_test(tc_core, test_delta_chain_bad_deltas);
+	tcase_add_test(tc_core, test_delta_chain_short_base);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
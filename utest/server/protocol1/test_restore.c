@@ -1,6 +1,8 @@
 #include "../../test.h"
 #include "../../../src/alloc.h"
 #include "../../../src/asfd.h"
+#include "../../../src/async.h"
+#include "../../../src/bu.h"
 #include "../../../src/cmd.h"
 #include "../../../src/cntr.h"
 #include "../../../src/conf.h"
@@ -144,7 +146,7 @@ START_TEST(test_protocol1_verify_file_non_existent)
 	setup_could_not_open_message(asfd, best);
 
 	// Returns 0 so that the parent process continues.
-	fail_unless(!verify_file(asfd, sb, 0 /*patches*/, best, cntr));
+	fail_unless(!verify_file(asfd, sb, NULL /*chain*/, best, cntr));
 	fail_unless(cntr->ent[CMD_WARNING]->count==1);
 	tear_down(&sb, &cntr, NULL, &asfd);
 }
@@ -170,7 +172,7 @@ static void do_md5sum_test(const char *endfile, int warnings,
 	setup_callback(asfd, sb);
 
 	// Returns 0 so that the parent process continues.
-	fail_unless(!verify_file(asfd, sb, 0 /*patches*/, best, cntr));
+	fail_unless(!verify_file(asfd, sb, NULL /*chain*/, best, cntr));
 	fail_unless(cntr->ent[CMD_WARNING]->count==warnings);
 	tear_down(&sb, &cntr, NULL, &asfd);
 }
@@ -226,7 +228,7 @@ START_TEST(test_protocol1_verify_file_gzip_read_failure)
 	setup_error_while_reading(asfd, best);
 
 	// Returns 0 so that the parent process continues.
-	fail_unless(!verify_file(asfd, sb, 0 /*patches*/, best, cntr));
+	fail_unless(!verify_file(asfd, sb, NULL /*chain*/, best, cntr));
 	fail_unless(cntr->ent[CMD_WARNING]->count==1);
 	tear_down(&sb, &cntr, NULL, &asfd);
 }
@@ -265,6 +267,79 @@ START_TEST(test_protocol1_restore_file_not_found)
 }
 END_TEST
 
+static int async_rw_simple(struct async *as)
+{
+	return as->asfd->read(as->asfd);
+}
+
+static void setup_restored_blah(struct asfd *asfd, struct sbuf *sb)
+{
+	int r=0;
+	int w=0;
+	asfd_mock_read_no_op(asfd, &r, 1);
+	asfd_assert_write(asfd, &w, 0, CMD_FILE, sb->path.buf);
+	asfd_assert_write(asfd, &w, 0, CMD_APPEND, "blah");
+	asfd_assert_write(asfd, &w, 0, CMD_END_FILE,
+		"4:6f1ed002ab5595859014ebf0951522d9");
+}
+
+static void do_uncompressed_test(enum action act,
+	void setup_callback(struct asfd *asfd, struct sbuf *sb))
+{
+	struct async *as;
+	struct asfd *asfd;
+	struct sbuf *sb;
+	struct bu *bu;
+	struct conf **confs;
+	struct cntr *cntr;
+	char *fullpath;
+	char *basename;
+	char *timestamp;
+
+	clean();
+	confs=setup_confs();
+	set_int(confs[OPT_RESTORE_COMPRESSION], 0);
+	sb=setup_sbuf("somepath", "/datapth",
+		"4:6f1ed002ab5595859014ebf0951522d9", 0/*compression*/);
+
+	fail_unless((bu=bu_alloc())!=NULL);
+	fail_unless((fullpath=strdup_w(BASE "/0000001", __func__))!=NULL);
+	fail_unless((basename=strdup_w("0000001", __func__))!=NULL);
+	fail_unless((timestamp=strdup_w("0000001 1970-01-01 00:00:00",
+		__func__))!=NULL);
+	fail_unless(!bu_init(bu, fullpath, basename, timestamp, 0));
+	build_file(BASE "/0000001/data/datapth", "blah");
+
+	fail_unless((as=async_alloc())!=NULL);
+	as->init(as, 0 /* estimate */);
+	asfd=asfd_mock_setup(&areads, &awrites);
+	as->asfd_add(as, asfd);
+	as->read_quick=async_rw_simple;
+	asfd->as=as;
+	setup_callback(asfd, sb);
+
+	// Stored uncompressed, and asked for as it is, so the client gets
+	// the plain data, without any gzip framing.
+	fail_unless(!restore_file(asfd, bu, sb, act, NULL /*sdirs*/, confs));
+	cntr=get_cntr(confs);
+	fail_unless(cntr->ent[CMD_WARNING]->count==0);
+	bu_free(&bu);
+	async_free(&as);
+	tear_down(&sb, NULL, &confs, &asfd);
+}
+
+START_TEST(test_protocol1_restore_file_uncompressed_level_0)
+{
+	do_uncompressed_test(ACTION_RESTORE, setup_restored_blah);
+}
+END_TEST
+
+START_TEST(test_protocol1_verify_file_uncompressed_level_0)
+{
+	do_uncompressed_test(ACTION_VERIFY, setup_md5sum_match);
+}
+END_TEST
+
 Suite *suite_server_protocol1_restore(void)
 {
 	Suite *s;
@@ -279,6 +354,8 @@ Suite *suite_server_protocol1_restore(void)
 	tcase_add_test(tc_core, test_protocol1_verify_file_md5sum_match);
 	tcase_add_test(tc_core, test_protocol1_verify_file_gzip_read_failure);
 	tcase_add_test(tc_core, test_protocol1_restore_file_not_found);
+	tcase_add_test(tc_core, test_protocol1_restore_file_uncompressed_level_0);
+	tcase_add_test(tc_core, test_protocol1_verify_file_uncompressed_level_0);
 	suite_add_tcase(s, tc_core);
 
 	return s;
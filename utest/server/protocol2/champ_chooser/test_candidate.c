@@ -0,0 +1,137 @@
+#include "../../../test.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/server/protocol2/champ_chooser/candidate.h"
+#include "../../../../src/server/protocol2/champ_chooser/incoming.h"
+#include "../../../../src/server/protocol2/champ_chooser/scores.h"
+#include "../../../../src/server/protocol2/champ_chooser/sparse.h"
+
+#define CANDIDATES	4
+
+static uint64_t f[]={
+	0xF000000000000001ULL,
+	0xF000000000000002ULL,
+	0xF000000000000003ULL,
+	0xF000000000000004ULL,
+	0xF000000000000005ULL,
+	0xF000000000000009ULL // Not in the sparse index.
+};
+
+static struct scores *setup(struct incoming **in)
+{
+	int i;
+	struct scores *scores;
+	// The last fingerprint comes in twice.
+	uint64_t incoming[]={f[3], f[0], f[5], f[1], f[2], f[3], f[4]};
+
+	for(i=0; i<CANDIDATES; i++)
+		fail_unless(candidates_add_new()!=NULL);
+	fail_unless(!sparse_add_candidate(&f[0], 0));
+	fail_unless(!sparse_add_candidate(&f[0], 1));
+	fail_unless(!sparse_add_candidate(&f[1], 1));
+	fail_unless(!sparse_add_candidate(&f[1], 2));
+	fail_unless(!sparse_add_candidate(&f[2], 1));
+	fail_unless(!sparse_add_candidate(&f[3], 2));
+	fail_unless(!sparse_add_candidate(&f[3], 3));
+	fail_unless(!sparse_add_candidate(&f[4], 3));
+
+	fail_unless((scores=scores_alloc())!=NULL);
+	fail_unless(!scores_grow(scores, CANDIDATES));
+	scores_reset(scores);
+
+	fail_unless((*in=incoming_alloc())!=NULL);
+	for(i=0; i<(int)ARR_LEN(incoming); i++)
+	{
+		fail_unless(!incoming_grow_maybe(*in));
+		(*in)->fingerprints[(*in)->size-1]=incoming[i];
+	}
+	incoming_found_reset(*in);
+	return scores;
+}
+
+static void tear_down(struct incoming **in, struct scores **scores)
+{
+	incoming_free(in);
+	scores_free(scores);
+	sparse_delete_all();
+	candidates_free();
+	alloc_check();
+}
+
+START_TEST(test_candidates_choose_champ)
+{
+	struct incoming *in;
+	struct scores *scores;
+	struct candidate *champ;
+	scores=setup(&in);
+
+	candidates_score(in, scores);
+	fail_unless(in->hits_len==5);
+	fail_unless(scores->scores[0]==1);
+	fail_unless(scores->scores[1]==3);
+	fail_unless(scores->scores[2]==3);
+	fail_unless(scores->scores[3]==3);
+
+	// A tie goes to the first candidate.
+	fail_unless((champ=candidates_choose_champ(scores))==candidates[1]);
+	candidates_champ_chosen(in, scores, champ);
+	fail_unless(scores->scores[0]==0);
+	fail_unless(scores->scores[1]==0);
+	fail_unless(scores->scores[2]==2);
+	fail_unless(scores->scores[3]==3);
+
+	fail_unless((champ=candidates_choose_champ(scores))==candidates[3]);
+	candidates_champ_chosen(in, scores, champ);
+	fail_unless(scores->scores[2]==0);
+	fail_unless(candidates_choose_champ(scores)==NULL);
+
+	// Scoring again starts from scratch.
+	incoming_found_reset(in);
+	candidates_score(in, scores);
+	fail_unless(scores->scores[1]==3);
+
+	tear_down(&in, &scores);
+}
+END_TEST
+
+START_TEST(test_candidates_choose_champ_deleted)
+{
+	struct incoming *in;
+	struct scores *scores;
+	scores=setup(&in);
+
+	candidates_score(in, scores);
+	candidates[1]->deleted=1;
+	fail_unless(candidates_choose_champ(scores)==candidates[2]);
+
+	tear_down(&in, &scores);
+}
+END_TEST
+
+START_TEST(test_candidates_choose_champ_nothing)
+{
+	struct incoming *in;
+	struct scores *scores;
+	fail_unless((in=incoming_alloc())!=NULL);
+	fail_unless((scores=scores_alloc())!=NULL);
+	candidates_score(in, scores);
+	fail_unless(candidates_choose_champ(scores)==NULL);
+	tear_down(&in, &scores);
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_candidate(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_candidate");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_candidates_choose_champ);
+	tcase_add_test(tc_core, test_candidates_choose_champ_deleted);
+	tcase_add_test(tc_core, test_candidates_choose_champ_nothing);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
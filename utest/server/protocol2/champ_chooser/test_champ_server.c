@@ -3,6 +3,7 @@
 #include "../../../../src/asfd.h"
 #include "../../../../src/iobuf.h"
 #include "../../../../src/protocol2/blist.h"
+#include "../../../../src/server/protocol2/champ_chooser/champ_chooser.h"
 #include "../../../../src/server/protocol2/champ_chooser/champ_server.h"
 #include "../../../../src/server/protocol2/champ_chooser/incoming.h"
 #include "../../../builders/build_asfd_mock.h"
@@ -14,6 +15,7 @@ static void tear_down(struct asfd **asfd)
 {
 	asfd_free(asfd);
 	asfd_mock_teardown(&reads, &writes);
+	champ_chooser_free(NULL);
 //printf("%d %d\n", alloc_count, free_count);
 	alloc_check();
 }
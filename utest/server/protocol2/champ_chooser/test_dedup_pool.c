@@ -0,0 +1,247 @@
+#include "../../../test.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/asfd.h"
+#include "../../../../src/fsops.h"
+#include "../../../../src/fzp.h"
+#include "../../../../src/iobuf.h"
+#include "../../../../src/protocol2/blist.h"
+#include "../../../../src/protocol2/blk.h"
+#include "../../../../src/server/protocol2/champ_chooser/candidate.h"
+#include "../../../../src/server/protocol2/champ_chooser/dedup_pool.h"
+#include "../../../../src/server/protocol2/champ_chooser/incoming.h"
+#include "../../../../src/server/protocol2/champ_chooser/scores.h"
+#include "../../../../src/server/protocol2/champ_chooser/sparse.h"
+
+#define BASE	"utest_server_protocol2_champ_chooser_dedup_pool"
+#define CHAMP	"champ"
+#define BLKS	500
+#define CLIENTS	5
+
+#ifdef HAVE_PTHREAD
+
+#define HOOK	0xF000000000000001ULL
+
+static void set_blk(struct blk *blk, int b)
+{
+	blk->fingerprint=b?(uint64_t)b*0x10001:HOOK;
+	memset(blk->md5sum, b&0xFF, MD5_DIGEST_LENGTH);
+	blk->savepath=b+1000;
+}
+
+// The champ has every other block, including the hook.
+static void build_champ(void)
+{
+	int b;
+	struct blk blk;
+	struct fzp *fzp;
+	struct iobuf wbuf;
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!build_path_w(BASE "/" CHAMP));
+	fail_unless((fzp=fzp_gzopen(BASE "/" CHAMP, "wb"))!=NULL);
+	for(b=0; b<BLKS; b+=2)
+	{
+		set_blk(&blk, b);
+		blk_to_iobuf_sig_and_savepath(&blk, &wbuf);
+		fail_unless(!iobuf_send_msg_fzp(&wbuf, fzp));
+	}
+	fail_unless(!fzp_close(&fzp));
+}
+
+static void add_blks(struct asfd *asfd, int from, int to)
+{
+	int b;
+	struct blk *blk;
+	for(b=from; b<to; b++)
+	{
+		fail_unless((blk=blk_alloc())!=NULL);
+		set_blk(blk, b);
+		blk->savepath=0;
+		blist_add_blk(asfd->blist, blk);
+		if(!asfd->blist->blk_to_dedup)
+			asfd->blist->blk_to_dedup=blk;
+		if(!blk_fingerprint_is_hook(blk))
+			continue;
+		fail_unless(!incoming_grow_maybe(asfd->in));
+		asfd->in->fingerprints[asfd->in->size-1]=blk->fingerprint;
+	}
+}
+
+static struct asfd *setup_client(int c)
+{
+	char desc[32];
+	struct asfd *asfd;
+	snprintf(desc, sizeof(desc), "client%d", c);
+	fail_unless((asfd=asfd_alloc())!=NULL);
+	asfd->fd=-1;
+	fail_unless((asfd->desc=strdup_w(desc, __func__))!=NULL);
+	fail_unless((asfd->blist=blist_alloc())!=NULL);
+	fail_unless((asfd->in=incoming_alloc())!=NULL);
+	add_blks(asfd, 0, BLKS);
+	return asfd;
+}
+
+static void wait_for(struct dedup_pool *pool, struct asfd *asfd,
+	struct blk *until)
+{
+	struct blk *busy;
+	while(1)
+	{
+		fail_unless(!dedup_pool_collect(pool, asfd, &busy));
+		if(busy==until)
+			break;
+		usleep(1000);
+	}
+}
+
+static void check_deduplicated(struct asfd *asfd)
+{
+	int b=0;
+	struct blk *blk;
+	for(blk=asfd->blist->head; b<BLKS; blk=blk->next, b++)
+	{
+		if(b%2)
+		{
+			fail_unless(blk->got==BLK_NOT_GOT);
+			continue;
+		}
+		fail_unless(blk->got==BLK_GOT);
+		fail_unless(blk->savepath==(uint64_t)b+1000);
+	}
+}
+
+static void tear_down(struct dedup_pool **pool, struct scores **scores,
+	struct asfd **asfds, int clients)
+{
+	int c;
+	for(c=0; c<clients; c++)
+	{
+		dedup_pool_remove(*pool, asfds[c]);
+		asfd_free(&asfds[c]);
+	}
+	dedup_pool_free(pool);
+	candidates_free();
+	sparse_delete_all();
+	scores_free(scores);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static void do_test_dedup_pool(int threads)
+{
+	int c;
+	uint64_t hook=HOOK;
+	struct scores *scores;
+	struct candidate *candidate;
+	struct dedup_pool *pool;
+	struct asfd *asfds[CLIENTS];
+
+	build_champ();
+	fail_unless((candidate=candidates_add_new())!=NULL);
+	fail_unless((candidate->path=strdup_w(CHAMP, __func__))!=NULL);
+	fail_unless(!sparse_add_candidate(&hook, candidate->id));
+	fail_unless((scores=scores_alloc())!=NULL);
+	fail_unless((pool=dedup_pool_alloc(threads, BASE, scores))!=NULL);
+
+	for(c=0; c<CLIENTS; c++)
+	{
+		asfds[c]=setup_client(c);
+		fail_unless(!dedup_pool_add_blks(pool, asfds[c]));
+		fail_unless(asfds[c]->in==NULL);
+		fail_unless(asfds[c]->blist->blk_to_dedup==NULL);
+		// The next lot can be added while the first is worked on.
+		fail_unless((asfds[c]->in=incoming_alloc())!=NULL);
+		add_blks(asfds[c], BLKS, BLKS+10);
+	}
+	for(c=0; c<CLIENTS; c++)
+	{
+		wait_for(pool, asfds[c], asfds[c]->blist->blk_to_dedup);
+		check_deduplicated(asfds[c]);
+		// The blocks added afterwards were left alone.
+		fail_unless(asfds[c]->blist->blk_to_dedup->got
+			==BLK_INCOMING);
+	}
+	fail_unless(!dedup_pool_outstanding(pool));
+
+	tear_down(&pool, &scores, asfds, CLIENTS);
+}
+
+START_TEST(test_dedup_pool_one_thread)
+{
+	do_test_dedup_pool(1);
+}
+END_TEST
+
+START_TEST(test_dedup_pool_threads)
+{
+	do_test_dedup_pool(3);
+}
+END_TEST
+
+START_TEST(test_dedup_pool_fresh_candidate)
+{
+	struct scores *scores;
+	struct dedup_pool *pool;
+	struct asfd *asfd;
+
+	build_champ();
+	fail_unless((scores=scores_alloc())!=NULL);
+	fail_unless((pool=dedup_pool_alloc(2, BASE, scores))!=NULL);
+	asfd=setup_client(0);
+
+	// The fresh candidate is loaded before the blocks that come after it
+	// are deduplicated.
+	fail_unless(!dedup_pool_add_fresh(pool, asfd, BASE "/" CHAMP));
+	fail_unless(!dedup_pool_add_blks(pool, asfd));
+	wait_for(pool, asfd, NULL);
+	fail_unless(candidates_len==1);
+	check_deduplicated(asfd);
+
+	tear_down(&pool, &scores, &asfd, 1);
+}
+END_TEST
+
+START_TEST(test_dedup_pool_remove_busy_client)
+{
+	int c;
+	struct scores *scores;
+	struct dedup_pool *pool;
+	struct asfd *asfds[CLIENTS];
+
+	build_champ();
+	fail_unless((scores=scores_alloc())!=NULL);
+	fail_unless((pool=dedup_pool_alloc(2, BASE, scores))!=NULL);
+	for(c=0; c<CLIENTS; c++)
+	{
+		asfds[c]=setup_client(c);
+		fail_unless(!dedup_pool_add_fresh(pool,
+			asfds[c], BASE "/" CHAMP));
+		fail_unless(!dedup_pool_add_blks(pool, asfds[c]));
+	}
+	// Removing clients with jobs still to do needs to wait for the ones
+	// that are running and throw the rest away.
+	tear_down(&pool, &scores, asfds, CLIENTS);
+}
+END_TEST
+
+#endif
+
+Suite *suite_server_protocol2_champ_chooser_dedup_pool(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_dedup_pool");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+
+#ifdef HAVE_PTHREAD
+	tcase_add_test(tc_core, test_dedup_pool_one_thread);
+	tcase_add_test(tc_core, test_dedup_pool_threads);
+	tcase_add_test(tc_core, test_dedup_pool_fresh_candidate);
+	tcase_add_test(tc_core, test_dedup_pool_remove_busy_client);
+#endif
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
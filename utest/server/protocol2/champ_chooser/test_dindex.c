@@ -9,6 +9,7 @@
 #include "../../../../src/hexmap.h"
 #include "../../../../src/prepend.h"
 #include "../../../../src/server/protocol2/champ_chooser/dindex.h"
+#include "../../../../src/server/protocol2/savepath_bitmap.h"
 #include "../../../../src/server/sdirs.h"
 
 #define CNAME	"utestclient"
@@ -107,6 +108,8 @@ static void common_di(uint64_t *dold, size_t dolen,
 	struct sdirs *sdirs;
 	char *dold_path;
 	char *dnew_path;
+	struct savepath_bitmap *allocated;
+	struct savepath_bitmap *live;
 	sdirs=setup();
 	fail_unless((dold_path=prepend_s(sdirs->data, "dindex.old"))!=NULL);
 	fail_unless((dnew_path=prepend_s(sdirs->data, "dindex.new"))!=NULL);
@@ -116,8 +119,14 @@ static void common_di(uint64_t *dold, size_t dolen,
 	create_data_files(sdirs->data, dold, dolen);
 	create_data_files(sdirs->data, dnew, dnlen);
 
-	fail_unless(!compare_dindexes_and_unlink_datafiles(dold_path,
-		dnew_path, sdirs->data));
+	fail_unless((allocated=savepath_bitmap_alloc())!=NULL);
+	fail_unless((live=savepath_bitmap_alloc())!=NULL);
+	fail_unless(!savepath_bitmap_load_dindex(allocated, dold_path));
+	fail_unless(!savepath_bitmap_load_dindex(live, dnew_path));
+	fail_unless(!unlink_unused_data_files(allocated, live, sdirs->data,
+		NULL /* deleter */));
+	savepath_bitmap_free(&allocated);
+	savepath_bitmap_free(&live);
 	assert_existences(sdirs->data,
 		deleted, deletedlen, 0 /* does not exist */);
 	assert_existences(sdirs->data,
@@ -165,7 +174,7 @@ END_TEST
 
 START_TEST(test_delete_unused_data_files_error)
 {
-	fail_unless(delete_unused_data_files(NULL, 0)==-1);
+	fail_unless(delete_unused_data_files(NULL, 0, NULL)==-1);
 	alloc_check();
 }
 END_TEST
@@ -239,7 +248,8 @@ static void do_delete_unused_data_files(
 
 	create_data_files(sdirs->data, dfiles, dfileslen);
 
-	fail_unless(!delete_unused_data_files(sdirs, resume));
+	fail_unless(!delete_unused_data_files(sdirs, resume,
+		NULL /* deleter */));
 
 	assert_existences(sdirs->data,
 		exists, existslen, 1 /* does exist */);
@@ -414,8 +424,8 @@ START_TEST(test_delete_unused_data_files)
 		din1, ARR_LEN(din1)  // client2 dfiles in backups
 	);
 	do_delete_unused_data_files_existed(
-		din0, ARR_LEN(din1), // client1 created cfiles
-		din1, ARR_LEN(din0), // client2 created cfiles
+		din0, ARR_LEN(din0), // client1 created cfiles
+		din1, ARR_LEN(din1), // client2 created cfiles
 		din1, ARR_LEN(din1), // client1 dfiles in backups
 		din1, ARR_LEN(din1)  // client2 dfiles in backups
 	);
@@ -1,41 +1,140 @@
 #include "../../../test.h"
 #include "../../../../src/alloc.h"
+#include "../../../../src/protocol2/blk.h"
 #include "../../../../src/server/protocol2/champ_chooser/hash.h"
 
+static struct hash_table *t=NULL;
+
+static void setup(void)
+{
+	fail_unless((t=hash_table_alloc())!=NULL);
+}
+
 static void tear_down(void)
 {
-	hash_delete_all();
+	hash_table_free(&t);
 	alloc_check();
 }
 
-START_TEST(test_hash_weak_add_alloc_error)
+static uint8_t md5a[MD5_DIGEST_LENGTH]={
+	0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+	0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10
+};
+static uint8_t md5b[MD5_DIGEST_LENGTH]={
+	0xF1, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+	0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10
+};
+
+START_TEST(test_hash_add_alloc_error)
 {
 	uint64_t f0=0xFF11223344556699;
+	setup();
 	alloc_errors=1;
-	fail_unless(!hash_weak_add(f0));
+	fail_unless(hash_add(t, f0, md5a, 1)==-1);
+	fail_unless(!hash_find(t, f0, md5a));
 	tear_down();
 }
 END_TEST
 
-START_TEST(test_hash_weak_add)
+START_TEST(test_hash_add)
 {
+	struct hash_entry *e;
 	uint64_t f0=0xFF11223344556699;
 	uint64_t f1=0xFF11223344556690;
 	uint64_t f2=0xFF00112233445566;
 	uint64_t f3=0xFF001122AA445566;
-	fail_unless(hash_weak_add(f0)!=NULL);
-	fail_unless(hash_weak_add(f1)!=NULL);
-	fail_unless(hash_weak_find(f0)!=NULL);
-	fail_unless(hash_weak_find(f1)!=NULL);
-	fail_unless(hash_weak_find(f2)==NULL);
-	fail_unless(hash_weak_find(f3)==NULL);
+	setup();
+	fail_unless(!hash_add(t, f0, md5a, 1));
+	fail_unless(!hash_add(t, f1, md5a, 2));
+	fail_unless((e=hash_find(t, f0, md5a))!=NULL);
+	fail_unless(e->savepath==1);
+	fail_unless((e=hash_find(t, f1, md5a))!=NULL);
+	fail_unless(e->savepath==2);
+	fail_unless(hash_find(t, f0, md5b)==NULL);
+	fail_unless(hash_find(t, f2, md5a)==NULL);
+	fail_unless(hash_find(t, f3, md5a)==NULL);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_hash_same_fingerprint)
+{
+	struct hash_entry *e;
+	uint64_t f0=0xFF11223344556699;
+	setup();
+	fail_unless(!hash_add(t, f0, md5a, 1));
+	fail_unless(!hash_add(t, f0, md5b, 2));
+	fail_unless((e=hash_find(t, f0, md5a))!=NULL);
+	fail_unless(e->savepath==1);
+	fail_unless((e=hash_find(t, f0, md5b))!=NULL);
+	fail_unless(e->savepath==2);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_hash_load_blk)
+{
+	struct blk blk;
+	setup();
+	memset(&blk, 0, sizeof(blk));
+	blk.fingerprint=0xFF11223344556699;
+	blk.savepath=5;
+	memcpy(blk.md5sum, md5a, MD5_DIGEST_LENGTH);
+	fail_unless(!hash_load_blk(t, &blk));
+	fail_unless(!hash_load_blk(t, &blk));
+	fail_unless(hash_count(t)==1);
+	fail_unless(hash_find(t, blk.fingerprint, md5a)->savepath==5);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_hash_grow_and_reset)
+{
+	uint64_t i;
+	uint64_t entries=100000;
+	struct hash_entry *e;
+	setup();
+	for(i=0; i<entries; i++)
+		fail_unless(!hash_add(t, i<<8, md5a, i));
+	fail_unless(hash_count(t)==entries);
+	for(i=0; i<entries; i++)
+	{
+		fail_unless((e=hash_find(t, i<<8, md5a))!=NULL);
+		fail_unless(e->savepath==i);
+	}
+	fail_unless(hash_find(t, entries<<8, md5a)==NULL);
+	hash_reset(t);
+	fail_unless(hash_count(t)==0);
+	fail_unless(hash_find(t, 0, md5a)==NULL);
+	fail_unless(!hash_add(t, 1, md5a, 1));
+	fail_unless(hash_find(t, 1, md5a)!=NULL);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_hash_tables_are_separate)
+{
+	struct hash_table *other;
+	uint64_t f0=0xFF11223344556699;
+	setup();
+	fail_unless((other=hash_table_alloc())!=NULL);
+	fail_unless(!hash_add(t, f0, md5a, 1));
+	fail_unless(!hash_add(other, f0, md5a, 2));
+	fail_unless(hash_find(t, f0, md5a)->savepath==1);
+	fail_unless(hash_find(other, f0, md5a)->savepath==2);
+	hash_reset(other);
+	fail_unless(hash_find(t, f0, md5a)!=NULL);
+	fail_unless(hash_find(other, f0, md5a)==NULL);
+	hash_table_free(&other);
 	tear_down();
 }
 END_TEST
 
 START_TEST(test_hash_load_fail_to_open)
 {
-	fail_unless(hash_load("champ", "dir")==HASH_RET_TEMP);
+	setup();
+	fail_unless(hash_load(t, "champ", "dir")==HASH_RET_TEMP);
+	tear_down();
 }
 END_TEST
 
@@ -48,8 +147,12 @@ Suite *suite_server_protocol2_champ_chooser_hash(void)
 
 	tc_core=tcase_create("Core");
 
-	tcase_add_test(tc_core, test_hash_weak_add_alloc_error);
-	tcase_add_test(tc_core, test_hash_weak_add);
+	tcase_add_test(tc_core, test_hash_add_alloc_error);
+	tcase_add_test(tc_core, test_hash_add);
+	tcase_add_test(tc_core, test_hash_same_fingerprint);
+	tcase_add_test(tc_core, test_hash_load_blk);
+	tcase_add_test(tc_core, test_hash_grow_and_reset);
+	tcase_add_test(tc_core, test_hash_tables_are_separate);
 	tcase_add_test(tc_core, test_hash_load_fail_to_open);
 	suite_add_tcase(s, tc_core);
 
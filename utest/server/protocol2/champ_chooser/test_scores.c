@@ -53,6 +53,42 @@ START_TEST(test_scores_grow_alloc_error)
 }
 END_TEST
 
+START_TEST(test_scores_add_subtract)
+{
+	uint32_t a[]={0, 3, 5};
+	uint32_t b[]={3, 9};
+	struct scores *scores=NULL;
+
+	fail_unless((scores=scores_alloc())!=NULL);
+	fail_unless(!scores_grow(scores, 10));
+	scores_reset(scores);
+
+	scores_add(scores, a, ARR_LEN(a), 2);
+	scores_add(scores, b, ARR_LEN(b), 1);
+	fail_unless(scores->touched_len==4);
+	fail_unless(scores->scores[0]==2);
+	fail_unless(scores->scores[3]==3);
+	fail_unless(scores->scores[9]==1);
+	scores_subtract(scores, a, ARR_LEN(a), 2);
+	fail_unless(scores->scores[3]==1);
+	fail_unless(scores->scores[5]==0);
+
+	// A dropped candidate stays at zero.
+	scores_drop(scores, 9);
+	scores_subtract(scores, b, ARR_LEN(b), 1);
+	fail_unless(scores->scores[3]==0);
+	fail_unless(scores->scores[9]==0);
+
+	scores_reset_touched(scores);
+	fail_unless(scores->touched_len==0);
+	fail_unless(scores->scores[3]==0);
+	fail_unless(scores->scores[9]==0);
+
+	scores_free(&scores);
+	tear_down();
+}
+END_TEST
+
 Suite *suite_server_protocol2_champ_chooser_scores(void)
 {
 	Suite *s;
@@ -64,6 +100,7 @@ Suite *suite_server_protocol2_champ_chooser_scores(void)
 
 	tcase_add_test(tc_core, test_scores);
 	tcase_add_test(tc_core, test_scores_grow_alloc_error);
+	tcase_add_test(tc_core, test_scores_add_subtract);
 	suite_add_tcase(s, tc_core);
 
 	return s;
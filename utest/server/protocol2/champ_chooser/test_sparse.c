@@ -1,6 +1,5 @@
 #include "../../../test.h"
 #include "../../../../src/alloc.h"
-#include "../../../../src/server/protocol2/champ_chooser/candidate.h"
 #include "../../../../src/server/protocol2/champ_chooser/sparse.h"
 
 static void tear_down(void)
@@ -12,7 +11,7 @@ START_TEST(test_sparse_add_alloc_error)
 {
 	uint64_t f0=0xFF11223344556699;
 	alloc_errors=1;
-	fail_unless(sparse_add_candidate(&f0, NULL)==-1);
+	fail_unless(sparse_add_candidate(&f0, 0)==-1);
 	tear_down();
 }
 END_TEST
@@ -21,18 +20,14 @@ START_TEST(test_sparse_add_one)
 {
 	struct sparse *sparse;
 	uint64_t f=0xFF11223344556677;
-	struct candidate *candidate;
 
-	fail_unless((candidate=candidate_alloc())!=NULL);
-	fail_unless(!sparse_add_candidate(&f, candidate));
+	fail_unless(!sparse_add_candidate(&f, 1));
 
 	fail_unless((sparse=sparse_find(&f))!=NULL);
 	fail_unless(sparse->size==1);
-	fail_unless(sparse->candidates[0]==candidate);
+	fail_unless(sparse->candidates[0]==1);
 
 	sparse_delete_all();
-	candidate_free(&candidate);
-	fail_unless(!candidate);
 	tear_down();
 }
 END_TEST
@@ -43,43 +38,35 @@ START_TEST(test_sparse_add_many)
 	uint64_t f0=0xFF11223344556699;
 	uint64_t f1=0xFF11223344556677;
 	uint64_t f2=0xFF11223344556688;
-	struct candidate *candidate1;
-	struct candidate *candidate2;
-	struct candidate *candidate3;
-	struct candidate *candidate4;
-	struct candidate *candidate5;
-
-	fail_unless((candidate1=candidate_alloc())!=NULL);
-	fail_unless((candidate2=candidate_alloc())!=NULL);
-	fail_unless((candidate3=candidate_alloc())!=NULL);
-	fail_unless((candidate4=candidate_alloc())!=NULL);
-	fail_unless((candidate5=candidate_alloc())!=NULL);
-	fail_unless(!sparse_add_candidate(&f1, candidate1));
-	fail_unless(!sparse_add_candidate(&f1, candidate1));
-	fail_unless(!sparse_add_candidate(&f1, candidate2));
-	fail_unless(!sparse_add_candidate(&f2, candidate3));
-	fail_unless(!sparse_add_candidate(&f2, candidate4));
-	fail_unless(!sparse_add_candidate(&f2, candidate5)); // Try same again. 
+	// Same bottom half as f1.
+	uint64_t f3=0xEE11223344556677;
+
+	fail_unless(!sparse_add_candidate(&f1, 1));
+	fail_unless(!sparse_add_candidate(&f1, 1));
+	fail_unless(!sparse_add_candidate(&f1, 2));
+	fail_unless(!sparse_add_candidate(&f2, 3));
+	fail_unless(!sparse_add_candidate(&f2, 4));
+	fail_unless(!sparse_add_candidate(&f2, 5)); // Try same again. 
 
 	fail_unless((sparse=sparse_find(&f0))==NULL);
+	fail_unless((sparse=sparse_find(&f3))==NULL);
 
 	fail_unless((sparse=sparse_find(&f1))!=NULL);
 	fail_unless(sparse->size==2);
-	fail_unless(sparse->candidates[0]==candidate1);
-	fail_unless(sparse->candidates[1]==candidate2);
+	fail_unless(sparse->candidates[0]==1);
+	fail_unless(sparse->candidates[1]==2);
 
 	fail_unless((sparse=sparse_find(&f2))!=NULL);
 	fail_unless(sparse->size==3);
-	fail_unless(sparse->candidates[0]==candidate3);
-	fail_unless(sparse->candidates[1]==candidate4);
-	fail_unless(sparse->candidates[2]==candidate5);
+	fail_unless(sparse->candidates[0]==3);
+	fail_unless(sparse->candidates[1]==4);
+	fail_unless(sparse->candidates[2]==5);
+
+	sparse_delete_fresh_candidate(5);
+	fail_unless((sparse=sparse_find(&f2))!=NULL);
+	fail_unless(sparse->size==2);
 
 	sparse_delete_all();
-	candidate_free(&candidate1);
-	candidate_free(&candidate2);
-	candidate_free(&candidate3);
-	candidate_free(&candidate4);
-	candidate_free(&candidate5);
 	tear_down();
 }
 END_TEST
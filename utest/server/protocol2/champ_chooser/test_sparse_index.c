@@ -0,0 +1,213 @@
+#include "../../../test.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/cmd.h"
+#include "../../../../src/fsops.h"
+#include "../../../../src/fzp.h"
+#include "../../../../src/hexmap.h"
+#include "../../../../src/protocol2/blk.h"
+#include "../../../../src/server/protocol2/champ_chooser/candidate.h"
+#include "../../../../src/server/protocol2/champ_chooser/scores.h"
+#include "../../../../src/server/protocol2/champ_chooser/sparse.h"
+#include "../../../../src/server/protocol2/champ_chooser/sparse_index.h"
+#include "../../../builders/build_file.h"
+
+#define BASE	"utest_server_protocol2_champ_chooser_sparse_index"
+#define SPARSE	BASE "/sparse"
+#define INDEX	SPARSE ".idx"
+
+#define MANIFESTS	10
+#define HOOKS		40
+
+static uint64_t hook(int h)
+{
+	return 0xF000000000000000ULL|((uint64_t)h*0x10001);
+}
+
+// Manifest m has hook h if h is a multiple of m+1, so that some hooks are
+// in many manifests. Each manifest also repeats its first hook.
+static int has_hook(int m, int h)
+{
+	return !(h%(m+1));
+}
+
+static void build_sparse(void)
+{
+	int m;
+	int h;
+	struct fzp *fzp;
+	fail_unless(!build_path_w(SPARSE));
+	fail_unless((fzp=fzp_gzopen(SPARSE, "wb"))!=NULL);
+	for(m=0; m<MANIFESTS; m++)
+	{
+		char mpath[256];
+		snprintf(mpath, sizeof(mpath), "some/manifest/%d", m);
+		fzp_printf(fzp, "%c%04lX%s\n",
+			CMD_MANIFEST, strlen(mpath), mpath);
+		for(h=0; h<HOOKS; h++)
+		{
+			if(!has_hook(m, h))
+				continue;
+			fail_unless(!to_fzp_fingerprint(fzp, hook(h)));
+		}
+		fail_unless(!to_fzp_fingerprint(fzp, hook(0)));
+	}
+	fail_unless(!fzp_close(&fzp));
+}
+
+static void setup(void)
+{
+	hexmap_init();
+	fail_unless(!recursive_delete(BASE));
+	build_sparse();
+}
+
+static void tear_down(void)
+{
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static void check_loaded(void)
+{
+	int m;
+	int h;
+	size_t s;
+	uint64_t f;
+	struct sparse *sparse;
+	fail_unless(candidates_len==MANIFESTS);
+	for(m=0; m<MANIFESTS; m++)
+	{
+		char mpath[256];
+		snprintf(mpath, sizeof(mpath), "some/manifest/%d", m);
+		fail_unless(!strcmp(candidates[m]->path, mpath));
+	}
+	for(h=0; h<HOOKS; h++)
+	{
+		f=hook(h);
+		fail_unless((sparse=sparse_find(&f))!=NULL);
+		for(m=0, s=0; m<MANIFESTS; m++)
+		{
+			if(!has_hook(m, h))
+				continue;
+			fail_unless(s<sparse->size);
+			fail_unless(sparse->candidates[s++]==(uint32_t)m);
+		}
+		fail_unless(s==sparse->size);
+	}
+	f=hook(HOOKS);
+	fail_unless(sparse_find(&f)==NULL);
+}
+
+START_TEST(test_sparse_index_same_as_gzip)
+{
+	struct scores *scores;
+	struct sparse_index *si;
+	setup();
+	fail_unless((scores=scores_alloc())!=NULL);
+
+	fail_unless(candidate_load(NULL, SPARSE, scores)==CAND_RET_OK);
+	check_loaded();
+	candidates_free();
+	sparse_delete_all();
+
+	fail_unless(!sparse_index_write(SPARSE));
+	fail_unless((si=sparse_index_open(SPARSE))!=NULL);
+	fail_unless(!candidates_load_index(si, scores));
+	check_loaded();
+	candidates_free();
+	sparse_delete_all();
+
+	scores_free(&scores);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_sparse_index_fresh_candidate)
+{
+	uint64_t f=hook(0);
+	struct scores *scores;
+	struct sparse *sparse;
+	struct sparse_index *si;
+	setup();
+	fail_unless((scores=scores_alloc())!=NULL);
+	fail_unless(!sparse_index_write(SPARSE));
+	fail_unless((si=sparse_index_open(SPARSE))!=NULL);
+	fail_unless(!candidates_load_index(si, scores));
+
+	// Adding to a mapped hook keeps the mapped candidates first.
+	fail_unless(!sparse_add_candidate(&f, MANIFESTS));
+	fail_unless((sparse=sparse_find(&f))!=NULL);
+	fail_unless(sparse->size==MANIFESTS+1);
+	fail_unless(sparse->candidates[0]==0);
+	fail_unless(sparse->candidates[MANIFESTS]==MANIFESTS);
+	sparse_delete_fresh_candidate(MANIFESTS);
+	fail_unless((sparse=sparse_find(&f))!=NULL);
+	fail_unless(sparse->size==MANIFESTS);
+
+	candidates_free();
+	sparse_delete_all();
+	scores_free(&scores);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_sparse_index_out_of_date)
+{
+	struct fzp *fzp;
+	setup();
+	fail_unless(!sparse_index_write(SPARSE));
+	// Rewriting the gzipped index gives it a new inode.
+	fail_unless(!do_rename(SPARSE, BASE "/moved"));
+	build_sparse();
+	fail_unless((fzp=fzp_gzopen(SPARSE, "ab"))!=NULL);
+	fail_unless(!to_fzp_fingerprint(fzp, hook(HOOKS)));
+	fail_unless(!fzp_close(&fzp));
+	fail_unless(sparse_index_open(SPARSE)==NULL);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_sparse_index_corrupt)
+{
+	struct fzp *fzp;
+	setup();
+	fail_unless(!sparse_index_write(SPARSE));
+	fail_unless((fzp=fzp_open(INDEX, "r+b"))!=NULL);
+	fail_unless(!fzp_seek(fzp, 0, SEEK_SET));
+	fail_unless(fzp_write(fzp, "x", 1)==1);
+	fail_unless(!fzp_close(&fzp));
+	fail_unless(sparse_index_open(SPARSE)==NULL);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_sparse_index_no_sparse)
+{
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!build_path_w(INDEX));
+	build_file(INDEX, "stale");
+	fail_unless(!sparse_index_write(SPARSE));
+	fail_unless(is_reg_lstat(INDEX)<0);
+	fail_unless(sparse_index_open(SPARSE)==NULL);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_sparse_index(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_sparse_index");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_sparse_index_same_as_gzip);
+	tcase_add_test(tc_core, test_sparse_index_fresh_candidate);
+	tcase_add_test(tc_core, test_sparse_index_out_of_date);
+	tcase_add_test(tc_core, test_sparse_index_corrupt);
+	tcase_add_test(tc_core, test_sparse_index_no_sparse);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -9,6 +9,7 @@
 #include "../../../src/protocol2/blk.h"
 #include "../../../src/server/manio.h"
 #include "../../../src/server/protocol2/backup_phase4.h"
+#include "../../../src/server/protocol2/dindex_file.h"
 
 #define PATH	"utest_merge"
 
@@ -115,10 +116,11 @@ static void check_result(struct sp *sp, size_t splen)
 static void common(struct sp *dst, size_t dlen,
 	struct sp *srca, size_t alen, struct sp *srcb, size_t blen)
 {
+	const char *srcs[2]={srca_path, srcb_path};
 	setup();
 	build_sparse_index(srca, alen, srca_path);
 	build_sparse_index(srcb, blen, srcb_path);
-	fail_unless(!merge_sparse_indexes(dst_path, srca_path, srcb_path));
+	fail_unless(!merge_sparse_indexes(dst_path, srcs, 2));
 	check_result(dst, dlen);
 	tear_down();
 }
@@ -238,39 +240,29 @@ static void check_result_di(uint64_t *di, size_t dlen)
 {
 	int ret;
 	size_t i=0;
-	struct fzp *fzp;
-	struct blk blk;
-	struct iobuf rbuf;
-	memset(&rbuf, 0, sizeof(struct iobuf));
+	uint64_t savepath;
+	struct dindex_file *df;
 	fail_unless(dlen>0);
-	fail_unless((fzp=fzp_gzopen(dst_path, "rb"))!=NULL);
+	fail_unless((df=dindex_file_open(dst_path, "rb"))!=NULL);
 
-	while(!(ret=iobuf_fill_from_fzp(&rbuf, fzp)))
+	while(!(ret=dindex_file_read(df, &savepath)))
 	{
-		switch(rbuf.cmd)
-		{
-			case CMD_SAVE_PATH:
-				blk_set_from_iobuf_savepath(&blk, &rbuf);
-				fail_unless(blk.savepath==di[i++]);
-				break;
-			default:
-				fail_unless(0==1);
-		}
-		iobuf_free_content(&rbuf);
+		fail_unless(i<dlen);
+		fail_unless(savepath==di[i++]);
 	}
-	fail_unless(!fzp_close(&fzp));
+	fail_unless(!dindex_file_close(&df));
 	fail_unless(ret==1);
 	fail_unless(i==dlen);
-	iobuf_free_content(&rbuf);
 }
 
 static void common_di(uint64_t *dst, size_t dlen,
 	uint64_t *srca, size_t alen, uint64_t *srcb, size_t blen)
 {
+	const char *srcs[2]={srca_path, srcb_path};
 	setup();
 	build_dindex(srca, alen, srca_path);
 	build_dindex(srcb, blen, srcb_path);
-	fail_unless(!merge_dindexes(dst_path, srca_path, srcb_path));
+	fail_unless(!merge_dindexes(dst_path, srcs, 2));
 	check_result_di(dst, dlen);
 	tear_down();
 }
@@ -338,167 +330,59 @@ static void make_file_for_rename(const char *path)
 
 static int calls;
 static int max_calls;
+static uint64_t expect_fcount;
 
-static int merge_callback_0(const char *dst, const char *srca, const char *srcb)
+static int merge_callback_0(const char *dst, const char **srcs, int count)
 {
 	fail_unless(0==1);
 	return 0;
 }
 
-static int merge_callback_1(const char *dst, const char *srca, const char *srcb)
-{
-	calls++;
-	ck_assert_str_eq(srca, "utest_merge/f/sd/00000000");
-	fail_unless(srcb==NULL);
-	ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-	make_file_for_rename(PATH "/f/m1/00000000");
-	return 0;
-}
-
-static int merge_callback_2(const char *dst, const char *srca, const char *srcb)
-{
-	calls++;
-	ck_assert_str_eq(srca, "utest_merge/f/sd/00000000");
-	ck_assert_str_eq(srcb, "utest_merge/f/sd/00000001");
-	ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-	make_file_for_rename(PATH "/f/m1/00000000");
-	return 0;
-}
-
-static int merge_callback_3(const char *dst, const char *srca, const char *srcb)
+static void check_srcs(const char *dir, uint64_t start,
+	const char **srcs, int count)
 {
-	calls++;
-	switch(calls)
+	int i;
+	char expect[64];
+	for(i=0; i<count; i++)
 	{
-		case 1:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-			break;
-		case 2:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000002");
-			fail_unless(srcb==NULL);
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000001");
-			break;
-		case 3:
-			ck_assert_str_eq(srca, "utest_merge/f/m1/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/m1/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m2/00000000");
-			make_file_for_rename(PATH "/f/m2/00000000");
-			break;
-		
+		snprintf(expect, sizeof(expect),
+			"%s/%08" PRIX64, dir, start+i);
+		ck_assert_str_eq(srcs[i], expect);
 	}
-	return 0;
 }
 
-static int merge_callback_4(const char *dst, const char *srca, const char *srcb)
+// Checks the merges of the first pass from the source directory, and the
+// final merge.
+static int merge_callback(const char *dst, const char **srcs, int count)
 {
+	char expect[64];
+	uint64_t first_pass;
 	calls++;
-	switch(calls)
+	first_pass=(expect_fcount+MERGE_FAN_IN-1)/MERGE_FAN_IN;
+	if((uint64_t)calls<=first_pass)
 	{
-		case 1:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-			break;
-		case 2:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000002");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000003");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000001");
-			break;
-		case 3:
-			ck_assert_str_eq(srca, "utest_merge/f/m1/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/m1/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m2/00000000");
-			make_file_for_rename(PATH "/f/m2/00000000");
-			break;
-		
+		uint64_t start=(calls-1)*MERGE_FAN_IN;
+		fail_unless((uint64_t)count==expect_fcount-start
+			|| count==MERGE_FAN_IN);
+		check_srcs(PATH "/f/sd", start, srcs, count);
+		snprintf(expect, sizeof(expect),
+			PATH "/f/m1/%08X", calls-1);
+		ck_assert_str_eq(dst, expect);
 	}
-	return 0;
-}
-
-static int merge_callback_5(const char *dst, const char *srca, const char *srcb)
-{
-	calls++;
-	switch(calls)
+	else
 	{
-		case 1:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-			break;
-		case 2:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000002");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000003");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000001");
-			break;
-		case 3:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000004");
-			fail_unless(srcb==NULL);
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000002");
-			break;
-		case 4:
-			ck_assert_str_eq(srca, "utest_merge/f/m1/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/m1/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m2/00000000");
-			break;
-		case 5:
-			ck_assert_str_eq(srca, "utest_merge/f/m1/00000002");
-			fail_unless(srcb==NULL);
-			ck_assert_str_eq(dst,  "utest_merge/f/m2/00000001");
-			break;
-		case 6:
-			ck_assert_str_eq(srca, "utest_merge/f/m2/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/m2/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-			make_file_for_rename(PATH "/f/m1/00000000");
-			break;
-	}
-	return 0;
-}
-
-static int merge_callback_6(const char *dst, const char *srca, const char *srcb)
-{
-	calls++;
-	switch(calls)
-	{
-		case 1:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-			break;
-		case 2:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000002");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000003");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000001");
-			break;
-		case 3:
-			ck_assert_str_eq(srca, "utest_merge/f/sd/00000004");
-			ck_assert_str_eq(srcb, "utest_merge/f/sd/00000005");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000002");
-			break;
-		case 4:
-			ck_assert_str_eq(srca, "utest_merge/f/m1/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/m1/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m2/00000000");
-			break;
-		case 5:
-			ck_assert_str_eq(srca, "utest_merge/f/m1/00000002");
-			fail_unless(srcb==NULL);
-			ck_assert_str_eq(dst,  "utest_merge/f/m2/00000001");
-			break;
-		case 6:
-			ck_assert_str_eq(srca, "utest_merge/f/m2/00000000");
-			ck_assert_str_eq(srcb, "utest_merge/f/m2/00000001");
-			ck_assert_str_eq(dst,  "utest_merge/f/m1/00000000");
-			make_file_for_rename(PATH "/f/m1/00000000");
-			break;
+		// All the output of the first pass goes into the second.
+		fail_unless((uint64_t)count==first_pass);
+		check_srcs(PATH "/f/m1", 0, srcs, count);
+		ck_assert_str_eq(dst, PATH "/f/m2/00000000");
 	}
+	if(calls==max_calls)
+		make_file_for_rename(dst);
 	return 0;
 }
 
 static void merge_common(uint64_t fcount, int set_max_calls,
-	int merge_callback(const char *dst, const char *srca, const char *srcb))
+	int merge_callback(const char *dst, const char **srcs, int count))
 {
 	int r;
 	const char *final=PATH "/dst";
@@ -508,6 +392,7 @@ static void merge_common(uint64_t fcount, int set_max_calls,
 
 	calls=0;
 	max_calls=set_max_calls;
+	expect_fcount=fcount;
 	r=merge_files_in_dir(final, fmanifest, srcdir, fcount, merge_callback);
 	fail_unless(r==0);
 	fail_unless(calls==max_calls);
@@ -518,12 +403,41 @@ START_TEST(test_merge_files_in_dir)
 {
 	// fcount, set_max_calls, merge_callback
 	merge_common(0, 0, merge_callback_0);
-	merge_common(1, 1, merge_callback_1);
-	merge_common(2, 1, merge_callback_2);
-	merge_common(3, 3, merge_callback_3);
-	merge_common(4, 3, merge_callback_4);
-	merge_common(5, 6, merge_callback_5);
-	merge_common(6, 6, merge_callback_6);
+	merge_common(1, 1, merge_callback);
+	merge_common(2, 1, merge_callback);
+	merge_common(6, 1, merge_callback);
+	merge_common(MERGE_FAN_IN, 1, merge_callback);
+	merge_common(MERGE_FAN_IN+1, 3, merge_callback);
+	merge_common(MERGE_FAN_IN*2+5, 4, merge_callback);
+}
+END_TEST
+
+static uint64_t din5[3]={
+	0x0000000011110000,
+	0x1111222233350000,
+	0xFFFFFFFFFFFF0000
+};
+
+// More than two sources at once, with some missing.
+START_TEST(test_merge_dindexes_many)
+{
+	const char *srcc_path=PATH "/srcc";
+	const char *srcs[5]={srca_path, NULL, srcb_path, srcc_path, NULL};
+	uint64_t ex[6]={
+		0x0000000011110000,
+		0x1111222233330000,
+		0x1111222233350000,
+		0x1111222244440000,
+		0x123456789ABC0000,
+		0xFFFFFFFFFFFF0000
+	};
+	setup();
+	build_dindex(din1, ARR_LEN(din1), srca_path);
+	build_dindex(din3, ARR_LEN(din3), srcb_path);
+	build_dindex(din5, ARR_LEN(din5), srcc_path);
+	fail_unless(!merge_dindexes(dst_path, srcs, ARR_LEN(srcs)));
+	check_result_di(ex, ARR_LEN(ex));
+	tear_down();
 }
 END_TEST
 
@@ -544,6 +458,7 @@ Suite *suite_server_protocol2_backup_phase4(void)
 	tcase_add_test(tc_core, test_merge_sparse_indexes_different_lengths2);
 
 	tcase_add_test(tc_core, test_merge_dindexes_simple1);
+	tcase_add_test(tc_core, test_merge_dindexes_many);
 
 	tcase_add_test(tc_core, test_merge_files_in_dir);
 	suite_add_tcase(s, tc_core);
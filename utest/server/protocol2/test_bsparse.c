@@ -8,6 +8,7 @@
 #include "../../../src/server/protocol2/backup_phase4.h"
 #include "../../../src/server/protocol2/bsparse.h"
 #include "../../../src/server/protocol2/champ_chooser/champ_chooser.h"
+#include "../../../src/server/protocol2/champ_chooser/sparse_index.h"
 #include "../../../src/server/sdirs.h"
 #include "../../builders/build.h"
 #include "../../builders/build_file.h"
@@ -234,10 +235,14 @@ START_TEST(test_bsparse_run)
 {
 	const char *cnames[] = {"cli1", "cli2", "cli3", NULL};
 	const char *argv[]={"utest", "-c", GLOBAL_CONF, BASE "/a_group" };
+	struct sparse_index *si;
 
 	sparse_setup(cnames);
 	fail_unless(run_bsparse(ARR_LEN(argv), (char **)argv)==0);
 	check_global_sparse(cnames);
+	fail_unless((si=sparse_index_open(BASE "/a_group/data/sparse"))!=NULL);
+	fail_unless(sparse_index_candidates(si)==FLEN*(ARR_LEN(cnames)-1));
+	sparse_index_close(&si);
 
 	tear_down();
 }
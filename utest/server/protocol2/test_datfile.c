@@ -0,0 +1,177 @@
+#include "../../test.h"
+#include "../../../src/alloc.h"
+#include "../../../src/cmd.h"
+#include "../../../src/fsops.h"
+#include "../../../src/fzp.h"
+#include "../../../src/server/protocol2/datfile.h"
+
+#define BASE		"utest_datfile"
+#define DATAFILE	BASE "/0000"
+
+static void setup(void)
+{
+	fail_unless(recursive_delete(BASE)==0);
+	fail_unless(!build_path_w(DATAFILE));
+}
+
+static void tear_down(void)
+{
+	fail_unless(recursive_delete(BASE)==0);
+	alloc_check();
+}
+
+static void fill(char *buf, int i, size_t len)
+{
+	memset(buf, i&0xFF, len);
+}
+
+static void write_indexed(int blocks)
+{
+	int i;
+	char buf[64];
+	struct fzp *fzp;
+	struct datfile_index *index;
+	fail_unless((index=(struct datfile_index *)
+		calloc_w(1, sizeof(*index), __func__))!=NULL);
+	fail_unless((fzp=fzp_open(DATAFILE, "wb"))!=NULL);
+	for(i=0; i<blocks; i++)
+	{
+		fill(buf, i, i%sizeof(buf));
+		fail_unless(!datfile_write_blk(fzp, index, buf, i%sizeof(buf)));
+	}
+	fail_unless(!datfile_write_index(fzp, index));
+	fail_unless(!fzp_close(&fzp));
+	free_v((void **)&index);
+}
+
+// The format written before there was an index on the end.
+static void write_old_format(int blocks)
+{
+	int i;
+	char buf[64];
+	struct fzp *fzp;
+	fail_unless((fzp=fzp_open(DATAFILE, "wb"))!=NULL);
+	for(i=0; i<blocks; i++)
+	{
+		fill(buf, i, i%sizeof(buf));
+		fail_unless(fzp_printf(fzp, "%c%04X",
+			CMD_DATA, (unsigned int)(i%sizeof(buf)))==5);
+		fail_unless(fzp_write(fzp, buf, i%sizeof(buf))==i%sizeof(buf));
+	}
+	fail_unless(!fzp_close(&fzp));
+}
+
+static void check_blocks(int blocks)
+{
+	int i;
+	char *data;
+	size_t len;
+	char buf[64];
+	struct datfile *datfile;
+	fail_unless((datfile=datfile_open(DATAFILE))!=NULL);
+	for(i=0; i<blocks; i++)
+	{
+		fill(buf, i, i%sizeof(buf));
+		fail_unless(!datfile_get(datfile, i, &data, &len));
+		fail_unless(len==i%sizeof(buf));
+		fail_unless(!memcmp(data, buf, len));
+	}
+	fail_unless(datfile_get(datfile, blocks, &data, &len)==-1);
+	datfile_close(&datfile);
+	fail_unless(datfile==NULL);
+}
+
+START_TEST(test_datfile_indexed)
+{
+	setup();
+	write_indexed(100);
+	check_blocks(100);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_datfile_indexed_full)
+{
+	setup();
+	write_indexed(DATA_FILE_SIG_MAX);
+	check_blocks(DATA_FILE_SIG_MAX);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_datfile_indexed_too_many)
+{
+	char buf[1]={'a'};
+	struct fzp *fzp;
+	struct datfile_index *index;
+	setup();
+	fail_unless((index=(struct datfile_index *)
+		calloc_w(1, sizeof(*index), __func__))!=NULL);
+	fail_unless((fzp=fzp_open(DATAFILE, "wb"))!=NULL);
+	index->count=DATA_FILE_SIG_MAX;
+	fail_unless(datfile_write_blk(fzp, index, buf, sizeof(buf))==-1);
+	fzp_close(&fzp);
+	free_v((void **)&index);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_datfile_old_format)
+{
+	setup();
+	write_old_format(100);
+	check_blocks(100);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_datfile_empty)
+{
+	setup();
+	write_old_format(0);
+	check_blocks(0);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_datfile_missing)
+{
+	setup();
+	fail_unless(datfile_open(DATAFILE)==NULL);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_datfile_corrupt)
+{
+	struct fzp *fzp;
+	setup();
+	fail_unless((fzp=fzp_open(DATAFILE, "wb"))!=NULL);
+	fail_unless(fzp_printf(fzp, "%c%04X", CMD_FILE, 1)==5);
+	fail_unless(fzp_write(fzp, "a", 1)==1);
+	fail_unless(!fzp_close(&fzp));
+	fail_unless(datfile_open(DATAFILE)==NULL);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_protocol2_datfile(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_datfile");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_datfile_indexed);
+	tcase_add_test(tc_core, test_datfile_indexed_full);
+	tcase_add_test(tc_core, test_datfile_indexed_too_many);
+	tcase_add_test(tc_core, test_datfile_old_format);
+	tcase_add_test(tc_core, test_datfile_empty);
+	tcase_add_test(tc_core, test_datfile_missing);
+	tcase_add_test(tc_core, test_datfile_corrupt);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -0,0 +1,217 @@
+#include "../../test.h"
+#include "../../../src/alloc.h"
+#include "../../../src/fsops.h"
+#include "../../../src/fzp.h"
+#include "../../../src/iobuf.h"
+#include "../../../src/protocol2/blk.h"
+#include "../../../src/server/protocol2/dindex_file.h"
+
+#define BASE		"utest_dindex_file"
+#define DINDEX		BASE "/dindex"
+
+static void setup(void)
+{
+	fail_unless(recursive_delete(BASE)==0);
+	fail_unless(!build_path_w(DINDEX));
+}
+
+static void tear_down(void)
+{
+	fail_unless(recursive_delete(BASE)==0);
+	alloc_check();
+}
+
+static uint64_t savepath_for(int i)
+{
+	// Like the real thing, the bottom 16 bits are clear.
+	return ((uint64_t)i*7+0x0001000200000000ULL)<<16;
+}
+
+static void write_savepaths(int count)
+{
+	int i;
+	struct dindex_file *df;
+	fail_unless((df=dindex_file_open(DINDEX, "wb"))!=NULL);
+	for(i=0; i<count; i++)
+		fail_unless(!dindex_file_write(df, savepath_for(i)));
+	fail_unless(!dindex_file_close(&df));
+}
+
+static void check_savepaths(int count)
+{
+	int i=0;
+	int ret;
+	uint64_t savepath;
+	struct dindex_file *df;
+	fail_unless((df=dindex_file_open(DINDEX, "rb"))!=NULL);
+	while(!(ret=dindex_file_read(df, &savepath)))
+	{
+		fail_unless(i<count);
+		fail_unless(savepath==savepath_for(i++));
+	}
+	fail_unless(ret==1);
+	fail_unless(i==count);
+	// Stays finished.
+	fail_unless(dindex_file_read(df, &savepath)==1);
+	fail_unless(!dindex_file_close(&df));
+}
+
+static void do_test_round_trip(int count)
+{
+	setup();
+	write_savepaths(count);
+	check_savepaths(count);
+	tear_down();
+}
+
+START_TEST(test_dindex_file_round_trip)
+{
+	do_test_round_trip(0);
+	do_test_round_trip(1);
+	do_test_round_trip(1023);
+	do_test_round_trip(1024);
+	do_test_round_trip(1025);
+	do_test_round_trip(5000);
+}
+END_TEST
+
+START_TEST(test_dindex_file_duplicates)
+{
+	struct dindex_file *df;
+	setup();
+	fail_unless((df=dindex_file_open(DINDEX, "wb"))!=NULL);
+	fail_unless(!dindex_file_write(df, savepath_for(0)));
+	fail_unless(!dindex_file_write(df, savepath_for(0)));
+	fail_unless(!dindex_file_write(df, savepath_for(1)));
+	fail_unless(!dindex_file_write(df, savepath_for(1)));
+	fail_unless(!dindex_file_close(&df));
+	check_savepaths(2);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_dindex_file_out_of_order)
+{
+	struct dindex_file *df;
+	setup();
+	fail_unless((df=dindex_file_open(DINDEX, "wb"))!=NULL);
+	fail_unless(!dindex_file_write(df, savepath_for(1)));
+	fail_unless(dindex_file_write(df, savepath_for(0))==-1);
+	fail_unless(!dindex_file_close(&df));
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_dindex_file_unshifted)
+{
+	int ret;
+	uint64_t savepath;
+	struct dindex_file *df;
+	setup();
+	fail_unless((df=dindex_file_open(DINDEX, "wb"))!=NULL);
+	fail_unless(!dindex_file_write(df, 1));
+	fail_unless(!dindex_file_write(df, 0xFFFFFFFFFFFFFFFFULL));
+	fail_unless(!dindex_file_close(&df));
+	fail_unless((df=dindex_file_open(DINDEX, "rb"))!=NULL);
+	fail_unless(!dindex_file_read(df, &savepath));
+	fail_unless(savepath==1);
+	fail_unless(!dindex_file_read(df, &savepath));
+	fail_unless(savepath==0xFFFFFFFFFFFFFFFFULL);
+	fail_unless((ret=dindex_file_read(df, &savepath))==1);
+	fail_unless(!dindex_file_close(&df));
+	tear_down();
+}
+END_TEST
+
+// The gzipped text format written by older versions.
+START_TEST(test_dindex_file_legacy)
+{
+	int i;
+	struct blk blk;
+	struct fzp *fzp;
+	struct iobuf wbuf;
+	setup();
+	fail_unless((fzp=fzp_gzopen(DINDEX, "wb"))!=NULL);
+	for(i=0; i<100; i++)
+	{
+		blk.savepath=savepath_for(i);
+		blk_to_iobuf_savepath(&blk, &wbuf);
+		fail_unless(!iobuf_send_msg_fzp(&wbuf, fzp));
+	}
+	fail_unless(!fzp_close(&fzp));
+	check_savepaths(100);
+	tear_down();
+}
+END_TEST
+
+static void corrupt_byte(long offset)
+{
+	char c;
+	struct fzp *fzp;
+	fail_unless((fzp=fzp_open(DINDEX, "r+b"))!=NULL);
+	fail_unless(!fzp_seek(fzp, offset, SEEK_SET));
+	fail_unless(fzp_read(fzp, &c, 1)==1);
+	c^=0x01;
+	fail_unless(!fzp_seek(fzp, offset, SEEK_SET));
+	fail_unless(fzp_write(fzp, &c, 1)==1);
+	fail_unless(!fzp_close(&fzp));
+}
+
+static void check_read_fails(int count)
+{
+	int i=0;
+	int ret;
+	uint64_t savepath;
+	struct dindex_file *df;
+	fail_unless((df=dindex_file_open(DINDEX, "rb"))!=NULL);
+	while(!(ret=dindex_file_read(df, &savepath)))
+		i++;
+	fail_unless(ret==-1);
+	fail_unless(i==count);
+	fail_unless(!dindex_file_close(&df));
+}
+
+START_TEST(test_dindex_file_bad_checksum)
+{
+	setup();
+	write_savepaths(2000);
+	// A byte in the payload of the first block.
+	corrupt_byte(8+13+5);
+	check_read_fails(0);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_dindex_file_truncated)
+{
+	struct stat statp;
+	setup();
+	write_savepaths(2000);
+	fail_unless(!lstat(DINDEX, &statp));
+	// Chop off the end marker.
+	fail_unless(!truncate(DINDEX, statp.st_size-13));
+	check_read_fails(2000);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_protocol2_dindex_file(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_dindex_file");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_dindex_file_round_trip);
+	tcase_add_test(tc_core, test_dindex_file_duplicates);
+	tcase_add_test(tc_core, test_dindex_file_out_of_order);
+	tcase_add_test(tc_core, test_dindex_file_unshifted);
+	tcase_add_test(tc_core, test_dindex_file_legacy);
+	tcase_add_test(tc_core, test_dindex_file_bad_checksum);
+	tcase_add_test(tc_core, test_dindex_file_truncated);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
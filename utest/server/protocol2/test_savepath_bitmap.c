@@ -0,0 +1,184 @@
+#include "../../test.h"
+#include "../../../src/alloc.h"
+#include "../../../src/fsops.h"
+#include "../../../src/server/protocol2/savepath_bitmap.h"
+
+#define BASE		"utest_savepath_bitmap"
+#define DINDEX		BASE "/dindex"
+
+static void tear_down(struct savepath_bitmap **a, struct savepath_bitmap **b)
+{
+	savepath_bitmap_free(a);
+	savepath_bitmap_free(b);
+	fail_unless(recursive_delete(BASE)==0);
+	alloc_check();
+}
+
+static uint64_t savepath_for(uint16_t c0, uint16_t c1, uint16_t c2)
+{
+	return ((uint64_t)c0<<48)|((uint64_t)c1<<32)|((uint64_t)c2<<16);
+}
+
+struct collected
+{
+	uint64_t *savepaths;
+	size_t len;
+	size_t max;
+};
+
+static int collect(uint64_t savepath, void *data)
+{
+	struct collected *c=(struct collected *)data;
+	fail_unless(c->len<c->max);
+	c->savepaths[c->len++]=savepath;
+	return 0;
+}
+
+// Adds every step'th value of the third component.
+static void add_range(struct savepath_bitmap *sb,
+	uint16_t c0, uint16_t c1, int step)
+{
+	int c2;
+	for(c2=0; c2<65536; c2+=step)
+		fail_unless(!savepath_bitmap_add(sb,
+			savepath_for(c0, c1, (uint16_t)c2)));
+}
+
+START_TEST(test_savepath_bitmap_add_and_contains)
+{
+	struct savepath_bitmap *sb;
+	fail_unless((sb=savepath_bitmap_alloc())!=NULL);
+	fail_unless(!savepath_bitmap_add(sb, savepath_for(1, 2, 3)));
+	fail_unless(!savepath_bitmap_add(sb, savepath_for(1, 2, 3)));
+	// The block number is ignored.
+	fail_unless(!savepath_bitmap_add(sb, savepath_for(1, 2, 3)|0x1234));
+	fail_unless(!savepath_bitmap_add(sb, savepath_for(0, 9, 9)));
+	fail_unless(savepath_bitmap_count(sb)==2);
+	fail_unless(savepath_bitmap_contains(sb, savepath_for(1, 2, 3)));
+	fail_unless(savepath_bitmap_contains(sb, savepath_for(0, 9, 9)));
+	fail_unless(!savepath_bitmap_contains(sb, savepath_for(1, 2, 4)));
+	fail_unless(!savepath_bitmap_contains(sb, savepath_for(1, 3, 3)));
+	tear_down(&sb, NULL);
+}
+END_TEST
+
+START_TEST(test_savepath_bitmap_dense)
+{
+	struct savepath_bitmap *sb;
+	fail_unless((sb=savepath_bitmap_alloc())!=NULL);
+	// Enough to need converting from an array to a bitmap.
+	add_range(sb, 5, 5, 3);
+	fail_unless(savepath_bitmap_count(sb)==21846);
+	fail_unless(savepath_bitmap_contains(sb, savepath_for(5, 5, 0)));
+	fail_unless(savepath_bitmap_contains(sb, savepath_for(5, 5, 65535)));
+	fail_unless(!savepath_bitmap_contains(sb, savepath_for(5, 5, 1)));
+	tear_down(&sb, NULL);
+}
+END_TEST
+
+static void check_or(int astep, int bstep)
+{
+	int c2;
+	uint64_t count=0;
+	struct savepath_bitmap *a;
+	struct savepath_bitmap *b;
+	fail_unless((a=savepath_bitmap_alloc())!=NULL);
+	fail_unless((b=savepath_bitmap_alloc())!=NULL);
+	add_range(a, 1, 1, astep);
+	add_range(b, 1, 1, bstep);
+	add_range(b, 2, 0, bstep);
+	fail_unless(!savepath_bitmap_or(a, b));
+	for(c2=0; c2<65536; c2++)
+	{
+		int want=!(c2%astep) || !(c2%bstep);
+		fail_unless(savepath_bitmap_contains(a,
+			savepath_for(1, 1, (uint16_t)c2))==want);
+		count+=want;
+		count+=!(c2%bstep);
+	}
+	fail_unless(savepath_bitmap_count(a)==count);
+	fail_unless(savepath_bitmap_contains(a, savepath_for(2, 0, 0)));
+	tear_down(&a, &b);
+}
+
+START_TEST(test_savepath_bitmap_or)
+{
+	// Arrays and bitmaps, in each combination.
+	check_or(1000, 2000);
+	check_or(1000, 3);
+	check_or(3, 1000);
+	check_or(3, 5);
+}
+END_TEST
+
+START_TEST(test_savepath_bitmap_diff)
+{
+	uint64_t buf[16];
+	struct collected c={buf, 0, 16};
+	struct savepath_bitmap *a;
+	struct savepath_bitmap *b;
+	fail_unless((a=savepath_bitmap_alloc())!=NULL);
+	fail_unless((b=savepath_bitmap_alloc())!=NULL);
+
+	add_range(a, 1, 1, 2);
+	add_range(b, 1, 1, 2);
+	fail_unless(!savepath_bitmap_add(b, savepath_for(1, 1, 1)));
+	// Only in a, in a dense container, a sparse one and one b has not got.
+	fail_unless(!savepath_bitmap_add(a, savepath_for(1, 1, 7)));
+	fail_unless(!savepath_bitmap_add(a, savepath_for(0, 4, 4)));
+	fail_unless(!savepath_bitmap_add(a, savepath_for(0, 4, 2)));
+	fail_unless(!savepath_bitmap_add(b, savepath_for(0, 4, 4)));
+	fail_unless(!savepath_bitmap_add(a, savepath_for(3, 0, 0)));
+
+	fail_unless(!savepath_bitmap_diff(a, b, collect, &c));
+	fail_unless(c.len==3);
+	fail_unless(buf[0]==savepath_for(0, 4, 2));
+	fail_unless(buf[1]==savepath_for(1, 1, 7));
+	fail_unless(buf[2]==savepath_for(3, 0, 0));
+
+	tear_down(&a, &b);
+}
+END_TEST
+
+START_TEST(test_savepath_bitmap_dindex)
+{
+	int c2;
+	struct savepath_bitmap *a;
+	struct savepath_bitmap *b;
+	fail_unless(recursive_delete(BASE)==0);
+	fail_unless(!build_path_w(DINDEX));
+	fail_unless((a=savepath_bitmap_alloc())!=NULL);
+	fail_unless((b=savepath_bitmap_alloc())!=NULL);
+	add_range(a, 7, 0, 5);
+	for(c2=0; c2<10; c2++)
+		fail_unless(!savepath_bitmap_add(a,
+			savepath_for(0, (uint16_t)c2, 1)));
+	fail_unless(!savepath_bitmap_write_dindex(a, DINDEX));
+	fail_unless(!savepath_bitmap_load_dindex(b, DINDEX));
+	fail_unless(savepath_bitmap_count(a)==savepath_bitmap_count(b));
+	fail_unless(savepath_bitmap_count(a)==13118);
+	fail_unless(savepath_bitmap_contains(b, savepath_for(0, 9, 1)));
+	fail_unless(savepath_bitmap_contains(b, savepath_for(7, 0, 65535)));
+	fail_unless(savepath_bitmap_load_dindex(b, BASE "/missing")==-1);
+	tear_down(&a, &b);
+}
+END_TEST
+
+Suite *suite_server_protocol2_savepath_bitmap(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_savepath_bitmap");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_savepath_bitmap_add_and_contains);
+	tcase_add_test(tc_core, test_savepath_bitmap_dense);
+	tcase_add_test(tc_core, test_savepath_bitmap_or);
+	tcase_add_test(tc_core, test_savepath_bitmap_diff);
+	tcase_add_test(tc_core, test_savepath_bitmap_dindex);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
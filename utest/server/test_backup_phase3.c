@@ -5,7 +5,9 @@
 #include "../../src/fsops.h"
 #include "../../src/fzp.h"
 #include "../../src/msg.h"
+#include "../../src/sbuf.h"
 #include "../../src/server/backup_phase3.h"
+#include "../../src/server/manio.h"
 #include "../../src/server/sdirs.h"
 
 #define BASE		"utest_server_backup_phase3"
@@ -188,6 +190,38 @@ static void check_manifest(
 	assert_files_compressed_equal(expected, path);
 }
 
+// Finished protocol2 manifests are in format 2, so make the expected one by
+// copying the entries from a text manifest through the same writer.
+static void check_manifest_v2(const char *manifest,
+	const char *path, struct mdata *m, size_t mlen)
+{
+	int ret;
+	char text[256];
+	char expected[256];
+	struct sbuf *sb;
+	struct manio *src;
+	struct manio *dst;
+
+	snprintf(text, sizeof(text), "%s.text/00000000", manifest);
+	generate_manifest(text, m, mlen);
+	snprintf(text, sizeof(text), "%s.text", manifest);
+	snprintf(expected, sizeof(expected), "%s.expected", manifest);
+
+	fail_unless((src=manio_open_phase2(text, "rb", PROTO_2))!=NULL);
+	fail_unless((dst=manio_open_phase3(expected, "wb", PROTO_2,
+		"rmanifest"))!=NULL);
+	fail_unless((sb=sbuf_alloc(PROTO_2))!=NULL);
+	fail_unless(!manio_read(src, sb));
+	while(!(ret=manio_copy_entry(sb, sb, src, dst)));
+	fail_unless(ret==1);
+	fail_unless(!manio_close(&src));
+	fail_unless(!manio_close(&dst));
+	sbuf_free(&sb);
+
+	snprintf(expected, sizeof(expected), "%s.expected/00000000", manifest);
+	assert_files_equal(expected, path);
+}
+
 static void build_and_check_phase3(enum protocol protocol,
 	struct mdata *a, size_t alen,
 	struct mdata *b, size_t blen,
@@ -232,7 +266,10 @@ static void build_and_check_phase3(enum protocol protocol,
 
 	fail_unless(!backup_phase3_server_all(sdirs, confs));
 
-	check_manifest(final, x, xlen);
+	if(protocol==PROTO_2)
+		check_manifest_v2(sdirs->manifest, final, x, xlen);
+	else
+		check_manifest(final, x, xlen);
 
 	tear_down(&sdirs, &confs);
 }
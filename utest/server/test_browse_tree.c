@@ -0,0 +1,204 @@
+#include "../test.h"
+#include "../builders/build.h"
+#include "../prng.h"
+#include "../../src/alloc.h"
+#include "../../src/base64.h"
+#include "../../src/fsops.h"
+#include "../../src/prepend.h"
+#include "../../src/sbuf.h"
+#include "../../src/slist.h"
+#include "../../src/server/browse_tree.h"
+#include "../../src/server/manio.h"
+
+#define BASE		"utest_browse_tree"
+
+static void setup(void)
+{
+	prng_init(0);
+	base64_init();
+	fail_unless(!recursive_delete(BASE));
+}
+
+static void tear_down(void)
+{
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static const char *manifest_name(enum protocol protocol)
+{
+	return protocol==PROTO_1?BASE "/manifest.gz":BASE "/manifest";
+}
+
+static uint32_t find_path(struct browse_tree *tree, const char *path,
+	int *fakes)
+{
+	size_t len;
+	uint32_t node=0;
+	const char *name;
+	const char *link;
+	struct stat statp;
+	for(; *path; path+=len)
+	{
+		if(*path=='/')
+		{
+			len=1;
+			continue;
+		}
+		len=strcspn(path, "/");
+		fail_unless(browse_tree_find(tree, node, path, len, &node)==1);
+		fail_unless(!browse_tree_entry(tree, node,
+			&name, &link, &statp));
+		fail_unless(strlen(name)==len);
+		fail_unless(!strncmp(name, path, len));
+		if(path[len])
+		{
+			// On the way down, so it is a directory.
+			fail_unless(S_ISDIR(statp.st_mode));
+			(*fakes)++;
+		}
+	}
+	return node;
+}
+
+static void check_tree(struct browse_tree *tree, struct slist *slist)
+{
+	int fakes=0;
+	uint32_t node;
+	uint32_t count;
+	const uint32_t *kids=NULL;
+	const char *name;
+	const char *link;
+	struct stat statp;
+	struct sbuf *sb;
+
+	fail_unless(!browse_tree_entry(tree, 0, &name, &link, &statp));
+	fail_unless(!strcmp(name, "/"));
+	fail_unless(browse_tree_find(tree, 0, "notthere", 8, &node)==0);
+	for(sb=slist->head; sb; sb=sb->next)
+	{
+		node=find_path(tree, sb->path.buf, &fakes);
+		fail_unless(!browse_tree_entry(tree, node,
+			&name, &link, &statp));
+		fail_unless(statp.st_mode==sb->statp.st_mode);
+		fail_unless(statp.st_size==sb->statp.st_size);
+		fail_unless(statp.st_mtime==sb->statp.st_mtime);
+		fail_unless(!strcmp(link, sb->link.buf?sb->link.buf:""));
+		if(!S_ISDIR(sb->statp.st_mode))
+		{
+			count=browse_tree_children(tree, node, &kids);
+			fail_unless(!count);
+		}
+	}
+	// The paths are made up, so most of the directories are not in the
+	// manifest.
+	fail_unless(fakes>0);
+}
+
+static struct browse_tree *build_from_manifest(enum protocol protocol)
+{
+	struct manio *manio;
+	struct browse_tree *tree;
+	fail_unless((manio=manio_open(manifest_name(protocol),
+		"rb", protocol))!=NULL);
+	manio->views=1;
+	fail_unless((tree=browse_tree_build(manio))!=NULL);
+	fail_unless(!manio_close(&manio));
+	return tree;
+}
+
+static void run_test(enum protocol protocol, int entries)
+{
+	struct slist *slist;
+	struct browse_tree *tree;
+
+	setup();
+	slist=build_manifest(manifest_name(protocol), protocol, entries,
+		0 /*phase*/);
+	fail_unless(!browse_tree_write(BASE, protocol));
+	fail_unless((tree=browse_tree_open(BASE))!=NULL);
+	check_tree(tree, slist);
+	browse_tree_free(&tree);
+
+	tree=build_from_manifest(protocol);
+	check_tree(tree, slist);
+	browse_tree_free(&tree);
+
+	slist_free(&slist);
+	tear_down();
+}
+
+START_TEST(test_browse_tree)
+{
+	run_test(PROTO_1, 10);
+	run_test(PROTO_1, 1000);
+	run_test(PROTO_2, 10);
+	run_test(PROTO_2, 1000);
+}
+END_TEST
+
+START_TEST(test_browse_tree_empty)
+{
+	const char *name;
+	const char *link;
+	const uint32_t *kids=NULL;
+	struct stat statp;
+	struct slist *slist;
+	struct browse_tree *tree;
+
+	setup();
+	slist=build_manifest(manifest_name(PROTO_2), PROTO_2, 0, 0 /*phase*/);
+	fail_unless(!browse_tree_write(BASE, PROTO_2));
+	fail_unless((tree=browse_tree_open(BASE))!=NULL);
+	fail_unless(!browse_tree_entry(tree, 0, &name, &link, &statp));
+	fail_unless(!*name);
+	fail_unless(!browse_tree_children(tree, 0, &kids));
+	fail_unless(browse_tree_entry(tree, 1, &name, &link, &statp)==-1);
+	browse_tree_free(&tree);
+	slist_free(&slist);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_browse_tree_unusable)
+{
+	char *path;
+	struct stat statp;
+	struct slist *slist;
+	struct browse_tree *tree;
+
+	setup();
+	slist=build_manifest(manifest_name(PROTO_2), PROTO_2, 10, 0 /*phase*/);
+	fail_unless(browse_tree_open(BASE)==NULL);
+
+	fail_unless(!browse_tree_write(BASE, PROTO_2));
+	fail_unless((path=prepend_s(BASE, "browse"))!=NULL);
+	fail_unless(!lstat(path, &statp));
+	fail_unless(!truncate(path, statp.st_size-1));
+	fail_unless((tree=browse_tree_open(BASE))==NULL);
+	fail_unless(!truncate(path, 3));
+	fail_unless((tree=browse_tree_open(BASE))==NULL);
+
+	free_w(&path);
+	slist_free(&slist);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_browse_tree(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_browse_tree");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+
+	tcase_add_test(tc_core, test_browse_tree);
+	tcase_add_test(tc_core, test_browse_tree_empty);
+	tcase_add_test(tc_core, test_browse_tree_unusable);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -70,7 +70,7 @@ static void build_and_autodelete(enum protocol protocol,
 	klist=build_keep_strlist(keep, klen);
 	build_storage_dirs(sdirs, s, slen);
 	fail_unless(!delete_backups(sdirs, CNAME, klist,
-		NULL /* manual_delete */));
+		NULL /* manual_delete */, NULL /* deleter */));
 	assert_bu_list(sdirs, e, elen);
 	tear_down(&klist, &sdirs);
 }
@@ -455,7 +455,8 @@ static void build_and_userdelete(
 		NULL, // cntr
 		CNAME,
 		backup_str,
-		NULL // manual_delete
+		NULL, // manual_delete
+		NULL // deleter
 	)==expected_ret);
 	assert_bu_list(sdirs, e, elen);
         asfd_free(&asfd);
@@ -0,0 +1,196 @@
+#include "../test.h"
+#include "../../src/alloc.h"
+#include "../../src/fsops.h"
+#include "../../src/prepend.h"
+#include "../../src/strlist.h"
+#include "../../src/server/deleter.h"
+
+#define BASE	"utest_deleter"
+#define TREE	BASE "/tree"
+
+static void tear_down(void)
+{
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static void create_file(const char *path)
+{
+	FILE *fp;
+	fail_unless(!build_path_w(path));
+	fail_unless((fp=fopen(path, "wb"))!=NULL);
+	fail_unless(!fclose(fp));
+}
+
+static int exists(const char *path)
+{
+	struct stat statp;
+	return !lstat(path, &statp);
+}
+
+// A few levels of directories, with some files at each level.
+static void build_tree(const char *dir, int depth, int width)
+{
+	int i;
+	char name[32];
+	char *path;
+	for(i=0; i<width; i++)
+	{
+		snprintf(name, sizeof(name), "f%d", i);
+		fail_unless((path=prepend_s(dir, name))!=NULL);
+		create_file(path);
+		free_w(&path);
+		if(!depth)
+			continue;
+		snprintf(name, sizeof(name), "d%d", i);
+		fail_unless((path=prepend_s(dir, name))!=NULL);
+		fail_unless(!mkdir(path, 0777));
+		build_tree(path, depth-1, width);
+		free_w(&path);
+	}
+}
+
+static void do_test_recursive_delete(int threads, int max_per_second)
+{
+	struct deleter *deleter;
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!build_path_w(TREE));
+	fail_unless(!mkdir(TREE, 0777));
+	build_tree(TREE, 3, 4);
+	// Symlinks to directories are removed, not followed.
+	fail_unless(!mkdir(BASE "/other", 0777));
+	create_file(BASE "/other/keep");
+	fail_unless(!symlink("../../other", TREE "/d0/link"));
+
+	fail_unless((deleter=deleter_alloc(threads,
+		max_per_second, NULL))!=NULL);
+	fail_unless(!deleter_recursive_delete(deleter, TREE));
+	fail_unless(!exists(TREE));
+	fail_unless(exists(BASE "/other/keep"));
+	// Not there any more, which is fine.
+	fail_unless(!deleter_recursive_delete(deleter, TREE));
+	deleter_free(&deleter);
+	tear_down();
+}
+
+START_TEST(test_deleter_recursive_delete)
+{
+	do_test_recursive_delete(0, 0);
+}
+END_TEST
+
+START_TEST(test_deleter_recursive_delete_threads)
+{
+	do_test_recursive_delete(1, 0);
+	do_test_recursive_delete(4, 0);
+}
+END_TEST
+
+START_TEST(test_deleter_recursive_delete_throttled)
+{
+	do_test_recursive_delete(2, 100000);
+}
+END_TEST
+
+START_TEST(test_deleter_recursive_delete_null)
+{
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!build_path_w(TREE));
+	fail_unless(!mkdir(TREE, 0777));
+	build_tree(TREE, 2, 3);
+	fail_unless(!deleter_recursive_delete(NULL, TREE));
+	fail_unless(!exists(TREE));
+	// A file rather than a directory.
+	create_file(TREE);
+	fail_unless(!deleter_recursive_delete(NULL, TREE));
+	fail_unless(!exists(TREE));
+	tear_down();
+}
+END_TEST
+
+static const char *files[]={
+	"0000/0000/0000",
+	"0000/0000/0001",
+	"0000/0001/0000",
+	"0001/0000/0000",
+	"0002/0000/0000",
+	"top",
+};
+
+static void do_test_unlink_files(int threads)
+{
+	size_t i;
+	char *path;
+	struct strlist *paths=NULL;
+	struct deleter *deleter;
+	fail_unless(!recursive_delete(BASE));
+	for(i=0; i<ARR_LEN(files); i++)
+	{
+		fail_unless((path=prepend_s(BASE, files[i]))!=NULL);
+		create_file(path);
+		free_w(&path);
+	}
+	create_file(BASE "/0000/0000/0002");
+
+	// Some that are not there, including a whole directory of them.
+	fail_unless(!strlist_add(&paths, "0000/0000/0000", 0));
+	fail_unless(!strlist_add(&paths, "0000/0000/0001", 0));
+	fail_unless(!strlist_add(&paths, "0000/0000/0009", 0));
+	fail_unless(!strlist_add(&paths, "0000/0001/0000", 0));
+	fail_unless(!strlist_add(&paths, "0001/0000/0000", 0));
+	fail_unless(!strlist_add(&paths, "0002/0000/0000", 0));
+	fail_unless(!strlist_add(&paths, "0003/0000/0000", 0));
+	fail_unless(!strlist_add(&paths, "top", 0));
+
+	fail_unless((deleter=deleter_alloc(threads, 0, NULL))!=NULL);
+	fail_unless(!deleter_unlink_files(deleter, BASE, paths));
+	for(i=0; i<ARR_LEN(files); i++)
+	{
+		fail_unless((path=prepend_s(BASE, files[i]))!=NULL);
+		fail_unless(!exists(path));
+		free_w(&path);
+	}
+	fail_unless(exists(BASE "/0000/0000/0002"));
+	fail_unless(!deleter_unlink_files(deleter, BASE, NULL));
+	deleter_free(&deleter);
+	strlists_free(&paths);
+	tear_down();
+}
+
+START_TEST(test_deleter_unlink_files)
+{
+	do_test_unlink_files(0);
+	do_test_unlink_files(3);
+}
+END_TEST
+
+START_TEST(test_deleter_unlink_files_no_dir)
+{
+	struct strlist *paths=NULL;
+	fail_unless(!strlist_add(&paths, "0000/0000/0000", 0));
+	fail_unless(deleter_unlink_files(NULL, BASE "/missing", paths)==-1);
+	strlists_free(&paths);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_deleter(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_deleter");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+
+	tcase_add_test(tc_core, test_deleter_recursive_delete);
+	tcase_add_test(tc_core, test_deleter_recursive_delete_threads);
+	tcase_add_test(tc_core, test_deleter_recursive_delete_throttled);
+	tcase_add_test(tc_core, test_deleter_recursive_delete_null);
+	tcase_add_test(tc_core, test_deleter_unlink_files);
+	tcase_add_test(tc_core, test_deleter_unlink_files_no_dir);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
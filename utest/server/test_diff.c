@@ -0,0 +1,306 @@
+#include "../test.h"
+#include "../../src/alloc.h"
+#include "../../src/asfd.h"
+#include "../../src/base64.h"
+#include "../../src/fsops.h"
+#include "../../src/fzp.h"
+#include "../../src/iobuf.h"
+#include "../../src/pathcmp.h"
+#include "../../src/prepend.h"
+#include "../../src/sbuf.h"
+#include "../../src/slist.h"
+#include "../../src/protocol2/blk.h"
+#include "../../src/server/diff.h"
+#include "../../src/server/manio.h"
+#include "../../src/server/manio_index.h"
+#include "../../src/server/manio_v2.h"
+#include "../builders/build.h"
+#include "../builders/build_asfd_mock.h"
+#include "../prng.h"
+
+#define BASE		"utest_server_diff"
+#define ORIG		BASE "/orig/manifest"
+#define BACKUP1		BASE "/1"
+#define BACKUP2		BASE "/2"
+
+static struct ioevent_list reads;
+static struct ioevent_list writes;
+
+static void tear_down(void)
+{
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static char *chunk_path(const char *manifest, int chunk)
+{
+	char tmp[32];
+	snprintf(tmp, sizeof(tmp), "%08X", chunk);
+	return prepend_s(manifest, tmp);
+}
+
+static int count_chunks(const char *manifest)
+{
+	int chunks=0;
+	char *path;
+	struct stat statp;
+	while(1)
+	{
+		fail_unless((path=chunk_path(manifest, chunks))!=NULL);
+		if(lstat(path, &statp))
+			break;
+		free_w(&path);
+		chunks++;
+	}
+	free_w(&path);
+	return chunks;
+}
+
+static void copy_chunk(const char *src, const char *dst)
+{
+	size_t got;
+	char buf[4096];
+	struct fzp *in;
+	struct fzp *out;
+	fail_unless((in=fzp_open(src, "rb"))!=NULL);
+	fail_unless((out=fzp_open(dst, "wb"))!=NULL);
+	while((got=fzp_read(in, buf, sizeof(buf))))
+		fail_unless(fzp_write(out, buf, got)==got);
+	fail_unless(!fzp_close(&in));
+	fail_unless(!fzp_close(&out));
+}
+
+// Copy a chunk, dropping every drop'th entry, and changing the modification
+// time of every touch'th one.
+static void change_chunk(const char *src, const char *dst,
+	int drop, int touch)
+{
+	int n=0;
+	int dropping=0;
+	struct sbuf *sb;
+	struct blk *blk;
+	struct iobuf wbuf;
+	struct manio_v2 *in;
+	struct manio_v2 *out;
+
+	fail_unless((in=manio_v2_open(src, "rb", 0))!=NULL);
+	fail_unless((out=manio_v2_open(dst, "wb",
+		MANIO_V2_CODEC_DEFLATE))!=NULL);
+	fail_unless((sb=sbuf_alloc(PROTO_2))!=NULL);
+	fail_unless((blk=blk_alloc())!=NULL);
+	while(1)
+	{
+		blk->got_save_path=0;
+		switch(manio_v2_read(in, sb, blk, 0))
+		{
+			case 0: break;
+			case 1: goto end;
+			default: fail_unless(0);
+		}
+		if(blk->got_save_path)
+		{
+			if(dropping) continue;
+			blk_to_iobuf_sig_and_savepath(blk, &wbuf);
+			fail_unless(!manio_v2_write_iobuf(out, &wbuf));
+		}
+		else if(sb->endfile.buf)
+		{
+			if(dropping) continue;
+			fail_unless(!manio_v2_write_iobuf(out, &sb->endfile));
+		}
+		else
+		{
+			n++;
+			if((dropping=!(n%drop)))
+				continue;
+			if(!(n%touch))
+				sb->statp.st_mtime++;
+			fail_unless(!manio_v2_write_sbuf(out, sb));
+		}
+	}
+end:
+	blk_free(&blk);
+	sbuf_free(&sb);
+	fail_unless(!manio_v2_close(&in));
+	fail_unless(!manio_v2_close(&out));
+}
+
+// Copy the original manifest into a backup, changing one chunk.
+static void build_backup(const char *dir, int chunks,
+	int changed, int drop, int touch)
+{
+	int i;
+	char *src;
+	char *dst;
+	char *manifest;
+	fail_unless((manifest=prepend_s(dir, "manifest"))!=NULL);
+	fail_unless(!build_path_w(manifest));
+	fail_unless(!mkdir(manifest, 0777));
+	for(i=0; i<chunks; i++)
+	{
+		fail_unless((src=chunk_path(ORIG, i))!=NULL);
+		fail_unless((dst=chunk_path(manifest, i))!=NULL);
+		if(i==changed)
+			change_chunk(src, dst, drop, touch);
+		else if(!i)
+			// The same file, not just the same contents.
+			fail_unless(!link(src, dst));
+		else
+			copy_chunk(src, dst);
+		free_w(&src);
+		free_w(&dst);
+	}
+	fail_unless(!manio_index_write(manifest));
+	free_w(&manifest);
+}
+
+static struct slist *read_manifest(const char *dir)
+{
+	int ars;
+	char *manifest;
+	struct sbuf *sb;
+	struct slist *slist;
+	struct manio *manio;
+	fail_unless((slist=slist_alloc())!=NULL);
+	fail_unless((manifest=prepend_s(dir, "manifest"))!=NULL);
+	fail_unless((manio=manio_open(manifest, "rb", PROTO_2))!=NULL);
+	while(1)
+	{
+		fail_unless((sb=sbuf_alloc(PROTO_2))!=NULL);
+		fail_unless((ars=manio_read(manio, sb))>=0);
+		if(ars || sb->endfile.buf)
+		{
+			sbuf_free(&sb);
+			if(ars) break;
+			continue;
+		}
+		slist_add_sbuf(slist, sb);
+	}
+	fail_unless(!manio_close(&manio));
+	free_w(&manifest);
+	return slist;
+}
+
+static void assert_diff(struct asfd *asfd, int *w,
+	const char *symbol, struct sbuf *sb)
+{
+	char *dpath;
+	fail_unless((dpath=prepend_s(symbol, sb->path.buf))!=NULL);
+	asfd_assert_write_iobuf(asfd, w, 0, &sb->attr);
+	asfd_assert_write(asfd, w, 0, sb->path.cmd, dpath);
+	if(sbuf_is_link(sb))
+		asfd_assert_write_iobuf(asfd, w, 0, &sb->link);
+	free_w(&dpath);
+}
+
+// Works out what the diff should be, the slow way.
+static int setup_writes(struct asfd *asfd,
+	struct slist *slist1, struct slist *slist2)
+{
+	int w=0;
+	int pcmp;
+	int changes=0;
+	struct sbuf *sb1=slist1->head;
+	struct sbuf *sb2=slist2->head;
+	while(sb1 || sb2)
+	{
+		if(!sb1) pcmp=1;
+		else if(!sb2) pcmp=-1;
+		else pcmp=pathcmp(sb1->path.buf, sb2->path.buf);
+		if(pcmp<0)
+		{
+			assert_diff(asfd, &w, "- ", sb1);
+			sb1=sb1->next;
+		}
+		else if(pcmp>0)
+		{
+			assert_diff(asfd, &w, "+ ", sb2);
+			sb2=sb2->next;
+		}
+		else
+		{
+			if(sb1->statp.st_mtime!=sb2->statp.st_mtime)
+			{
+				assert_diff(asfd, &w, "- ", sb1);
+				assert_diff(asfd, &w, "+ ", sb2);
+			}
+			sb1=sb1->next;
+			sb2=sb2->next;
+			continue;
+		}
+		changes++;
+	}
+	return changes;
+}
+
+static void run_diff(const char *dir1, struct slist *slist1,
+	const char *dir2, struct slist *slist2, int threads)
+{
+	struct asfd *asfd;
+	asfd=asfd_mock_setup(&reads, &writes);
+	fail_unless(setup_writes(asfd, slist1, slist2)>0);
+	fail_unless(!diff_manifests(asfd, dir1, dir2, PROTO_2, threads));
+	asfd_free(&asfd);
+	asfd_mock_teardown(&reads, &writes);
+}
+
+static void remove_index(const char *dir)
+{
+	char *path;
+	fail_unless((path=prepend_s(dir, "manifest/index"))!=NULL);
+	fail_unless(!unlink(path));
+	free_w(&path);
+}
+
+START_TEST(test_diff_manifests)
+{
+	int chunks;
+	struct slist *slist;
+	struct slist *slist1;
+	struct slist *slist2;
+
+	prng_init(0);
+	base64_init();
+	fail_unless(!recursive_delete(BASE));
+	slist=build_manifest(ORIG, PROTO_2, 4000, 0 /*phase*/);
+	chunks=count_chunks(ORIG);
+	fail_unless(chunks>=4);
+
+	build_backup(BACKUP1, chunks, 1, 5, 1000000);
+	build_backup(BACKUP2, chunks, chunks-2, 3, 7);
+	slist1=read_manifest(BACKUP1);
+	slist2=read_manifest(BACKUP2);
+
+	run_diff(BACKUP1, slist1, BACKUP2, slist2, 0);
+	run_diff(BACKUP1, slist1, BACKUP2, slist2, 1);
+	run_diff(BACKUP1, slist1, BACKUP2, slist2, 3);
+	run_diff(BACKUP2, slist2, BACKUP1, slist1, 3);
+
+	// Without the indexes, it is all compared in one go.
+	remove_index(BACKUP1);
+	run_diff(BACKUP1, slist1, BACKUP2, slist2, 3);
+	remove_index(BACKUP2);
+	run_diff(BACKUP1, slist1, BACKUP2, slist2, 0);
+
+	slist_free(&slist);
+	slist_free(&slist1);
+	slist_free(&slist2);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_diff(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_diff");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+
+	tcase_add_test(tc_core, test_diff_manifests);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -0,0 +1,168 @@
+#include "../test.h"
+#include "../../src/alloc.h"
+#include "../../src/fsops.h"
+#include "../../src/prepend.h"
+#include "../../src/server/durable.h"
+
+#define BASE	"utest_durable"
+
+static void tear_down(void)
+{
+	durable_release();
+	durable_set_interval(0);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static char *create_file(int i)
+{
+	FILE *fp;
+	char name[32];
+	char *path;
+	snprintf(name, sizeof(name), "f%d", i);
+	fail_unless((path=prepend_s(BASE, name))!=NULL);
+	fail_unless(!build_path_w(path));
+	fail_unless((fp=fopen(path, "wb"))!=NULL);
+	fail_unless(fprintf(fp, "%s", path)>0);
+	fail_unless(!fclose(fp));
+	return path;
+}
+
+static void add_files(int count)
+{
+	int i;
+	char *path;
+	for(i=0; i<count; i++)
+	{
+		path=create_file(i);
+		fail_unless(!durable_add_path(path));
+		free_w(&path);
+	}
+}
+
+START_TEST(test_durable_commit)
+{
+	char *path;
+	FILE *fp;
+	fail_unless(!recursive_delete(BASE));
+	durable_set_interval(0);
+	add_files(3);
+	// The same file again is not added twice.
+	fail_unless((path=create_file(1))!=NULL);
+	fail_unless(!durable_add_path(path));
+	fail_unless((fp=fopen(path, "ab"))!=NULL);
+	fail_unless(!durable_add_fd(fileno(fp)));
+	fail_unless(!fclose(fp));
+	free_w(&path);
+	fail_unless(durable_pending()==3);
+	fail_unless(!durable_commit(0));
+	fail_unless(durable_pending()==0);
+	// Nothing to do.
+	fail_unless(!durable_commit(0));
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_durable_interval)
+{
+	fail_unless(!recursive_delete(BASE));
+	durable_set_interval(3600);
+	add_files(2);
+	// Too soon after the last one.
+	fail_unless(!durable_commit(0));
+	fail_unless(durable_pending()==2);
+	fail_unless(!durable_commit(1));
+	fail_unless(durable_pending()==0);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_durable_never)
+{
+	fail_unless(!recursive_delete(BASE));
+	durable_set_interval(-1);
+	add_files(2);
+	fail_unless(durable_pending()==0);
+	fail_unless(!durable_commit(1));
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_durable_many_files)
+{
+	fail_unless(!recursive_delete(BASE));
+	durable_set_interval(0);
+	// Too many to keep, so they are swapped for the one filesystem that
+	// they are all on.
+	add_files(100);
+#ifdef HAVE_SYNCFS
+	fail_unless(durable_pending()==1);
+#else
+	fail_unless(durable_pending()==-1);
+#endif
+	fail_unless(!durable_commit(0));
+	fail_unless(durable_pending()==0);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_durable_flush)
+{
+	char *path;
+	FILE *fp;
+	fail_unless(!recursive_delete(BASE));
+	durable_set_interval(0);
+	fail_unless((path=create_file(0))!=NULL);
+	fail_unless((fp=fopen(path, "ab"))!=NULL);
+	fail_unless(!durable_flush_fd(fileno(fp)));
+	fail_unless(!fclose(fp));
+	fail_unless(!durable_flush_dir(path));
+	// Flushed straight away, so nothing is left for the next commit.
+	fail_unless(durable_pending()==0);
+	fail_unless(durable_flush_dir(BASE "/missing/file")==-1);
+	free_w(&path);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_durable_forced_commit)
+{
+	fail_unless(!recursive_delete(BASE));
+	durable_set_interval(0);
+	add_files(2);
+	fail_unless(durable_pending()==2);
+	fail_unless(!durable_commit(1));
+	fail_unless(durable_pending()==0);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_durable_missing)
+{
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(durable_add_path(BASE "/missing")==-1);
+	fail_unless(durable_pending()==0);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_durable(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_durable");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_durable_commit);
+	tcase_add_test(tc_core, test_durable_interval);
+	tcase_add_test(tc_core, test_durable_never);
+	tcase_add_test(tc_core, test_durable_many_files);
+	tcase_add_test(tc_core, test_durable_flush);
+	tcase_add_test(tc_core, test_durable_forced_commit);
+	tcase_add_test(tc_core, test_durable_missing);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
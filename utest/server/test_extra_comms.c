@@ -163,7 +163,7 @@ static const char *get_features(enum protocol protocol, int srestore,
 	if(version && !strcmp(version, "1.4.40"))
 		old_version=1;
 
-	snprintf(features, sizeof(features), "extra_comms_begin ok:autoupgrade:incexc:orig_client:uname:%s%smsg:%s%s", srestore?"srestore:":"", old_version?"":"counters_json:", proto, rshash);
+	snprintf(features, sizeof(features), "extra_comms_begin ok:autoupgrade:incexc:orig_client:uname:%s%smsg:restore_compression:%s%s", srestore?"srestore:":"", old_version?"":"counters_json:", proto, rshash);
 	return features;
 }
 
@@ -489,6 +489,36 @@ static void checks_msg(struct conf **confs, struct conf **cconfs,
 	fail_unless(get_int(cconfs[OPT_MESSAGE])==1);
 }
 
+static void setup_restore_compression(struct asfd *asfd,
+	struct conf **confs, struct conf **cconfs)
+{
+	setup_simple(asfd, confs, cconfs, "restore_compression=0",
+		/*srestore*/0);
+}
+
+static void checks_restore_compression(struct conf **confs,
+	struct conf **cconfs, const char *incexc, int srestore)
+{
+	fail_unless(get_int(confs[OPT_RESTORE_COMPRESSION])==0);
+	fail_unless(get_int(cconfs[OPT_RESTORE_COMPRESSION])==0);
+}
+
+static void setup_restore_compression_bad(struct asfd *asfd,
+	struct conf **confs, struct conf **cconfs)
+{
+	int r=0; int w=0;
+	setup_send_features_proto_begin(asfd, confs, cconfs,
+		PROTO_AUTO, &r, &w, PACKAGE_VERSION, /*srestore*/0);
+	asfd_mock_read(asfd, &r, 0, CMD_GEN, "restore_compression=10");
+}
+
+static void checks_restore_compression_unset(struct conf **confs,
+	struct conf **cconfs, const char *incexc, int srestore)
+{
+	fail_unless(get_int(confs[OPT_RESTORE_COMPRESSION])==9);
+	fail_unless(get_int(cconfs[OPT_RESTORE_COMPRESSION])==9);
+}
+
 static void setup_counters_ok(struct asfd *asfd,
 	struct conf **confs, struct conf **cconfs)
 {
@@ -787,6 +817,9 @@ START_TEST(test_server_extra_comms)
 #endif
 	run_test(0, setup_counters_ok, checks_counters_ok);
 	run_test(0, setup_msg, checks_msg);
+	run_test(0, setup_restore_compression, checks_restore_compression);
+	run_test(-1, setup_restore_compression_bad, NULL);
+	run_test(0, setup_counters_ok, checks_restore_compression_unset);
 	run_test(0, setup_uname, checks_uname);
 	run_test(0, setup_uname_is_windows, checks_uname_is_windows);
 	run_test(-1, setup_unexpected_feature, NULL);
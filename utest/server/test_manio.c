@@ -14,6 +14,7 @@
 #include "../../src/slist.h"
 #include "../../src/protocol2/blk.h"
 #include "../../src/server/manio.h"
+#include "../../src/server/protocol2/dindex_file.h"
 
 static const char *path="utest_manio";
 
@@ -326,36 +327,24 @@ static void check_hooks(int i, int fcount)
 static void check_dindex(int i)
 {
 	int ret;
-	struct fzp *fzp;
 	const char *p;
-	struct iobuf rbuf;
 	int lines=0;
-	struct blk blk;
+	uint64_t savepath;
 	uint64_t last_savepath=0;
+	struct dindex_file *df;
 
 	p=get_extra_path(i, "dindex");
-	memset(&rbuf, 0, sizeof(rbuf));
 
-	fail_unless((fzp=fzp_gzopen(p, "rb"))!=NULL);
-	while(!(ret=iobuf_fill_from_fzp(&rbuf, fzp)))
+	fail_unless((df=dindex_file_open(p, "rb"))!=NULL);
+	while(!(ret=dindex_file_read(df, &savepath)))
 	{
 		lines++;
-		switch(rbuf.cmd)
-		{
-			case CMD_SAVE_PATH:
-				blk_set_from_iobuf_savepath(&blk, &rbuf);
-				fail_unless(blk.savepath>last_savepath);
-				last_savepath=blk.savepath;
-				break;
-			default:
-				fail_unless(0==1);
-				break;
-		}
-		iobuf_free_content(&rbuf);
+		fail_unless(savepath>last_savepath);
+		last_savepath=savepath;
 	}
 	fail_unless(ret==1);
 	fail_unless(lines>500);
-	fail_unless(!fzp_close(&fzp));
+	fail_unless(!dindex_file_close(&df));
 }
 
 START_TEST(test_man_protocol2_hooks)
@@ -395,6 +384,196 @@ START_TEST(test_man_protocol2_hooks)
 }
 END_TEST
 
+// Copy every entry of a manifest into another one, the way that the backup
+// phases do, then read the copy back.
+static void test_copy_entry(int src_phase, int dst_phase)
+{
+	int entries=1000;
+	char dst[64]="";
+	struct manio *src;
+	struct manio *dstmanio;
+	struct slist *slist;
+	struct sbuf *sb;
+	struct sbuf *csb;
+	uint64_t copied_raw;
+	uint64_t copied_blk;
+
+	prng_init(0);
+	base64_init();
+	hexmap_init();
+	recursive_delete(path);
+	snprintf(dst, sizeof(dst), "%s/copy", path);
+
+	slist=build_manifest(path, PROTO_2, entries, src_phase);
+	fail_unless(slist!=NULL);
+	fail_unless((src=do_manio_open(path, "rb", PROTO_2, src_phase))!=NULL);
+	if(dst_phase==3)
+		dstmanio=manio_open_phase3(dst, "wb", PROTO_2,
+			RMANIFEST_RELATIVE);
+	else
+		dstmanio=do_manio_open(dst, "wb", PROTO_2, dst_phase);
+	fail_unless(dstmanio!=NULL);
+	fail_unless((csb=sbuf_alloc(PROTO_2))!=NULL);
+	fail_unless(!manio_read(src, csb));
+	while(1)
+	{
+		int ret=manio_copy_entry(csb, csb, src, dstmanio);
+		fail_unless(ret>=0);
+		if(ret) break;
+	}
+	copied_raw=dstmanio->copied_raw;
+	copied_blk=dstmanio->copied_blk;
+	fail_unless(!manio_close(&src));
+	fail_unless(!manio_close(&dstmanio));
+
+	// Only the first record in each file of the source goes through a
+	// blk.
+	fail_unless(copied_raw>1000);
+	fail_unless(copied_blk<10);
+
+	sb=slist->head;
+	fail_unless((src=do_manio_open(dst, "rb", PROTO_2,
+		dst_phase==3?0:dst_phase))!=NULL);
+	read_manifest(&sb, src, 0, entries, PROTO_2, dst_phase);
+	fail_unless(sb==NULL);
+	fail_unless(!manio_close(&src));
+
+	sbuf_free(&csb);
+	slist_free(&slist);
+	tear_down();
+}
+
+START_TEST(test_man_protocol2_copy_entry_phase2_to_phase3)
+{
+	test_copy_entry(2, 3);
+}
+END_TEST
+
+START_TEST(test_man_protocol2_copy_entry_phase0_to_phase2)
+{
+	test_copy_entry(0, 2);
+}
+END_TEST
+
+// Copy a final manifest into a new one that may reuse its chunks, changing
+// the modification time of entry number touch on the way.
+static void copy_with_reuse(const char *src, const char *dst, int touch)
+{
+	int n=0;
+	int ret;
+	struct sbuf *csb;
+	struct manio *srcmanio;
+	struct manio *dstmanio;
+
+	fail_unless((srcmanio=manio_open(src, "rb", PROTO_2))!=NULL);
+	fail_unless((dstmanio=manio_open_phase3(dst, "wb", PROTO_2,
+		RMANIFEST_RELATIVE))!=NULL);
+	fail_unless(!manio_reuse_chunks_from(dstmanio, src));
+	fail_unless((csb=sbuf_alloc(PROTO_2))!=NULL);
+	fail_unless(!manio_read(srcmanio, csb));
+	do
+	{
+		if(n++==touch)
+			csb->statp.st_mtime++;
+		fail_unless((ret=manio_copy_entry(csb, csb,
+			srcmanio, dstmanio))>=0);
+	} while(!ret);
+	fail_unless(!manio_close(&srcmanio));
+	fail_unless(!manio_close(&dstmanio));
+	sbuf_free(&csb);
+}
+
+static ino_t get_ino(const char *dir, const char *sub, uint64_t chunk)
+{
+	char p[128];
+	struct stat statp;
+	snprintf(p, sizeof(p), "%s/%s%08" PRIX64, dir, sub, chunk);
+	fail_unless(!lstat(p, &statp));
+	return statp.st_ino;
+}
+
+START_TEST(test_man_protocol2_reuse_chunks)
+{
+	int entries=1000;
+	uint64_t i;
+	uint64_t fcount;
+	uint64_t linked=0;
+	char prev[64]="";
+	char same[64]="";
+	char touched[64]="";
+	struct manio *manio;
+	struct slist *slist;
+	struct sbuf *sb;
+
+	prng_init(0);
+	base64_init();
+	hexmap_init();
+	recursive_delete(path);
+	snprintf(prev, sizeof(prev), "%s/prev", path);
+	snprintf(same, sizeof(same), "%s/same", path);
+	snprintf(touched, sizeof(touched), "%s/touched", path);
+
+	slist=build_manifest(prev, PROTO_2, entries, 3);
+	fail_unless(slist!=NULL);
+	fail_unless((manio=manio_open(prev, "rb", PROTO_2))!=NULL);
+	fail_unless(!manio_read_fcount(manio));
+	fcount=manio->offset->fcount;
+	fail_unless(!manio_close(&manio));
+
+	// Nothing to reuse without digests.
+	fail_unless((manio=manio_open_phase3(same, "wb", PROTO_2,
+		RMANIFEST_RELATIVE))!=NULL);
+	fail_unless(!manio_reuse_chunks_from(manio, path));
+	fail_unless(!manio->reuse);
+	fail_unless(!manio_close(&manio));
+	recursive_delete(same);
+
+	// Every chunk of an unchanged copy is a link to the previous one,
+	// and so are their dindex files.
+	copy_with_reuse(prev, same, -1);
+	for(i=0; i<fcount; i++)
+	{
+		fail_unless(get_ino(prev, "", i)==get_ino(same, "", i));
+		fail_unless(get_ino(prev, "dindex/", i)
+			==get_ino(same, "dindex/", i));
+		// Hooks files name their own chunk, so are new.
+		fail_unless(get_ino(prev, "hooks/", i)
+			!=get_ino(same, "hooks/", i));
+	}
+	sb=slist->head;
+	fail_unless((manio=manio_open(same, "rb", PROTO_2))!=NULL);
+	read_manifest(&sb, manio, 0, entries, PROTO_2, 0);
+	fail_unless(sb==NULL);
+	fail_unless(!manio_close(&manio));
+
+	// Changing one entry only changes the chunk that it is in.
+	copy_with_reuse(prev, touched, entries/2);
+	for(i=0; i<fcount; i++)
+		if(get_ino(prev, "", i)==get_ino(touched, "", i))
+			linked++;
+	fail_unless(linked==fcount-1);
+
+	// A resumed backup writes its manifest again over the top of one
+	// that has links to the previous one. That must leave the previous
+	// one as it was.
+	copy_with_reuse(prev, same, entries/2);
+	linked=0;
+	for(i=0; i<fcount; i++)
+		if(get_ino(prev, "", i)==get_ino(same, "", i)
+		  && get_ino(prev, "dindex/", i)==get_ino(same, "dindex/", i))
+			linked++;
+	fail_unless(linked==fcount-1);
+	sb=slist->head;
+	fail_unless((manio=manio_open(prev, "rb", PROTO_2))!=NULL);
+	read_manifest(&sb, manio, 0, entries, PROTO_2, 0);
+	fail_unless(sb==NULL);
+	fail_unless(!manio_close(&manio));
+
+	slist_free(&slist);
+	tear_down();
+}
+END_TEST
+
 struct boundary_data
 {
 	char mdstr[33];
@@ -460,6 +639,9 @@ Suite *suite_server_manio(void)
 	tcase_add_test(tc_core, test_man_protocol2_phase2_tell_seek);
 
 	tcase_add_test(tc_core, test_man_protocol2_hooks);
+	tcase_add_test(tc_core, test_man_protocol2_copy_entry_phase2_to_phase3);
+	tcase_add_test(tc_core, test_man_protocol2_copy_entry_phase0_to_phase2);
+	tcase_add_test(tc_core, test_man_protocol2_reuse_chunks);
 
 	tcase_add_test(tc_core, test_man_find_boundary);
 
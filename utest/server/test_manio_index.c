@@ -0,0 +1,168 @@
+#include "../test.h"
+#include "../builders/build.h"
+#include "../../src/alloc.h"
+#include "../../src/fsops.h"
+#include "../../src/prepend.h"
+#include "../../src/sbuf.h"
+#include "../../src/slist.h"
+#include "../../src/server/manio.h"
+#include "../../src/server/manio_index.h"
+
+#define BASE		"utest_manio_index"
+#define MANIFEST	BASE "/manifest"
+
+static void tear_down(void)
+{
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static int starts_with(const char *path, const char *prefix)
+{
+	return !strncmp(path, prefix, strlen(prefix));
+}
+
+static void check_prefix(struct slist *slist, const char *prefix,
+	int indexed)
+{
+	int r;
+	int read=0;
+	int before=-1;
+	struct sbuf *sb;
+	struct sbuf *rb;
+	struct manio *manio;
+
+	fail_unless((manio=manio_open(MANIFEST, "rb", PROTO_2))!=NULL);
+	fail_unless((rb=sbuf_alloc(PROTO_2))!=NULL);
+	r=manio_index_seek(manio, prefix);
+	fail_unless(r>=0);
+	if(!indexed)
+		fail_unless(!r);
+
+	for(sb=slist->head; sb && !starts_with(sb->path.buf, prefix);
+		sb=sb->next) { }
+	while(1)
+	{
+		sbuf_free_content(rb);
+		switch(manio_read(manio, rb))
+		{
+			case 0: break;
+			case 1: goto end;
+			default: fail_unless(0);
+		}
+		if(rb->endfile.buf)
+			continue;
+		if(manio_index_past(prefix, rb->path.buf))
+			break;
+		read++;
+		if(!starts_with(rb->path.buf, prefix))
+			continue;
+		if(before<0)
+			before=read-1;
+		// Everything wanted comes back, in order.
+		fail_unless(sb!=NULL);
+		fail_unless(!strcmp(rb->path.buf, sb->path.buf));
+		for(sb=sb->next; sb && !starts_with(sb->path.buf, prefix);
+			sb=sb->next) { }
+	}
+end:
+	fail_unless(sb==NULL);
+	// Not much is read before the first wanted entry.
+	if(indexed && before>=0)
+		fail_unless(before<=1024);
+	sbuf_free(&rb);
+	fail_unless(!manio_close(&manio));
+}
+
+static void check_prefixes(struct slist *slist, int indexed)
+{
+	int i=0;
+	char *cp;
+	char *dir;
+	struct sbuf *sb;
+	for(sb=slist->head; sb; sb=sb->next)
+	{
+		if(i++%97)
+			continue;
+		check_prefix(slist, sb->path.buf, indexed);
+		fail_unless((dir=strdup_w(sb->path.buf, __func__))!=NULL);
+		if((cp=strrchr(dir, '/')) && cp>dir)
+		{
+			*cp='\0';
+			check_prefix(slist, dir, indexed);
+			// Part of a name.
+			*(cp-1)='\0';
+			check_prefix(slist, dir, indexed);
+		}
+		free_w(&dir);
+	}
+	// Before and after everything.
+	check_prefix(slist, "/", indexed);
+	check_prefix(slist, "!", indexed);
+	check_prefix(slist, "~", indexed);
+}
+
+START_TEST(test_manio_index)
+{
+	char *index;
+	struct slist *slist;
+
+	fail_unless(!recursive_delete(BASE));
+	slist=build_manifest(MANIFEST, PROTO_2, 4000, 0 /*phase*/);
+	fail_unless(!manio_index_write(MANIFEST));
+	check_prefixes(slist, 1);
+
+	// Without the index, the whole manifest gets read.
+	fail_unless((index=prepend_s(MANIFEST, "index"))!=NULL);
+	fail_unless(!unlink(index));
+	free_w(&index);
+	check_prefixes(slist, 0);
+
+	slist_free(&slist);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_manio_index_empty)
+{
+	struct slist *slist;
+	fail_unless(!recursive_delete(BASE));
+	slist=build_manifest(MANIFEST, PROTO_2, 0, 0 /*phase*/);
+	fail_unless(!manio_index_write(MANIFEST));
+	check_prefix(slist, "/a", 1);
+	slist_free(&slist);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_manio_index_past)
+{
+	fail_unless(!manio_index_past("/a/b", "/a"));
+	fail_unless(!manio_index_past("/a/b", "/a/a"));
+	fail_unless(!manio_index_past("/a/b", "/a/b"));
+	fail_unless(!manio_index_past("/a/b", "/a/b/c"));
+	fail_unless(!manio_index_past("/a/b", "/a/bc"));
+	fail_unless(manio_index_past("/a/b", "/a/c"));
+	fail_unless(manio_index_past("/a/b", "/b"));
+	fail_unless(manio_index_past("/a/b/", "/a/bc"));
+	alloc_check();
+}
+END_TEST
+
+Suite *suite_server_manio_index(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_manio_index");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+
+	tcase_add_test(tc_core, test_manio_index);
+	tcase_add_test(tc_core, test_manio_index_empty);
+	tcase_add_test(tc_core, test_manio_index_past);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
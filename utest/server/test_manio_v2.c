@@ -0,0 +1,282 @@
+#include "../test.h"
+#include "../builders/build.h"
+#include "../../src/alloc.h"
+#include "../../src/attribs.h"
+#include "../../src/cmd.h"
+#include "../../src/fsops.h"
+#include "../../src/fzp.h"
+#include "../../src/iobuf.h"
+#include "../../src/sbuf.h"
+#include "../../src/slist.h"
+#include "../../src/protocol2/blk.h"
+#include "../../src/server/manio_v2.h"
+
+#define BASE		"utest_manio_v2"
+#define MANIFEST	BASE "/manifest"
+
+static void tear_down(void)
+{
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static void setup(void)
+{
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!build_path_w(MANIFEST));
+}
+
+// The text that the gzipped format would give back for the attributes.
+static char *stripped_attr(struct sbuf *sb)
+{
+	char *cp;
+	fail_unless(!attribs_encode(sb));
+	fail_unless((cp=strchr(sb->attr.buf, ' '))!=NULL);
+	return strdup_w(cp, __func__);
+}
+
+static void write_sbuf(struct manio_v2 *mv2, struct sbuf *sb, int sigs)
+{
+	int i;
+	struct blk blk;
+	struct iobuf wbuf;
+	fail_unless(!manio_v2_write_sbuf(mv2, sb));
+	memset(&blk, 0, sizeof(blk));
+	for(i=0; i<sigs; i++)
+	{
+		blk.fingerprint=i;
+		blk.savepath=i*7;
+		blk_to_iobuf_sig_and_savepath(&blk, &wbuf);
+		fail_unless(!manio_v2_write_iobuf(mv2, &wbuf));
+	}
+}
+
+static struct slist *build(enum manio_v2_codec codec, int entries)
+{
+	struct sbuf *sb;
+	struct slist *slist;
+	struct manio_v2 *mv2;
+	slist=build_slist_phase1(NULL, PROTO_2, entries);
+	fail_unless((mv2=manio_v2_open(MANIFEST, "wb", codec))!=NULL);
+	for(sb=slist->head; sb; sb=sb->next)
+		write_sbuf(mv2, sb, sbuf_is_filedata(sb)?3:0);
+	fail_unless(!manio_v2_close(&mv2));
+	return slist;
+}
+
+static void check_read(struct slist *slist, int views)
+{
+	int i;
+	char *attr;
+	struct sbuf *sb;
+	struct sbuf *rb;
+	struct blk *blk;
+	struct manio_v2 *mv2;
+	fail_unless(manio_v2_sniff(MANIFEST)==1);
+	fail_unless((mv2=manio_v2_open(MANIFEST, "rb", 0))!=NULL);
+	fail_unless((rb=sbuf_alloc(PROTO_2))!=NULL);
+	fail_unless((blk=blk_alloc())!=NULL);
+	for(sb=slist->head; sb; sb=sb->next)
+	{
+		fail_unless(!manio_v2_read(mv2, rb, blk, views));
+		fail_unless(!!(rb->flags & SBUF_VIEW)==!!views);
+		fail_unless(!strcmp(rb->path.buf, sb->path.buf));
+		fail_unless(rb->path.cmd==sb->path.cmd);
+		fail_unless(rb->path.len==sb->path.len);
+		if(sb->link.buf)
+			fail_unless(!strcmp(rb->link.buf, sb->link.buf));
+		fail_unless((attr=stripped_attr(sb))!=NULL);
+		fail_unless(!strcmp(rb->attr.buf, attr));
+		fail_unless(rb->attr.len==strlen(attr));
+		free_w(&attr);
+		if(!sbuf_is_filedata(sb))
+			continue;
+		for(i=0; i<3; i++)
+		{
+			fail_unless(!manio_v2_read(mv2, rb, blk, views));
+			fail_unless(blk->fingerprint==(uint64_t)i);
+			fail_unless(blk->savepath==(uint64_t)i*7);
+		}
+	}
+	fail_unless(manio_v2_read(mv2, rb, blk, views)==1);
+	fail_unless(manio_v2_read(mv2, rb, blk, views)==1);
+	blk_free(&blk);
+	sbuf_free(&rb);
+	fail_unless(!manio_v2_close(&mv2));
+}
+
+static void run_round_trip(enum manio_v2_codec codec, int entries)
+{
+	struct slist *slist;
+	setup();
+	slist=build(codec, entries);
+	check_read(slist, 0);
+	check_read(slist, 1);
+	slist_free(&slist);
+	tear_down();
+}
+
+START_TEST(test_manio_v2_round_trip)
+{
+	run_round_trip(MANIO_V2_CODEC_DEFLATE, 0);
+	run_round_trip(MANIO_V2_CODEC_DEFLATE, 10);
+	run_round_trip(MANIO_V2_CODEC_NONE, 10);
+	// Enough to need more than one block.
+	run_round_trip(MANIO_V2_CODEC_DEFLATE, 5000);
+	run_round_trip(MANIO_V2_CODEC_NONE, 5000);
+}
+END_TEST
+
+static void run_tell_seek(enum manio_v2_codec codec)
+{
+	int i;
+	int count=0;
+	off_t *pos=NULL;
+	char **paths=NULL;
+	struct sbuf *rb;
+	struct slist *slist;
+	struct manio_v2 *mv2;
+
+	setup();
+	slist=build(codec, 3000);
+	fail_unless((mv2=manio_v2_open(MANIFEST, "rb", 0))!=NULL);
+	fail_unless((rb=sbuf_alloc(PROTO_2))!=NULL);
+	while(1)
+	{
+		fail_unless((pos=(off_t *)realloc_w(pos,
+			(count+1)*sizeof(off_t), __func__))!=NULL);
+		fail_unless((paths=(char **)realloc_w(paths,
+			(count+1)*sizeof(char *), __func__))!=NULL);
+		pos[count]=manio_v2_tell(mv2);
+		switch(manio_v2_read(mv2, rb, NULL, 0))
+		{
+			case 0: break;
+			case 1: goto end;
+			default: fail_unless(0);
+		}
+		fail_unless((paths[count]=strdup_w(rb->path.buf,
+			__func__))!=NULL);
+		count++;
+	}
+end:
+	// Go backwards, so that every seek is to somewhere else.
+	for(i=count-1; i>=0; i-=7)
+	{
+		fail_unless(!manio_v2_seek(mv2, pos[i]));
+		fail_unless(!manio_v2_read(mv2, rb, NULL, 1));
+		fail_unless(!strcmp(rb->path.buf, paths[i]));
+	}
+	fail_unless(!manio_v2_seek(mv2, pos[count]));
+	fail_unless(manio_v2_read(mv2, rb, NULL, 0)==1);
+	for(i=0; i<count; i++)
+		free_w(&paths[i]);
+	free_v((void **)&paths);
+	free_v((void **)&pos);
+	sbuf_free(&rb);
+	fail_unless(!manio_v2_close(&mv2));
+	slist_free(&slist);
+	tear_down();
+}
+
+START_TEST(test_manio_v2_tell_seek)
+{
+	run_tell_seek(MANIO_V2_CODEC_DEFLATE);
+	run_tell_seek(MANIO_V2_CODEC_NONE);
+}
+END_TEST
+
+static void build_file_content(const char *content, size_t len)
+{
+	struct fzp *fzp;
+	fail_unless((fzp=fzp_open(MANIFEST, "wb"))!=NULL);
+	fail_unless(fzp_write(fzp, content, len)==len);
+	fail_unless(!fzp_close(&fzp));
+}
+
+static void assert_read_error(void)
+{
+	int ret=0;
+	struct sbuf *rb;
+	struct manio_v2 *mv2;
+	fail_unless((rb=sbuf_alloc(PROTO_2))!=NULL);
+	if((mv2=manio_v2_open(MANIFEST, "rb", 0)))
+	{
+		while(!(ret=manio_v2_read(mv2, rb, NULL, 0))) { }
+		fail_unless(!manio_v2_close(&mv2));
+	}
+	else
+		ret=-1;
+	fail_unless(ret==-1);
+	sbuf_free(&rb);
+}
+
+static void corrupt_byte(off_t offset)
+{
+	FILE *fp;
+	int c;
+	fail_unless((fp=fopen(MANIFEST, "r+b"))!=NULL);
+	fail_unless(!fseeko(fp, offset, SEEK_SET));
+	fail_unless((c=fgetc(fp))!=EOF);
+	fail_unless(!fseeko(fp, offset, SEEK_SET));
+	fail_unless(fputc(c^0xFF, fp)!=EOF);
+	fail_unless(!fclose(fp));
+}
+
+START_TEST(test_manio_v2_corrupt)
+{
+	struct stat statp;
+	struct slist *slist;
+
+	setup();
+
+	// Not format 2.
+	build_file_content("abc", 3);
+	fail_unless(!manio_v2_sniff(MANIFEST));
+	assert_read_error();
+	build_file_content("", 0);
+	fail_unless(!manio_v2_sniff(MANIFEST));
+	fail_unless(manio_v2_sniff(BASE "/missing")==-1);
+
+	// Unknown codec.
+	build_file_content("burpman2\x09", 9);
+	fail_unless(manio_v2_sniff(MANIFEST)==1);
+	assert_read_error();
+
+	// No end marker.
+	build_file_content("burpman2\x01", 9);
+	assert_read_error();
+
+	// Bad contents.
+	slist=build(MANIO_V2_CODEC_NONE, 10);
+	corrupt_byte(30);
+	assert_read_error();
+	slist_free(&slist);
+
+	// Truncated.
+	slist=build(MANIO_V2_CODEC_DEFLATE, 10);
+	fail_unless(!lstat(MANIFEST, &statp));
+	fail_unless(!truncate(MANIFEST, statp.st_size-12));
+	assert_read_error();
+	slist_free(&slist);
+
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_manio_v2(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_manio_v2");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+
+	tcase_add_test(tc_core, test_manio_v2_round_trip);
+	tcase_add_test(tc_core, test_manio_v2_tell_seek);
+	tcase_add_test(tc_core, test_manio_v2_corrupt);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -0,0 +1,190 @@
+#include "../test.h"
+#include "../../src/alloc.h"
+#include "../../src/fzp.h"
+#include "../../src/server/pgzip.h"
+#include "../prng.h"
+
+#define BASE		"utest_pgzip"
+#define BLOCK		131072
+
+static void tear_down(void)
+{
+	pgzip_set_threads(0);
+	alloc_check();
+	unlink(BASE);
+}
+
+static uint8_t *make_data(size_t len, int compressible)
+{
+	size_t i;
+	uint8_t *data;
+	static const char words[]="the quick brown fox jumps over the lazy dog ";
+	fail_unless((data=(uint8_t *)malloc_w(len+1, __func__))!=NULL);
+	for(i=0; i<len; i++)
+	{
+		if(compressible && prng_next()%64)
+			data[i]=words[i%(sizeof(words)-1)];
+		else
+			data[i]=(uint8_t)prng_next();
+	}
+	return data;
+}
+
+static off_t file_size(void)
+{
+	struct stat statp;
+	fail_unless(!lstat(BASE, &statp));
+	return statp.st_size;
+}
+
+static void check_contents(const uint8_t *data, size_t len)
+{
+	int got;
+	size_t total=0;
+	uint8_t *buf;
+	struct fzp *fzp;
+	fail_unless((buf=(uint8_t *)malloc_w(len+1, __func__))!=NULL);
+	fail_unless((fzp=fzp_gzopen(BASE, "rb"))!=NULL);
+	while((got=fzp_read(fzp, buf+total, len+1-total))>0)
+	{
+		total+=got;
+		if(total>len)
+			break;
+	}
+	fail_unless(total==len);
+	fail_unless(fzp_eof(fzp)>0);
+	fail_unless(!fzp_close(&fzp));
+	fail_unless(!memcmp(buf, data, len));
+	free_v((void **)&buf);
+}
+
+static void run_round_trip(int threads, const char *mode,
+	size_t len, int compressible)
+{
+	size_t n;
+	size_t done;
+	uint8_t *data;
+	struct fzp *fzp;
+
+	pgzip_set_threads(threads);
+	data=make_data(len, compressible);
+	fail_unless((fzp=fzp_gzopen(BASE, mode))!=NULL);
+	fail_unless(fzp->type==(threads?FZP_PGZIP:FZP_COMPRESSED));
+	// Write it in odd sized bits.
+	for(done=0; done<len; done+=n)
+	{
+		n=1+prng_next()%(BLOCK/2);
+		if(n>len-done)
+			n=len-done;
+		fail_unless(fzp_write(fzp, data+done, n)==n);
+		fail_unless(fzp_tell(fzp)==(off_t)(done+n));
+	}
+	fail_unless(!fzp_close(&fzp));
+
+	check_contents(data, len);
+	if(compressible && len>=BLOCK)
+		fail_unless(file_size()<(off_t)len/4);
+	free_v((void **)&data);
+	tear_down();
+}
+
+static size_t sizes[] = { 0, 10, BLOCK, BLOCK+1, 5*BLOCK+1234 };
+static const char *modes[] = { "wb", "wb1", "wb9" };
+
+START_TEST(test_pgzip_round_trip)
+{
+	size_t s;
+	size_t m;
+	int threads;
+	prng_init(0);
+	for(threads=0; threads<=3; threads+=3)
+	  for(m=0; m<ARR_LEN(modes); m++)
+	    for(s=0; s<ARR_LEN(sizes); s++)
+	{
+		run_round_trip(threads, modes[m], sizes[s], 0);
+		run_round_trip(threads, modes[m], sizes[s], 1);
+	}
+}
+END_TEST
+
+START_TEST(test_pgzip_one_thread)
+{
+	prng_init(0);
+	run_round_trip(1, "wb6", 3*BLOCK+7, 1);
+	run_round_trip(1, "wb0", 3*BLOCK+7, 0);
+}
+END_TEST
+
+START_TEST(test_pgzip_printf_and_flush)
+{
+	int i;
+	char buf[64];
+	char expected[64];
+	struct fzp *fzp;
+
+	pgzip_set_threads(2);
+	fail_unless((fzp=fzp_gzopen(BASE, "wb"))!=NULL);
+	fail_unless(fzp->type==FZP_PGZIP);
+	for(i=0; i<20000; i++)
+	{
+		fail_unless(fzp_printf(fzp, "line %d\n", i)>0);
+		if(!(i%7000))
+			fail_unless(!fzp_flush(fzp));
+	}
+	fail_unless(!fzp_close(&fzp));
+
+	fail_unless((fzp=fzp_gzopen(BASE, "rb"))!=NULL);
+	for(i=0; i<20000; i++)
+	{
+		snprintf(expected, sizeof(expected), "line %d\n", i);
+		fail_unless(fzp_gets(fzp, buf, sizeof(buf))!=NULL);
+		ck_assert_str_eq(expected, buf);
+	}
+	fail_unless(fzp_gets(fzp, buf, sizeof(buf))==NULL);
+	fail_unless(!fzp_close(&fzp));
+	tear_down();
+}
+END_TEST
+
+static void check_type(const char *mode, enum fzp_type type)
+{
+	struct fzp *fzp;
+	fail_unless((fzp=fzp_gzopen(BASE, mode))!=NULL);
+	fail_unless(fzp->type==type);
+	fail_unless(!fzp_close(&fzp));
+}
+
+START_TEST(test_pgzip_modes)
+{
+	pgzip_set_threads(2);
+	check_type("wb", FZP_PGZIP);
+	check_type("w9", FZP_PGZIP);
+	// Anything zlib has to do itself.
+	check_type("ab", FZP_COMPRESSED);
+	check_type("wbT", FZP_COMPRESSED);
+	check_type("wb9h", FZP_COMPRESSED);
+	check_type("rb", FZP_COMPRESSED);
+	pgzip_set_threads(0);
+	check_type("wb", FZP_COMPRESSED);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_pgzip(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_pgzip");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+
+	tcase_add_test(tc_core, test_pgzip_round_trip);
+	tcase_add_test(tc_core, test_pgzip_one_thread);
+	tcase_add_test(tc_core, test_pgzip_printf_and_flush);
+	tcase_add_test(tc_core, test_pgzip_modes);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -62,6 +62,7 @@ extern void assert_xattr(const char *expected,
 
 Suite *suite_alloc(void);
 Suite *suite_asfd(void);
+Suite *suite_async(void);
 Suite *suite_attribs(void);
 Suite *suite_base64(void);
 Suite *suite_client_acl(void);
@@ -76,6 +77,7 @@ Suite *suite_client_monitor_lline(void);
 Suite *suite_client_monitor_status_client_ncurses(void);
 Suite *suite_client_protocol1_backup_phase2(void);
 Suite *suite_client_protocol2_backup_phase2(void);
+Suite *suite_client_protocol2_chunk_pool(void);
 Suite *suite_client_protocol2_rabin_read(void);
 Suite *suite_client_restore(void);
 Suite *suite_client_xattr(void);
@@ -95,20 +97,28 @@ Suite *suite_protocol2_rabin_rabin(void);
 Suite *suite_protocol2_rabin_rconf(void);
 Suite *suite_protocol2_rabin_win(void);
 Suite *suite_protocol2_sbuf_protocol2(void);
+Suite *suite_regexp(void);
 Suite *suite_server_auth(void);
 Suite *suite_server_autoupgrade(void);
 Suite *suite_server_ca(void);
 Suite *suite_server_backup_phase3(void);
+Suite *suite_server_browse_tree(void);
 Suite *suite_server_bu_get(void);
 Suite *suite_server_delete(void);
+Suite *suite_server_deleter(void);
+Suite *suite_server_diff(void);
+Suite *suite_server_durable(void);
 Suite *suite_server_extra_comms(void);
 Suite *suite_server_list(void);
 Suite *suite_server_manio(void);
+Suite *suite_server_manio_index(void);
+Suite *suite_server_manio_v2(void);
 Suite *suite_server_monitor_browse(void);
 Suite *suite_server_monitor_cache(void);
 Suite *suite_server_monitor_cstat(void);
 Suite *suite_server_monitor_json_output(void);
 Suite *suite_server_monitor_status_server(void);
+Suite *suite_server_pgzip(void);
 Suite *suite_server_resume(void);
 Suite *suite_server_restore(void);
 Suite *suite_server_run_action(void);
@@ -118,19 +128,26 @@ Suite *suite_server_protocol1_backup_phase2(void);
 Suite *suite_server_protocol1_backup_phase4(void);
 Suite *suite_server_protocol1_bedup(void);
 Suite *suite_server_protocol1_blocklen(void);
+Suite *suite_server_protocol1_delta_chain(void);
 Suite *suite_server_protocol1_dpth(void);
 Suite *suite_server_protocol1_fdirs(void);
 Suite *suite_server_protocol1_restore(void);
 Suite *suite_server_protocol2_backup_phase2(void);
 Suite *suite_server_protocol2_backup_phase4(void);
 Suite *suite_server_protocol2_bsparse(void);
+Suite *suite_server_protocol2_champ_chooser_candidate(void);
 Suite *suite_server_protocol2_champ_chooser_champ_chooser(void);
 Suite *suite_server_protocol2_champ_chooser_champ_server(void);
+Suite *suite_server_protocol2_champ_chooser_dedup_pool(void);
 Suite *suite_server_protocol2_champ_chooser_dindex(void);
 Suite *suite_server_protocol2_champ_chooser_hash(void);
 Suite *suite_server_protocol2_champ_chooser_scores(void);
 Suite *suite_server_protocol2_champ_chooser_sparse(void);
+Suite *suite_server_protocol2_champ_chooser_sparse_index(void);
+Suite *suite_server_protocol2_datfile(void);
+Suite *suite_server_protocol2_dindex_file(void);
 Suite *suite_server_protocol2_dpth(void);
+Suite *suite_server_protocol2_savepath_bitmap(void);
 Suite *suite_slist(void);
 Suite *suite_times(void);
 
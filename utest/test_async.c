@@ -0,0 +1,161 @@
+#include "test.h"
+#include "../src/alloc.h"
+#include "../src/asfd.h"
+#include "../src/async.h"
+#include "../src/cmd.h"
+#include "../src/iobuf.h"
+
+static struct async *setup(struct async *alloc(void),
+	struct asfd **a, struct asfd **b)
+{
+	int fds[2];
+	struct async *as;
+	fail_unless((as=alloc())!=NULL);
+	fail_unless(!as->init(as, 0));
+	fail_unless(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+	fail_unless((*a=setup_asfd(as, "a", &fds[0], /*port*/-1))!=NULL);
+	fail_unless((*b=setup_asfd(as, "b", &fds[1], /*port*/-1))!=NULL);
+	return as;
+}
+
+static void tear_down(struct async **as)
+{
+	async_asfd_free_all(as);
+	alloc_check();
+}
+
+static void do_test_async_write_read(struct async *alloc(void))
+{
+	struct async *as;
+	struct asfd *a;
+	struct asfd *b;
+	as=setup(alloc, &a, &b);
+
+	fail_unless(!a->write_str(a, CMD_GEN, "hello"));
+	fail_unless(!b->read(b));
+	fail_unless(b->rbuf->cmd==CMD_GEN);
+	fail_unless(!strcmp(b->rbuf->buf, "hello"));
+	iobuf_free_content(b->rbuf);
+
+	// And back the other way.
+	fail_unless(!b->write_str(b, CMD_GEN, "there"));
+	fail_unless(!a->read(a));
+	fail_unless(!strcmp(a->rbuf->buf, "there"));
+	iobuf_free_content(a->rbuf);
+
+	// Nothing more to read.
+	fail_unless(!as->read_quick(as));
+	fail_unless(!a->rbuf->buf);
+	fail_unless(!b->rbuf->buf);
+
+	tear_down(&as);
+}
+
+// Big payloads are sent from where they are, rather than being copied into
+// the write buffer, so check that they still arrive in order.
+static void do_test_async_write_big(struct async *alloc(void))
+{
+	int i;
+	char big[20000];
+	struct iobuf wbuf;
+	struct async *as;
+	struct asfd *a;
+	struct asfd *b;
+	as=setup(alloc, &a, &b);
+
+	for(i=0; i<(int)sizeof(big); i++)
+		big[i]='a'+i%26;
+	iobuf_set(&wbuf, CMD_DATA, big, sizeof(big));
+
+	fail_unless(!a->write_str(a, CMD_GEN, "before"));
+	fail_unless(!a->write(a, &wbuf));
+	fail_unless(!wbuf.len);
+	fail_unless(!a->writereflen);
+	fail_unless(!a->write_str(a, CMD_GEN, "after"));
+
+	fail_unless(!b->read(b));
+	fail_unless(!strcmp(b->rbuf->buf, "before"));
+	iobuf_free_content(b->rbuf);
+	fail_unless(!b->read(b));
+	fail_unless(b->rbuf->cmd==CMD_DATA);
+	fail_unless(b->rbuf->len==sizeof(big));
+	fail_unless(!memcmp(b->rbuf->buf, big, sizeof(big)));
+	iobuf_free_content(b->rbuf);
+	fail_unless(!b->read(b));
+	fail_unless(!strcmp(b->rbuf->buf, "after"));
+	iobuf_free_content(b->rbuf);
+
+	tear_down(&as);
+}
+
+static void do_test_async_hangup(struct async *alloc(void))
+{
+	struct async *as;
+	struct asfd *a;
+	struct asfd *b;
+	as=setup(alloc, &a, &b);
+
+	fail_unless(!as->read_quick(as));
+	as->asfd_remove(as, a);
+	asfd_free(&a);
+	fail_unless(as->read_write(as)==-1);
+	fail_unless(b->want_to_remove);
+
+	tear_down(&as);
+}
+
+START_TEST(test_async_write_read)
+{
+	do_test_async_write_read(async_alloc);
+}
+END_TEST
+
+START_TEST(test_async_write_big)
+{
+	do_test_async_write_big(async_alloc);
+}
+END_TEST
+
+START_TEST(test_async_hangup)
+{
+	do_test_async_hangup(async_alloc);
+}
+END_TEST
+
+START_TEST(test_async_epoll_write_read)
+{
+	do_test_async_write_read(async_alloc_epoll);
+}
+END_TEST
+
+START_TEST(test_async_epoll_write_big)
+{
+	do_test_async_write_big(async_alloc_epoll);
+}
+END_TEST
+
+START_TEST(test_async_epoll_hangup)
+{
+	do_test_async_hangup(async_alloc_epoll);
+}
+END_TEST
+
+Suite *suite_async(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("async");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_async_write_read);
+	tcase_add_test(tc_core, test_async_write_big);
+	tcase_add_test(tc_core, test_async_hangup);
+	tcase_add_test(tc_core, test_async_epoll_write_read);
+	tcase_add_test(tc_core, test_async_epoll_write_big);
+	tcase_add_test(tc_core, test_async_epoll_hangup);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
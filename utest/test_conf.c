@@ -71,6 +71,7 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_REGEX:
 		case OPT_RESTORE_CLIENT:
 		case OPT_MONITOR_EXE:
+		case OPT_CHUNKER:
 			fail_unless(get_string(c[o])==NULL);
 			break;
 		case OPT_RATELIMIT:
@@ -99,6 +100,14 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_STRIP_VSS:
 		case OPT_ATIME:
 		case OPT_SCAN_PROBLEM_RAISES_ERROR:
+		case OPT_CHUNKER_THREADS:
+		case OPT_DEDUP_THREADS:
+		case OPT_DELETE_THREADS:
+		case OPT_DELETE_MAX_PER_SECOND:
+		case OPT_DELTA_THREADS:
+		case OPT_DIFF_THREADS:
+		case OPT_COMPRESS_THREADS:
+		case OPT_SYNC_INTERVAL:
 		case OPT_OVERWRITE:
 		case OPT_CNAME_LOWERCASE:
 		case OPT_STRIP:
@@ -143,6 +152,7 @@ static void check_default(struct conf **c, enum conf_opt o)
 			fail_unless(get_int(c[o])==5);
 			break;
         	case OPT_COMPRESSION:
+		case OPT_RESTORE_COMPRESSION:
 			fail_unless(get_int(c[o])==9);
 			break;
 		case OPT_MAX_STORAGE_SUBDIRS:
@@ -0,0 +1,63 @@
+#include "test.h"
+#include "../src/alloc.h"
+#include "../src/regexp.h"
+
+struct data
+{
+	const char *str;
+	const char *expected;
+};
+
+static struct data p[] = {
+	{ NULL,			NULL },
+	{ "",			NULL },
+	{ "/home",		NULL },
+	{ "^",			NULL },
+	{ "^.*",		NULL },
+	{ "^/home",		"/home" },
+	{ "^/home/user/",	"/home/user/" },
+	{ "^/home/us.r",	"/home/us" },
+	{ "^/home/[a-z]*",	"/home/" },
+	{ "^/home/users*",	"/home/user" },
+	{ "^/home/users?",	"/home/user" },
+	{ "^/home/users{0,1}",	"/home/user" },
+	{ "^/home/users+",	"/home/users" },
+	{ "^/home/(a|b)",	NULL },
+	{ "^/a|^/b",		NULL },
+	{ "^/home\\.d/",	"/home.d/" },
+	{ "^/home\\w",		"/home" },
+	{ "^/home$",		"/home" },
+};
+
+START_TEST(test_regex_literal_prefix)
+{
+	FOREACH(p)
+	{
+		char *prefix=regex_literal_prefix(p[i].str);
+		if(p[i].expected)
+		{
+			fail_unless(prefix!=NULL);
+			fail_unless(!strcmp(prefix, p[i].expected));
+		}
+		else
+			fail_unless(prefix==NULL);
+		free_w(&prefix);
+	}
+	alloc_check();
+}
+END_TEST
+
+Suite *suite_regexp(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("regexp");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_regex_literal_prefix);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}